@@ -27,6 +27,8 @@
 struct kiss_fft_state{
     int nfft;
     int inverse;
+    int kernel; /* KISS_FFT_KERNEL_*, picks the radix 2/4 butterflies */
+    kiss_fft_allocator allocator; /* temporary buffers, alloc NULL for the default */
     int factors[2*MAXFACTORS];
     kiss_fft_cpx twiddles[1];
 };
@@ -163,5 +165,11 @@ struct kiss_fft_state{
 #define  KISS_FFT_TMP_FREE(ptr) KISS_FFT_FREE(ptr)
 #endif
 
+/* temporary buffers for a cfg, through its allocator if one is set */
+#define  KISS_FFT_CFG_TMP_ALLOC(st,nbytes) \
+    ((st)->allocator.alloc ? (st)->allocator.alloc((st)->allocator.ctx,(nbytes)) : KISS_FFT_TMP_ALLOC(nbytes))
+#define  KISS_FFT_CFG_TMP_FREE(st,ptr) \
+    do { if ((st)->allocator.alloc) (st)->allocator.free((st)->allocator.ctx,(ptr)); else { KISS_FFT_TMP_FREE(ptr); } } while (0)
+
 #endif /* _kiss_fft_guts_h */
 
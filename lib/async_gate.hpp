@@ -0,0 +1,344 @@
+#ifndef ASYNC_GATE_HPP
+#define ASYNC_GATE_HPP
+
+// c++20 coroutine front end for event loop servers: coroutines on one EventLoop
+// thread hand gating and file reads to a BatchExecutor, which runs every queued
+// block in one pass and resumes them all with one wake up (see tools/async_streams.cpp)
+
+#include <condition_variable>
+#include <coroutine>
+#include <cstdio>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <optional>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "noisereduce.h"
+#include "pcm_io.h"
+
+namespace noisereduce::async {
+
+// single threaded queue of coroutines ready to resume, fed from any thread
+class EventLoop {
+public:
+    EventLoop() = default;
+    EventLoop(const EventLoop&) = delete;
+    EventLoop& operator=(const EventLoop&) = delete;
+
+    void post(std::coroutine_handle<> h);
+    void post(const std::vector<std::coroutine_handle<>>& hs);
+
+    // resumes posted coroutines on the calling thread until every spawned task
+    // has finished
+    void run();
+
+    // outstanding task count, kept by spawn()
+    void add_work();
+    void finish_work();
+
+private:
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    std::vector<std::coroutine_handle<>> ready_;
+    long outstanding_ = 0;
+};
+
+// one blocking call waiting for the worker. lives inside the suspended
+// coroutine's awaiter, so queueing it allocates nothing
+struct Job {
+    virtual void execute() = 0;
+    std::coroutine_handle<> continuation;
+    Job* next = nullptr;
+
+protected:
+    ~Job() = default;
+};
+
+class BatchExecutor {
+public:
+    explicit BatchExecutor(EventLoop& loop);
+    ~BatchExecutor();
+    BatchExecutor(const BatchExecutor&) = delete;
+    BatchExecutor& operator=(const BatchExecutor&) = delete;
+
+    void submit(Job* job);
+
+    // blocking call f() on the worker, co_await gives back its result
+    template <typename F>
+    auto call(F f);
+
+    long jobs() const { return jobs_; }
+    long batches() const { return batches_; }
+
+private:
+    void worker();
+
+    EventLoop& loop_;
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    Job* head_ = nullptr;
+    Job* tail_ = nullptr;
+    bool stop_ = false;
+    long jobs_ = 0; // written by the worker only
+    long batches_ = 0;
+    std::thread thread_;
+};
+
+template <typename F>
+class CallAwaiter : public Job {
+public:
+    using Result = decltype(std::declval<F&>()());
+
+    CallAwaiter(BatchExecutor& exec, F f) : exec_(exec), f_(std::move(f)) {}
+    bool await_ready() const noexcept { return false; }
+    void await_suspend(std::coroutine_handle<> h) {
+        continuation = h;
+        exec_.submit(this);
+    }
+    Result await_resume() {
+        if (error_) std::rethrow_exception(error_);
+        if constexpr (!std::is_void_v<Result>) return std::move(*result_);
+    }
+    void execute() override {
+        try {
+            if constexpr (std::is_void_v<Result>) {
+                f_();
+            } else {
+                result_.emplace(f_());
+            }
+        } catch (...) {
+            error_ = std::current_exception();
+        }
+    }
+
+private:
+    struct Empty {};
+    BatchExecutor& exec_;
+    F f_;
+    std::conditional_t<std::is_void_v<Result>, std::optional<Empty>, std::optional<Result>> result_;
+    std::exception_ptr error_;
+};
+
+template <typename F>
+auto BatchExecutor::call(F f) {
+    return CallAwaiter<F>(*this, std::move(f));
+}
+
+// lazily started coroutine, co_await it from another coroutine or hand it to spawn()
+template <typename T = void>
+class Task;
+
+namespace detail {
+
+// a finished task resumes whoever awaited it
+struct FinalAwaiter {
+    bool await_ready() noexcept { return false; }
+    template <typename P>
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<P> h) noexcept {
+        return h.promise().continuation;
+    }
+    void await_resume() noexcept {}
+};
+
+struct PromiseBase {
+    std::coroutine_handle<> continuation = std::noop_coroutine();
+    std::exception_ptr error;
+
+    std::suspend_always initial_suspend() noexcept { return {}; }
+    FinalAwaiter final_suspend() noexcept { return {}; }
+    void unhandled_exception() { error = std::current_exception(); }
+};
+
+template <typename T>
+struct Promise : PromiseBase {
+    std::optional<T> value;
+    Task<T> get_return_object();
+    void return_value(T v) { value.emplace(std::move(v)); }
+    T take() {
+        if (error) std::rethrow_exception(error);
+        return std::move(*value);
+    }
+};
+
+template <>
+struct Promise<void> : PromiseBase {
+    Task<void> get_return_object();
+    void return_void() {}
+    void take() {
+        if (error) std::rethrow_exception(error);
+    }
+};
+
+}  // namespace detail
+
+template <typename T>
+class Task {
+public:
+    using promise_type = detail::Promise<T>;
+
+    explicit Task(std::coroutine_handle<promise_type> h) : handle_(h) {}
+    Task(Task&& other) noexcept : handle_(std::exchange(other.handle_, {})) {}
+    Task& operator=(Task&& other) noexcept {
+        if (this != &other) {
+            if (handle_) handle_.destroy();
+            handle_ = std::exchange(other.handle_, {});
+        }
+        return *this;
+    }
+    Task(const Task&) = delete;
+    Task& operator=(const Task&) = delete;
+    ~Task() {
+        if (handle_) handle_.destroy();
+    }
+
+    bool await_ready() const noexcept { return false; }
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<> caller) noexcept {
+        handle_.promise().continuation = caller;
+        return handle_;
+    }
+    T await_resume() { return handle_.promise().take(); }
+
+private:
+    std::coroutine_handle<promise_type> handle_;
+};
+
+namespace detail {
+
+template <typename T>
+Task<T> Promise<T>::get_return_object() {
+    return Task<T>(std::coroutine_handle<Promise<T>>::from_promise(*this));
+}
+
+inline Task<void> Promise<void>::get_return_object() {
+    return Task<void>(std::coroutine_handle<Promise<void>>::from_promise(*this));
+}
+
+// fire and forget driver behind spawn()
+struct Detached {
+    struct promise_type {
+        Detached get_return_object() noexcept { return {}; }
+        std::suspend_never initial_suspend() noexcept { return {}; }
+        std::suspend_never final_suspend() noexcept { return {}; }
+        void return_void() noexcept {}
+        void unhandled_exception() noexcept { std::terminate(); }
+    };
+};
+
+inline Detached run_detached(EventLoop& loop, Task<void> task) {
+    try {
+        co_await task;
+    } catch (const std::exception& e) {
+        std::fprintf(stderr, "async task failed: %s\n", e.what());
+    }
+    loop.finish_work();
+}
+
+}  // namespace detail
+
+// starts task on the calling thread (which should be the loop's), it runs until
+// its first co_await and then continues from loop.run()
+inline void spawn(EventLoop& loop, Task<void> task) {
+    loop.add_work();
+    detail::run_detached(loop, std::move(task));
+}
+
+// a gate instance that gates on the executor's worker. wraps spectral_gate_stream,
+// so the output is delayed by spectral_gate_latency(). await each call before the next
+class AsyncGate {
+public:
+    AsyncGate(BatchExecutor& exec, const SpectralGateConfig& config);
+    // instance on a shared block, all of whose instances must use the same executor
+    AsyncGate(BatchExecutor& exec, SpectralGateShared* shared);
+    AsyncGate(AsyncGate&& other) noexcept;
+    AsyncGate& operator=(AsyncGate&& other) noexcept;
+    AsyncGate(const AsyncGate&) = delete;
+    AsyncGate& operator=(const AsyncGate&) = delete;
+    ~AsyncGate();
+
+    class Awaiter : public Job {
+    public:
+        Awaiter(AsyncGate& gate, std::span<const float> in, std::span<float> out)
+            : gate_(gate), in_(in), out_(out) {}
+        bool await_ready() const noexcept { return in_.empty(); }
+        void await_suspend(std::coroutine_handle<> h) {
+            continuation = h;
+            gate_.exec_->submit(this);
+        }
+        void await_resume() const {
+            if (status_ != 0) throw std::runtime_error("spectral_gate_stream failed");
+        }
+        void execute() override {
+            status_ = spectral_gate_stream(gate_.spd_, in_.data(), out_.data(), static_cast<long>(in_.size()));
+        }
+
+    private:
+        AsyncGate& gate_;
+        std::span<const float> in_;
+        std::span<float> out_;
+        int status_ = 0;
+    };
+
+    // gates in into out (at least as long), may be the same buffer
+    Awaiter process(std::span<const float> in, std::span<float> out) {
+        if (out.size() < in.size()) throw std::invalid_argument("AsyncGate::process: output shorter than input");
+        return Awaiter(*this, in, out);
+    }
+    Awaiter process(std::span<float> block) { return process(block, block); }
+
+    SpectralGateData* get() const { return spd_; }
+
+private:
+    BatchExecutor* exec_;
+    SpectralGateData* spd_;
+};
+
+// pcm_io reader whose reads run on an (io) executor
+class AsyncPcmReader {
+public:
+    // throws std::runtime_error if the file can't be opened
+    AsyncPcmReader(BatchExecutor& exec, const std::string& filename);
+    AsyncPcmReader(AsyncPcmReader&& other) noexcept;
+    AsyncPcmReader& operator=(AsyncPcmReader&& other) noexcept;
+    AsyncPcmReader(const AsyncPcmReader&) = delete;
+    AsyncPcmReader& operator=(const AsyncPcmReader&) = delete;
+    ~AsyncPcmReader();
+
+    const PcmSpec& spec() const { return *pcm_reader_spec(reader_); }
+
+    // co_await gives the frames read into out (interleaved), 0 at end of file
+    auto read(std::span<float> out) {
+        PcmReader* reader = reader_;
+        long max_frames = static_cast<long>(out.size()) / spec().channels;
+        float* data = out.data();
+        return exec_->call([reader, data, max_frames] {
+            long frames = pcm_reader_read(reader, data, max_frames);
+            if (frames < 0) throw std::runtime_error("pcm_reader_read failed");
+            return frames;
+        });
+    }
+
+private:
+    BatchExecutor* exec_;
+    PcmReader* reader_;
+};
+
+struct DecodedAudio {
+    std::vector<float> samples; // interleaved
+    int sample_rate = 0;
+    int channels = 0;
+};
+
+// whole file mp3 decode (mp3_to_float_mt with one thread) on the executor's
+// worker, throws std::runtime_error if decoding fails
+CallAwaiter<std::function<DecodedAudio()>> decode_mp3(BatchExecutor& exec, std::string filename);
+
+}  // namespace noisereduce::async
+
+#endif
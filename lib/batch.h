@@ -0,0 +1,36 @@
+#ifndef BATCH_H
+#define BATCH_H
+
+#include "noisereduce.h"
+#include "pcm_io.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// denoises many files at once on a work-stealing pool. every file becomes a
+// decode task, which spawns one gate task per channel, the last of which
+// spawns the encode task. each file's stages run on its share of the workers
+// by size, so one large file alone is decoded, gated and encoded on all of
+// them (the _mt variants). outputs keep the input's name and container, so
+// inputs sharing a name, or outputs that would replace an input, make the
+// whole run fail before anything is written
+
+typedef struct {
+  const char* input;    // directory, or a text file with one path per line
+  const char* out_dir;  // must exist
+  int threads;          // <= 0 means one per core
+  PcmSpec raw_spec;     // describes .raw/.pcm inputs
+  int out_format;       // pcm output format, -1 = same as input (s16 for mp3)
+  SpectralGateConfig config;  // sample_rate is set per file
+} BatchOptions;
+
+// prints per file results and a throughput summary (files/s, realtime factor,
+// cpu utilization)
+// returns 0 if every file was processed and -1 otherwise
+int batch_run(const BatchOptions* opts);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
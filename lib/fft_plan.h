@@ -0,0 +1,42 @@
+#ifndef FFT_PLAN_H
+#define FFT_PLAN_H
+
+#include <stdio.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// fft autotuner: once enabled, kiss_fft_alloc takes the radix order and kernel
+// from the wisdom file, or in FFT_PLAN_MEASURE mode times the candidates for an
+// unknown size. load wisdom, enable, init the gates, then save wisdom
+
+typedef enum {
+  FFT_PLAN_ESTIMATE,  // wisdom if there is some, kf_factor otherwise
+  FFT_PLAN_MEASURE,   // wisdom, or benchmark the candidates and remember
+} FftPlanMode;
+
+// installs the planner into kiss_fft. call before any threads allocate ffts
+void fft_plan_enable(FftPlanMode mode);
+void fft_plan_disable(void);
+
+// returns the number of plans loaded, 0 if the file doesn't exist and -1 if
+// it can't be read or parsed, in which case none of its plans are kept
+int fft_plan_load_wisdom(const char* path);
+
+// writes every plan (loaded and measured), returns 0 on success and -1 on error
+int fft_plan_save_wisdom(const char* path);
+
+// plans measured since startup, i.e. wisdom worth saving
+int fft_plan_new_plans(void);
+
+// tunes one size right away (regardless of mode), returns 0 on success
+int fft_plan_tune(int nfft, int inverse);
+
+// one line per known plan with its time against the default plan, if measured
+void fft_plan_report(FILE* fp);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
@@ -0,0 +1,36 @@
+#ifndef FILTER_H
+#define FILTER_H
+
+#include "noisereduce.h"
+#include "pcm_io.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// streaming filter: reads blocks from a pcm reader (eg. stdin), gates every
+// channel with spectral_gate_stream (or all of them together with
+// spectral_gate_stream_linked) and writes each block out as soon as it is done, so memory stays at a few blocks however long the stream runs. the gate
+// delay is taken out (the first latency frames are dropped and the tail is
+// flushed with silence at end of stream), so output frame i is input frame i
+
+typedef struct {
+  long frames_in;
+  long frames_out;
+  long blocks;
+  int gate_latency;    // frames of algorithmic delay inside the gate
+  int latency_blocks;  // blocks between a frame being read and written
+} FilterStats;
+
+// block_frames <= 0 uses config->frame_size. config->sample_rate should match
+// the reader. link is a SpectralGateLink, or -1 to gate the channels on their
+// own. profile, if not NULL, is loaded into every channel's gate
+// returns 0 on success and -1 on error, stats may be NULL
+int filter_run(PcmReader* reader, PcmWriter* writer,
+               const SpectralGateConfig* config, long block_frames, int link,
+               const char* profile, FilterStats* stats);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
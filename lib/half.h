@@ -0,0 +1,19 @@
+#ifndef HALF_H
+#define HALF_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// ieee binary16 storage for state that can live with ~3 decimal digits
+// round to nearest even, subnormals, inf and nan are kept (nan payloads aren't)
+
+void half_from_float(uint16_t* dst, const float* src, long n);
+void half_to_float(float* dst, const uint16_t* src, long n);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
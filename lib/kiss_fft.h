@@ -153,6 +153,42 @@ int KISS_FFT_API kiss_fft_next_fast_size(int n);
 #define kiss_fftr_next_fast_size_real(n) \
         (kiss_fft_next_fast_size( ((n)+1)>>1)<<1)
 
+/*
+ * Plan hooks (local extension, see fft_plan.h): the radix order and butterfly
+ * kernel of a cfg. an installed planner is asked first by kiss_fft_alloc.
+ */
+#define KISS_FFT_KERNEL_SCALAR 0
+#define KISS_FFT_KERNEL_SIMD 1   /* sse radix 2, 3, 4 and 5, float builds only */
+
+/* fills radices (at most max_radices, product nfft) and *kernel, returns the
+   number of radices or 0 for the default plan. must be thread safe */
+typedef int (*kiss_fft_planner)(int nfft,int inverse_fft,int * radices,int max_radices,int * kernel);
+
+/* install before allocating from several threads, NULL restores the default */
+void KISS_FFT_API kiss_fft_set_planner(kiss_fft_planner planner);
+
+/* replans an allocated cfg, returns 0 or -1 if the radices don't multiply to
+   nfft or the kernel isn't built in */
+int KISS_FFT_API kiss_fft_set_plan(kiss_fft_cfg cfg,const int * radices,int num_radices,int kernel);
+
+/* returns the number of radices (up to max_radices stored) */
+int KISS_FFT_API kiss_fft_get_plan(kiss_fft_cfg cfg,int * radices,int max_radices,int * kernel);
+
+int KISS_FFT_API kiss_fft_kernel_available(int kernel);
+
+/*
+ * Allocator hook (local extension) for the per call temporary buffers (in place
+ * transforms, generic radix), which otherwise come from KISS_FFT_TMP_ALLOC.
+ */
+typedef struct {
+    void * (*alloc)(void * ctx,size_t nbytes);
+    void (*free)(void * ctx,void * ptr);
+    void * ctx;
+} kiss_fft_allocator;
+
+/* the allocator is copied into cfg, NULL restores KISS_FFT_TMP_ALLOC */
+void KISS_FFT_API kiss_fft_set_allocator(kiss_fft_cfg cfg,const kiss_fft_allocator * allocator);
+
 #ifdef __cplusplus
 } 
 #endif
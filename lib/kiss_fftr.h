@@ -48,6 +48,9 @@ void KISS_FFT_API kiss_fftri(kiss_fftr_cfg cfg,const kiss_fft_cpx *freqdata,kiss
 
 #define kiss_fftr_free KISS_FFT_FREE
 
+/* temporary buffer allocator for the complex fft inside, see kiss_fft_set_allocator */
+void KISS_FFT_API kiss_fftr_set_allocator(kiss_fftr_cfg cfg,const kiss_fft_allocator * allocator);
+
 #ifdef __cplusplus
 }
 #endif
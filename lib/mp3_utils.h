@@ -13,17 +13,88 @@ extern "C" {
 
 // decodes mp3 files to a float buffer
 // returns number of samples decoded on success and -1 on error
+// output comes from the process allocator (nr_alloc.h), free it with nr_free(NULL, ...)
 // channels: 1 (mono) or 2 (stereo)
-static inline float mad_fixed_to_float(mad_fixed_t fixed);
-
 long mp3_to_float(const char* mp3_filename, float** output, int* sample_rate,
                   int* channels);
 
+// same result as mp3_to_float, sample for sample, but decoded on num_threads
+// threads (<= 0 means one per core). the frame headers are scanned first and
+// each thread decodes its own range of frames, starting a few frames early so
+// the bit reservoir and synth state match the serial decoder at its boundary.
+// falls back to mp3_to_float for short or free-format streams
+long mp3_to_float_mt(const char* mp3_filename, float** output,
+                     int* sample_rate, int* channels, int num_threads);
+
+// per-frame seek table of an mp3 file: where every frame starts in the file
+// and which output sample (per channel) it decodes to. it may cover only the
+// start of the file, up to where the header scan stopped
+typedef struct {
+  long num_frames;
+  long capacity;  // entries allocated
+  long* byte_offsets;
+  long* sample_pos;
+  long total_samples;  // per channel, of the frames indexed so far
+  int sample_rate;
+  int channels;
+  long file_size;   // of the mp3 the index was built from, used to detect
+  long file_mtime;  // a stale sidecar
+  long scan_pos;    // where the header scan goes on, file_size once complete
+} Mp3FrameIndex;
+
+// scans the whole mp3 file and fills index, returns 0 on success and -1 on error
+int mp3_index_build(const char* mp3_filename, Mp3FrameIndex* index);
+
+// scans on from index->scan_pos, reading the file in blocks, until the index
+// covers end_sample (per channel) and the frame after it, or the end of the
+// file (end_sample < 0 scans it all). saves the index to sidecar if anything
+// was added (sidecar may be NULL)
+// returns 0 on success and -1 on error
+int mp3_index_extend(const char* mp3_filename, const char* sidecar,
+                     Mp3FrameIndex* index, long end_sample);
+
+// writes/reads an index sidecar file. load rejects a sidecar that does not
+// match mp3_filename's size and mtime (pass NULL to skip the check)
+// return 0 on success and -1 on error
+int mp3_index_save(const Mp3FrameIndex* index, const char* path);
+int mp3_index_load(const char* path, const char* mp3_filename,
+                   Mp3FrameIndex* index);
+
+// loads the sidecar if it is valid, otherwise indexes just the first frames
+// and caches that there (sidecar may be NULL to skip caching). either way
+// mp3_index_extend has to cover a range before mp3_to_float_range decodes it
+// returns 0 on success and -1 on error
+int mp3_index_open(const char* mp3_filename, const char* sidecar,
+                   Mp3FrameIndex* index);
+
+void mp3_index_free(Mp3FrameIndex* index);
+
+// decodes num_samples samples per channel starting at start_sample, reading
+// only the frames that cover the range plus the few before it needed to prime
+// the bit reservoir. output matches the same span of mp3_to_float()
+// returns number of (interleaved) samples decoded on success and -1 on error
+long mp3_to_float_range(const char* mp3_filename, const Mp3FrameIndex* index,
+                        long start_sample, long num_samples, float** output);
+
 // encodes a float buffer into an mp3 then write to mp3 file
+// lame's info frame (frame count, encoder delay and padding) is filled in when
+// the file can seek, a pipe gets lame's blank placeholder
 // returns 0 on success and -1 on error
 int float_to_mp3(const char* filename, const float* input, long num_samples,
                  int sample_rate, int channels);
 
+// same as float_to_mp3 but the pcm is split into one large chunk per thread
+// (<= 0 means one per core), each encoded on its own lame instance. chunks
+// start on the global mp3 frame grid with a few frames of lead-in, the bit
+// reservoir is disabled so the frames can be cut there, and the kept frames
+// are concatenated into one gapless stream with the same frame count as the
+// serial encoder. the first chunk's info frame is rewritten for the whole
+// stream, with the last chunk's padding. falls back to float_to_mp3 for short inputs or when lame
+// resamples
+// returns 0 on success and -1 on error
+int float_to_mp3_mt(const char* filename, const float* input, long num_samples,
+                    int sample_rate, int channels, int num_threads);
+
 #ifdef __cplusplus
 }
 #endif
\ No newline at end of file
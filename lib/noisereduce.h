@@ -6,28 +6,164 @@ extern "C" {
 #endif
 
 #define PI 3.14159265359
+#include <stddef.h>
+#include <stdint.h>
 #include "kiss_fft.h"
 #include "kiss_fftr.h"
+#include "nr_alloc.h"
+
+// analysis/synthesis window pairs
+typedef enum {
+    SG_WINDOW_HANN = 0,        // hann for both, delay of a full frame when streaming
+    SG_WINDOW_LOW_LATENCY = 1, // asymmetric pair, full frame resolution with a 1.25*hop delay (needs frame_size > 1.25*hop_size)
+} SpectralGateWindow;
+
+// processing engines behind the same config and calls
+typedef enum {
+    SG_ENGINE_STFT = 0, // frame_size point fft of a frame_size window every hop
+    SG_ENGINE_WOLA = 1, // weighted overlap-add filterbank: a wola_taps long prototype folded into frame_size subbands
+} SpectralGateEngine;
 
 typedef struct {
-    int frame_size;
+    int frame_size; // even, fastest when frame_size / 2 only has factors 2, 3 and 5
     int hop_size;
     float alpha; // gating threshold
     float noise_floor; // minimal gain floor
-    float noise_decay; // smoothing factor 0-1; (eg. 0.9 = 90% old and 10% new)
+    float noise_decay; // smoothing factor 0-1 per hop, see smoothing_hop; (eg. 0.9 = 90% old and 10% new)
     float silence_threshold; //e enrgy threshold to consider frame as silence, if negative, auto calibration used
+    int window_mode; // SpectralGateWindow, 0 = hann
+    int num_bands; // 0 tracks noise per fft bin, otherwise on this many erb spaced bands (24-48 is plenty)
+    int sample_rate; // lays out the bands and times smoothing_hop, 0 = 44100
+    int compact_state; // keep per stream state as half floats, see spectral_gate_state_bytes
+    int engine; // SpectralGateEngine, 0 = stft. wola needs hann windows and 2 * hop_size <= frame_size
+    int wola_taps; // wola prototype length, a multiple of frame_size, 0 = frame_size
+    int link_channels; // most channels spectral_gate_start_linked will get, 0 = not used
+    int smoothing_hop; // 0 applies noise_decay and the vad smoothing once per hop, otherwise once per this many samples at 44.1 kHz (eg. 256), whatever the hop and rate
 }SpectralGateConfig;
 
+// the wola engine gates frame_size / 2 + 1 subbands every hop_size samples, with a
+// short synthesis window for a delay of about wola_taps / 2 + hop_size. pair its
+// short hops with smoothing_hop so the noise estimate doesn't follow speech
+
+// the parameters that can change while a gate runs, see spectral_gate_set_params
+typedef struct {
+    float alpha;
+    float noise_floor;
+    float noise_decay;
+    float silence_threshold;
+} SpectralGateParams;
+
+struct SpectralGateParamBox;
+
+// everything that only depends on the config (fft plans, windows, band tables,
+// scratch). backs any number of instances driven from one thread at a time
+typedef struct {
+    SpectralGateConfig config;
+    NrAllocator allocator; // everything below, fft plans included
+    kiss_fftr_cfg fwd_cfg;
+    kiss_fftr_cfg inv_cfg;
+    float* window;
+    float* synth_window;
+    int stream_offset;
+    float stream_norm;
+    int window_length; // samples one frame spans: frame_size, or wola_taps
+    float* wola_analysis; // wola prototypes, window_length long, NULL for the stft
+    float* wola_synthesis;
+    float wola_energy_norm;
+
+    int num_noise; // length of noise_est, bins or bands
+    int num_bands;
+    int* band_edges;
+    int* bin_band;
+    float* bin_weight;
+
+    // per frame scratch
+    kiss_fft_scalar* in_buf;
+    kiss_fft_cpx* freq_bins;
+    kiss_fft_cpx* out_freq_bins;
+    float* time_buf;
+    float* mag_buf;
+    float* band_gain;
+
+    // linked gating scratch: link_channels frame pointers, frames and spectra, one mask
+    const float** link_frames;
+    kiss_fft_scalar* link_in;
+    kiss_fft_cpx* link_spectra;
+    float* link_gains;
+
+    // compact_state: float copies of the running instance's state
+    float* work_noise;
+    float* work_overlap;
+    float* work_stream_in;
+    float* work_stream_ola;
+} SpectralGateShared;
+
 typedef struct {
     SpectralGateConfig config;
+    SpectralGateShared* shared; // plans, windows, tables and scratch below point into it
+    int owns_shared; // made by spectral_gate_init, freed with the instance
+    NrAllocator allocator; // the instance and its state, not the shared block
     
     kiss_fftr_cfg fwd_cfg; // real to complex
     kiss_fftr_cfg inv_cfg; // complex to real
 
     //buffers
-    float* window; // hanning window of length frame size
-    float* noise_est; // estimated noise floor for each window
-    float* overlap; // overlap buffer
+    float* window; // analysis window of length frame size (hanning unless low latency)
+    float* synth_window; // synthesis window, points at window for hann
+    int window_length; // samples one frame spans: frame_size, or wola_taps for the filterbank
+    float* wola_analysis; // filterbank prototypes (SG_ENGINE_WOLA), window_length long
+    float* wola_synthesis;
+    float wola_energy_norm; // makes the filterbank's frame energy read like a hann frame's for the VAD
+    float* noise_est; // estimated noise floor for each bin, or each band when num_bands > 0
+    float* overlap; // overlap buffer, window_length like stream_in and stream_ola
+    float* link_overlap; // spectral_gate_start_linked's, frame_size per channel
+
+    // compact_state storage of noise_est, overlap, stream_in and stream_ola. the
+    // float pointers then point at the shared working copies, which only hold
+    // this instance's state while one of its calls runs
+    uint16_t* noise_half;
+    uint16_t* overlap_half;
+    uint16_t* stream_in_half;
+    uint16_t* stream_ola_half;
+
+    // per frame scratch
+    kiss_fft_scalar* in_buf;
+    kiss_fft_cpx* freq_bins;
+    kiss_fft_cpx* out_freq_bins;
+    float* time_buf;
+    float* mag_buf;
+
+    // band grouped tracking, all NULL when noise is tracked per bin
+    int num_bands; // bands actually used, can be fewer than asked for on small frames
+    int* band_edges; // num_bands + 1 bin indices, band b covers [edges[b], edges[b+1])
+    int* bin_band; // per bin, the band centre at or below it
+    float* bin_weight; // per bin, how far it is towards the next band centre
+    float* band_gain; // per frame scratch
+
+    // streaming state (spectral_gate_stream)
+    float* stream_in; // last frame_size input samples
+    float* stream_ola; // overlap-add accumulator
+    float* stream_out; // finished hop being handed out
+    int stream_fill; // samples of the current hop taken in so far
+    int stream_offset; // first synthesis sample that can be nonzero
+    float stream_norm; // 1 / overlap-add gain of the window pair
+    float vad_energy; // VAD state carried across stream calls
+    int vad_silence;
+
+    // spectral_gate_stream_linked's stream_in, stream_ola (frame_size) and
+    // stream_out (hop_size) per channel. the link_ buffers stay float in compact_state
+    float* link_stream_in;
+    float* link_stream_ola;
+    float* link_stream_out;
+    int link_fill;
+
+    // frame classification counters
+    long frames_gated; // full fft path
+    long frames_silent; // digital silence, no fft
+    long frames_passthrough; // gate fully open, no inverse fft
+
+    struct SpectralGateParamBox* params; // pending spectral_gate_set_params values
+    unsigned params_seen; // sequence of the last values applied to config
 
     int initialized;
 } SpectralGateData;
@@ -39,9 +175,79 @@ typedef struct {
 static void make_hann_window(float* window, int length);
 static float db_to_gain(float db); // convert dB to linear gain for noise floor, etc.
 SpectralGateData* spectral_gate_init(const SpectralGateConfig* config); // initialize a spectral gate data variable
+// hop_size = codec_frame and frame_size = 4 * codec_frame, one gate frame per codec
+// frame. returns 0, or -1 if codec_frame isn't positive
+int spectral_gate_codec_config(SpectralGateConfig* config, int codec_frame);
 void spectral_gate_free(SpectralGateData* spd); // free spectral gate data variable
+
+// many streams with one config: build the shared part once, then one small
+// instance per stream. free the instances before the shared block
+SpectralGateShared* spectral_gate_shared_init(const SpectralGateConfig* config);
+void spectral_gate_shared_free(SpectralGateShared* shared);
+SpectralGateData* spectral_gate_init_shared(SpectralGateShared* shared);
+
+// the same with allocator callbacks (see nr_alloc.h), copied in. NULL means the
+// process allocator for the shared block and the shared block's allocator for
+// an instance on it, so per stream accounting passes one allocator per instance
+SpectralGateShared* spectral_gate_shared_init_alloc(const SpectralGateConfig* config, const NrAllocator* allocator);
+SpectralGateData* spectral_gate_init_shared_alloc(SpectralGateShared* shared, const NrAllocator* allocator);
+SpectralGateData* spectral_gate_init_alloc(const SpectralGateConfig* config, const NrAllocator* allocator);
+
+// bytes owned by one instance on a shared block (struct included), about halved by
+// compact_state, which rounds the state to half floats once per call (see check_compact)
+size_t spectral_gate_state_bytes(const SpectralGateData* spd);
+// offline gating, the output lined up with the input. where the gate is open the
+// output keeps the input's level, in every window mode and engine
 int spectral_gate_start(SpectralGateData* spd, const float* input, float* output, long num_samples);
 
+// spectral_gate_start on num_threads threads (<= 0 means one per core), bit-identical
+// output. hann stft only, other modes and short inputs fall back to spectral_gate_start
+int spectral_gate_start_mt(SpectralGateData* spd, const float* input, float* output, long num_samples, int num_threads);
+
+// how spectral_gate_start_linked gets its one mask for all channels
+typedef enum {
+    SG_LINK_MID = 0, // gate on the mid (mean) signal
+    SG_LINK_MAX = 1, // gate on the loudest channel per bin, VAD on the loudest channel
+} SpectralGateLink;
+
+// one VAD, noise_est and gain mask (link is a SpectralGateLink) for up to
+// config.link_channels planar channels, so the stereo image stays put. low latency,
+// wola and a single channel fall back to spectral_gate_start per channel
+int spectral_gate_start_linked(SpectralGateData* spd, const float* const* inputs, float* const* outputs,
+                               int channels, long num_samples, int link);
+
+// streaming linked gating, spectral_gate_stream for up to config.link_channels
+// planar channels: any block size, every output is its input delayed by
+// spectral_gate_latency() samples. stft engine only (hann or low latency windows)
+int spectral_gate_stream_linked(SpectralGateData* spd, const float* const* inputs, float* const* outputs,
+                                int channels, long num_samples, int link);
+
+// streaming version for live audio - any block size, output is the gated input
+// delayed by spectral_gate_latency() samples. VAD state carries over between calls
+int spectral_gate_stream(SpectralGateData* spd, const float* input, float* output, long num_samples);
+void spectral_gate_stream_reset(SpectralGateData* spd); // drop buffered audio, keep noise_est
+
+// back to a freshly initialised gate (noise_est baseline, overlap, stream buffers,
+// VAD, counters) without reallocating. call it from the thread running the gate
+void spectral_gate_reset(SpectralGateData* spd);
+
+// changes the params without a reinit, from any thread: the gate picks them up at its
+// next frame boundary without blocking. returns 0, or -1 if a value is out of range
+int spectral_gate_set_params(SpectralGateData* spd, const SpectralGateParams* params);
+// the newest values, applied or still pending
+int spectral_gate_get_params(const SpectralGateData* spd, SpectralGateParams* params);
+
+// algorithmic delay of spectral_gate_stream in samples: about frame_size for hann,
+// about 1.25*hop_size for SG_WINDOW_LOW_LATENCY and wola_taps / 2 + hop_size for
+// SG_ENGINE_WOLA. spectral_gate_start compensates it
+int spectral_gate_latency(const SpectralGateData* spd);
+
+// noise profiles - a snapshot of noise_est so a fresh instance can start out converged,
+// interpolated by frequency when loaded at another frame size or sample rate
+// both return 0 on success and -1 on error
+int spectral_gate_save_profile(const SpectralGateData* spd, int sample_rate, const char* filename);
+int spectral_gate_load_profile(SpectralGateData* spd, int sample_rate, const char* filename);
+
 
 #ifdef __cplusplus
 }
@@ -0,0 +1,36 @@
+#ifndef NR_ALLOC_H
+#define NR_ALLOC_H
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// allocator callbacks, eg. for numa local arenas or per stream accounting. free
+// takes blocks from both alloc and aligned_alloc (NULL falls back to alloc)
+typedef struct {
+  void* (*alloc)(void* ctx, size_t size);
+  void (*free)(void* ctx, void* ptr);
+  void* (*aligned_alloc)(void* ctx, size_t alignment, size_t size);
+  void* ctx;
+} NrAllocator;
+
+// the process wide allocator, behind the codec layer and gates without their own
+// (free their buffers with nr_free(NULL, ...)). set it once at startup, NULL
+// restores malloc/free
+void nr_set_allocator(const NrAllocator* allocator);
+const NrAllocator* nr_get_allocator(void);
+
+// a NULL allocator means nr_get_allocator(). all of them return NULL on failure
+void* nr_malloc(const NrAllocator* a, size_t size);
+void* nr_calloc(const NrAllocator* a, size_t count, size_t size);
+void* nr_aligned_alloc(const NrAllocator* a, size_t alignment, size_t size);
+// callbacks have no realloc, so old_size is what gets copied over
+void* nr_realloc(const NrAllocator* a, void* ptr, size_t old_size, size_t new_size);
+void nr_free(const NrAllocator* a, void* ptr);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
@@ -0,0 +1,52 @@
+#ifndef NR_CLIENT_H
+#define NR_CLIENT_H
+
+#include "noisereduce.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// client side of nr_daemon: one gate instance in the daemon per client, fed
+// through a shared memory ring so blocks are written and read in place
+//
+//   NrClient* c = nr_client_open(NULL, &config, 8, 1024);
+//   float* buf = nr_client_buffer(c);       // fill with up to 1024 frames
+//   long seq = nr_client_submit(c, frames);
+//   float* out;
+//   nr_client_wait(c, seq, &out);           // gated frames, delayed by latency
+//
+// up to `slots` blocks can be in flight. the output of a block stays valid
+// until its slot comes round again, ie. until `slots` more submits
+// the gated stream is delayed by nr_client_latency() samples, like
+// spectral_gate_stream
+
+typedef struct NrClient NrClient;
+
+// connects to the daemon (NULL for NR_IPC_DEFAULT_SOCKET) and creates a gate
+// there. config is a mono gate config as for spectral_gate_init
+// returns NULL on error
+NrClient* nr_client_open(const char* socket_path, const SpectralGateConfig* config,
+                         int slots, int slot_frames);
+
+// slot the next submit will send, or NULL while every slot is in flight
+// (wait for the oldest block first)
+float* nr_client_buffer(NrClient* client);
+
+// hands the first `frames` samples of nr_client_buffer() to the daemon
+// returns the block's sequence number, -1 on error
+long nr_client_submit(NrClient* client, long frames);
+
+// blocks until block seq is gated, then points *output at it (may be NULL)
+// returns frames in the block, -1 on error
+long nr_client_wait(NrClient* client, long seq, float** output);
+
+int nr_client_latency(const NrClient* client);
+
+// closes the connection, the daemon drops the gate instance
+void nr_client_close(NrClient* client);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
@@ -0,0 +1,74 @@
+#ifndef NR_IPC_H
+#define NR_IPC_H
+
+#include <stdint.h>
+
+#include "noisereduce.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// wire protocol between nr_daemon and nr_client. the socket is a unix
+// SOCK_SEQPACKET socket, so every message arrives whole; audio never goes
+// through it. each client owns a memfd ring of `slots` blocks of
+// `slot_frames` mono floats, passed to the daemon with the open message, and
+// the daemon gates the block of a submit in place in its slot.
+//
+//   client                                daemon
+//   NR_MSG_OPEN  (NrOpenMsg + memfd)  ->
+//                                     <-  NR_MSG_OPENED (status, latency)
+//   NR_MSG_SUBMIT seq, frames         ->  gates slot seq % slots in place
+//                                     <-  NR_MSG_DONE seq, status
+//
+// blocks of one client are gated in submit order on one daemon worker.
+// the memfd must carry F_SEAL_SHRINK and F_SEAL_GROW (version 2), the daemon
+// refuses an unsealed ring.
+
+#define NR_IPC_MAGIC 0x3144524eu  // "NRD1" little endian
+#define NR_IPC_VERSION 2
+#define NR_IPC_DEFAULT_SOCKET "/tmp/noisereduce.sock"
+
+// largest ring the daemon maps: slots, frames per slot and bytes in all
+#define NR_IPC_MAX_SLOTS 1024
+#define NR_IPC_MAX_SLOT_FRAMES (1 << 20)
+#define NR_IPC_MAX_RING_BYTES (256u << 20)
+
+enum {
+  NR_MSG_OPEN = 1,
+  NR_MSG_OPENED,
+  NR_MSG_SUBMIT,
+  NR_MSG_DONE,
+};
+
+typedef struct {
+  uint32_t type;  // NR_MSG_OPEN
+  uint32_t magic;
+  uint32_t version;
+  uint32_t slots;
+  uint32_t slot_frames;
+  SpectralGateConfig config;
+} NrOpenMsg;
+
+typedef struct {
+  uint32_t type;
+  int32_t status;  // 0 ok, -1 error (OPENED, DONE)
+  int64_t seq;     // block sequence number (SUBMIT, DONE), latency (OPENED)
+  int64_t frames;  // frames in the block (SUBMIT)
+} NrMsg;
+
+// ring layout: slot i starts at i * slot_frames floats
+// returns the ring's size, or 0 if it is empty or over the limits above
+static inline uint64_t nr_ring_bytes(uint32_t slots, uint32_t slot_frames) {
+  if (slots == 0 || slot_frames == 0 || slots > NR_IPC_MAX_SLOTS ||
+      slot_frames > NR_IPC_MAX_SLOT_FRAMES) {
+    return 0;
+  }
+  uint64_t bytes = (uint64_t)slots * slot_frames * sizeof(float);
+  return bytes <= NR_IPC_MAX_RING_BYTES ? bytes : 0;
+}
+
+#ifdef __cplusplus
+}
+#endif
+#endif
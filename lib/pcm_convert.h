@@ -0,0 +1,48 @@
+#ifndef PCM_CONVERT_H
+#define PCM_CONVERT_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// sample layout and format conversion kernels shared by every io path (wav/raw,
+// the mp3 decoder and encoder, the per channel gate loops). sse2 where the
+// compiler has it (plus ssse3 for packed 24 bit), plain loops otherwise; both
+// give the same bits. buffers need no particular alignment
+//
+// the peak arguments are running maxima of |sample| over the converted data:
+// *peak is raised, never lowered, so a caller can carry one across calls. NULL
+// skips the peak
+
+// planar channels to one interleaved buffer and back, any channel count (1-8
+// have their own kernels). the same pointer may appear more than once in in,
+// eg. to copy one gated channel to all of them
+void pcm_interleave(const float* const* in, float* out, int channels, long frames);
+void pcm_deinterleave(const float* in, float* const* out, int channels, long frames);
+
+// one channel ch of an interleaved buffer to a planar one and back, the other
+// channels of out are left alone
+void pcm_extract_channel(const float* in, float* out, int channels, int ch, long frames);
+void pcm_insert_channel(const float* in, float* out, int channels, int ch, long frames);
+
+// planar fixed point with frac_bits fraction bits (libmad's q28) to interleaved
+// float
+void pcm_fixed_to_float(const int32_t* const* in, float* out, int channels, long frames,
+                        int frac_bits, float* peak);
+
+// little endian s16 / packed s24 to float in [-1, 1) and back. the way out
+// clips to [-1, 1] and rounds to nearest
+void pcm_s16_to_float(const unsigned char* in, float* out, long count, float* peak);
+void pcm_s24_to_float(const unsigned char* in, float* out, long count, float* peak);
+void pcm_float_to_s16(const float* in, unsigned char* out, long count);
+void pcm_float_to_s24(const float* in, unsigned char* out, long count);
+
+// raises *peak to the largest |sample| of in
+void pcm_peak(const float* in, long count, float* peak);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
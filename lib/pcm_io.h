@@ -0,0 +1,108 @@
+#ifndef PCM_IO_H
+#define PCM_IO_H
+
+#include <stdio.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// wav and raw pcm readers/writers so the gate can be run without going through
+// libmad and lame. samples are always handed out as interleaved floats in
+// [-1, 1], the same layout mp3_to_float() produces.
+
+typedef enum {
+  PCM_FORMAT_S16 = 0,  // 16-bit signed int
+  PCM_FORMAT_S24,      // 24-bit signed int, packed (3 bytes per sample)
+  PCM_FORMAT_F32,      // 32-bit ieee float
+} PcmFormat;
+
+typedef enum {
+  PCM_CONTAINER_RAW = 0,  // headerless interleaved samples
+  PCM_CONTAINER_WAV,      // RIFF/WAVE
+} PcmContainer;
+
+typedef struct {
+  int sample_rate;
+  int channels;
+  PcmFormat format;
+} PcmSpec;
+
+typedef struct PcmReader PcmReader;
+typedef struct PcmWriter PcmWriter;
+
+// picks the container from the file extension (.wav, .raw, .pcm)
+// returns -1 when the extension is not a pcm one (eg. .mp3)
+int pcm_container_from_filename(const char* filename);
+
+// bytes per sample for a format, 0 for an unknown format
+int pcm_format_bytes(PcmFormat format);
+
+// parses "s16", "s24" or "f32", returns -1 on anything else
+int pcm_format_from_string(const char* str);
+
+// opens a file for block reading
+// raw_spec is required for PCM_CONTAINER_RAW and ignored for wav (read from the
+// header). with use_mmap the file is mapped and converted straight out of the
+// page cache, otherwise it is streamed through a small staging buffer.
+// returns NULL on error
+PcmReader* pcm_reader_open(const char* filename, PcmContainer container,
+                           const PcmSpec* raw_spec, int use_mmap);
+
+// same as pcm_reader_open but reads a stream (eg. stdin); never mmaps
+PcmReader* pcm_reader_open_file(FILE* fp, PcmContainer container,
+                                const PcmSpec* raw_spec);
+
+const PcmSpec* pcm_reader_spec(const PcmReader* reader);
+
+// total frames (samples per channel) in the file, -1 if unknown (streams)
+long pcm_reader_frames(const PcmReader* reader);
+
+// reads up to max_frames frames as interleaved floats
+// returns frames read, 0 at end of file and -1 on error
+long pcm_reader_read(PcmReader* reader, float* output, long max_frames);
+
+// moves frames forward without decoding them: a mapped file or a seekable one
+// just moves its position, a pipe is read and thrown away
+// returns frames skipped (fewer at the end of the file) and -1 on error
+long pcm_reader_skip(PcmReader* reader, long frames);
+
+void pcm_reader_close(PcmReader* reader);
+
+// opens a file for block writing, the wav header is finalized on close
+// returns NULL on error
+PcmWriter* pcm_writer_open(const char* filename, PcmContainer container,
+                           const PcmSpec* spec);
+
+// same as pcm_writer_open but writes to a stream (eg. stdout). a wav header on
+// a non-seekable stream keeps its "unknown length" sizes
+PcmWriter* pcm_writer_open_file(FILE* fp, PcmContainer container,
+                                const PcmSpec* spec);
+
+// writes frames interleaved floats, clipping to [-1, 1] for int formats
+// returns 0 on success and -1 on error
+int pcm_writer_write(PcmWriter* writer, const float* input, long frames);
+
+// pushes buffered samples out to the stream (eg. once per block in a pipe)
+// returns 0 on success and -1 on error
+int pcm_writer_flush(PcmWriter* writer);
+
+// returns 0 on success and -1 on error
+int pcm_writer_close(PcmWriter* writer);
+
+// decodes a whole wav/raw file to a float buffer (mmap'd where possible)
+// spec is in/out: for raw files it must describe the data, for wav files it is
+// filled from the header
+// returns number of samples decoded on success and -1 on error, output comes
+// from the process allocator (nr_alloc.h), free it with nr_free(NULL, ...)
+long pcm_to_float(const char* filename, PcmSpec* spec, float** output);
+
+// writes a float buffer to a wav/raw file (container picked from the name)
+// returns 0 on success and -1 on error
+int float_to_pcm(const char* filename, const float* input, long num_samples,
+                 const PcmSpec* spec);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
@@ -0,0 +1,60 @@
+#ifndef RESAMPLE_H
+#define RESAMPLE_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// rational polyphase resampler (kaiser windowed sinc, 80 dB stopband), used to
+// run the gate on a decimated voice band. the filters are linear phase and their
+// delay is taken out, so output sample k lines up with input time
+// k * in_rate / out_rate
+// when the higher rate is even and at least RESAMPLE_HALF_BAND_RATIO times the
+// lower one, a 2:1 half band stage takes the step next to the higher rate, so the
+// polyphase filter runs at half that rate with half the taps. the half band only
+// has to keep what would fold into the lower nyquist out, which leaves it a wide
+// transition and a dozen or so multiplies per sample
+#define RESAMPLE_HALF_BAND_RATIO 2.5
+
+typedef struct {
+    int in_rate;
+    int out_rate;
+    // the polyphase stage, between in_rate and out_rate with the half band's
+    // factor of 2 taken off the higher one
+    int up; // L, interpolation factor after reducing its rates by their gcd
+    int down; // M, decimation factor
+    int taps; // taps per phase, multiple of 4 for the sse dot product
+    float* phases; // up phases of taps coefficients each, stored time reversed
+    long delay; // filter delay in upsampled samples
+    // the half band stage: -1 decimates by 2 ahead of the polyphase stage, 1
+    // interpolates by 2 after it, 0 when there is none
+    int half_band;
+    int half_taps; // nonzero taps each side of the centre, at odd offsets
+    float* half_coefs; // the 2 * half_taps of them in order, the centre's 0.5 left out
+} Resampler;
+
+// taps_per_phase (input samples under the filter at in_rate) trades the
+// transition width around the lower nyquist for speed: 64 at the lower rate
+// keeps it to about +-1 kHz at 16 kHz, a decimator wants that times
+// in_rate / out_rate
+// returns NULL on error
+Resampler* resampler_init(int in_rate, int out_rate, int taps_per_phase);
+void resampler_free(Resampler* rs);
+
+// gain of the filters at freq Hz in dB: the passband loss below the lower
+// nyquist, and above it how far what folds back (decimating) or the images
+// (interpolating) are taken down
+double resampler_gain_db(const Resampler* rs, double freq);
+
+// number of output samples for num_in input samples
+long resampler_output_length(const Resampler* rs, long num_in);
+
+// resamples a whole buffer, samples outside the input count as zero
+// output must hold resampler_output_length(rs, num_in) samples
+// returns samples written, -1 on error
+long resampler_process(const Resampler* rs, const float* input, long num_in, float* output);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
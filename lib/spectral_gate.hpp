@@ -0,0 +1,372 @@
+#ifndef SPECTRAL_GATE_HPP
+#define SPECTRAL_GATE_HPP
+
+// header only c++20 version of the streaming gate (spectral_gate_stream with the
+// hann window), with frame and hop fixed at compile time so the window, bin and
+// overlap loops have constant trip counts. the window, twiddles and bit reversal
+// table are built at compile time, the fft is a radix-2 real fft of its own
+//
+//   SpectralGate<1024, 256> gate(config);   // frame/hop in config must be 0 or match
+//   gate.process(in, out);                  // any block size, delayed by latency()
+//
+// the common sizes are instantiated once in src/spectral_gate.cpp, link it or
+// define SPECTRAL_GATE_HEADER_ONLY to have every user instantiate its own
+
+#include <array>
+#include <cmath>
+#include <cstddef>
+#include <cstring>
+#include <memory>
+#include <span>
+#include <stdexcept>
+#include <utility>
+
+#include "noisereduce.h"
+
+namespace noisereduce {
+
+namespace detail {
+
+constexpr double kPi = 3.14159265358979323846;
+
+// std::cos is not constexpr before c++26
+constexpr double const_cos(double x) {
+    // reduce to [-pi, pi]
+    double turns = x / (2.0 * kPi);
+    long long whole = static_cast<long long>(turns);
+    x -= 2.0 * kPi * static_cast<double>(whole);
+    if (x > kPi) x -= 2.0 * kPi;
+    if (x < -kPi) x += 2.0 * kPi;
+
+    double term = 1.0;
+    double sum = 1.0;
+    for (int n = 1; n < 40; n++) {
+        term *= -x * x / ((2.0 * n - 1) * (2.0 * n));
+        sum += term;
+    }
+    return sum;
+}
+
+constexpr double const_sin(double x) {
+    return const_cos(x - kPi / 2.0);
+}
+
+constexpr bool is_pow2(int n) {
+    return n > 0 && (n & (n - 1)) == 0;
+}
+
+struct Cpx {
+    float r;
+    float i;
+};
+
+// the symmetric hann of make_hann_window, evaluated in double
+template <int N>
+constexpr std::array<float, N> hann_window() {
+    std::array<float, N> w{};
+    for (int i = 0; i < N; i++) {
+        w[i] = static_cast<float>(0.5 - 0.5 * const_cos(2.0 * kPi * i / (N - 1)));
+    }
+    return w;
+}
+
+// exp(-2 pi i k / N) for k < N/2, the complex fft of N/2 uses every other one
+template <int N>
+constexpr std::array<Cpx, N / 2> twiddles() {
+    std::array<Cpx, N / 2> t{};
+    for (int k = 0; k < N / 2; k++) {
+        double a = -2.0 * kPi * k / N;
+        t[k] = {static_cast<float>(const_cos(a)), static_cast<float>(const_sin(a))};
+    }
+    return t;
+}
+
+template <int M>
+constexpr std::array<int, M> bit_reverse() {
+    std::array<int, M> rev{};
+    int bits = 0;
+    while ((1 << bits) < M) bits++;
+    for (int i = 0; i < M; i++) {
+        int r = 0;
+        for (int b = 0; b < bits; b++) {
+            r |= ((i >> b) & 1) << (bits - 1 - b);
+        }
+        rev[i] = r;
+    }
+    return rev;
+}
+
+// overlap-add gain of the window with itself, same sums as ola_gain in noisereduce.c
+template <int N, int Hop>
+constexpr float ola_norm(const std::array<float, N>& w) {
+    float mean = 0.0f;
+    for (int i = 0; i < Hop; i++) {
+        float sum = 0.0f;
+        for (int n = i; n < N; n += Hop) {
+            sum += w[n] * w[n];
+        }
+        mean += sum;
+    }
+    mean /= Hop;
+    return mean > 0.0f ? 1.0f / mean : 1.0f;
+}
+
+template <int N, int Hop>
+constexpr int synth_offset(const std::array<float, N>& w) {
+    int start = 0;
+    while (start < N - Hop && w[start] == 0.0f) start++;
+    return start;
+}
+
+}  // namespace detail
+
+template <int FrameSize, int HopSize>
+class SpectralGate {
+    static_assert(detail::is_pow2(FrameSize) && FrameSize >= 4, "frame size must be a power of 2");
+    static_assert(HopSize > 0 && HopSize <= FrameSize, "hop must be within the frame");
+
+public:
+    static constexpr int kFrameSize = FrameSize;
+    static constexpr int kHopSize = HopSize;
+    static constexpr int kBins = FrameSize / 2 + 1;
+
+    explicit SpectralGate(const SpectralGateConfig& config) : state_(std::make_unique<State>()) {
+        if ((config.frame_size != 0 && config.frame_size != FrameSize) ||
+            (config.hop_size != 0 && config.hop_size != HopSize)) {
+            throw std::invalid_argument("SpectralGate: config frame/hop do not match the template");
+        }
+        if (config.window_mode != SG_WINDOW_HANN || config.num_bands != 0 || config.engine != SG_ENGINE_STFT) {
+            throw std::invalid_argument("SpectralGate: only the per bin hann gate is specialized");
+        }
+        if (config.smoothing_hop < 0 || config.sample_rate < 0) {
+            throw std::invalid_argument("SpectralGate: negative smoothing hop or sample rate");
+        }
+        alpha_ = config.alpha;
+        floor_gain_ = std::pow(10.0f, config.noise_floor / 20.0f);
+        noise_decay_ = per_hop(config, config.noise_decay);
+        vad_smoothing_ = per_hop(config, kVadSmoothing);
+        vad_high_ = config.silence_threshold * 1.5f;
+        vad_low_ = config.silence_threshold * 0.75f;
+        state_->noise_est.fill(1e-3f);
+    }
+
+    SpectralGate(SpectralGate&&) noexcept = default;
+    SpectralGate& operator=(SpectralGate&&) noexcept = default;
+    SpectralGate(const SpectralGate&) = delete;
+    SpectralGate& operator=(const SpectralGate&) = delete;
+
+    // delay of process() in samples, like spectral_gate_latency()
+    static constexpr int latency() { return FrameSize - kOffset; }
+
+    // gates in into out (same length), both can be any size and may alias
+    void process(std::span<const float> in, std::span<float> out) {
+        if (out.size() < in.size()) {
+            throw std::invalid_argument("SpectralGate::process: output shorter than input");
+        }
+        State& s = *state_;
+        constexpr int kTail = FrameSize - HopSize;
+        std::size_t pos = 0;
+        const std::size_t n_total = in.size();
+        while (pos < n_total) {
+            std::size_t n = static_cast<std::size_t>(HopSize - s.fill);
+            if (n > n_total - pos) n = n_total - pos;
+            // read before write so in and out can be the same buffer
+            std::memcpy(s.in.data() + kTail + s.fill, in.data() + pos, n * sizeof(float));
+            std::memcpy(out.data() + pos, s.out.data() + s.fill, n * sizeof(float));
+            s.fill += static_cast<int>(n);
+            pos += n;
+            if (s.fill < HopSize) break;
+            s.fill = 0;
+
+            gate_frame(s);
+
+            for (int i = 0; i < FrameSize; i++) {
+                s.ola[i] += s.time[i];
+            }
+            for (int i = 0; i < HopSize; i++) {
+                s.out[i] = s.ola[kOffset + i] * kNorm;
+            }
+            std::memmove(s.ola.data(), s.ola.data() + HopSize, kTail * sizeof(float));
+            std::memset(s.ola.data() + kTail, 0, HopSize * sizeof(float));
+            std::memmove(s.in.data(), s.in.data() + HopSize, kTail * sizeof(float));
+        }
+    }
+
+    // drops buffered audio and the vad state, keeps the noise estimate
+    void reset() {
+        State& s = *state_;
+        s.in.fill(0.0f);
+        s.ola.fill(0.0f);
+        s.out.fill(0.0f);
+        s.fill = 0;
+        s.vad_energy = 0.0f;
+        s.vad_silence = true;
+    }
+
+    std::span<const float, kBins> noise_estimate() const { return state_->noise_est; }
+
+private:
+    static constexpr int kHalf = FrameSize / 2;
+    static constexpr std::array<float, FrameSize> kWindow = detail::hann_window<FrameSize>();
+    static constexpr std::array<detail::Cpx, kHalf> kTwiddles = detail::twiddles<FrameSize>();
+    static constexpr std::array<int, kHalf> kBitRev = detail::bit_reverse<kHalf>();
+    static constexpr float kNorm = detail::ola_norm<FrameSize, HopSize>(kWindow);
+    static constexpr int kOffset = detail::synth_offset<FrameSize, HopSize>(kWindow);
+    static constexpr float kVadSmoothing = 0.9f;
+
+    // a smoothing factor as applied once per hop, like per_hop in noisereduce.c
+    static float per_hop(const SpectralGateConfig& config, float factor) {
+        if (config.smoothing_hop <= 0) return factor;
+        int sample_rate = config.sample_rate > 0 ? config.sample_rate : 44100;
+        float hops = static_cast<float>(HopSize) * 44100 /
+                     (static_cast<float>(sample_rate) * config.smoothing_hop);
+        return hops == 1.0f ? factor : std::pow(factor, hops);
+    }
+
+    // lives on the heap so moves are a pointer swap and the gate fits anywhere
+    struct State {
+        std::array<float, FrameSize> in{};
+        std::array<float, FrameSize> ola{};
+        std::array<float, HopSize> out{};
+        std::array<float, FrameSize> frame{};
+        std::array<float, FrameSize> time{};
+        std::array<detail::Cpx, kHalf + 1> spec{};
+        std::array<detail::Cpx, kHalf> work{};
+        std::array<float, kBins> noise_est{};
+        int fill = 0;
+        float vad_energy = 0.0f;
+        bool vad_silence = true;
+    };
+
+    // in place radix-2 fft of kHalf points, twiddles taken at stride 2
+    static void fft_half(std::array<detail::Cpx, kHalf>& a) {
+        for (int i = 0; i < kHalf; i++) {
+            int j = kBitRev[i];
+            if (i < j) std::swap(a[i], a[j]);
+        }
+        for (int len = 2; len <= kHalf; len <<= 1) {
+            const int half = len >> 1;
+            const int stride = 2 * (kHalf / len);
+            for (int start = 0; start < kHalf; start += len) {
+                for (int k = 0; k < half; k++) {
+                    const detail::Cpx w = kTwiddles[k * stride];
+                    detail::Cpx& x = a[start + k];
+                    detail::Cpx& y = a[start + k + half];
+                    float tr = y.r * w.r - y.i * w.i;
+                    float ti = y.r * w.i + y.i * w.r;
+                    y = {x.r - tr, x.i - ti};
+                    x = {x.r + tr, x.i + ti};
+                }
+            }
+        }
+    }
+
+    // real fft of s.frame into s.spec (kHalf + 1 bins)
+    static void forward(State& s) {
+        for (int n = 0; n < kHalf; n++) {
+            s.work[n] = {s.frame[2 * n], s.frame[2 * n + 1]};
+        }
+        fft_half(s.work);
+        for (int k = 0; k <= kHalf; k++) {
+            const detail::Cpx z = s.work[k % kHalf];
+            const detail::Cpx zc = {s.work[(kHalf - k) % kHalf].r, -s.work[(kHalf - k) % kHalf].i};
+            // even and odd sample spectra
+            float er = 0.5f * (z.r + zc.r), ei = 0.5f * (z.i + zc.i);
+            float or_ = 0.5f * (z.i - zc.i), oi = -0.5f * (z.r - zc.r);
+            const detail::Cpx w = k < kHalf ? kTwiddles[k] : detail::Cpx{-1.0f, 0.0f};
+            s.spec[k] = {er + or_ * w.r - oi * w.i, ei + or_ * w.i + oi * w.r};
+        }
+    }
+
+    // inverse of forward(), s.spec back into s.time, scaled
+    static void inverse(State& s) {
+        for (int k = 0; k < kHalf; k++) {
+            const detail::Cpx x = s.spec[k];
+            const detail::Cpx xc = {s.spec[kHalf - k].r, -s.spec[kHalf - k].i};
+            float er = x.r + xc.r, ei = x.i + xc.i;
+            float dr = x.r - xc.r, di = x.i - xc.i;
+            // odd spectrum = difference times conj(twiddle)
+            const detail::Cpx w = kTwiddles[k];
+            float or_ = dr * w.r + di * w.i;
+            float oi = di * w.r - dr * w.i;
+            // z = even + i * odd, conjugated so the forward fft does the inverse
+            s.work[k] = {er - oi, -(ei + or_)};
+        }
+        fft_half(s.work);
+        constexpr float scale = 1.0f / FrameSize;
+        for (int n = 0; n < kHalf; n++) {
+            s.time[2 * n] = s.work[n].r * scale;
+            s.time[2 * n + 1] = -s.work[n].i * scale;
+        }
+    }
+
+    void gate_frame(State& s) {
+        float energy = 0.0f;
+        bool digital_silence = true;
+        for (int i = 0; i < FrameSize; i++) {
+            s.frame[i] = s.in[i] * kWindow[i];
+            energy += s.frame[i] * s.frame[i];
+            digital_silence &= s.frame[i] == 0.0f;
+        }
+        energy /= FrameSize;
+        s.vad_energy = vad_smoothing_ * s.vad_energy + (1.0f - vad_smoothing_) * energy;
+        if (s.vad_silence) {
+            if (s.vad_energy > vad_high_) s.vad_silence = false;
+        } else if (s.vad_energy < vad_low_) {
+            s.vad_silence = true;
+        }
+
+        if (digital_silence) {
+            if (s.vad_silence) {
+                for (float& e : s.noise_est) e *= noise_decay_;
+            }
+            s.time.fill(0.0f);
+            return;
+        }
+
+        forward(s);
+        int gated = 0;
+        for (int j = 0; j < kBins; j++) {
+            float mag = std::sqrt(s.spec[j].r * s.spec[j].r + s.spec[j].i * s.spec[j].i);
+            if (s.vad_silence) {
+                s.noise_est[j] = noise_decay_ * s.noise_est[j] + (1.0f - noise_decay_) * mag;
+            }
+            // a real gain keeps the phase, so the bin is scaled in place
+            if (mag < alpha_ * s.noise_est[j]) {
+                s.spec[j].r *= floor_gain_;
+                s.spec[j].i *= floor_gain_;
+                gated++;
+            }
+        }
+
+        if (gated == 0) {
+            for (int i = 0; i < FrameSize; i++) {
+                s.time[i] = s.frame[i] * kWindow[i];
+            }
+            return;
+        }
+        inverse(s);
+        for (int i = 0; i < FrameSize; i++) {
+            s.time[i] *= kWindow[i];
+        }
+    }
+
+    std::unique_ptr<State> state_;
+    float alpha_ = 0.0f;
+    float floor_gain_ = 0.0f;
+    float noise_decay_ = 0.0f;
+    float vad_smoothing_ = 0.0f;
+    float vad_high_ = 0.0f;
+    float vad_low_ = 0.0f;
+};
+
+#ifndef SPECTRAL_GATE_HEADER_ONLY
+extern template class SpectralGate<256, 64>;
+extern template class SpectralGate<512, 128>;
+extern template class SpectralGate<1024, 256>;
+extern template class SpectralGate<2048, 512>;
+#endif
+
+}  // namespace noisereduce
+
+#endif
@@ -0,0 +1,34 @@
+#ifndef TASK_POOL_H
+#define TASK_POOL_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// work-stealing thread pool. every worker has its own deque: tasks submitted
+// from inside a task go to the front of the submitting worker's deque and are
+// run newest first, idle workers steal the oldest task from the back of
+// someone else's. tasks submitted from outside are spread round robin
+
+typedef struct TaskPool TaskPool;
+typedef void (*TaskFn)(TaskPool* pool, void* arg);
+
+// num_threads <= 0 means one per core, returns NULL on error
+TaskPool* task_pool_create(int num_threads);
+
+// returns 0 on success and -1 on error (out of memory)
+int task_pool_submit(TaskPool* pool, TaskFn fn, void* arg);
+
+// blocks until every submitted task, including the ones they submitted, is done
+void task_pool_wait(TaskPool* pool);
+
+// waits for the remaining tasks and joins the workers
+void task_pool_destroy(TaskPool* pool);
+
+int task_pool_threads(const TaskPool* pool);
+long task_pool_steals(const TaskPool* pool); // tasks run by a worker other than their owner
+
+#ifdef __cplusplus
+}
+#endif
+#endif
@@ -0,0 +1,49 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// timeline tracing of the pipeline stages (decode, gate, encode, file io) as
+// chrome trace-event json, for chrome://tracing or ui.perfetto.dev. every
+// thread appends complete ("X") events to a buffer of its own without locks,
+// the buffers are written out at exit (or by trace_stop). off by default, and
+// then a span costs one load
+//
+//   uint64_t t0 = trace_begin();
+//   ... work ...
+//   trace_end("gate", "spectral_gate_start", t0, num_samples);
+//
+// cat and name are stored as pointers, so they must be string literals
+
+// starts tracing into path. per frame spans are only kept for every
+// frame_sample-th frame (<= 1 keeps all). returns 0 on success and -1 on error
+int trace_start(const char* path, int frame_sample);
+
+// writes the file and stops tracing, returns 0 on success and -1 on error.
+// also runs at exit. threads still tracing at that point may lose their
+// newest events
+int trace_stop(void);
+
+int trace_active(void);
+
+// nonzero if frame (a running frame number) should get a span
+int trace_frame_sampled(long frame);
+
+// the start time of a span, 0 while tracing is off
+uint64_t trace_begin(void);
+
+// records the span from begin to now with arg as its "n" argument (samples,
+// frames, channel...), nothing if begin is 0
+void trace_end(const char* cat, const char* name, uint64_t begin, long arg);
+
+// names the calling thread's row on the timeline, name is copied
+void trace_thread_name(const char* name);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
@@ -0,0 +1,53 @@
+#ifndef VOICEBAND_H
+#define VOICEBAND_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "noisereduce.h"
+#include "resample.h"
+
+// decimated processing for speech: the gate runs on a band_rate (eg. 16 kHz)
+// copy of the signal with a proportionally smaller fft, and the result is
+// interpolated back to the full rate. the band above band_rate / 2 is either
+// attenuated or passed through untouched
+
+#define VOICEBAND_RATE 16000
+#define VOICEBAND_TAPS 64 // taps per resampler phase at band_rate, the decimator scales it up
+#define VOICEBAND_FOLLOW_MS 4 // blocks the attenuated high band follows the gate in
+#define VOICEBAND_FOLLOW_RELEASE 0.5f // per block, how slowly it closes again
+
+typedef enum {
+    VB_HIGH_ATTENUATE = 0, // scale the high band by the gate's noise floor
+    VB_HIGH_PASS = 1, // pass the high band through unchanged
+} VoiceBandHighMode;
+
+typedef struct {
+    int sample_rate;
+    int band_rate;
+    int high_mode; // VoiceBandHighMode
+    float high_gain; // gain applied to the band above band_rate / 2, the least of it when attenuated
+    Resampler* down;
+    Resampler* up;
+} VoiceBand;
+
+// scales frame_size (to the nearest power of 2) and hop_size from sample_rate to
+// band_rate, keeping the other settings. returns 0 on success and -1 on error
+int voiceband_config(const SpectralGateConfig* full, int sample_rate, int band_rate,
+                     SpectralGateConfig* band);
+
+// returns NULL on error
+VoiceBand* voiceband_init(const SpectralGateConfig* full, int sample_rate, int band_rate,
+                          VoiceBandHighMode high_mode);
+void voiceband_free(VoiceBand* vb);
+
+// gates one channel. band_spd must be initialized from voiceband_config()
+// returns 0 on success and -1 on error
+int voiceband_process(VoiceBand* vb, SpectralGateData* band_spd, const float* input,
+                      float* output, long num_samples);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
@@ -0,0 +1,172 @@
+#include <cstdlib>
+
+#include "async_gate.hpp"
+#include "mp3_utils.h"
+#include "nr_alloc.h"
+
+namespace noisereduce::async {
+
+void EventLoop::post(std::coroutine_handle<> h) {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        ready_.push_back(h);
+    }
+    cv_.notify_one();
+}
+
+void EventLoop::post(const std::vector<std::coroutine_handle<>>& hs) {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        ready_.insert(ready_.end(), hs.begin(), hs.end());
+    }
+    cv_.notify_one();
+}
+
+void EventLoop::add_work() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    outstanding_++;
+}
+
+void EventLoop::finish_work() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        outstanding_--;
+    }
+    cv_.notify_one();
+}
+
+void EventLoop::run() {
+    std::vector<std::coroutine_handle<>> batch;
+    for (;;) {
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            cv_.wait(lock, [this] { return !ready_.empty() || outstanding_ == 0; });
+            if (ready_.empty()) {
+                return;
+            }
+            batch.swap(ready_);
+        }
+        for (std::coroutine_handle<> h : batch) {
+            h.resume();
+        }
+        batch.clear();
+    }
+}
+
+BatchExecutor::BatchExecutor(EventLoop& loop) : loop_(loop), thread_([this] { worker(); }) {}
+
+BatchExecutor::~BatchExecutor() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stop_ = true;
+    }
+    cv_.notify_one();
+    thread_.join();
+}
+
+void BatchExecutor::submit(Job* job) {
+    job->next = nullptr;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (tail_) {
+            tail_->next = job;
+        } else {
+            head_ = job;
+        }
+        tail_ = job;
+    }
+    cv_.notify_one();
+}
+
+void BatchExecutor::worker() {
+    std::vector<std::coroutine_handle<>> done;
+    for (;;) {
+        Job* batch;
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            cv_.wait(lock, [this] { return head_ != nullptr || stop_; });
+            if (!head_) {
+                return;
+            }
+            // everything queued so far is one pass
+            batch = head_;
+            head_ = tail_ = nullptr;
+        }
+        batches_++;
+        while (batch) {
+            // the job lives in a coroutine frame that may be gone once resumed,
+            // so read everything first
+            Job* next = batch->next;
+            batch->execute();
+            done.push_back(batch->continuation);
+            jobs_++;
+            batch = next;
+        }
+        loop_.post(done);
+        done.clear();
+    }
+}
+
+AsyncGate::AsyncGate(BatchExecutor& exec, const SpectralGateConfig& config)
+    : exec_(&exec), spd_(spectral_gate_init(&config)) {
+    if (!spd_) throw std::runtime_error("failed to initialize spectral gate");
+}
+
+AsyncGate::AsyncGate(BatchExecutor& exec, SpectralGateShared* shared)
+    : exec_(&exec), spd_(spectral_gate_init_shared(shared)) {
+    if (!spd_) throw std::runtime_error("failed to initialize spectral gate");
+}
+
+AsyncGate::AsyncGate(AsyncGate&& other) noexcept
+    : exec_(other.exec_), spd_(std::exchange(other.spd_, nullptr)) {}
+
+AsyncGate& AsyncGate::operator=(AsyncGate&& other) noexcept {
+    if (this != &other) {
+        spectral_gate_free(spd_);
+        exec_ = other.exec_;
+        spd_ = std::exchange(other.spd_, nullptr);
+    }
+    return *this;
+}
+
+AsyncGate::~AsyncGate() {
+    spectral_gate_free(spd_);
+}
+
+AsyncPcmReader::AsyncPcmReader(BatchExecutor& exec, const std::string& filename) : exec_(&exec), reader_(nullptr) {
+    int container = pcm_container_from_filename(filename.c_str());
+    if (container < 0) throw std::runtime_error("not a wav or raw file: " + filename);
+    reader_ = pcm_reader_open(filename.c_str(), static_cast<PcmContainer>(container), nullptr, 0);
+    if (!reader_) throw std::runtime_error("failed to open " + filename);
+}
+
+AsyncPcmReader::AsyncPcmReader(AsyncPcmReader&& other) noexcept
+    : exec_(other.exec_), reader_(std::exchange(other.reader_, nullptr)) {}
+
+AsyncPcmReader& AsyncPcmReader::operator=(AsyncPcmReader&& other) noexcept {
+    if (this != &other) {
+        if (reader_) pcm_reader_close(reader_);
+        exec_ = other.exec_;
+        reader_ = std::exchange(other.reader_, nullptr);
+    }
+    return *this;
+}
+
+AsyncPcmReader::~AsyncPcmReader() {
+    if (reader_) pcm_reader_close(reader_);
+}
+
+CallAwaiter<std::function<DecodedAudio()>> decode_mp3(BatchExecutor& exec, std::string filename) {
+    std::function<DecodedAudio()> job = [filename = std::move(filename)] {
+        DecodedAudio audio;
+        float* data = nullptr;
+        long n = mp3_to_float_mt(filename.c_str(), &data, &audio.sample_rate, &audio.channels, 1);
+        if (n < 0) throw std::runtime_error("failed to decode " + filename);
+        audio.samples.assign(data, data + n);
+        nr_free(nullptr, data);
+        return audio;
+    };
+    return exec.call(std::move(job));
+}
+
+}  // namespace noisereduce::async
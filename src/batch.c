@@ -0,0 +1,429 @@
+#include "batch.h"
+
+#include <dirent.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <time.h>
+
+#include "mp3_utils.h"
+#include "nr_alloc.h"
+#include "pcm_convert.h"
+#include "task_pool.h"
+
+typedef struct BatchRun BatchRun;
+
+typedef struct {
+  BatchRun* run;
+  char* in_path;
+  char* out_path;
+  long size;  // bytes, for scheduling
+  dev_t dev;  // identify the input when checking for outputs written over it
+  ino_t ino;
+  int in_is_pcm;
+  int threads;  // this file's share of the pool, its stages split that many ways
+
+  // filled in by the decode task
+  PcmSpec in_spec;
+  float* pcm;
+  float* processed;
+  long total_samples;
+  int sample_rate;
+  int channels;
+
+  atomic_int channels_left;
+  atomic_int failed;
+} BatchFile;
+
+typedef struct {
+  BatchFile* file;
+  int channel;
+} ChannelJob;
+
+struct BatchRun {
+  const BatchOptions* opts;
+  BatchFile* files;
+  long num_files;
+
+  pthread_mutex_t lock;
+  long files_ok;
+  long files_failed;
+  double audio_seconds;
+};
+
+static double now_seconds(void) {
+  struct timespec ts;
+  timespec_get(&ts, TIME_UTC);
+  return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+static double cpu_seconds(void) {
+  struct rusage ru;
+  if (getrusage(RUSAGE_SELF, &ru) != 0) return 0.0;
+  return (double)ru.ru_utime.tv_sec + ru.ru_utime.tv_usec * 1e-6 +
+         (double)ru.ru_stime.tv_sec + ru.ru_stime.tv_usec * 1e-6;
+}
+
+static int is_audio_file(const char* path) {
+  const char* dot = strrchr(path, '.');
+  return pcm_container_from_filename(path) >= 0 ||
+         (dot && (strcmp(dot, ".mp3") == 0 || strcmp(dot, ".MP3") == 0));
+}
+
+static int add_file(BatchRun* run, long* cap, const char* path) {
+  struct stat st;
+  if (stat(path, &st) != 0 || !S_ISREG(st.st_mode) || !is_audio_file(path)) {
+    return 0;  // not something to process, skip quietly
+  }
+  if (run->num_files == *cap) {
+    long grown = *cap ? 2 * *cap : 64;
+    BatchFile* files = (BatchFile*)nr_realloc(NULL, run->files, *cap * sizeof(BatchFile),
+                                              grown * sizeof(BatchFile));
+    if (!files) return -1;
+    run->files = files;
+    *cap = grown;
+  }
+  const char* base = strrchr(path, '/');
+  base = base ? base + 1 : path;
+  size_t out_len = strlen(run->opts->out_dir) + strlen(base) + 2;
+
+  BatchFile* f = &run->files[run->num_files];
+  memset(f, 0, sizeof(*f));
+  f->run = run;
+  size_t in_len = strlen(path) + 1;
+  f->in_path = (char*)nr_malloc(NULL, in_len);
+  f->out_path = (char*)nr_malloc(NULL, out_len);
+  if (!f->in_path || !f->out_path) {
+    nr_free(NULL, f->in_path);
+    nr_free(NULL, f->out_path);
+    return -1;
+  }
+  memcpy(f->in_path, path, in_len);
+  snprintf(f->out_path, out_len, "%s/%s", run->opts->out_dir, base);
+  f->size = (long)st.st_size;
+  f->dev = st.st_dev;
+  f->ino = st.st_ino;
+  f->in_is_pcm = pcm_container_from_filename(path) >= 0;
+  run->num_files++;
+  return 0;
+}
+
+// input is a directory or a list file
+static int collect_files(BatchRun* run) {
+  const char* input = run->opts->input;
+  long cap = 0;
+  struct stat st;
+  if (stat(input, &st) != 0) {
+    perror(input);
+    return -1;
+  }
+  if (S_ISDIR(st.st_mode)) {
+    DIR* dir = opendir(input);
+    if (!dir) {
+      perror(input);
+      return -1;
+    }
+    struct dirent* ent;
+    while ((ent = readdir(dir)) != NULL) {
+      if (ent->d_name[0] == '.') continue;
+      size_t len = strlen(input) + strlen(ent->d_name) + 2;
+      char* path = (char*)nr_malloc(NULL, len);
+      if (!path) {
+        closedir(dir);
+        return -1;
+      }
+      snprintf(path, len, "%s/%s", input, ent->d_name);
+      int err = add_file(run, &cap, path);
+      nr_free(NULL, path);
+      if (err != 0) {
+        closedir(dir);
+        return -1;
+      }
+    }
+    closedir(dir);
+    return 0;
+  }
+
+  FILE* fp = fopen(input, "r");
+  if (!fp) {
+    perror(input);
+    return -1;
+  }
+  char line[4096];
+  while (fgets(line, sizeof(line), fp)) {
+    line[strcspn(line, "\r\n")] = '\0';
+    if (line[0] == '\0' || line[0] == '#') continue;
+    if (add_file(run, &cap, line) != 0) {
+      fclose(fp);
+      return -1;
+    }
+  }
+  fclose(fp);
+  return 0;
+}
+
+static int by_out_path(const void* a, const void* b) {
+  return strcmp((*(const BatchFile* const*)a)->out_path,
+                (*(const BatchFile* const*)b)->out_path);
+}
+
+static int by_inode(const void* a, const void* b) {
+  const BatchFile* fa = *(const BatchFile* const*)a;
+  const BatchFile* fb = *(const BatchFile* const*)b;
+  if (fa->dev != fb->dev) return (fa->dev > fb->dev) - (fa->dev < fb->dev);
+  return (fa->ino > fb->ino) - (fa->ino < fb->ino);
+}
+
+// files are gated concurrently, so two inputs with the same name would race
+// on one output, and an output that is one of the inputs (--out-dir pointing
+// at the input directory) would be truncated while it is still being read
+// returns 0 if every output is distinct and none of them is an input
+static int check_outputs(BatchRun* run) {
+  long n = run->num_files;
+  BatchFile** sorted = (BatchFile**)nr_malloc(NULL, n * sizeof(BatchFile*));
+  if (!sorted) return -1;
+  for (long i = 0; i < n; i++) sorted[i] = &run->files[i];
+
+  int status = 0;
+  qsort(sorted, n, sizeof(BatchFile*), by_out_path);
+  for (long i = 1; i < n; i++) {
+    if (strcmp(sorted[i - 1]->out_path, sorted[i]->out_path) == 0) {
+      fprintf(stderr, "batch: %s and %s would both be written to %s\n",
+              sorted[i - 1]->in_path, sorted[i]->in_path, sorted[i]->out_path);
+      status = -1;
+    }
+  }
+
+  // one hit is enough, an --out-dir holding the inputs would hit on every file
+  qsort(sorted, n, sizeof(BatchFile*), by_inode);
+  for (long i = 0; i < n && status == 0; i++) {
+    struct stat st;
+    if (stat(run->files[i].out_path, &st) != 0) continue;  // not there yet
+    BatchFile key;
+    key.dev = st.st_dev;
+    key.ino = st.st_ino;
+    const BatchFile* keyp = &key;
+    BatchFile** hit = (BatchFile**)bsearch(&keyp, sorted, n, sizeof(BatchFile*), by_inode);
+    if (hit) {
+      fprintf(stderr, "batch: %s would overwrite the input %s, use another "
+              "--out-dir\n", run->files[i].out_path, (*hit)->in_path);
+      status = -1;
+    }
+  }
+  nr_free(NULL, sorted);
+  return status;
+}
+
+static void file_done(BatchFile* f) {
+  BatchRun* run = f->run;
+  int failed = atomic_load(&f->failed);
+  double seconds = failed || f->sample_rate <= 0 || f->channels <= 0
+                       ? 0.0
+                       : (double)f->total_samples / f->channels / f->sample_rate;
+  nr_free(NULL, f->pcm);
+  nr_free(NULL, f->processed);
+  f->pcm = NULL;
+  f->processed = NULL;
+
+  pthread_mutex_lock(&run->lock);
+  if (failed) {
+    run->files_failed++;
+  } else {
+    run->files_ok++;
+    run->audio_seconds += seconds;
+  }
+  pthread_mutex_unlock(&run->lock);
+  printf("[%s] %s -> %s (%.1f s of audio)\n", failed ? "failed" : "ok",
+         f->in_path, f->out_path, seconds);
+}
+
+static void encode_task(TaskPool* pool, void* arg) {
+  (void)pool;
+  BatchFile* f = (BatchFile*)arg;
+  const BatchOptions* opts = f->run->opts;
+  if (!atomic_load(&f->failed)) {
+    int status;
+    if (pcm_container_from_filename(f->out_path) >= 0) {
+      PcmSpec out_spec;
+      out_spec.sample_rate = f->sample_rate;
+      out_spec.channels = f->channels;
+      out_spec.format = opts->out_format >= 0 ? (PcmFormat)opts->out_format
+                        : f->in_is_pcm        ? f->in_spec.format
+                                              : PCM_FORMAT_S16;
+      status = float_to_pcm(f->out_path, f->processed, f->total_samples,
+                            &out_spec);
+    } else {
+      status = float_to_mp3_mt(f->out_path, f->processed, f->total_samples,
+                               f->sample_rate, f->channels, f->threads);
+    }
+    if (status != 0) atomic_store(&f->failed, 1);
+  }
+  file_done(f);
+}
+
+static void channel_task(TaskPool* pool, void* arg) {
+  ChannelJob* job = (ChannelJob*)arg;
+  BatchFile* f = job->file;
+  const int channels = f->channels;
+  const long per_channel = f->total_samples / channels;
+
+  // the file's share goes to its channels, bit-identical to the serial gate
+  const int gate_threads = f->threads > channels ? f->threads / channels : 1;
+
+  SpectralGateConfig config = f->run->opts->config;
+  config.sample_rate = f->sample_rate;
+  SpectralGateData* spd = spectral_gate_init(&config);
+
+  // mono gates straight between the file buffers
+  float* in = channels == 1 ? f->pcm : (float*)nr_malloc(NULL, per_channel * sizeof(float));
+  float* out = channels == 1 ? f->processed : (float*)nr_malloc(NULL, per_channel * sizeof(float));
+  if (!spd || !in || !out) {
+    atomic_store(&f->failed, 1);
+  } else {
+    if (channels > 1) pcm_extract_channel(f->pcm, in, channels, job->channel, per_channel);
+    if (spectral_gate_start_mt(spd, in, out, per_channel, gate_threads) != 0) {
+      atomic_store(&f->failed, 1);
+    }
+    if (channels > 1) {
+      pcm_insert_channel(out, f->processed, channels, job->channel, per_channel);
+    }
+  }
+  if (channels > 1) {
+    nr_free(NULL, in);
+    nr_free(NULL, out);
+  }
+  spectral_gate_free(spd);
+  nr_free(NULL, job);
+
+  // the last channel to finish hands the file on
+  if (atomic_fetch_sub(&f->channels_left, 1) == 1) {
+    if (task_pool_submit(pool, encode_task, f) != 0) {
+      atomic_store(&f->failed, 1);
+      file_done(f);
+    }
+  }
+}
+
+static void decode_task(TaskPool* pool, void* arg) {
+  BatchFile* f = (BatchFile*)arg;
+  const BatchOptions* opts = f->run->opts;
+  if (f->in_is_pcm) {
+    f->in_spec = opts->raw_spec;
+    f->total_samples = pcm_to_float(f->in_path, &f->in_spec, &f->pcm);
+    f->sample_rate = f->in_spec.sample_rate;
+    f->channels = f->in_spec.channels;
+  } else {
+    f->total_samples = mp3_to_float_mt(f->in_path, &f->pcm, &f->sample_rate, &f->channels,
+                                       f->threads);
+  }
+  if (f->total_samples <= 0 || f->channels <= 0) {
+    atomic_store(&f->failed, 1);
+    file_done(f);
+    return;
+  }
+  f->total_samples -= f->total_samples % f->channels;
+  f->processed = (float*)nr_calloc(NULL, f->total_samples, sizeof(float));
+  if (!f->processed) {
+    atomic_store(&f->failed, 1);
+    file_done(f);
+    return;
+  }
+
+  // channels are gated independently, so each is its own task
+  atomic_store(&f->channels_left, f->channels);
+  for (int ch = 0; ch < f->channels; ch++) {
+    ChannelJob* job = (ChannelJob*)nr_malloc(NULL, sizeof(ChannelJob));
+    if (job) {
+      job->file = f;
+      job->channel = ch;
+    }
+    if (!job || task_pool_submit(pool, channel_task, job) != 0) {
+      nr_free(NULL, job);
+      atomic_store(&f->failed, 1);
+      if (atomic_fetch_sub(&f->channels_left, 1) == 1) file_done(f);
+    }
+  }
+}
+
+static int by_size(const void* a, const void* b) {
+  long sa = ((const BatchFile*)a)->size;
+  long sb = ((const BatchFile*)b)->size;
+  return (sa > sb) - (sa < sb);
+}
+
+int batch_run(const BatchOptions* opts) {
+  if (!opts || !opts->input || !opts->out_dir) {
+    fprintf(stderr, "batch_run: input and output directory are required\n");
+    return -1;
+  }
+  BatchRun run;
+  memset(&run, 0, sizeof(run));
+  run.opts = opts;
+  pthread_mutex_init(&run.lock, NULL);
+
+  int status = -1;
+  TaskPool* pool = NULL;
+  if (collect_files(&run) != 0) {
+    fprintf(stderr, "batch: failed to list the input files\n");
+    goto done;
+  }
+  if (run.num_files == 0) {
+    fprintf(stderr, "batch: no .mp3/.wav/.raw files in %s\n", opts->input);
+    goto done;
+  }
+  if (check_outputs(&run) != 0) goto done;
+  pool = task_pool_create(opts->threads);
+  if (!pool) goto done;
+
+  // workers run their own deque newest first, so submitting smallest to
+  // largest starts the big files first and leaves the small ones to fill the
+  // gaps at the end
+  qsort(run.files, run.num_files, sizeof(BatchFile), by_size);
+  printf("batch: %ld files on %d threads\n", run.num_files, task_pool_threads(pool));
+
+  // each file gets a share of the workers by size, so a lone large file still
+  // spreads its decode, gate and encode over all of them, while a crowd of
+  // small files runs every stage on the one worker it landed on
+  long total_size = 0;
+  for (long i = 0; i < run.num_files; i++) total_size += run.files[i].size;
+  for (long i = 0; i < run.num_files; i++) {
+    int threads = task_pool_threads(pool);
+    double share = total_size > 0 ? (double)threads * run.files[i].size / total_size : 1.0;
+    run.files[i].threads = share < 1.0 ? 1 : share > threads ? threads : (int)(share + 0.5);
+  }
+
+  double wall0 = now_seconds();
+  double cpu0 = cpu_seconds();
+  for (long i = 0; i < run.num_files; i++) {
+    if (task_pool_submit(pool, decode_task, &run.files[i]) != 0) {
+      atomic_store(&run.files[i].failed, 1);
+      file_done(&run.files[i]);
+    }
+  }
+  task_pool_wait(pool);
+  double wall = now_seconds() - wall0;
+  double cpu = cpu_seconds() - cpu0;
+
+  int threads = task_pool_threads(pool);
+  printf("batch: %ld ok, %ld failed in %.2f s\n", run.files_ok, run.files_failed, wall);
+  printf("batch: %.2f files/s, %.1fx realtime, cpu utilization %.0f%% of %d threads, %ld steals\n",
+         wall > 0.0 ? run.files_ok / wall : 0.0,
+         wall > 0.0 ? run.audio_seconds / wall : 0.0,
+         wall > 0.0 ? 100.0 * cpu / (wall * threads) : 0.0, threads,
+         task_pool_steals(pool));
+  status = run.files_failed == 0 ? 0 : -1;
+
+done:
+  task_pool_destroy(pool);
+  for (long i = 0; i < run.num_files; i++) {
+    nr_free(NULL, run.files[i].in_path);
+    nr_free(NULL, run.files[i].out_path);
+  }
+  nr_free(NULL, run.files);
+  pthread_mutex_destroy(&run.lock);
+  return status;
+}
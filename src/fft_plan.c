@@ -0,0 +1,446 @@
+// kf_factor always factors radix 4, then 2, then the odd primes, which isn't
+// the fastest plan on every machine. the wisdom file is plain text, one
+// "<nfft> <fwd|inv> <scalar|simd> <radix>x<radix>..." line per plan. entries
+// for a kernel this build lacks are skipped, so a file copied from another
+// machine only costs the retune
+
+#include "fft_plan.h"
+
+#include <errno.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "kiss_fft.h"
+#include "nr_alloc.h"
+
+#define MAX_RADICES 32
+#define MAX_CANDIDATES 12
+#define BENCH_RUNS 3
+
+typedef struct {
+  int nfft;
+  int inverse;
+  int kernel;
+  int num_radices;
+  int radices[MAX_RADICES];
+  double ns;          // per transform, 0 for plans loaded from wisdom
+  double default_ns;  // kf_factor order with the default kernel
+} Plan;
+
+static pthread_mutex_t plan_lock = PTHREAD_MUTEX_INITIALIZER;
+static Plan* plans;
+static int num_plans;
+static int cap_plans;
+static int new_plans;
+static FftPlanMode plan_mode;
+
+// set while benchmarking, so the candidate cfgs keep the plan they're given
+static __thread int tuning;
+
+static const char* kernel_name(int kernel) {
+  return kernel == KISS_FFT_KERNEL_SIMD ? "simd" : "scalar";
+}
+
+static double now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (double)ts.tv_sec * 1e9 + (double)ts.tv_nsec;
+}
+
+static Plan* find_plan(int nfft, int inverse) {
+  for (int i = 0; i < num_plans; i++) {
+    if (plans[i].nfft == nfft && plans[i].inverse == inverse) return &plans[i];
+  }
+  return NULL;
+}
+
+// the existing entry for the size, or a new one. NULL if out of memory
+static Plan* store_plan(int nfft, int inverse) {
+  Plan* plan = find_plan(nfft, inverse);
+  if (plan) return plan;
+  if (num_plans == cap_plans) {
+    int grown = cap_plans ? 2 * cap_plans : 16;
+    Plan* p = (Plan*)nr_realloc(NULL, plans, cap_plans * sizeof(Plan), grown * sizeof(Plan));
+    if (!p) return NULL;
+    plans = p;
+    cap_plans = grown;
+  }
+  plan = &plans[num_plans++];
+  memset(plan, 0, sizeof(*plan));
+  plan->nfft = nfft;
+  plan->inverse = inverse;
+  return plan;
+}
+
+// radix orders worth timing: the powers of two as 4s with the odd 2 last
+// (kf_factor's order), the odd 2 first, or all 2s, each with the odd primes
+// ascending or descending, after or before the powers of two. the first one
+// is kf_factor's plan
+static int candidate_orders(int nfft, int orders[][MAX_RADICES], int* lens) {
+  int odd[MAX_RADICES];
+  int num_odd = 0;
+  int twos = 0;
+  int n = nfft;
+  while (n % 2 == 0) {
+    n /= 2;
+    twos++;
+  }
+  for (int p = 3; n > 1; p += 2) {
+    if (p * p > n) p = n;
+    while (n % p == 0 && num_odd < MAX_RADICES) {
+      odd[num_odd++] = p;
+      n /= p;
+    }
+  }
+
+  int count = 0;
+  for (int pow2 = 0; pow2 < 3; pow2++) {
+    for (int desc = 0; desc < 2; desc++) {
+      for (int odd_first = 0; odd_first < 2; odd_first++) {
+        int pw[MAX_RADICES];
+        int num_pw = 0;
+        if (pow2 == 2) {
+          for (int i = 0; i < twos; i++) pw[num_pw++] = 2;
+        } else {
+          if (pow2 == 1 && twos % 2) pw[num_pw++] = 2;
+          for (int i = 0; i < twos / 2; i++) pw[num_pw++] = 4;
+          if (pow2 == 0 && twos % 2) pw[num_pw++] = 2;
+        }
+        int len = num_pw + num_odd;
+        if (len == 0 || len > MAX_RADICES) continue;
+
+        int* order = orders[count];
+        int at = 0;
+        if (!odd_first) {
+          for (int i = 0; i < num_pw; i++) order[at++] = pw[i];
+        }
+        for (int i = 0; i < num_odd; i++) {
+          order[at++] = desc ? odd[num_odd - 1 - i] : odd[i];
+        }
+        if (odd_first) {
+          for (int i = 0; i < num_pw; i++) order[at++] = pw[i];
+        }
+
+        int dup = 0;
+        for (int c = 0; c < count && !dup; c++) {
+          dup = lens[c] == len && memcmp(orders[c], order, len * sizeof(int)) == 0;
+        }
+        if (!dup) lens[count++] = len;
+        if (count == MAX_CANDIDATES) return count;
+      }
+    }
+  }
+  return count;
+}
+
+// best of a few runs, in ns per transform
+static double time_plan(kiss_fft_cfg cfg, const kiss_fft_cpx* in,
+                        kiss_fft_cpx* out, int nfft) {
+  int reps = 200000 / nfft + 1;  // about a millisecond per run
+  double best = 0.0;
+  kiss_fft(cfg, in, out);  // warm up
+  for (int run = 0; run < BENCH_RUNS; run++) {
+    double t0 = now_ns();
+    for (int r = 0; r < reps; r++) kiss_fft(cfg, in, out);
+    double ns = (now_ns() - t0) / reps;
+    if (run == 0 || ns < best) best = ns;
+  }
+  return best;
+}
+
+static void* fft_tmp_alloc(void* ctx, size_t nbytes) {
+  (void)ctx;
+  return nr_malloc(NULL, nbytes);
+}
+
+static void fft_tmp_free(void* ctx, void* ptr) {
+  (void)ctx;
+  nr_free(NULL, ptr);
+}
+
+// a cfg in one aligned block from the process allocator, its temporary buffers
+// from there too, so tuning allocates the same way the gates do
+static kiss_fft_cfg alloc_fft(int nfft, int inverse) {
+  size_t len = 0;
+  kiss_fft_alloc(nfft, inverse, NULL, &len);
+  void* mem = len > 0 ? nr_aligned_alloc(NULL, 16, len) : NULL;
+  kiss_fft_cfg cfg = mem ? kiss_fft_alloc(nfft, inverse, mem, &len) : NULL;
+  if (!cfg) {
+    nr_free(NULL, mem);
+    return NULL;
+  }
+  kiss_fft_allocator tmp = {fft_tmp_alloc, fft_tmp_free, NULL};
+  kiss_fft_set_allocator(cfg, &tmp);
+  return cfg;
+}
+
+// times every candidate and stores the fastest. caller holds plan_lock
+static int tune_locked(int nfft, int inverse) {
+  static int orders[MAX_CANDIDATES][MAX_RADICES];
+  int lens[MAX_CANDIDATES];
+  int num_orders = candidate_orders(nfft, orders, lens);
+  if (num_orders == 0) return -1;
+
+  kiss_fft_cpx* in = (kiss_fft_cpx*)nr_malloc(NULL, nfft * sizeof(kiss_fft_cpx));
+  kiss_fft_cpx* ref = (kiss_fft_cpx*)nr_malloc(NULL, nfft * sizeof(kiss_fft_cpx));
+  kiss_fft_cpx* out = (kiss_fft_cpx*)nr_malloc(NULL, nfft * sizeof(kiss_fft_cpx));
+  tuning = 1;
+  kiss_fft_cfg cfg = alloc_fft(nfft, inverse);
+  if (!in || !ref || !out || !cfg) {
+    tuning = 0;
+    nr_free(NULL, in);
+    nr_free(NULL, ref);
+    nr_free(NULL, out);
+    nr_free(NULL, cfg);
+    return -1;
+  }
+
+  unsigned int seed = 12345u;
+  for (int i = 0; i < nfft; i++) {
+    seed = seed * 1664525u + 1013904223u;
+    in[i].r = (float)(seed >> 8) / 16777216.0f - 0.5f;
+    seed = seed * 1664525u + 1013904223u;
+    in[i].i = (float)(seed >> 8) / 16777216.0f - 0.5f;
+  }
+
+  // the reference output and time come from the default plan
+  kiss_fft(cfg, in, ref);
+  double peak = 0.0;
+  for (int i = 0; i < nfft; i++) {
+    peak = fmax(peak, fmax(fabs(ref[i].r), fabs(ref[i].i)));
+  }
+  double default_ns = time_plan(cfg, in, out, nfft);
+
+  int best_order = -1;
+  int best_kernel = KISS_FFT_KERNEL_SCALAR;
+  double best_ns = 0.0;
+  for (int kernel = KISS_FFT_KERNEL_SCALAR; kernel <= KISS_FFT_KERNEL_SIMD; kernel++) {
+    if (!kiss_fft_kernel_available(kernel)) continue;
+    for (int o = 0; o < num_orders; o++) {
+      if (kiss_fft_set_plan(cfg, orders[o], lens[o], kernel) != 0) continue;
+      // a plan has to give the same transform, within rounding
+      kiss_fft(cfg, in, out);
+      double err = 0.0;
+      for (int i = 0; i < nfft; i++) {
+        err = fmax(err, fmax(fabs(out[i].r - ref[i].r), fabs(out[i].i - ref[i].i)));
+      }
+      if (err > 1e-4 * (peak + 1.0)) continue;
+      double ns = time_plan(cfg, in, out, nfft);
+      if (best_order < 0 || ns < best_ns) {
+        best_order = o;
+        best_kernel = kernel;
+        best_ns = ns;
+      }
+    }
+  }
+
+  tuning = 0;
+  nr_free(NULL, cfg);
+  nr_free(NULL, in);
+  nr_free(NULL, ref);
+  nr_free(NULL, out);
+  if (best_order < 0) return -1;
+
+  Plan* plan = store_plan(nfft, inverse);
+  if (!plan) return -1;
+  plan->kernel = best_kernel;
+  plan->num_radices = lens[best_order];
+  memcpy(plan->radices, orders[best_order], lens[best_order] * sizeof(int));
+  plan->ns = best_ns;
+  plan->default_ns = default_ns;
+  new_plans++;
+  return 0;
+}
+
+static int planner(int nfft, int inverse, int* radices, int max_radices,
+                   int* kernel) {
+  if (tuning) return 0;
+  int n = 0;
+  pthread_mutex_lock(&plan_lock);
+  Plan* plan = find_plan(nfft, inverse);
+  if (!plan && plan_mode == FFT_PLAN_MEASURE && tune_locked(nfft, inverse) == 0) {
+    plan = find_plan(nfft, inverse);
+  }
+  if (plan && plan->num_radices <= max_radices) {
+    memcpy(radices, plan->radices, plan->num_radices * sizeof(int));
+    *kernel = plan->kernel;
+    n = plan->num_radices;
+  }
+  pthread_mutex_unlock(&plan_lock);
+  return n;
+}
+
+void fft_plan_enable(FftPlanMode mode) {
+  plan_mode = mode;
+  kiss_fft_set_planner(planner);
+}
+
+void fft_plan_disable(void) {
+  kiss_fft_set_planner(NULL);
+}
+
+int fft_plan_tune(int nfft, int inverse) {
+  if (nfft <= 0) return -1;
+  pthread_mutex_lock(&plan_lock);
+  int status = tune_locked(nfft, inverse ? 1 : 0);
+  pthread_mutex_unlock(&plan_lock);
+  return status;
+}
+
+int fft_plan_new_plans(void) {
+  pthread_mutex_lock(&plan_lock);
+  int n = new_plans;
+  pthread_mutex_unlock(&plan_lock);
+  return n;
+}
+
+// "4x4x2x3" -> radices, returns the count or -1
+static int parse_radices(const char* text, int* radices) {
+  int count = 0;
+  const char* p = text;
+  while (*p) {
+    char* end;
+    long r = strtol(p, &end, 10);
+    if (end == p || r < 2 || count == MAX_RADICES) return -1;
+    radices[count++] = (int)r;
+    if (*end == 'x') {
+      end++;
+    } else if (*end != '\0') {
+      return -1;
+    }
+    p = end;
+  }
+  return count;
+}
+
+int fft_plan_load_wisdom(const char* path) {
+  FILE* fp = fopen(path, "r");
+  if (!fp) {
+    if (errno == ENOENT) return 0;
+    perror(path);
+    return -1;
+  }
+  int loaded = 0;
+  int line_no = 0;
+  char line[512];
+  pthread_mutex_lock(&plan_lock);
+  // the table as it was, put back if the file turns out bad halfway
+  int saved_num = num_plans;
+  Plan* saved = (Plan*)nr_malloc(NULL, (saved_num > 0 ? saved_num : 1) * sizeof(Plan));
+  if (!saved) {
+    pthread_mutex_unlock(&plan_lock);
+    fclose(fp);
+    return -1;
+  }
+  if (saved_num > 0) memcpy(saved, plans, saved_num * sizeof(Plan));
+  while (fgets(line, sizeof(line), fp)) {
+    line_no++;
+    if (line[0] == '#' || line[0] == '\n') continue;
+
+    int nfft;
+    char dir[8], kernel_str[16], radix_str[256];
+    int radices[MAX_RADICES];
+    if (sscanf(line, "%d %7s %15s %255s", &nfft, dir, kernel_str, radix_str) != 4 ||
+        nfft <= 0 || (strcmp(dir, "fwd") != 0 && strcmp(dir, "inv") != 0)) {
+      fprintf(stderr, "%s:%d: malformed wisdom\n", path, line_no);
+      loaded = -1;
+      break;
+    }
+    int num_radices = parse_radices(radix_str, radices);
+    long product = 1;
+    for (int i = 0; i < num_radices && product <= nfft; i++) product *= radices[i];
+    if (num_radices <= 0 || product != nfft) {
+      fprintf(stderr, "%s:%d: radices don't multiply to %d\n", path, line_no, nfft);
+      loaded = -1;
+      break;
+    }
+    int kernel = strcmp(kernel_str, "simd") == 0     ? KISS_FFT_KERNEL_SIMD
+                 : strcmp(kernel_str, "scalar") == 0 ? KISS_FFT_KERNEL_SCALAR
+                                                     : -1;
+    if (kernel < 0 || !kiss_fft_kernel_available(kernel)) continue;
+
+    Plan* plan = store_plan(nfft, strcmp(dir, "inv") == 0);
+    if (!plan) {
+      loaded = -1;
+      break;
+    }
+    plan->kernel = kernel;
+    plan->num_radices = num_radices;
+    memcpy(plan->radices, radices, num_radices * sizeof(int));
+    plan->ns = 0.0;
+    plan->default_ns = 0.0;
+    loaded++;
+  }
+  if (loaded < 0) {
+    if (saved_num > 0) memcpy(plans, saved, saved_num * sizeof(Plan));
+    num_plans = saved_num;
+  }
+  nr_free(NULL, saved);
+  pthread_mutex_unlock(&plan_lock);
+  fclose(fp);
+  return loaded;
+}
+
+static void format_radices(const Plan* plan, char* buf, size_t size) {
+  size_t at = 0;
+  buf[0] = '\0';
+  for (int i = 0; i < plan->num_radices && at < size; i++) {
+    at += snprintf(buf + at, size - at, i ? "x%d" : "%d", plan->radices[i]);
+  }
+}
+
+int fft_plan_save_wisdom(const char* path) {
+  // written next to the old file and renamed over it, so concurrent runs
+  // never read half a file
+  size_t len = strlen(path) + 5;
+  char* tmp = (char*)nr_malloc(NULL, len);
+  if (!tmp) return -1;
+  snprintf(tmp, len, "%s.tmp", path);
+  FILE* fp = fopen(tmp, "w");
+  if (!fp) {
+    perror(tmp);
+    nr_free(NULL, tmp);
+    return -1;
+  }
+
+  pthread_mutex_lock(&plan_lock);
+  fprintf(fp, "# noisereduce fft wisdom: <nfft> <fwd|inv> <kernel> <radices>\n");
+  for (int i = 0; i < num_plans; i++) {
+    char radices[256];
+    format_radices(&plans[i], radices, sizeof(radices));
+    fprintf(fp, "%d %s %s %s\n", plans[i].nfft, plans[i].inverse ? "inv" : "fwd",
+            kernel_name(plans[i].kernel), radices);
+  }
+  new_plans = 0;
+  pthread_mutex_unlock(&plan_lock);
+
+  int status = fclose(fp) == 0 && rename(tmp, path) == 0 ? 0 : -1;
+  if (status != 0) {
+    perror(path);
+    remove(tmp);
+  }
+  nr_free(NULL, tmp);
+  return status;
+}
+
+void fft_plan_report(FILE* fp) {
+  pthread_mutex_lock(&plan_lock);
+  for (int i = 0; i < num_plans; i++) {
+    const Plan* plan = &plans[i];
+    char radices[256];
+    format_radices(plan, radices, sizeof(radices));
+    if (plan->ns > 0.0) {
+      fprintf(fp, "fft %d %s: %s %s, %.2f us (default %.2f us, %.2fx)\n",
+              plan->nfft, plan->inverse ? "inv" : "fwd",
+              kernel_name(plan->kernel), radices, plan->ns * 1e-3,
+              plan->default_ns * 1e-3, plan->default_ns / plan->ns);
+    } else {
+      fprintf(fp, "fft %d %s: %s %s (wisdom)\n", plan->nfft,
+              plan->inverse ? "inv" : "fwd", kernel_name(plan->kernel), radices);
+    }
+  }
+  pthread_mutex_unlock(&plan_lock);
+}
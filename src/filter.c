@@ -0,0 +1,173 @@
+#include "filter.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "nr_alloc.h"
+#include "pcm_convert.h"
+#include "trace.h"
+
+typedef struct {
+  SpectralGateShared* shared;
+  SpectralGateData** gates;  // one per channel, or one for all when linked
+  int channels;
+  int link;         // SpectralGateLink, -1 = channels gated on their own
+  long block;
+  float* in;        // interleaved block
+  float* out;
+  float* chan_in;   // one channel of it, all of them planar when linked
+  float* chan_out;
+  float** planes_in;  // the linked gate's channel pointers into chan_in / chan_out
+  float** planes_out;
+} Filter;
+
+static void filter_free(Filter* f) {
+  for (int ch = 0; f->gates && ch < f->channels; ch++) {
+    spectral_gate_free(f->gates[ch]);
+  }
+  nr_free(NULL, f->gates);
+  spectral_gate_shared_free(f->shared);
+  nr_free(NULL, f->in);
+  nr_free(NULL, f->out);
+  nr_free(NULL, f->chan_in);
+  nr_free(NULL, f->chan_out);
+  nr_free(NULL, f->planes_in);
+  nr_free(NULL, f->planes_out);
+}
+
+// gates frames of f->in into f->out
+static int gate_block(Filter* f, long frames) {
+  const int channels = f->channels;
+  if (channels == 1) {
+    return spectral_gate_stream(f->gates[0], f->in, f->out, frames);
+  }
+  if (f->link >= 0) {
+    pcm_deinterleave(f->in, f->planes_in, channels, frames);
+    if (spectral_gate_stream_linked(f->gates[0], (const float* const*)f->planes_in,
+                                    f->planes_out, channels, frames, f->link) != 0) {
+      return -1;
+    }
+    pcm_interleave((const float* const*)f->planes_out, f->out, channels, frames);
+    return 0;
+  }
+  for (int ch = 0; ch < channels; ch++) {
+    pcm_extract_channel(f->in, f->chan_in, channels, ch, frames);
+    if (spectral_gate_stream(f->gates[ch], f->chan_in, f->chan_out, frames) != 0) {
+      return -1;
+    }
+    pcm_insert_channel(f->chan_out, f->out, channels, ch, frames);
+  }
+  return 0;
+}
+
+int filter_run(PcmReader* reader, PcmWriter* writer,
+               const SpectralGateConfig* config, long block_frames, int link,
+               const char* profile, FilterStats* stats) {
+  const PcmSpec* spec = pcm_reader_spec(reader);
+  if (!spec || !writer || !config) {
+    fprintf(stderr, "filter_run: invalid arguments\n");
+    return -1;
+  }
+
+  Filter f;
+  memset(&f, 0, sizeof(f));
+  f.channels = spec->channels;
+  f.link = f.channels > 1 ? link : -1;
+  f.block = block_frames > 0 ? block_frames : config->frame_size;
+  // one shared block (ffts, windows, scratch), one small gate per channel, or
+  // one gate sized for all of them when they're linked
+  SpectralGateConfig gate_config = *config;
+  int gates = f.channels;
+  long planar = f.block;
+  if (f.link >= 0) {
+    gate_config.link_channels = f.channels;
+    gates = 1;
+    planar = f.block * f.channels;
+  }
+  f.shared = spectral_gate_shared_init(&gate_config);
+  f.gates =
+      (SpectralGateData**)nr_calloc(NULL, f.channels, sizeof(SpectralGateData*));
+  f.in = (float*)nr_malloc(NULL, f.block * f.channels * sizeof(float));
+  f.out = (float*)nr_malloc(NULL, f.block * f.channels * sizeof(float));
+  f.chan_in = (float*)nr_malloc(NULL, planar * sizeof(float));
+  f.chan_out = (float*)nr_malloc(NULL, planar * sizeof(float));
+  f.planes_in = (float**)nr_malloc(NULL, f.channels * sizeof(float*));
+  f.planes_out = (float**)nr_malloc(NULL, f.channels * sizeof(float*));
+  if (!f.shared || !f.gates || !f.in || !f.out || !f.chan_in || !f.chan_out ||
+      !f.planes_in || !f.planes_out) {
+    fprintf(stderr, "filter: failed to set up the gates\n");
+    filter_free(&f);
+    return -1;
+  }
+  for (int ch = 0; ch < f.channels; ch++) {
+    f.planes_in[ch] = f.chan_in + ch * f.block;
+    f.planes_out[ch] = f.chan_out + ch * f.block;
+  }
+  for (int ch = 0; ch < gates; ch++) {
+    f.gates[ch] = spectral_gate_init_shared(f.shared);
+    if (!f.gates[ch]) {
+      filter_free(&f);
+      return -1;
+    }
+    if (profile &&
+        spectral_gate_load_profile(f.gates[ch], spec->sample_rate, profile) != 0) {
+      fprintf(stderr, "warning: could not load noise profile %s\n", profile);
+      profile = NULL;
+    }
+  }
+
+  FilterStats st;
+  memset(&st, 0, sizeof(st));
+  st.gate_latency = spectral_gate_latency(f.gates[0]);
+  // a frame waits for its block to fill, then comes out gate_latency frames
+  // (whole blocks, since output only leaves per block) later
+  st.latency_blocks = 1 + (int)((st.gate_latency + f.block - 1) / f.block);
+
+  int status = 0;
+  long skip = st.gate_latency;  // leading delay, dropped so output lines up
+  int eof = 0;
+  while (status == 0) {
+    uint64_t t0 = trace_begin();
+    long n = 0;
+    if (!eof) {
+      n = pcm_reader_read(reader, f.in, f.block);
+      if (n < 0) {
+        status = -1;
+        break;
+      }
+      if (n == 0) eof = 1;
+      st.frames_in += n;
+    }
+    if (eof) {
+      // flush the gate with silence until every input frame has come out
+      long left = st.frames_in - st.frames_out;
+      if (left <= 0) break;
+      n = skip + left < f.block ? skip + left : f.block;
+      memset(f.in, 0, n * f.channels * sizeof(float));
+    }
+
+    if (gate_block(&f, n) != 0) {
+      status = -1;
+      break;
+    }
+    long drop = skip < n ? skip : n;
+    long keep = n - drop;
+    if (keep > st.frames_in - st.frames_out) keep = st.frames_in - st.frames_out;
+    skip -= drop;
+    // flushed per block so downstream sees it now, not when stdio's buffer fills
+    if (keep > 0 &&
+        (pcm_writer_write(writer, f.out + drop * f.channels, keep) != 0 ||
+         pcm_writer_flush(writer) != 0)) {
+      status = -1;
+      break;
+    }
+    st.frames_out += keep;
+    st.blocks++;
+    trace_end("filter", "block", t0, n);
+  }
+
+  if (stats) *stats = st;
+  filter_free(&f);
+  return status;
+}
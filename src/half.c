@@ -0,0 +1,165 @@
+#include <string.h>
+
+// f16c when the compiler targets it (-mf16c), otherwise sse2 kernels eight
+// values at a time, and scalar code for the rest. all give the same bits except
+// for nan payloads: the sse2 and scalar code turn every nan into the plain quiet
+// one, f16c keeps the top bits of the payload
+
+#include "half.h"
+
+#if defined(__F16C__)
+#include <immintrin.h>
+#define HALF_F16C 1
+#elif defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define HALF_SSE2 1
+#endif
+
+static uint16_t float_bits_to_half(uint32_t f) {
+    uint32_t sign = (f >> 16) & 0x8000;
+    uint32_t abs = f & 0x7fffffff;
+
+    if (abs >= 0x7f800000) {
+        // inf stays inf, nan stays a quiet nan
+        return (uint16_t)(sign | 0x7c00 | (abs > 0x7f800000 ? 0x0200 : 0));
+    }
+    if (abs >= 0x477ff000) {
+        return (uint16_t)(sign | 0x7c00); // rounds past the largest half (65504)
+    }
+    if (abs < 0x38800000) {
+        // subnormal half (or zero), shift the mantissa with the implicit bit in
+        if (abs < 0x33000000) {
+            return (uint16_t)sign; // below half the smallest subnormal
+        }
+        uint32_t exp = abs >> 23;
+        uint32_t mant = (abs & 0x7fffff) | 0x800000;
+        uint32_t shift = 126 - exp; // 14..24
+        uint32_t h = mant >> shift;
+        uint32_t rest = mant & ((1u << shift) - 1);
+        uint32_t halfway = 1u << (shift - 1);
+        if (rest > halfway || (rest == halfway && (h & 1))) h++;
+        return (uint16_t)(sign | h);
+    }
+    // normal, rebias the exponent and round the dropped 13 bits to nearest even
+    uint32_t h = (abs - 0x38000000) >> 13;
+    uint32_t rest = abs & 0x1fff;
+    if (rest > 0x1000 || (rest == 0x1000 && (h & 1))) h++;
+    return (uint16_t)(sign | h);
+}
+
+static uint32_t half_to_float_bits(uint16_t h) {
+    uint32_t sign = (uint32_t)(h & 0x8000) << 16;
+    uint32_t exp = (h >> 10) & 0x1f;
+    uint32_t mant = h & 0x3ff;
+
+    if (exp == 0x1f) {
+        return sign | 0x7f800000 | (mant << 13);
+    }
+    if (exp == 0) {
+        if (mant == 0) return sign;
+        // subnormal, normalise it
+        exp = 113;
+        while (!(mant & 0x400)) {
+            mant <<= 1;
+            exp--;
+        }
+        return sign | (exp << 23) | ((mant & 0x3ff) << 13);
+    }
+    return sign | ((exp + 112) << 23) | (mant << 13);
+}
+
+#ifdef HALF_SSE2
+// the scalar conversions four lanes at a time, same bits. normals round by
+// adding 0xfff plus the lowest kept bit before the shift, subnormals by letting
+// an fp add against 2^-1 line them up with the half's fixed point
+static __m128i half_from_float4(__m128 v) {
+    const __m128i sign_mask = _mm_set1_epi32((int)0x80000000u);
+    __m128i f = _mm_castps_si128(v);
+    __m128i sign = _mm_and_si128(f, sign_mask);
+    f = _mm_xor_si128(f, sign);
+
+    __m128i special = _mm_cmpgt_epi32(f, _mm_set1_epi32(0x477fffff)); // inf, nan, overflow
+    __m128i nan = _mm_cmpgt_epi32(f, _mm_set1_epi32(0x7f800000));
+    __m128i sub = _mm_cmplt_epi32(f, _mm_set1_epi32(0x38800000));
+
+    const __m128i denorm_magic = _mm_set1_epi32(((127 - 15) + (23 - 10) + 1) << 23);
+    __m128i h_sub = _mm_sub_epi32(_mm_castps_si128(_mm_add_ps(_mm_castsi128_ps(f), _mm_castsi128_ps(denorm_magic))),
+                                  denorm_magic);
+
+    __m128i odd = _mm_and_si128(_mm_srli_epi32(f, 13), _mm_set1_epi32(1));
+    __m128i h_norm = _mm_add_epi32(f, _mm_set1_epi32((int)(((15u - 127u) << 23) + 0xfffu)));
+    h_norm = _mm_srli_epi32(_mm_add_epi32(h_norm, odd), 13);
+
+    __m128i h_special = _mm_or_si128(_mm_set1_epi32(0x7c00), _mm_and_si128(nan, _mm_set1_epi32(0x0200)));
+    __m128i h = _mm_or_si128(_mm_and_si128(sub, h_sub), _mm_andnot_si128(sub, h_norm));
+    h = _mm_or_si128(_mm_and_si128(special, h_special), _mm_andnot_si128(special, h));
+    return _mm_or_si128(h, _mm_srli_epi32(sign, 16));
+}
+
+static __m128 half_to_float4(__m128i h) {
+    __m128i sign = _mm_slli_epi32(_mm_and_si128(h, _mm_set1_epi32(0x8000)), 16);
+    __m128i em = _mm_and_si128(h, _mm_set1_epi32(0x7fff));
+    __m128i exp = _mm_and_si128(em, _mm_set1_epi32(0x7c00));
+
+    // rebias, and once more for inf / nan so they land on exponent 255
+    __m128i f = _mm_add_epi32(_mm_slli_epi32(em, 13), _mm_set1_epi32(112 << 23));
+    __m128i inf = _mm_cmpeq_epi32(exp, _mm_set1_epi32(0x7c00));
+    f = _mm_add_epi32(f, _mm_and_si128(inf, _mm_set1_epi32(112 << 23)));
+
+    // subnormals and zero: the mantissa under a 2^-14 exponent, less the 2^-14
+    const __m128 magic = _mm_castsi128_ps(_mm_set1_epi32(113 << 23));
+    __m128i f_sub = _mm_castps_si128(_mm_sub_ps(_mm_castsi128_ps(_mm_add_epi32(_mm_slli_epi32(em, 13), _mm_castps_si128(magic))),
+                                                magic));
+    __m128i sub = _mm_cmpeq_epi32(exp, _mm_setzero_si128());
+    f = _mm_or_si128(_mm_and_si128(sub, f_sub), _mm_andnot_si128(sub, f));
+    return _mm_castsi128_ps(_mm_or_si128(f, sign));
+}
+
+// two vectors of 32 bit lanes holding 16 bit values to one of 16 bit lanes
+static __m128i pack_u16(__m128i lo, __m128i hi) {
+    lo = _mm_srai_epi32(_mm_slli_epi32(lo, 16), 16);
+    hi = _mm_srai_epi32(_mm_slli_epi32(hi, 16), 16);
+    return _mm_packs_epi32(lo, hi);
+}
+#endif
+
+void half_from_float(uint16_t* dst, const float* src, long n) {
+    long i = 0;
+#ifdef HALF_F16C
+    for (; i + 8 <= n; i += 8) {
+        __m128i h = _mm256_cvtps_ph(_mm256_loadu_ps(src + i), _MM_FROUND_TO_NEAREST_INT);
+        _mm_storeu_si128((__m128i*)(dst + i), h);
+    }
+#elif defined(HALF_SSE2)
+    for (; i + 8 <= n; i += 8) {
+        __m128i lo = half_from_float4(_mm_loadu_ps(src + i));
+        __m128i hi = half_from_float4(_mm_loadu_ps(src + i + 4));
+        _mm_storeu_si128((__m128i*)(dst + i), pack_u16(lo, hi));
+    }
+#endif
+    for (; i < n; i++) {
+        uint32_t bits;
+        memcpy(&bits, &src[i], sizeof(bits));
+        dst[i] = float_bits_to_half(bits);
+    }
+}
+
+void half_to_float(float* dst, const uint16_t* src, long n) {
+    long i = 0;
+#ifdef HALF_F16C
+    for (; i + 8 <= n; i += 8) {
+        __m128i h = _mm_loadu_si128((const __m128i*)(src + i));
+        _mm256_storeu_ps(dst + i, _mm256_cvtph_ps(h));
+    }
+#elif defined(HALF_SSE2)
+    for (; i + 8 <= n; i += 8) {
+        __m128i h = _mm_loadu_si128((const __m128i*)(src + i));
+        _mm_storeu_ps(dst + i, half_to_float4(_mm_unpacklo_epi16(h, _mm_setzero_si128())));
+        _mm_storeu_ps(dst + i + 4, half_to_float4(_mm_unpackhi_epi16(h, _mm_setzero_si128())));
+    }
+#endif
+    for (; i < n; i++) {
+        uint32_t bits = half_to_float_bits(src[i]);
+        memcpy(&dst[i], &bits, sizeof(bits));
+    }
+}
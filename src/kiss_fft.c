@@ -12,6 +12,13 @@
  fixed or floating point complex numbers.  It also delares the kf_ internal functions.
  */
 
+#if (defined(__SSE__) || defined(_M_X64)) && !defined(FIXED_POINT) && !defined(USE_SIMD)
+#include <xmmintrin.h>
+#define KF_HAVE_SSE 1
+#endif
+
+static kiss_fft_planner kf_planner = NULL;
+
 static void kf_bfly2(
         kiss_fft_cpx * Fout,
         const size_t fstride,
@@ -188,6 +195,171 @@ static void kf_bfly5(
     }
 }
 
+#ifdef KF_HAVE_SSE
+/* sse versions of the radix 2, 3, 4 and 5 butterflies, two complex values
+   per register, so m must be even. they do the same operations in the same order
+   as the scalar ones, so without fma contraction the results match bit for
+   bit */
+
+/* two twiddles k*stride and (k+1)*stride apart */
+static inline __m128 kf_load_tw(const kiss_fft_cpx * tw, size_t stride)
+{
+    if (stride == 1)
+        return _mm_loadu_ps((const float*)tw);
+    __m128 t = _mm_loadl_pi(_mm_setzero_ps(), (const __m64*)tw);
+    return _mm_loadh_pi(t, (const __m64*)(tw + stride));
+}
+
+/* (ar*br - ai*bi, ar*bi + ai*br) for both lanes */
+static inline __m128 kf_cmul_sse(__m128 a, __m128 b)
+{
+    const __m128 sign = _mm_setr_ps(-0.0f, 0.0f, -0.0f, 0.0f);
+    __m128 ar = _mm_shuffle_ps(a, a, _MM_SHUFFLE(2,2,0,0));
+    __m128 ai = _mm_shuffle_ps(a, a, _MM_SHUFFLE(3,3,1,1));
+    __m128 bs = _mm_shuffle_ps(b, b, _MM_SHUFFLE(2,3,0,1));
+    return _mm_add_ps(_mm_mul_ps(ar, b), _mm_xor_ps(_mm_mul_ps(ai, bs), sign));
+}
+
+static void kf_bfly2_sse(
+        kiss_fft_cpx * Fout,
+        const size_t fstride,
+        const kiss_fft_cfg st,
+        int m
+        )
+{
+    kiss_fft_cpx * Fout2 = Fout + m;
+    const kiss_fft_cpx * tw1 = st->twiddles;
+    int k;
+    for (k = 0; k < m; k += 2) {
+        __m128 t = kf_cmul_sse(_mm_loadu_ps((float*)(Fout2 + k)), kf_load_tw(tw1 + k*fstride, fstride));
+        __m128 f = _mm_loadu_ps((float*)(Fout + k));
+        _mm_storeu_ps((float*)(Fout2 + k), _mm_sub_ps(f, t));
+        _mm_storeu_ps((float*)(Fout + k), _mm_add_ps(f, t));
+    }
+}
+
+static void kf_bfly4_sse(
+        kiss_fft_cpx * Fout,
+        const size_t fstride,
+        const kiss_fft_cfg st,
+        const size_t m
+        )
+{
+    const kiss_fft_cpx * tw = st->twiddles;
+    const size_t m2 = 2*m;
+    const size_t m3 = 3*m;
+    /* multiplying by -i (forward) or i (inverse) swaps re/im and flips a sign */
+    const __m128 rot = st->inverse ? _mm_setr_ps(-0.0f, 0.0f, -0.0f, 0.0f)
+                                   : _mm_setr_ps(0.0f, -0.0f, 0.0f, -0.0f);
+    size_t k;
+    for (k = 0; k < m; k += 2) {
+        float * f0 = (float*)(Fout + k);
+        float * f1 = (float*)(Fout + k + m);
+        float * f2 = (float*)(Fout + k + m2);
+        float * f3 = (float*)(Fout + k + m3);
+        __m128 s0 = kf_cmul_sse(_mm_loadu_ps(f1), kf_load_tw(tw + k*fstride, fstride));
+        __m128 s1 = kf_cmul_sse(_mm_loadu_ps(f2), kf_load_tw(tw + 2*k*fstride, 2*fstride));
+        __m128 s2 = kf_cmul_sse(_mm_loadu_ps(f3), kf_load_tw(tw + 3*k*fstride, 3*fstride));
+        __m128 x0 = _mm_loadu_ps(f0);
+
+        __m128 s5 = _mm_sub_ps(x0, s1);
+        x0 = _mm_add_ps(x0, s1);
+        __m128 s3 = _mm_add_ps(s0, s2);
+        __m128 s4 = _mm_sub_ps(s0, s2);
+        _mm_storeu_ps(f2, _mm_sub_ps(x0, s3));
+        _mm_storeu_ps(f0, _mm_add_ps(x0, s3));
+
+        __m128 r = _mm_xor_ps(_mm_shuffle_ps(s4, s4, _MM_SHUFFLE(2,3,0,1)), rot);
+        _mm_storeu_ps(f1, _mm_add_ps(s5, r));
+        _mm_storeu_ps(f3, _mm_sub_ps(s5, r));
+    }
+}
+
+static void kf_bfly3_sse(
+        kiss_fft_cpx * Fout,
+        const size_t fstride,
+        const kiss_fft_cfg st,
+        size_t m
+        )
+{
+    const kiss_fft_cpx * tw = st->twiddles;
+    const size_t m2 = 2*m;
+    const __m128 epi3 = _mm_set1_ps(st->twiddles[fstride*m].i);
+    const __m128 half = _mm_set1_ps(.5f);
+    const __m128 neg_im = _mm_setr_ps(0.0f, -0.0f, 0.0f, -0.0f);
+    size_t k;
+    for (k = 0; k < m; k += 2) {
+        float * f0 = (float*)(Fout + k);
+        float * f1 = (float*)(Fout + k + m);
+        float * f2 = (float*)(Fout + k + m2);
+        __m128 s1 = kf_cmul_sse(_mm_loadu_ps(f1), kf_load_tw(tw + k*fstride, fstride));
+        __m128 s2 = kf_cmul_sse(_mm_loadu_ps(f2), kf_load_tw(tw + 2*k*fstride, 2*fstride));
+        __m128 x0 = _mm_loadu_ps(f0);
+
+        __m128 s3 = _mm_add_ps(s1, s2);
+        __m128 s0 = _mm_mul_ps(_mm_sub_ps(s1, s2), epi3);
+        __m128 fm = _mm_sub_ps(x0, _mm_mul_ps(s3, half));
+        _mm_storeu_ps(f0, _mm_add_ps(x0, s3));
+
+        /* (s0.i, -s0.r) */
+        __m128 r = _mm_xor_ps(_mm_shuffle_ps(s0, s0, _MM_SHUFFLE(2,3,0,1)), neg_im);
+        _mm_storeu_ps(f2, _mm_add_ps(fm, r));
+        _mm_storeu_ps(f1, _mm_sub_ps(fm, r));
+    }
+}
+
+static void kf_bfly5_sse(
+        kiss_fft_cpx * Fout,
+        const size_t fstride,
+        const kiss_fft_cfg st,
+        int m
+        )
+{
+    const kiss_fft_cpx * tw = st->twiddles;
+    const kiss_fft_cpx ya = tw[fstride*m];
+    const kiss_fft_cpx yb = tw[fstride*2*m];
+    const __m128 yar = _mm_set1_ps(ya.r), yai = _mm_set1_ps(ya.i);
+    const __m128 ybr = _mm_set1_ps(yb.r), ybi = _mm_set1_ps(yb.i);
+    const __m128 neg_re = _mm_setr_ps(-0.0f, 0.0f, -0.0f, 0.0f);
+    const __m128 neg_im = _mm_setr_ps(0.0f, -0.0f, 0.0f, -0.0f);
+    int u;
+    for (u = 0; u < m; u += 2) {
+        float * f0 = (float*)(Fout + u);
+        float * f1 = (float*)(Fout + u + m);
+        float * f2 = (float*)(Fout + u + 2*m);
+        float * f3 = (float*)(Fout + u + 3*m);
+        float * f4 = (float*)(Fout + u + 4*m);
+        __m128 s0 = _mm_loadu_ps(f0);
+        __m128 s1 = kf_cmul_sse(_mm_loadu_ps(f1), kf_load_tw(tw + u*fstride, fstride));
+        __m128 s2 = kf_cmul_sse(_mm_loadu_ps(f2), kf_load_tw(tw + 2*u*fstride, 2*fstride));
+        __m128 s3 = kf_cmul_sse(_mm_loadu_ps(f3), kf_load_tw(tw + 3*u*fstride, 3*fstride));
+        __m128 s4 = kf_cmul_sse(_mm_loadu_ps(f4), kf_load_tw(tw + 4*u*fstride, 4*fstride));
+
+        __m128 s7 = _mm_add_ps(s1, s4);
+        __m128 s10 = _mm_sub_ps(s1, s4);
+        __m128 s8 = _mm_add_ps(s2, s3);
+        __m128 s9 = _mm_sub_ps(s2, s3);
+        _mm_storeu_ps(f0, _mm_add_ps(s0, _mm_add_ps(s7, s8)));
+
+        /* re/im swapped copies for the odd terms */
+        __m128 a = _mm_shuffle_ps(s10, s10, _MM_SHUFFLE(2,3,0,1));
+        __m128 b = _mm_shuffle_ps(s9, s9, _MM_SHUFFLE(2,3,0,1));
+
+        __m128 s5 = _mm_add_ps(_mm_add_ps(s0, _mm_mul_ps(s7, yar)), _mm_mul_ps(s8, ybr));
+        __m128 s6 = _mm_add_ps(_mm_xor_ps(_mm_mul_ps(a, yai), neg_im),
+                               _mm_xor_ps(_mm_mul_ps(b, ybi), neg_im));
+        _mm_storeu_ps(f1, _mm_sub_ps(s5, s6));
+        _mm_storeu_ps(f4, _mm_add_ps(s5, s6));
+
+        __m128 s11 = _mm_add_ps(_mm_add_ps(s0, _mm_mul_ps(s7, ybr)), _mm_mul_ps(s8, yar));
+        __m128 s12 = _mm_add_ps(_mm_xor_ps(_mm_mul_ps(a, ybi), neg_re),
+                                _mm_xor_ps(_mm_mul_ps(b, yai), neg_im));
+        _mm_storeu_ps(f2, _mm_add_ps(s11, s12));
+        _mm_storeu_ps(f3, _mm_sub_ps(s11, s12));
+    }
+}
+#endif
+
 /* perform the butterfly for one stage of a mixed radix FFT */
 static void kf_bfly_generic(
         kiss_fft_cpx * Fout,
@@ -202,7 +374,7 @@ static void kf_bfly_generic(
     kiss_fft_cpx t;
     int Norig = st->nfft;
 
-    kiss_fft_cpx * scratch = (kiss_fft_cpx*)KISS_FFT_TMP_ALLOC(sizeof(kiss_fft_cpx)*p);
+    kiss_fft_cpx * scratch = (kiss_fft_cpx*)KISS_FFT_CFG_TMP_ALLOC(st,sizeof(kiss_fft_cpx)*p);
     if (scratch == NULL){
         KISS_FFT_ERROR("Memory allocation failed.");
         return;
@@ -229,7 +401,35 @@ static void kf_bfly_generic(
             k += m;
         }
     }
-    KISS_FFT_TMP_FREE(scratch);
+    KISS_FFT_CFG_TMP_FREE(st,scratch);
+}
+
+static void kf_bfly(
+        kiss_fft_cpx * Fout,
+        const size_t fstride,
+        const kiss_fft_cfg st,
+        int m,
+        int p
+        )
+{
+#ifdef KF_HAVE_SSE
+    if (st->kernel == KISS_FFT_KERNEL_SIMD && (m & 1) == 0) {
+        switch (p) {
+            case 2: kf_bfly2_sse(Fout,fstride,st,m); return;
+            case 3: kf_bfly3_sse(Fout,fstride,st,m); return;
+            case 4: kf_bfly4_sse(Fout,fstride,st,m); return;
+            case 5: kf_bfly5_sse(Fout,fstride,st,m); return;
+            default: break;
+        }
+    }
+#endif
+    switch (p) {
+        case 2: kf_bfly2(Fout,fstride,st,m); break;
+        case 3: kf_bfly3(Fout,fstride,st,m); break;
+        case 4: kf_bfly4(Fout,fstride,st,m); break;
+        case 5: kf_bfly5(Fout,fstride,st,m); break;
+        default: kf_bfly_generic(Fout,fstride,st,m,p); break;
+    }
 }
 
 static
@@ -260,13 +460,7 @@ void kf_work(
             kf_work( Fout +k*m, f+ fstride*in_stride*k,fstride*p,in_stride,factors,st);
         // all threads have joined by this point
 
-        switch (p) {
-            case 2: kf_bfly2(Fout,fstride,st,m); break;
-            case 3: kf_bfly3(Fout,fstride,st,m); break;
-            case 4: kf_bfly4(Fout,fstride,st,m); break;
-            case 5: kf_bfly5(Fout,fstride,st,m); break;
-            default: kf_bfly_generic(Fout,fstride,st,m,p); break;
-        }
+        kf_bfly(Fout,fstride,st,m,p);
         return;
     }
 #endif
@@ -290,13 +484,7 @@ void kf_work(
     Fout=Fout_beg;
 
     // recombine the p smaller DFTs
-    switch (p) {
-        case 2: kf_bfly2(Fout,fstride,st,m); break;
-        case 3: kf_bfly3(Fout,fstride,st,m); break;
-        case 4: kf_bfly4(Fout,fstride,st,m); break;
-        case 5: kf_bfly5(Fout,fstride,st,m); break;
-        default: kf_bfly_generic(Fout,fstride,st,m,p); break;
-    }
+    kf_bfly(Fout,fstride,st,m,p);
 }
 
 /*  facbuf is populated by p1,m1,p2,m2, ...
@@ -353,6 +541,7 @@ kiss_fft_cfg kiss_fft_alloc(int nfft,int inverse_fft,void * mem,size_t * lenmem
         int i;
         st->nfft=nfft;
         st->inverse = inverse_fft;
+        memset(&st->allocator, 0, sizeof(st->allocator));
 
         for (i=0;i<nfft;++i) {
             const double pi=3.141592653589793238462643383279502884197169399375105820974944;
@@ -363,10 +552,80 @@ kiss_fft_cfg kiss_fft_alloc(int nfft,int inverse_fft,void * mem,size_t * lenmem
         }
 
         kf_factor(nfft,st->factors);
+        /* same results as scalar, so it's the default where it's built in */
+        st->kernel = kiss_fft_kernel_available(KISS_FFT_KERNEL_SIMD) ? KISS_FFT_KERNEL_SIMD : KISS_FFT_KERNEL_SCALAR;
+        if (kf_planner) {
+            int radices[MAXFACTORS];
+            int kernel = KISS_FFT_KERNEL_SCALAR;
+            int n = kf_planner(nfft, inverse_fft, radices, MAXFACTORS, &kernel);
+            if (n > 0 && kiss_fft_set_plan(st, radices, n, kernel) != 0) {
+                KISS_FFT_WARNING("planner returned an invalid plan for %d, using the default", nfft);
+            }
+        }
     }
     return st;
 }
 
+void kiss_fft_set_allocator(kiss_fft_cfg st,const kiss_fft_allocator * allocator)
+{
+    if (allocator && allocator->alloc && allocator->free)
+        st->allocator = *allocator;
+    else
+        memset(&st->allocator, 0, sizeof(st->allocator));
+}
+
+void kiss_fft_set_planner(kiss_fft_planner planner)
+{
+    kf_planner = planner;
+}
+
+int kiss_fft_kernel_available(int kernel)
+{
+    if (kernel == KISS_FFT_KERNEL_SCALAR)
+        return 1;
+#ifdef KF_HAVE_SSE
+    if (kernel == KISS_FFT_KERNEL_SIMD)
+        return 1;
+#endif
+    return 0;
+}
+
+int kiss_fft_set_plan(kiss_fft_cfg st,const int * radices,int num_radices,int kernel)
+{
+    int i, n = 1;
+    if (!st || num_radices <= 0 || num_radices > MAXFACTORS || !kiss_fft_kernel_available(kernel))
+        return -1;
+    for (i = 0; i < num_radices; ++i) {
+        if (radices[i] < 2 || n > st->nfft / radices[i])
+            return -1;
+        n *= radices[i];
+    }
+    if (n != st->nfft)
+        return -1;
+    /* same p1,m1,p2,m2 layout as kf_factor */
+    for (i = 0; i < num_radices; ++i) {
+        n /= radices[i];
+        st->factors[2*i] = radices[i];
+        st->factors[2*i+1] = n;
+    }
+    st->kernel = kernel;
+    return 0;
+}
+
+int kiss_fft_get_plan(kiss_fft_cfg st,int * radices,int max_radices,int * kernel)
+{
+    int i = 0;
+    if (!st)
+        return 0;
+    do {
+        if (i < max_radices)
+            radices[i] = st->factors[2*i];
+    } while (st->factors[2*i++ + 1] > 1);
+    if (kernel)
+        *kernel = st->kernel;
+    return i;
+}
+
 
 void kiss_fft_stride(kiss_fft_cfg st,const kiss_fft_cpx *fin,kiss_fft_cpx *fout,int in_stride)
 {
@@ -378,7 +637,7 @@ void kiss_fft_stride(kiss_fft_cfg st,const kiss_fft_cpx *fin,kiss_fft_cpx *fout,
         return;
         }
 
-        kiss_fft_cpx * tmpbuf = (kiss_fft_cpx*)KISS_FFT_TMP_ALLOC( sizeof(kiss_fft_cpx)*st->nfft);
+        kiss_fft_cpx * tmpbuf = (kiss_fft_cpx*)KISS_FFT_CFG_TMP_ALLOC(st, sizeof(kiss_fft_cpx)*st->nfft);
         if (tmpbuf == NULL){
             KISS_FFT_ERROR("Memory allocation error.");
         return;
@@ -388,7 +647,7 @@ void kiss_fft_stride(kiss_fft_cfg st,const kiss_fft_cpx *fin,kiss_fft_cpx *fout,
 
         kf_work(tmpbuf,fin,1,in_stride, st->factors,st);
         memcpy(fout,tmpbuf,sizeof(kiss_fft_cpx)*st->nfft);
-        KISS_FFT_TMP_FREE(tmpbuf);
+        KISS_FFT_CFG_TMP_FREE(st,tmpbuf);
     }else{
         kf_work( fout, fin, 1,in_stride, st->factors,st );
     }
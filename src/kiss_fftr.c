@@ -153,3 +153,8 @@ void kiss_fftri(kiss_fftr_cfg st,const kiss_fft_cpx *freqdata,kiss_fft_scalar *t
     }
     kiss_fft (st->substate, st->tmpbuf, (kiss_fft_cpx *) timedata);
 }
+
+void kiss_fftr_set_allocator(kiss_fftr_cfg st,const kiss_fft_allocator * allocator)
+{
+    kiss_fft_set_allocator(st->substate, allocator);
+}
@@ -1,126 +1,896 @@
+#include <math.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <time.h>
 
+#include "batch.h"
+#include "fft_plan.h"
+#include "filter.h"
 #include "mp3_utils.h"
 #include "noisereduce.h"
+#include "nr_alloc.h"
+#include "pcm_convert.h"
+#include "pcm_io.h"
+#include "trace.h"
+#include "voiceband.h"
+
+typedef struct {
+  const char *input;
+  const char *output;
+  PcmSpec raw_spec;  // describes .raw/.pcm inputs
+  int out_format;    // pcm output format, -1 = same as input (s16 for mp3)
+  int threads;       // codec threads, 0 = one per core
+  int gate_threads;  // two pass gating threads, 1 = serial, 0 = one per core
+  double start;      // seconds, only this range is processed when >= 0
+  double duration;   // seconds, < 0 = to the end
+  const char *index_path;  // mp3 frame index sidecar, NULL = <input>.idx
+  const char *load_profile;  // noise profile to start from
+  const char *save_profile;  // where to store the learned noise profile
+  int low_latency;           // asymmetric windows with a short hop
+  int wola;                  // wola filterbank engine instead of the stft
+  int voice_band;            // gate a decimated 16 kHz copy
+  int voice_band_pass;       // pass the band above 8 kHz instead of gating it
+  int compare;               // also run full rate and report the difference
+  int bands;                 // track noise on this many bands, 0 = per bin
+  int compact;               // half precision per stream state
+  const char *batch;         // directory or file list to process instead
+  const char *out_dir;       // where batch mode writes its outputs
+  const char *wisdom;        // fft plans to load, tune and save
+  const char *trace;         // chrome trace-event json of the run
+  double codec_frame_ms;     // > 0 lines the gate hop up with codec frames
+  int raw_pipe;              // stdin/stdout carry headerless pcm, not wav
+  long block;                // frames per pass in filter mode, 0 = default
+  int link;                  // SpectralGateLink for linked channels, -1 = off
+} CliOptions;
+
+// stdio buffer for the filter's stdin, reads come in large blocks
+#define FILTER_IO_BUFFER (1 << 16)
+
+// audio decoded ahead of a --start range so the vad and noise estimate have
+// settled by the time the requested range begins
+#define RANGE_PREROLL_SECONDS 1.0
+
+// channels closer than this (half an s16 step) to the first count as copies
+#define DUAL_MONO_TOLERANCE (1.0f / 65536)
+
+// --trace keeps a span for every this many gate frames, about 0.4 s at 44.1 kHz
+#define TRACE_FRAME_SAMPLE 64
+
+static void usage(const char *prog) {
+  fprintf(stderr,
+          "usage: %s [options] <input> <output>\n"
+          "       %s [options] --batch <dir|list.txt> --out-dir <dir>\n"
+          "  input/output may be .mp3, .wav or .raw/.pcm (picked by extension)\n"
+          "  an input of - filters a wav stream from stdin to the output (- for\n"
+          "  stdout) block by block\n"
+          "  --raw-rate <hz>        sample rate of a raw input (default 44100)\n"
+          "  --raw-channels <n>     channels of a raw input (default 2)\n"
+          "  --raw-format <fmt>     s16, s24 or f32 for a raw input (default s16)\n"
+          "  --out-format <fmt>     s16, s24 or f32 for a wav/raw output\n"
+          "  --raw                  stdin/stdout are raw pcm (see --raw-*)\n"
+          "  --block <frames>       frames per read/gate/write pass when filtering\n"
+          "                         (default one gate frame, or one codec frame)\n"
+          "  --threads <n>          mp3 codec threads, 0 = one per core (default 1,\n"
+          "                         one per core with --batch)\n"
+          "  --gate-threads <n>     gate each channel in two passes on n threads,\n"
+          "                         0 = one per core, same output (default 1)\n"
+          "  --start <sec>          process only from this time on\n"
+          "  --duration <sec>       length of the range to process\n"
+          "  --index <file>         mp3 frame index cache (default <input>.idx)\n"
+          "  --load-profile <file>  start from a saved noise profile\n"
+          "  --save-profile <file>  save the learned noise profile\n"
+          "  --low-latency          asymmetric windows, ~3.6 ms delay at 44.1 kHz\n"
+          "  --wola                 filterbank engine, 256 subbands every 32\n"
+          "                         samples, ~3.6 ms delay\n"
+          "  --voice-band           gate at 16 kHz, above 8 kHz follows the gate;\n"
+          "                         ~1.7x faster, ~0.3 dB less noise reduction,\n"
+          "                         up to 3 dB less on broadband noise\n"
+          "  --voice-band-pass      gate at 16 kHz, pass above 8 kHz through\n"
+          "                         (~0.9 dB less, keeps the noise above 8 kHz)\n"
+          "  --compare              with --voice-band, compare to full rate\n"
+          "  --bands N              track noise on N erb bands instead of bins\n"
+          "  --compact              keep gate state in half precision\n"
+          "  --link <mid|max>       one gain mask for all channels, from the mid\n"
+          "                         signal or the loudest channel per bin\n"
+          "  --codec-frame <ms>     hop of one codec frame (eg. 10 or 20 ms),\n"
+          "                         fft of four\n"
+          "  --batch <dir|list>     gate every file of a directory or list file on\n"
+          "                         a work stealing pool of --threads workers\n"
+          "  --out-dir <dir>        output directory for --batch\n"
+          "  --trace <file>         write a chrome trace-event timeline of the\n"
+          "                         decode, gate, encode and io stages\n"
+          "  --wisdom <file>        load fft plans, benchmark missing sizes on\n"
+          "                         this machine and save them back\n",
+          prog, prog);
+}
+
+static int parse_args(int argc, char **argv, CliOptions *opts) {
+  opts->input = NULL;
+  opts->output = NULL;
+  opts->raw_spec.sample_rate = 44100;
+  opts->raw_spec.channels = 2;
+  opts->raw_spec.format = PCM_FORMAT_S16;
+  opts->out_format = -1;
+  opts->threads = -1;  // 1 for a single file, one per core for --batch
+  opts->gate_threads = 1;
+  opts->start = -1.0;
+  opts->duration = -1.0;
+  opts->index_path = NULL;
+  opts->load_profile = NULL;
+  opts->save_profile = NULL;
+  opts->low_latency = 0;
+  opts->wola = 0;
+  opts->voice_band = 0;
+  opts->voice_band_pass = 0;
+  opts->compare = 0;
+  opts->bands = 0;
+  opts->compact = 0;
+  opts->batch = NULL;
+  opts->out_dir = NULL;
+  opts->wisdom = NULL;
+  opts->trace = NULL;
+  opts->codec_frame_ms = 0.0;
+  opts->raw_pipe = 0;
+  opts->block = 0;
+  opts->link = -1;
+
+  for (int i = 1; i < argc; i++) {
+    const char *arg = argv[i];
+    if (strcmp(arg, "--low-latency") == 0) {
+      opts->low_latency = 1;
+    } else if (strcmp(arg, "--wola") == 0) {
+      opts->wola = 1;
+    } else if (strcmp(arg, "--voice-band") == 0) {
+      opts->voice_band = 1;
+    } else if (strcmp(arg, "--voice-band-pass") == 0) {
+      opts->voice_band = 1;
+      opts->voice_band_pass = 1;
+    } else if (strcmp(arg, "--compare") == 0) {
+      opts->compare = 1;
+    } else if (strcmp(arg, "--compact") == 0) {
+      opts->compact = 1;
+    } else if (strcmp(arg, "--raw") == 0) {
+      opts->raw_pipe = 1;
+    } else if (strncmp(arg, "--", 2) == 0) {
+      if (i + 1 >= argc) {
+        fprintf(stderr, "missing value for %s\n", arg);
+        return -1;
+      }
+      const char *val = argv[++i];
+      if (strcmp(arg, "--raw-rate") == 0) {
+        opts->raw_spec.sample_rate = atoi(val);
+      } else if (strcmp(arg, "--raw-channels") == 0) {
+        opts->raw_spec.channels = atoi(val);
+      } else if (strcmp(arg, "--raw-format") == 0) {
+        int fmt = pcm_format_from_string(val);
+        if (fmt < 0) {
+          fprintf(stderr, "unknown sample format %s\n", val);
+          return -1;
+        }
+        opts->raw_spec.format = (PcmFormat)fmt;
+      } else if (strcmp(arg, "--threads") == 0) {
+        opts->threads = atoi(val);
+      } else if (strcmp(arg, "--gate-threads") == 0) {
+        opts->gate_threads = atoi(val);
+      } else if (strcmp(arg, "--batch") == 0) {
+        opts->batch = val;
+      } else if (strcmp(arg, "--out-dir") == 0) {
+        opts->out_dir = val;
+      } else if (strcmp(arg, "--wisdom") == 0) {
+        opts->wisdom = val;
+      } else if (strcmp(arg, "--trace") == 0) {
+        opts->trace = val;
+      } else if (strcmp(arg, "--block") == 0) {
+        opts->block = atol(val);
+        if (opts->block <= 0) {
+          fprintf(stderr, "invalid block size %s\n", val);
+          return -1;
+        }
+      } else if (strcmp(arg, "--codec-frame") == 0) {
+        opts->codec_frame_ms = atof(val);
+        if (opts->codec_frame_ms <= 0.0) {
+          fprintf(stderr, "invalid codec frame %s\n", val);
+          return -1;
+        }
+      } else if (strcmp(arg, "--link") == 0) {
+        if (strcmp(val, "mid") == 0) {
+          opts->link = SG_LINK_MID;
+        } else if (strcmp(val, "max") == 0) {
+          opts->link = SG_LINK_MAX;
+        } else {
+          fprintf(stderr, "unknown link mode %s\n", val);
+          return -1;
+        }
+      } else if (strcmp(arg, "--bands") == 0) {
+        opts->bands = atoi(val);
+      } else if (strcmp(arg, "--start") == 0) {
+        opts->start = atof(val);
+      } else if (strcmp(arg, "--duration") == 0) {
+        opts->duration = atof(val);
+        if (opts->start < 0.0) opts->start = 0.0;
+      } else if (strcmp(arg, "--index") == 0) {
+        opts->index_path = val;
+      } else if (strcmp(arg, "--load-profile") == 0) {
+        opts->load_profile = val;
+      } else if (strcmp(arg, "--save-profile") == 0) {
+        opts->save_profile = val;
+      } else if (strcmp(arg, "--out-format") == 0) {
+        opts->out_format = pcm_format_from_string(val);
+        if (opts->out_format < 0) {
+          fprintf(stderr, "unknown sample format %s\n", val);
+          return -1;
+        }
+      } else {
+        fprintf(stderr, "unknown option %s\n", arg);
+        return -1;
+      }
+    } else if (!opts->input) {
+      opts->input = arg;
+    } else if (!opts->output) {
+      opts->output = arg;
+    } else {
+      fprintf(stderr, "unexpected argument %s\n", arg);
+      return -1;
+    }
+  }
+  if (opts->threads < 0) opts->threads = opts->batch ? 0 : 1;
+  if (opts->codec_frame_ms > 0.0 && (opts->batch || opts->voice_band)) {
+    // both pick the gate rate per file / band, which the framing depends on
+    fprintf(stderr, "--codec-frame can't be combined with --batch or --voice-band\n");
+    return -1;
+  }
+  if (opts->wola && opts->low_latency) {
+    fprintf(stderr, "--wola has its own short delay, it can't be combined with "
+            "--low-latency\n");
+    return -1;
+  }
+  if (opts->link >= 0 &&
+      (opts->batch || opts->voice_band || opts->gate_threads != 1)) {
+    // the linked gate is one serial pass over whole channels
+    fprintf(stderr, "--link can't be combined with --batch, --voice-band or "
+            "--gate-threads\n");
+    return -1;
+  }
+  if (opts->link >= 0 && opts->wola && opts->input &&
+      strcmp(opts->input, "-") == 0) {
+    fprintf(stderr, "filtering stdin with --link needs the stft engine, not "
+            "--wola\n");
+    return -1;
+  }
+  if (opts->batch &&
+      (opts->voice_band || opts->compare || opts->start >= 0.0 ||
+       opts->load_profile || opts->save_profile || opts->gate_threads != 1)) {
+    // batch gates every file whole on its own pool task with a fresh state
+    fprintf(stderr, "--batch can't be combined with --voice-band, --compare, "
+            "--start/--duration, --load-profile, --save-profile or "
+            "--gate-threads\n");
+    return -1;
+  }
+  if (opts->batch) return opts->out_dir && !opts->input ? 0 : -1;
+  if (opts->input && strcmp(opts->input, "-") == 0 &&
+      (opts->voice_band || opts->start >= 0.0 || opts->save_profile)) {
+    fprintf(stderr, "filtering stdin doesn't support --voice-band, --start or "
+            "--save-profile\n");
+    return -1;
+  }
+  return (opts->input && opts->output) ? 0 : -1;
+}
+
+// reads [start - preroll, start + duration) of a wav/raw file, skipping what
+// comes before it, so only the range is converted
+// returns samples read and -1 on error, spec is filled like pcm_to_float and
+// *preroll gets the per-channel samples in front of the requested start
+static long decode_pcm_range(const CliOptions *opts, PcmSpec *spec,
+                             float **pcm_data, long *preroll) {
+  int container = pcm_container_from_filename(opts->input);
+  PcmReader *reader =
+      pcm_reader_open(opts->input, (PcmContainer)container, spec, 1);
+  if (!reader) return -1;
+  *spec = *pcm_reader_spec(reader);
+
+  long frames = pcm_reader_frames(reader);
+  long start = (long)(opts->start * spec->sample_rate);
+  long end = opts->duration >= 0.0
+                 ? start + (long)(opts->duration * spec->sample_rate)
+                 : frames;
+  if (end > frames) end = frames;
+  *preroll = (long)(RANGE_PREROLL_SECONDS * spec->sample_rate);
+  if (*preroll > start) *preroll = start;
+  if (start >= end ||
+      pcm_reader_skip(reader, start - *preroll) != start - *preroll) {
+    pcm_reader_close(reader);
+    return -1;
+  }
+
+  long length = end - start + *preroll;
+  *pcm_data = (float *)nr_malloc(NULL, length * spec->channels * sizeof(float));
+  long got = *pcm_data ? pcm_reader_read(reader, *pcm_data, length) : -1;
+  pcm_reader_close(reader);
+  if (got <= 0) {
+    nr_free(NULL, *pcm_data);
+    *pcm_data = NULL;
+    return -1;
+  }
+  return got * spec->channels;
+}
+
+// decodes [start - preroll, start + duration) of an mp3 through its frame
+// index, which is only scanned up to the end of the range, so the work
+// depends on the range and not the file length
+// returns samples decoded and -1 on error, *preroll gets the per-channel
+// samples in front of the requested start
+static long decode_mp3_range(const CliOptions *opts, float **pcm_data,
+                             int *sample_rate, int *channels, long *preroll) {
+  char sidecar[4096];
+  const char *index_path = opts->index_path;
+  if (!index_path) {
+    snprintf(sidecar, sizeof(sidecar), "%s.idx", opts->input);
+    index_path = sidecar;
+  }
+
+  Mp3FrameIndex index;
+  if (mp3_index_open(opts->input, index_path, &index) != 0) {
+    return -1;
+  }
+  *sample_rate = index.sample_rate;
+  *channels = index.channels;
+
+  long start = (long)(opts->start * index.sample_rate);
+  long length = (long)(opts->duration * index.sample_rate);
+  if (mp3_index_extend(opts->input, index_path, &index,
+                       opts->duration >= 0.0 ? start + length : -1) != 0) {
+    mp3_index_free(&index);
+    return -1;
+  }
+  if (opts->duration < 0.0) length = index.total_samples - start;
+  *preroll = (long)(RANGE_PREROLL_SECONDS * index.sample_rate);
+  if (*preroll > start) *preroll = start;
+
+  long decoded = mp3_to_float_range(opts->input, &index, start - *preroll,
+                                    length + *preroll, pcm_data);
+  mp3_index_free(&index);
+  return decoded;
+}
+
+static double now_seconds(void) {
+  struct timespec ts;
+  timespec_get(&ts, TIME_UTC);
+  return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+// returns 0, or -1 if the codec frame isn't a whole number of samples
+static int make_config(const CliOptions *opts, int sample_rate,
+                       SpectralGateConfig *config) {
+  config->frame_size = 1024;  // even, factors of 2, 3 and 5 keep the fft fast
+  config->hop_size = 256;     // 50% overlap for proper COLA with a Hann window
+  config->alpha = 1.5f;       // threshold scaling factor
+  config->noise_floor = -30.0f;  // noise floor in dB
+  config->noise_decay = 0.98f;    // noise estimation decay factor
+  config->silence_threshold = 0.01f;
+  config->window_mode = SG_WINDOW_HANN;
+  config->num_bands = opts->bands;
+  config->sample_rate = sample_rate;
+  config->compact_state = opts->compact;
+  config->engine = SG_ENGINE_STFT;
+  config->wola_taps = 0;  // a frame long prototype
+  config->link_channels = 0;
+  config->smoothing_hop = 0;  // noise_decay is per hop
+  if (opts->low_latency) {
+    // same 1024 point resolution, but only the newest hop + hop / 4 samples of
+    // each frame reach the output. the smoothing stays timed like the 256 hop
+    config->hop_size = 128;
+    config->window_mode = SG_WINDOW_LOW_LATENCY;
+    config->smoothing_hop = 256;
+  }
+  if (opts->wola) {
+    // 256 subbands (172 Hz at 44.1 kHz) from a frame long prototype, 8x
+    // oversampled so the 64 sample synthesis window keeps the delay short
+    config->frame_size = 256;
+    config->hop_size = 32;
+    config->engine = SG_ENGINE_WOLA;
+    config->smoothing_hop = 256;
+  }
+  if (opts->codec_frame_ms > 0.0) {
+    double samples = opts->codec_frame_ms * sample_rate / 1000.0;
+    if (samples < 1.0 || fabs(samples - lround(samples)) > 1e-6) {
+      fprintf(stderr, "a %g ms codec frame isn't a whole number of samples at %d Hz\n",
+              opts->codec_frame_ms, sample_rate);
+      return -1;
+    }
+    spectral_gate_codec_config(config, (int)lround(samples));
+    // eg. 10 ms at 44.1 kHz is a 882 point fft, 2 * 3^2 * 7^2
+    int half = config->frame_size / 2;
+    if (kiss_fft_next_fast_size(half) != half) {
+      fprintf(stderr, "warning: %d point fft has factors other than 2, 3 and 5, "
+              "it will be slow\n", half);
+    }
+  }
+  return 0;
+}
+
+// plans from the wisdom file, the sizes it lacks get tuned as the gates
+// allocate their ffts
+// log is stderr when stdout carries audio
+static void load_wisdom(const char *path, FILE *log) {
+  int loaded = fft_plan_load_wisdom(path);
+  if (loaded < 0) {
+    fprintf(stderr, "warning: ignoring fft wisdom %s\n", path);
+  } else {
+    fprintf(log, "fft wisdom: %d plans from %s\n", loaded, path);
+  }
+  fft_plan_enable(FFT_PLAN_MEASURE);
+}
+
+static void save_wisdom(const char *path, FILE *log) {
+  if (fft_plan_new_plans() == 0) return;
+  fft_plan_report(log);
+  if (fft_plan_save_wisdom(path) != 0) {
+    fprintf(stderr, "warning: could not save fft wisdom %s\n", path);
+  }
+}
+
+// the gate a channel goes through
+typedef struct {
+  SpectralGateData *spd;  // full rate, or band rate when vb is set
+  VoiceBand *vb;          // decimated voice band mode
+  int threads;            // spectral_gate_start_mt threads, 1 = serial
+  int link;               // SpectralGateLink, -1 gates channels on their own
+  int dual_mono;          // all channels equal: gate the first, copy it out
+} ChannelGate;
+
+// nonzero if every channel of the interleaved buffer is a copy of the first,
+// eg. a mono recording stored as stereo
+static int is_dual_mono(const float *pcm_data, long frames, int channels) {
+  for (long i = 0; i < frames; i++) {
+    const float *frame = pcm_data + i * channels;
+    for (int ch = 1; ch < channels; ch++) {
+      if (fabsf(frame[ch] - frame[0]) > DUAL_MONO_TOLERANCE) return 0;
+    }
+  }
+  return 1;
+}
+
+// all channels through spectral_gate_start_linked, which takes them planar
+static int gate_linked(ChannelGate *gate, const float *pcm_data,
+                       float *processed_data, long samples_per_channel,
+                       int channels) {
+  long total_samples = samples_per_channel * channels;
+  float *planar_in = (float *)nr_malloc(NULL, total_samples * sizeof(float));
+  float *planar_out = (float *)nr_malloc(NULL, total_samples * sizeof(float));
+  const float **inputs =
+      (const float **)nr_malloc(NULL, channels * sizeof(float *));
+  float **outputs = (float **)nr_malloc(NULL, channels * sizeof(float *));
+  int status = -1;
+  if (!planar_in || !planar_out || !inputs || !outputs) {
+    fprintf(stderr, "failed to allocate channel buffers\n");
+    goto done;
+  }
+  for (int ch = 0; ch < channels; ch++) {
+    inputs[ch] = planar_in + ch * samples_per_channel;
+    outputs[ch] = planar_out + ch * samples_per_channel;
+  }
+  pcm_deinterleave(pcm_data, (float *const *)inputs, channels,
+                   samples_per_channel);
+  uint64_t t0 = trace_begin();
+  if (spectral_gate_start_linked(gate->spd, inputs, outputs, channels,
+                                 samples_per_channel, gate->link) != 0) {
+    fprintf(stderr, "linked noise reduction processing failed\n");
+    goto done;
+  }
+  trace_end("cli", "linked channels", t0, channels);
+  pcm_interleave((const float *const *)outputs, processed_data, channels,
+                 samples_per_channel);
+  status = 0;
+done:
+  nr_free(NULL, planar_in);
+  nr_free(NULL, planar_out);
+  nr_free(NULL, inputs);
+  nr_free(NULL, outputs);
+  return status;
+}
+
+static int gate_channel(ChannelGate *gate, const float *input, float *output,
+                        long num_samples) {
+  if (gate->vb) {
+    return voiceband_process(gate->vb, gate->spd, input, output, num_samples);
+  }
+  if (gate->threads != 1) {
+    return spectral_gate_start_mt(gate->spd, input, output, num_samples,
+                                  gate->threads);
+  }
+  return spectral_gate_start(gate->spd, input, output, num_samples);
+}
+
+// gates every channel of an interleaved buffer
+// returns 0 on success and -1 on error
+static int gate_interleaved(ChannelGate *gate, const float *pcm_data,
+                            float *processed_data, long total_samples,
+                            int channels) {
+  // If audio is mono, process directly. If multi-channel, process each channel
+  // separately.
+  if (channels == 1) {
+    uint64_t t0 = trace_begin();
+    if (gate_channel(gate, pcm_data, processed_data, total_samples) != 0) {
+      fprintf(stderr, "noise reduction processing failed\n");
+      return -1;
+    }
+    trace_end("cli", "channel", t0, 0);
+    return 0;
+  }
+
+  // Calculate samples per channel (assume pcm_data is interleaved).
+  long samples_per_channel = total_samples / channels;
+  if (gate->link >= 0 && !gate->dual_mono) {
+    return gate_linked(gate, pcm_data, processed_data, samples_per_channel,
+                       channels);
+  }
+  // a dual mono input gates its first channel and copies it to the others
+  int gated_channels = gate->dual_mono ? 1 : channels;
+  // Allocate temporary buffers for the individual channel.
+  float *channel_in =
+      (float *)nr_malloc(NULL, samples_per_channel * sizeof(float));
+  float *channel_out =
+      (float *)nr_calloc(NULL, samples_per_channel, sizeof(float));
+  // every channel of a dual mono output reads channel_out
+  const float **copy_of =
+      (const float **)nr_malloc(NULL, channels * sizeof(float *));
+  if (!channel_in || !channel_out || !copy_of) {
+    fprintf(stderr, "failed to allocate channel buffers\n");
+    nr_free(NULL, channel_in);
+    nr_free(NULL, channel_out);
+    nr_free(NULL, copy_of);
+    return -1;
+  }
+  for (int c = 0; c < channels; c++) copy_of[c] = channel_out;
+  for (int ch = 0; ch < gated_channels; ch++) {
+    uint64_t t0 = trace_begin();
+    // Deinterleave: extract the channel data.
+    pcm_extract_channel(pcm_data, channel_in, channels, ch,
+                        samples_per_channel);
+    // Process noise reduction for this channel.
+    if (gate_channel(gate, channel_in, channel_out, samples_per_channel) !=
+        0) {
+      fprintf(stderr, "noise reduction processing failed on channel %d\n",
+              ch);
+      nr_free(NULL, channel_in);
+      nr_free(NULL, channel_out);
+      nr_free(NULL, copy_of);
+      return -1;
+    }
+    // Reinterleave: write the processed data back into the output buffer.
+    if (gate->dual_mono) {
+      pcm_interleave(copy_of, processed_data, channels, samples_per_channel);
+    } else {
+      pcm_insert_channel(channel_out, processed_data, channels, ch,
+                         samples_per_channel);
+    }
+    trace_end("cli", "channel", t0, ch);
+  }
+  nr_free(NULL, channel_in);
+  nr_free(NULL, channel_out);
+  nr_free(NULL, copy_of);
+  return 0;
+}
+
+// runs the full rate gate on the same input and reports how far the voice
+// band output is from it, and how much faster it was
+static void compare_with_full_rate(const SpectralGateConfig *config,
+                                   const float *pcm_data,
+                                   const float *band_output,
+                                   long total_samples, int channels,
+                                   int dual_mono, double band_time) {
+  SpectralGateData *full = spectral_gate_init(config);
+  float *full_output = (float *)nr_calloc(NULL, total_samples, sizeof(float));
+  if (!full || !full_output) {
+    fprintf(stderr, "compare: failed to set up the full rate gate\n");
+    spectral_gate_free(full);
+    nr_free(NULL, full_output);
+    return;
+  }
+  ChannelGate gate = {full, NULL, 1, -1, dual_mono};
+  double t0 = now_seconds();
+  int failed =
+      gate_interleaved(&gate, pcm_data, full_output, total_samples, channels);
+  double full_time = now_seconds() - t0;
+
+  if (!failed) {
+    // snr of the voice band output against the full rate output, so any
+    // difference above 8 kHz counts as error too
+    double ref = 0.0;
+    double err = 0.0;
+    for (long i = 0; i < total_samples; i++) {
+      double d = (double)band_output[i] - full_output[i];
+      ref += (double)full_output[i] * full_output[i];
+      err += d * d;
+    }
+    printf("compare: full rate %.3f s, voice band %.3f s (%.2fx faster), "
+           "snr vs full rate %.1f dB\n",
+           full_time, band_time, band_time > 0.0 ? full_time / band_time : 0.0,
+           err > 0.0 ? 10.0 * log10(ref / err) : 999.0);
+  }
+  spectral_gate_free(full);
+  nr_free(NULL, full_output);
+}
+
+// input "-": gates a wav (or --raw) stream from stdin block by block and
+// writes it to stdout or the output file as it goes. stdout may carry the
+// audio, so everything else goes to stderr
+static int run_filter(const CliOptions *opts) {
+  PcmContainer container = opts->raw_pipe ? PCM_CONTAINER_RAW : PCM_CONTAINER_WAV;
+  setvbuf(stdin, NULL, _IOFBF, FILTER_IO_BUFFER);
+  PcmReader *reader = pcm_reader_open_file(stdin, container, &opts->raw_spec);
+  if (!reader) {
+    fprintf(stderr, "failed to read a %s stream from stdin\n",
+            opts->raw_pipe ? "raw" : "wav");
+    return 1;
+  }
+  PcmSpec spec = *pcm_reader_spec(reader);
+  if (opts->out_format >= 0) spec.format = (PcmFormat)opts->out_format;
+
+  SpectralGateConfig config;
+  if (make_config(opts, spec.sample_rate, &config) != 0) {
+    pcm_reader_close(reader);
+    return 1;
+  }
+  // a codec frame per pass keeps the blocks on the codec's boundaries
+  long block = opts->block;
+  if (block == 0 && opts->codec_frame_ms > 0.0) block = config.hop_size;
+
+  PcmWriter *writer;
+  if (strcmp(opts->output, "-") == 0) {
+    writer = pcm_writer_open_file(stdout, container, &spec);
+  } else {
+    int out_container = pcm_container_from_filename(opts->output);
+    writer = out_container < 0
+                 ? NULL
+                 : pcm_writer_open(opts->output, (PcmContainer)out_container, &spec);
+    if (out_container < 0) {
+      fprintf(stderr, "filter output must be - or a .wav/.raw file\n");
+    }
+  }
+  if (!writer) {
+    pcm_reader_close(reader);
+    return 1;
+  }
+
+  FilterStats stats;
+  double t0 = now_seconds();
+  int status = filter_run(reader, writer, &config, block, opts->link,
+                          opts->load_profile, &stats);
+  double elapsed = now_seconds() - t0;
+  if (pcm_writer_close(writer) != 0) status = -1;
+  pcm_reader_close(reader);
+  if (status != 0) {
+    fprintf(stderr, "filter failed after %ld frames\n", stats.frames_in);
+    return 1;
+  }
+
+  long block_frames = block > 0 ? block : config.frame_size;
+  fprintf(stderr, "filter: %ld frames in %ld blocks of %ld (%.1fx realtime)\n",
+          stats.frames_out, stats.blocks, block_frames,
+          elapsed > 0.0 ? stats.frames_out / (double)spec.sample_rate / elapsed
+                        : 0.0);
+  fprintf(stderr, "filter: added latency %d blocks (%.1f ms), %d frames of it "
+          "gate delay\n", stats.latency_blocks,
+          1000.0 * stats.latency_blocks * block_frames / spec.sample_rate,
+          stats.gate_latency);
+  return 0;
+}
 
 int main(int argc, char **argv) {
-  if (argc < 3) {
-    fprintf(stderr, "usage: %s <input.mp3> <output.mp3>\n", argv[0]);
+  CliOptions opts;
+  if (parse_args(argc, argv, &opts) != 0) {
+    usage(argv[0]);
     return 1;
   }
 
-  const char *input_mp3 = argv[1];
-  const char *output_mp3 = argv[2];
+  // written at exit
+  if (opts.trace && trace_start(opts.trace, TRACE_FRAME_SAMPLE) != 0) {
+    fprintf(stderr, "warning: not tracing to %s\n", opts.trace);
+  }
+
+  int filtering = strcmp(opts.input ? opts.input : "", "-") == 0;
+  if (opts.wisdom) load_wisdom(opts.wisdom, filtering ? stderr : stdout);
+
+  if (filtering) {
+    int status = run_filter(&opts);
+    if (opts.wisdom) save_wisdom(opts.wisdom, stderr);
+    return status;
+  }
+
+  if (opts.batch) {
+    BatchOptions batch;
+    batch.input = opts.batch;
+    batch.out_dir = opts.out_dir;
+    batch.threads = opts.threads;
+    batch.raw_spec = opts.raw_spec;
+    batch.out_format = opts.out_format;
+    make_config(&opts, 0, &batch.config);  // rate is set per file
+    int status = batch_run(&batch);
+    if (opts.wisdom) save_wisdom(opts.wisdom, stdout);
+    return status == 0 ? 0 : 1;
+  }
+
+  const char *input_path = opts.input;
+  const char *output_path = opts.output;
 
   float *pcm_data = NULL;
   int sample_rate = 0;
   int channels = 0;
+  PcmSpec in_spec = opts.raw_spec;
+  int in_is_pcm = pcm_container_from_filename(input_path) >= 0;
+  int out_is_pcm = pcm_container_from_filename(output_path) >= 0;
 
-  // decode mp3 file
-  long total_samples =
-      mp3_to_float(input_mp3, &pcm_data, &sample_rate, &channels);
+  // decode the input, wav/raw skip the mp3 codec entirely
+  double t0 = now_seconds();
+  long total_samples;
+  long preroll = 0;  // per-channel samples decoded only to warm up the gate
+  if (in_is_pcm && opts.start >= 0.0) {
+    total_samples = decode_pcm_range(&opts, &in_spec, &pcm_data, &preroll);
+    sample_rate = in_spec.sample_rate;
+    channels = in_spec.channels;
+  } else if (in_is_pcm) {
+    total_samples = pcm_to_float(input_path, &in_spec, &pcm_data);
+    sample_rate = in_spec.sample_rate;
+    channels = in_spec.channels;
+  } else if (opts.start >= 0.0) {
+    total_samples = decode_mp3_range(&opts, &pcm_data, &sample_rate,
+                                     &channels, &preroll);
+    in_spec.format = PCM_FORMAT_S16;
+  } else {
+    total_samples = mp3_to_float_mt(input_path, &pcm_data, &sample_rate,
+                                    &channels, opts.threads);
+    in_spec.format = PCM_FORMAT_S16;
+  }
   if (total_samples <= 0) {
-    fprintf(stderr, "failed to decode mp3 file\n");
+    fprintf(stderr, "failed to decode %s\n", input_path);
     return 1;
   }
-  printf("decoded %ld samples, sample rate = %d, channels = %d\n",
-         total_samples, sample_rate, channels);
+  printf("decoded %ld samples, sample rate = %d, channels = %d (%.3f s)\n",
+         total_samples, sample_rate, channels, now_seconds() - t0);
 
   // noise reduce
 
   SpectralGateConfig config;
-  config.frame_size = 1024;  // must be a power of 2
-  config.hop_size = 256;     // 50% overlap for proper COLA with a Hann window
-  config.alpha = 1.5f;       // threshold scaling factor
-  config.noise_floor = -30.0f;  // noise floor in dB
-  config.noise_decay = 0.98f;    // noise estimation decay factor
-  config.silence_threshold = 0.01f;
+  if (make_config(&opts, sample_rate, &config) != 0) {
+    nr_free(NULL, pcm_data);
+    return 1;
+  }
+  if (opts.codec_frame_ms > 0.0) {
+    printf("codec framing: hop %d / frame %d (%g ms at %d Hz)\n",
+           config.hop_size, config.frame_size, opts.codec_frame_ms, sample_rate);
+  }
+
+  // in voice band mode the gate itself runs at the band rate
+  ChannelGate gate = {NULL, NULL, opts.gate_threads, opts.link, 0};
+  if (channels > 1 && is_dual_mono(pcm_data, total_samples / channels, channels)) {
+    gate.dual_mono = 1;
+    printf("dual mono input: gating one channel for all %d\n", channels);
+  }
+  SpectralGateConfig gate_config = config;
+  if (opts.link >= 0) gate_config.link_channels = channels;
+  if (opts.voice_band) {
+    gate.vb = voiceband_init(&config, sample_rate, VOICEBAND_RATE,
+                             opts.voice_band_pass ? VB_HIGH_PASS
+                                                  : VB_HIGH_ATTENUATE);
+    if (!gate.vb ||
+        voiceband_config(&config, sample_rate, VOICEBAND_RATE,
+                         &gate_config) != 0) {
+      fprintf(stderr, "failed to initialize voice band mode\n");
+      voiceband_free(gate.vb);
+      nr_free(NULL, pcm_data);
+      return 1;
+    }
+    printf("voice band: gating at %d Hz with frame %d / hop %d\n",
+           VOICEBAND_RATE, gate_config.frame_size, gate_config.hop_size);
+  }
 
   // Initialize the spectral gate data structure for noise reduction.
-  SpectralGateData *spd = spectral_gate_init(&config);
+  SpectralGateData *spd = spectral_gate_init(&gate_config);
   if (!spd) {
     fprintf(stderr, "failed to initialize spectral gate\n");
-    free(pcm_data);
+    voiceband_free(gate.vb);
+    nr_free(NULL, pcm_data);
     return 1;
   }
+  gate.spd = spd;
+  if (opts.wisdom) save_wisdom(opts.wisdom, stdout);
+  int gate_rate = gate.vb ? VOICEBAND_RATE : sample_rate;
+  printf("gate latency when streaming: %d samples (%.1f ms)\n",
+         spectral_gate_latency(spd),
+         1000.0 * spectral_gate_latency(spd) / gate_rate);
+  printf("gate state per stream: %zu bytes\n", spectral_gate_state_bytes(spd));
+
+  // a saved profile lets the gate start converged instead of warming up
+  if (opts.load_profile &&
+      spectral_gate_load_profile(spd, gate_rate, opts.load_profile) != 0) {
+    fprintf(stderr, "warning: could not load noise profile %s\n",
+            opts.load_profile);
+  }
 
   // Allocate a buffer for the processed (noise reduced) audio.
-  float *processed_data = (float *)calloc(total_samples, sizeof(float));
+  float *processed_data =
+      (float *)nr_calloc(NULL, total_samples, sizeof(float));
   if (!processed_data) {
     fprintf(stderr, "failed to allocate processed data buffer\n");
     spectral_gate_free(spd);
-    free(pcm_data);
+    voiceband_free(gate.vb);
+    nr_free(NULL, pcm_data);
     return 1;
   }
 
-  // If audio is mono, process directly. If multi-channel, process each channel
-  // separately.
-  if (channels == 1) {
-    if (spectral_gate_start(spd, pcm_data, processed_data, total_samples) !=
-        0) {
-      fprintf(stderr, "noise reduction processing failed\n");
-      free(processed_data);
-      spectral_gate_free(spd);
-      free(pcm_data);
-      return 1;
-    }
-  } else {
-    // Calculate samples per channel (assume pcm_data is interleaved).
-    int samples_per_channel = total_samples / channels;
-    for (int ch = 0; ch < channels; ch++) {
-      // Allocate temporary buffers for the individual channel.
-      float *channel_in = (float *)malloc(samples_per_channel * sizeof(float));
-      float *channel_out = (float *)calloc(samples_per_channel, sizeof(float));
-      if (!channel_in || !channel_out) {
-        fprintf(stderr, "failed to allocate buffers for channel %d\n", ch);
-        free(channel_in);
-        free(channel_out);
-        spectral_gate_free(spd);
-        free(processed_data);
-        free(pcm_data);
-        return 1;
-      }
-      // Deinterleave: extract the channel data.
-      for (int i = 0; i < samples_per_channel; i++) {
-        channel_in[i] = pcm_data[i * channels + ch];
-      }
-      // Process noise reduction for this channel.
-      if (spectral_gate_start(spd, channel_in, channel_out,
-                              samples_per_channel) != 0) {
-        fprintf(stderr, "noise reduction processing failed on channel %d\n",
-                ch);
-        free(channel_in);
-        free(channel_out);
-        spectral_gate_free(spd);
-        free(processed_data);
-        free(pcm_data);
-        return 1;
-      }
-      // Reinterleave: write the processed data back into the output buffer.
-      for (int i = 0; i < samples_per_channel; i++) {
-        processed_data[i * channels + ch] = channel_out[i];
-      }
-      free(channel_in);
-      free(channel_out);
-    }
+  double gate_start = now_seconds();
+
+  if (gate_interleaved(&gate, pcm_data, processed_data, total_samples,
+                       channels) != 0) {
+    nr_free(NULL, processed_data);
+    spectral_gate_free(spd);
+    voiceband_free(gate.vb);
+    nr_free(NULL, pcm_data);
+    return 1;
+  }
+  double gate_time = now_seconds() - gate_start;
+  double audio_seconds = (double)total_samples / channels / sample_rate;
+  printf("noise reduced! gate took %.3f s (%.1fx realtime)\n", gate_time,
+         gate_time > 0.0 ? audio_seconds / gate_time : 0.0);
+  printf("frames: %ld gated, %ld digital silence, %ld passthrough\n",
+         spd->frames_gated, spd->frames_silent, spd->frames_passthrough);
+
+  if (opts.save_profile &&
+      spectral_gate_save_profile(spd, gate_rate, opts.save_profile) != 0) {
+    fprintf(stderr, "warning: could not save noise profile %s\n",
+            opts.save_profile);
+  }
+
+  if (gate.vb && opts.compare) {
+    // the resampler pair's own loss, from its filters: down then up at 6 and
+    // 7 kHz, and what of 9 kHz folds back into the band
+    printf("compare: resampler %.2f dB at 6 kHz, %.2f dB at 7 kHz, "
+           "9 kHz aliased back at %.1f dB\n",
+           resampler_gain_db(gate.vb->down, 6000.0) +
+               resampler_gain_db(gate.vb->up, 6000.0),
+           resampler_gain_db(gate.vb->down, 7000.0) +
+               resampler_gain_db(gate.vb->up, 7000.0),
+           resampler_gain_db(gate.vb->down, 9000.0));
+    compare_with_full_rate(&config, pcm_data, processed_data,
+                           total_samples, channels, gate.dual_mono, gate_time);
   }
-  printf("noise reduced!\n");
 
   // Cleanup noise reduction data structure.
   spectral_gate_free(spd);
+  voiceband_free(gate.vb);
+
+  // drop the warm-up audio in front of a requested range
+  float *out_data = processed_data + preroll * channels;
+  long out_samples = total_samples - preroll * channels;
 
-  // encode mp3 file
-  if (float_to_mp3(output_mp3, processed_data, total_samples, sample_rate,
-                   channels) != 0) {
-    fprintf(stderr, "failed to encode mp3 file\n");
-    free(pcm_data);
+  // encode the output, same extension rules as the input
+  t0 = now_seconds();
+  int write_failed;
+  if (out_is_pcm) {
+    PcmSpec out_spec;
+    out_spec.sample_rate = sample_rate;
+    out_spec.channels = channels;
+    out_spec.format =
+        opts.out_format >= 0 ? (PcmFormat)opts.out_format : in_spec.format;
+    write_failed =
+        float_to_pcm(output_path, out_data, out_samples, &out_spec) != 0;
+  } else {
+    write_failed = float_to_mp3_mt(output_path, out_data, out_samples,
+                                   sample_rate, channels, opts.threads) != 0;
+  }
+  if (write_failed) {
+    fprintf(stderr, "failed to encode %s\n", output_path);
+    nr_free(NULL, processed_data);
+    nr_free(NULL, pcm_data);
     return 1;
   }
 
-  printf("encoding successful!\n");
+  printf("encoding successful! (%.3f s)\n", now_seconds() - t0);
 
   // Cleanup
-  free(pcm_data);
+  nr_free(NULL, processed_data);
+  nr_free(NULL, pcm_data);
   return 0;
 }
\ No newline at end of file
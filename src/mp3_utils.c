@@ -1,9 +1,18 @@
 #include "mp3_utils.h"
 
+#include <limits.h>
 #include <math.h>
+#include <pthread.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "nr_alloc.h"
+#include "pcm_convert.h"
+#include "trace.h"
 
 // for decoding
 #include <mad.h>
@@ -11,38 +20,199 @@
 // for encoding
 #include <lame/lame.h>
 
-static inline float mad_fixed_to_float(mad_fixed_t fixed) {
-  const double scale = 1.0 / (double)(1 << MAD_F_FRACBITS);
-  return (float)(fixed * scale);
+// layer III main data can start up to this many bytes of main data (headers
+// and side info not counted) before its frame
+#define MP3_RESERVOIR_BYTES 511
+// header, crc and stereo mpeg 1 side info, the most a frame holds besides main data
+#define MP3_FRAME_OVERHEAD_BYTES 38
+// frames decoded past a full reservoir before the output is trusted, one for
+// the imdct overlap and one for the synth filterbank history
+#define MP3_PRIME_EXTRA_FRAMES 2
+// below this many frames per thread the serial decoder is used
+#define MP3_MIN_FRAMES_PER_THREAD 64
+
+typedef struct {
+  int layer;              // 1, 2 or 3
+  int samplerate;
+  int channels;
+  int samples_per_frame;  // per channel
+  int frame_bytes;        // including the header
+} Mp3Header;
+
+_Static_assert(sizeof(mad_fixed_t) == sizeof(int32_t), "pcm_fixed_to_float takes 32 bit samples");
+
+// one synthesized frame, planar q28, appended interleaved to out
+static void mad_pcm_to_float(const struct mad_pcm* pcm, float* out, float* peak) {
+  const int32_t* planes[2] = {(const int32_t*)pcm->samples[0],
+                              (const int32_t*)pcm->samples[1]};
+  pcm_fixed_to_float(planes, out, pcm->channels, pcm->length, MAD_F_FRACBITS, peak);
 }
 
-long mp3_to_float(const char* filename, float** output, int* sample_rate,
-                  int* channels) {
-  if (!filename || !output || !sample_rate || !channels) {
-    perror("invalid args to mp3_to_float");
+// parses the 4 byte frame header at p
+// returns 0 on success and -1 if p is not a (supported) frame header
+static int mp3_parse_header(const unsigned char* p, Mp3Header* h) {
+  static const int bitrates[2][3][16] = {
+      // mpeg 1: layer I, II, III
+      {{0, 32, 64, 96, 128, 160, 192, 224, 256, 288, 320, 352, 384, 416, 448},
+       {0, 32, 48, 56, 64, 80, 96, 112, 128, 160, 192, 224, 256, 320, 384},
+       {0, 32, 40, 48, 56, 64, 80, 96, 112, 128, 160, 192, 224, 256, 320}},
+      // mpeg 2 and 2.5: layer I, II, III
+      {{0, 32, 48, 56, 64, 80, 96, 112, 128, 144, 160, 176, 192, 224, 256},
+       {0, 8, 16, 24, 32, 40, 48, 56, 64, 80, 96, 112, 128, 144, 160},
+       {0, 8, 16, 24, 32, 40, 48, 56, 64, 80, 96, 112, 128, 144, 160}}};
+  static const int samplerates[3] = {44100, 48000, 32000};
+
+  if (p[0] != 0xff || (p[1] & 0xe0) != 0xe0) return -1;
+
+  int version = (p[1] >> 3) & 3;  // 0 = 2.5, 2 = 2, 3 = 1
+  int layer_bits = (p[1] >> 1) & 3;
+  int bitrate_index = (p[2] >> 4) & 15;
+  int rate_index = (p[2] >> 2) & 3;
+  int padding = (p[2] >> 1) & 1;
+  if (version == 1 || layer_bits == 0 || rate_index == 3) return -1;
+  // free format (index 0) has no computable frame length, not supported here
+  if (bitrate_index == 0 || bitrate_index == 15) return -1;
+
+  int lsf = version != 3;
+  h->layer = 4 - layer_bits;
+  h->samplerate = samplerates[rate_index] >> (version == 3 ? 0 : (version == 2 ? 1 : 2));
+  h->channels = ((p[3] >> 6) & 3) == 3 ? 1 : 2;
+
+  long bitrate = bitrates[lsf][h->layer - 1][bitrate_index] * 1000L;
+  if (h->layer == 1) {
+    h->samples_per_frame = 384;
+    h->frame_bytes = (int)((12 * bitrate / h->samplerate + padding) * 4);
+  } else if (h->layer == 2 || !lsf) {
+    h->samples_per_frame = 1152;
+    h->frame_bytes = (int)(144 * bitrate / h->samplerate + padding);
+  } else {
+    h->samples_per_frame = 576;
+    h->frame_bytes = (int)(72 * bitrate / h->samplerate + padding);
+  }
+  return 0;
+}
+
+// size of an id3v2 tag at the start of the buffer, 0 if there is none
+static long mp3_id3v2_size(const unsigned char* buf, long size) {
+  if (size < 10 || memcmp(buf, "ID3", 3) != 0) return 0;
+  long tag = ((long)(buf[6] & 0x7f) << 21) | ((long)(buf[7] & 0x7f) << 14) |
+             ((long)(buf[8] & 0x7f) << 7) | (long)(buf[9] & 0x7f);
+  tag += 10;
+  if (buf[5] & 0x10) tag += 10;  // footer
+  return tag < size ? tag : size;
+}
+
+// builds the table of frame start offsets by walking frame headers
+// a header only counts when the next frame (or the end of the buffer) follows
+// it, so stray sync words in tags and junk are skipped
+// returns the number of frames found and -1 on allocation failure
+static long mp3_scan_frames(const unsigned char* buf, long size, long** offsets,
+                            Mp3Header** headers) {
+  long cap = 1024;
+  long count = 0;
+  long* offs = (long*)nr_malloc(NULL, cap * sizeof(long));
+  Mp3Header* hdrs = (Mp3Header*)nr_malloc(NULL, cap * sizeof(Mp3Header));
+  if (!offs || !hdrs) {
+    nr_free(NULL, offs);
+    nr_free(NULL, hdrs);
     return -1;
   }
 
+  long pos = mp3_id3v2_size(buf, size);
+  while (pos + 4 <= size) {
+    Mp3Header h;
+    if (mp3_parse_header(buf + pos, &h) != 0 || pos + h.frame_bytes > size) {
+      pos++;
+      continue;
+    }
+    long next = pos + h.frame_bytes;
+    if (next + 4 <= size) {
+      Mp3Header nh;
+      if (mp3_parse_header(buf + next, &nh) != 0 ||
+          nh.samplerate != h.samplerate || nh.layer != h.layer) {
+        // the last frame may be followed by an id3v1 tag instead
+        if (!(size - next == 128 && memcmp(buf + next, "TAG", 3) == 0)) {
+          pos++;
+          continue;
+        }
+      }
+    }
+
+    if (count == cap) {
+      cap *= 2;
+      long* o = (long*)nr_realloc(NULL, offs, count * sizeof(long), cap * sizeof(long));
+      if (o) offs = o;
+      Mp3Header* hh = (Mp3Header*)nr_realloc(NULL, hdrs, count * sizeof(Mp3Header),
+                                           cap * sizeof(Mp3Header));
+      if (hh) hdrs = hh;
+      if (!o || !hh) {
+        nr_free(NULL, offs);
+        nr_free(NULL, hdrs);
+        return -1;
+      }
+    }
+    offs[count] = pos;
+    hdrs[count] = h;
+    count++;
+    pos = next;
+  }
+
+  *offsets = offs;
+  *headers = hdrs;
+  return count;
+}
+
+// reads a whole file followed by MAD_BUFFER_GUARD zero bytes
+static unsigned char* read_mp3_file(const char* filename, long* filesize) {
+  uint64_t t0 = trace_begin();
   FILE* fp = fopen(filename, "rb");
   if (!fp) {
     perror("failed to open file");
-    return -1;
+    return NULL;
   }
 
   // read file into a buffer
   fseek(fp, 0, SEEK_END);
-  long filesize = ftell(fp);
+  long size = ftell(fp);
   fseek(fp, 0, SEEK_SET);
 
-  unsigned char* mp3_buffer = (unsigned char*)malloc(filesize + MAD_BUFFER_GUARD);
+  unsigned char* mp3_buffer = (unsigned char*)nr_malloc(NULL, size + MAD_BUFFER_GUARD);
   if (!mp3_buffer) {
     perror("unable to allocate memory for mp3 buffer");
     fclose(fp);
-    return -1;
+    return NULL;
+  }
+  memset(mp3_buffer + size, 0, MAD_BUFFER_GUARD);
+  if (fread(mp3_buffer, 1, size, fp) != (size_t)size) {
+    perror("failed to read mp3 file");
+    nr_free(NULL, mp3_buffer);
+    fclose(fp);
+    return NULL;
   }
-  memset(mp3_buffer + filesize, 0, MAD_BUFFER_GUARD);
-  fread(mp3_buffer, 1, filesize, fp);
   fclose(fp);
+  trace_end("io", "read_mp3_file", t0, size);
+
+  *filesize = size;
+  return mp3_buffer;
+}
+
+static void print_peak(float peak) {
+  printf("Max decoded amplitude: %f\n", peak);
+}
+
+long mp3_to_float(const char* filename, float** output, int* sample_rate,
+                  int* channels) {
+  if (!filename || !output || !sample_rate || !channels) {
+    perror("invalid args to mp3_to_float");
+    return -1;
+  }
+  uint64_t t0 = trace_begin();
+
+  long filesize = 0;
+  unsigned char* mp3_buffer = read_mp3_file(filename, &filesize);
+  if (!mp3_buffer) {
+    return -1;
+  }
 
   // libmad stuff
   struct mad_stream stream;
@@ -60,6 +230,7 @@ long mp3_to_float(const char* filename, float** output, int* sample_rate,
 
   float* decoded_data = NULL;
   long decoded_size = 0;
+  float peak = 0.0f;  // kept while converting, saves a pass at the end
 
   // libmad runs with a constant decoding loop
   while (1) {
@@ -87,25 +258,21 @@ long mp3_to_float(const char* filename, float** output, int* sample_rate,
     unsigned int fch = synth.pcm.channels;
 
     // allocate output buffer
-    float* temp = (float*)realloc(
-        decoded_data, (decoded_size + (no_samples * fch)) * sizeof(float));
+    float* temp = (float*)nr_realloc(NULL, decoded_data, decoded_size * sizeof(float),
+                                     (decoded_size + (no_samples * fch)) * sizeof(float));
 
     if (!temp) {
-      free(decoded_data);
+      nr_free(NULL, decoded_data);
       decoded_data = NULL;
       break;
     }
     decoded_data = temp;
 
     // convert from fixed to float
-    for (int i = 0; i < no_samples; i++) {
-      for (int j = 0; j < fch; j++) {
-        decoded_data[decoded_size++] =
-            mad_fixed_to_float(synth.pcm.samples[j][i]);
-      }
-    }
+    mad_pcm_to_float(&synth.pcm, decoded_data + decoded_size, &peak);
+    decoded_size += no_samples * fch;
   }
-  free(mp3_buffer);
+  nr_free(NULL, mp3_buffer);
 
   mad_stream_finish(&stream);
   mad_frame_finish(&frame);
@@ -113,26 +280,732 @@ long mp3_to_float(const char* filename, float** output, int* sample_rate,
 
   if (!decoded_data || decoded_size == 0) {
     if (decoded_data) {
-      free(decoded_data);
+      nr_free(NULL, decoded_data);
     }
     return -1;
   }
 
   // set arguments to values read
-  float max_val = 0.0f;
-  for (long i = 0; i < decoded_size; i++) {
-    if (fabsf(decoded_data[i]) > max_val)
-        max_val = fabsf(decoded_data[i]);
+  print_peak(peak);
+
+  *output = decoded_data;
+  *sample_rate = sr;
+  *channels = ch;
+  trace_end("decode", "mp3_to_float", t0, decoded_size);
+
+  return decoded_size;
+}
+
+typedef struct {
+  const unsigned char* buffer;
+  long buffer_size;
+  const long* offsets;  // frame table from mp3_scan_frames
+  long first;           // first frame whose samples are kept
+  long last;            // one past the last kept frame
+  long end_offset;      // byte offset where the next job's frames begin
+  long prime;           // frame decoding starts at (<= first)
+  float* out;           // where frame `first` lands in the shared output
+  long out_capacity;    // samples this job may write
+  long out_size;        // samples written
+  float peak;           // largest |sample| written
+  int truncated;        // hit a decode error the serial path stops on
+} DecodeJob;
+
+// decodes frames [prime, last) with a private libmad state, throwing away the
+// samples of the priming frames [prime, first)
+static void* decode_range(void* arg) {
+  DecodeJob* job = (DecodeJob*)arg;
+  uint64_t t0 = trace_begin();
+
+  struct mad_stream stream;
+  struct mad_frame frame;
+  struct mad_synth synth;
+  mad_stream_init(&stream);
+  mad_frame_init(&frame);
+  mad_synth_init(&synth);
+
+  long start = job->offsets[job->prime];
+  mad_stream_buffer(&stream, job->buffer + start, job->buffer_size - start);
+
+  long index = job->prime;
+  while (1) {
+    int failed = mad_frame_decode(&frame, &stream) == -1;
+    long offset = (long)(stream.this_frame - job->buffer);
+    if (failed && stream.error == MAD_ERROR_BUFLEN) break;
+    if (offset >= job->end_offset) break;
+
+    while (index + 1 < job->last && job->offsets[index + 1] <= offset) index++;
+    int keep = index >= job->first;
+
+    if (failed) {
+      if (stream.error == MAD_ERROR_LOSTSYNC) continue;
+      if (!keep && MAD_RECOVERABLE(stream.error)) {
+        // expected while the reservoir fills up
+        continue;
+      }
+      fprintf(stderr, "libmad error: %s\n", mad_stream_errorstr(&stream));
+      job->truncated = 1;
+      break;
+    }
+
+    mad_synth_frame(&synth, &frame);
+    if (!keep) continue;
+
+    unsigned int no_samples = synth.pcm.length;
+    unsigned int fch = synth.pcm.channels;
+    if (job->out_size + (long)(no_samples * fch) > job->out_capacity) {
+      // libmad saw frames the scanner did not, let the caller fall back
+      job->truncated = 1;
+      job->out_size = -1;
+      break;
+    }
+    mad_pcm_to_float(&synth.pcm, job->out + job->out_size, &job->peak);
+    job->out_size += no_samples * fch;
+  }
+
+  mad_stream_finish(&stream);
+  mad_frame_finish(&frame);
+  mad_synth_finish(&synth);
+  trace_end("decode", "decode_range", t0, job->last - job->first);
+  return NULL;
+}
+
+// first frame to decode so that frame `first` comes out exactly as it does
+// from a decoder that started at the beginning of the stream: the extra frames
+// ahead of it must decode from a full reservoir, so the frames before those
+// have to hold MP3_RESERVOIR_BYTES of main data. at low bitrates that is many
+// more than 511 bytes of file
+static long priming_frame(const long* offsets, long first) {
+  long prime = first - MP3_PRIME_EXTRA_FRAMES;
+  long main_data = 0;
+  while (prime > 0 && main_data < MP3_RESERVOIR_BYTES) {
+    prime--;
+    main_data += offsets[prime + 1] - offsets[prime] - MP3_FRAME_OVERHEAD_BYTES;
+  }
+  return prime < 0 ? 0 : prime;
+}
+
+long mp3_to_float_mt(const char* filename, float** output, int* sample_rate,
+                     int* channels, int num_threads) {
+  if (!filename || !output || !sample_rate || !channels) {
+    perror("invalid args to mp3_to_float_mt");
+    return -1;
+  }
+  if (num_threads <= 0) {
+    num_threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+  }
+  if (num_threads <= 1) {
+    return mp3_to_float(filename, output, sample_rate, channels);
   }
-  printf("Max decoded amplitude: %f\n", max_val);
+  uint64_t t0 = trace_begin();
+
+  long filesize = 0;
+  unsigned char* mp3_buffer = read_mp3_file(filename, &filesize);
+  if (!mp3_buffer) {
+    return -1;
+  }
+
+  long* offsets = NULL;
+  Mp3Header* headers = NULL;
+  long num_frames = mp3_scan_frames(mp3_buffer, filesize, &offsets, &headers);
+  if (num_frames / MP3_MIN_FRAMES_PER_THREAD < num_threads) {
+    num_threads = (int)(num_frames / MP3_MIN_FRAMES_PER_THREAD);
+  }
+  if (num_threads <= 1) {
+    // short or unscannable (eg. free format) stream
+    nr_free(NULL, offsets);
+    nr_free(NULL, headers);
+    nr_free(NULL, mp3_buffer);
+    return mp3_to_float(filename, output, sample_rate, channels);
+  }
+
+  // exact output position of every frame, from the headers alone
+  long* frame_pos = (long*)nr_malloc(NULL, (num_frames + 1) * sizeof(long));
+  DecodeJob* jobs = (DecodeJob*)nr_calloc(NULL, num_threads, sizeof(DecodeJob));
+  pthread_t* threads = (pthread_t*)nr_malloc(NULL, num_threads * sizeof(pthread_t));
+  float* decoded_data = NULL;
+  if (frame_pos && jobs && threads) {
+    frame_pos[0] = 0;
+    for (long f = 0; f < num_frames; f++) {
+      frame_pos[f + 1] =
+          frame_pos[f] + (long)headers[f].samples_per_frame * headers[f].channels;
+    }
+    decoded_data = (float*)nr_malloc(NULL, frame_pos[num_frames] * sizeof(float));
+  }
+  if (!decoded_data) {
+    perror("unable to allocate memory for parallel decode");
+    nr_free(NULL, frame_pos);
+    nr_free(NULL, jobs);
+    nr_free(NULL, threads);
+    nr_free(NULL, offsets);
+    nr_free(NULL, headers);
+    nr_free(NULL, mp3_buffer);
+    return -1;
+  }
+
+  int started = 0;
+  for (int t = 0; t < num_threads; t++) {
+    DecodeJob* job = &jobs[t];
+    job->buffer = mp3_buffer;
+    job->buffer_size = filesize;
+    job->offsets = offsets;
+    job->first = num_frames * t / num_threads;
+    job->last = num_frames * (t + 1) / num_threads;
+    job->end_offset = job->last < num_frames ? offsets[job->last] : filesize;
+    job->prime = priming_frame(offsets, job->first);
+    job->out = decoded_data + frame_pos[job->first];
+    job->out_capacity = frame_pos[job->last] - frame_pos[job->first];
+    if (pthread_create(&threads[t], NULL, decode_range, job) != 0) {
+      break;
+    }
+    started++;
+  }
+  for (int t = 0; t < started; t++) {
+    pthread_join(threads[t], NULL);
+  }
+
+  // stitch the ranges together, stopping where the serial decoder would have
+  long decoded_size = 0;
+  float peak = 0.0f;
+  int fallback = started != num_threads;
+  for (int t = 0; t < started && !fallback; t++) {
+    if (jobs[t].out_size < 0) {
+      fallback = 1;
+      break;
+    }
+    if (decoded_data + decoded_size != jobs[t].out) {
+      memmove(decoded_data + decoded_size, jobs[t].out,
+              jobs[t].out_size * sizeof(float));
+    }
+    decoded_size += jobs[t].out_size;
+    if (jobs[t].peak > peak) peak = jobs[t].peak;
+    if (jobs[t].truncated) break;
+  }
+
+  int sr = headers[0].samplerate;
+  int ch = headers[0].channels;
+  nr_free(NULL, frame_pos);
+  nr_free(NULL, jobs);
+  nr_free(NULL, threads);
+  nr_free(NULL, offsets);
+  nr_free(NULL, headers);
+  nr_free(NULL, mp3_buffer);
+
+  if (fallback) {
+    nr_free(NULL, decoded_data);
+    return mp3_to_float(filename, output, sample_rate, channels);
+  }
+  if (decoded_size == 0) {
+    nr_free(NULL, decoded_data);
+    return -1;
+  }
+
+  print_peak(peak);
 
   *output = decoded_data;
   *sample_rate = sr;
   *channels = ch;
+  trace_end("decode", "mp3_to_float_mt", t0, decoded_size);
 
   return decoded_size;
 }
 
+// the sidecar is little endian whatever the host: a 56 byte header (magic,
+// u32 version, i64 file size, i64 mtime, i32 sample rate, i32 channels, i64
+// frames, i64 total samples, i64 scan position) then an i64 byte offset and
+// i64 sample position per frame. version 1 was a dump of native structs and
+// version 2 had no scan position (always complete), both are rebuilt on load
+#define MP3_INDEX_MAGIC "NRMI"
+#define MP3_INDEX_VERSION 3
+#define MP3_INDEX_HEADER_SIZE 56
+#define MP3_INDEX_ENTRY_SIZE 16
+#define MP3_INDEX_CHUNK 256  // entries per read/write
+#define MP3_INDEX_READ (256 * 1024)  // bytes per block of the header scan
+// mpeg 2.5 layer II at 160 kbit/s and 8 kHz, with padding
+#define MP3_MAX_FRAME_BYTES 2881
+
+static void put_u32(unsigned char* p, uint32_t v) {
+  for (int i = 0; i < 4; i++) p[i] = (unsigned char)(v >> (8 * i));
+}
+
+static void put_u64(unsigned char* p, uint64_t v) {
+  for (int i = 0; i < 8; i++) p[i] = (unsigned char)(v >> (8 * i));
+}
+
+static uint32_t get_u32(const unsigned char* p) {
+  uint32_t v = 0;
+  for (int i = 0; i < 4; i++) v |= (uint32_t)p[i] << (8 * i);
+  return v;
+}
+
+static uint64_t get_u64(const unsigned char* p) {
+  uint64_t v = 0;
+  for (int i = 0; i < 8; i++) v |= (uint64_t)p[i] << (8 * i);
+  return v;
+}
+
+static int mp3_file_stat(const char* filename, long* size, long* mtime) {
+  struct stat st;
+  if (stat(filename, &st) != 0) {
+    perror("failed to stat mp3 file");
+    return -1;
+  }
+  *size = (long)st.st_size;
+  *mtime = (long)st.st_mtime;
+  return 0;
+}
+
+void mp3_index_free(Mp3FrameIndex* index) {
+  if (!index) return;
+  nr_free(NULL, index->byte_offsets);
+  nr_free(NULL, index->sample_pos);
+  memset(index, 0, sizeof(*index));
+}
+
+// room for one more entry
+static int mp3_index_grow(Mp3FrameIndex* index) {
+  if (index->num_frames < index->capacity) return 0;
+  long cap = index->capacity ? 2 * index->capacity : 1024;
+  long* o = (long*)nr_realloc(NULL, index->byte_offsets, index->num_frames * sizeof(long),
+                              cap * sizeof(long));
+  if (o) index->byte_offsets = o;
+  long* p = (long*)nr_realloc(NULL, index->sample_pos, index->num_frames * sizeof(long),
+                              cap * sizeof(long));
+  if (p) index->sample_pos = p;
+  if (!o || !p) {
+    perror("unable to allocate mp3 frame index");
+    return -1;
+  }
+  index->capacity = cap;
+  return 0;
+}
+
+// the index reaches end_sample when the frame after the one holding it is in
+// (mp3_to_float_range reads up to the next frame's start)
+static int mp3_index_covers(const Mp3FrameIndex* index, long end_sample) {
+  if (index->scan_pos >= index->file_size) return 1;
+  return end_sample >= 0 && index->num_frames >= 2 &&
+         index->sample_pos[index->num_frames - 2] >= end_sample;
+}
+
+int mp3_index_extend(const char* filename, const char* sidecar, Mp3FrameIndex* index,
+                     long end_sample) {
+  if (!filename || !index) {
+    perror("invalid args to mp3_index_extend");
+    return -1;
+  }
+  if (mp3_index_covers(index, end_sample)) return 0;
+  FILE* fp = fopen(filename, "rb");
+  unsigned char* buf = (unsigned char*)nr_malloc(NULL, MP3_INDEX_READ);
+  if (!fp || !buf) {
+    perror(fp ? "unable to allocate mp3 scan buffer" : "failed to open file");
+    if (fp) fclose(fp);
+    nr_free(NULL, buf);
+    return -1;
+  }
+  uint64_t t0 = trace_begin();
+  long frames_before = index->num_frames;
+  int status = 0;
+
+  // the mp3_scan_frames walk, a block at a time. away from the end of the
+  // file a header is only looked at while the largest frame and the header
+  // after it still fit in the block, the rest waits for the next one
+  while (status == 0 && !mp3_index_covers(index, end_sample)) {
+    long n = 0;
+    if (fseek(fp, index->scan_pos, SEEK_SET) == 0) {
+      n = (long)fread(buf, 1, MP3_INDEX_READ, fp);
+    }
+    if (n <= 0) {
+      status = -1;
+      break;
+    }
+    int at_eof = index->scan_pos + n >= index->file_size;
+    if (index->scan_pos == 0 && mp3_id3v2_size(buf, index->file_size) > 0) {
+      index->scan_pos = mp3_id3v2_size(buf, index->file_size);
+      continue;
+    }
+    long limit = at_eof ? n : n - MP3_MAX_FRAME_BYTES - 4;
+    long pos = 0;
+    while (pos + 4 <= n && pos < limit && !mp3_index_covers(index, end_sample)) {
+      Mp3Header h;
+      if (mp3_parse_header(buf + pos, &h) != 0 || pos + h.frame_bytes > n) {
+        pos++;
+        continue;
+      }
+      long next = pos + h.frame_bytes;
+      if (next + 4 <= n) {
+        Mp3Header nh;
+        if (mp3_parse_header(buf + next, &nh) != 0 ||
+            nh.samplerate != h.samplerate || nh.layer != h.layer) {
+          // the last frame may be followed by an id3v1 tag instead
+          if (!(at_eof && n - next == 128 && memcmp(buf + next, "TAG", 3) == 0)) {
+            pos++;
+            continue;
+          }
+        }
+      }
+      if (mp3_index_grow(index) != 0) {
+        status = -1;
+        break;
+      }
+      if (index->num_frames == 0) {
+        index->sample_rate = h.samplerate;
+        index->channels = h.channels;
+      }
+      index->byte_offsets[index->num_frames] = index->scan_pos + pos;
+      index->sample_pos[index->num_frames] = index->total_samples;
+      index->total_samples += h.samples_per_frame;
+      index->num_frames++;
+      pos = next;
+    }
+    if (pos == 0 && !at_eof) {
+      status = -1;  // short read
+      break;
+    }
+    index->scan_pos = at_eof && pos + 4 > n ? index->file_size : index->scan_pos + pos;
+  }
+  fclose(fp);
+  nr_free(NULL, buf);
+  trace_end("io", "mp3_index_extend", t0, index->num_frames - frames_before);
+
+  if (status == 0 && index->num_frames == 0) {
+    fprintf(stderr, "mp3_index_extend: no frames found in %s\n", filename);
+    status = -1;
+  }
+  if (status == 0 && sidecar && index->num_frames > frames_before &&
+      mp3_index_save(index, sidecar) != 0) {
+    // the index is still good for this run
+    fprintf(stderr, "warning: could not cache mp3 index in %s\n", sidecar);
+  }
+  return status;
+}
+
+// an empty index of filename, nothing scanned yet
+static int mp3_index_start(const char* filename, Mp3FrameIndex* index) {
+  memset(index, 0, sizeof(*index));
+  return mp3_file_stat(filename, &index->file_size, &index->file_mtime);
+}
+
+int mp3_index_build(const char* filename, Mp3FrameIndex* index) {
+  if (!filename || !index) {
+    perror("invalid args to mp3_index_build");
+    return -1;
+  }
+  if (mp3_index_start(filename, index) != 0 ||
+      mp3_index_extend(filename, NULL, index, -1) != 0) {
+    mp3_index_free(index);
+    return -1;
+  }
+  return 0;
+}
+
+int mp3_index_save(const Mp3FrameIndex* index, const char* path) {
+  if (!index || !path || index->num_frames <= 0) {
+    perror("invalid args to mp3_index_save");
+    return -1;
+  }
+  FILE* fp = fopen(path, "wb");
+  if (!fp) {
+    perror("failed to open mp3 index for writing");
+    return -1;
+  }
+
+  unsigned char hdr[MP3_INDEX_HEADER_SIZE];
+  memcpy(hdr, MP3_INDEX_MAGIC, 4);
+  put_u32(hdr + 4, MP3_INDEX_VERSION);
+  put_u64(hdr + 8, (uint64_t)(int64_t)index->file_size);
+  put_u64(hdr + 16, (uint64_t)(int64_t)index->file_mtime);
+  put_u32(hdr + 24, (uint32_t)index->sample_rate);
+  put_u32(hdr + 28, (uint32_t)index->channels);
+  put_u64(hdr + 32, (uint64_t)(int64_t)index->num_frames);
+  put_u64(hdr + 40, (uint64_t)(int64_t)index->total_samples);
+  put_u64(hdr + 48, (uint64_t)(int64_t)index->scan_pos);
+
+  int ok = fwrite(hdr, 1, sizeof(hdr), fp) == sizeof(hdr);
+  unsigned char entries[MP3_INDEX_CHUNK * MP3_INDEX_ENTRY_SIZE];
+  for (long f = 0; ok && f < index->num_frames; f += MP3_INDEX_CHUNK) {
+    long n = index->num_frames - f < MP3_INDEX_CHUNK ? index->num_frames - f : MP3_INDEX_CHUNK;
+    for (long i = 0; i < n; i++) {
+      put_u64(entries + i * MP3_INDEX_ENTRY_SIZE, (uint64_t)(int64_t)index->byte_offsets[f + i]);
+      put_u64(entries + i * MP3_INDEX_ENTRY_SIZE + 8, (uint64_t)(int64_t)index->sample_pos[f + i]);
+    }
+    size_t bytes = (size_t)n * MP3_INDEX_ENTRY_SIZE;
+    ok = fwrite(entries, 1, bytes, fp) == bytes;
+  }
+  if (fclose(fp) != 0) ok = 0;
+  if (!ok) {
+    fprintf(stderr, "mp3_index_save: failed to write %s\n", path);
+    remove(path);
+    return -1;
+  }
+  return 0;
+}
+
+int mp3_index_load(const char* path, const char* mp3_filename,
+                   Mp3FrameIndex* index) {
+  if (!path || !index) {
+    perror("invalid args to mp3_index_load");
+    return -1;
+  }
+  memset(index, 0, sizeof(*index));
+
+  FILE* fp = fopen(path, "rb");
+  if (!fp) {
+    return -1;  // no sidecar yet, not an error worth printing
+  }
+  unsigned char hdr[MP3_INDEX_HEADER_SIZE];
+  if (fread(hdr, 1, sizeof(hdr), fp) != sizeof(hdr) || memcmp(hdr, MP3_INDEX_MAGIC, 4) != 0 ||
+      get_u32(hdr + 4) != MP3_INDEX_VERSION) {
+    fclose(fp);
+    return -1;
+  }
+  int64_t file_size = (int64_t)get_u64(hdr + 8);
+  int64_t file_mtime = (int64_t)get_u64(hdr + 16);
+  int32_t sample_rate = (int32_t)get_u32(hdr + 24);
+  int32_t channels = (int32_t)get_u32(hdr + 28);
+  int64_t num_frames = (int64_t)get_u64(hdr + 32);
+  int64_t total_samples = (int64_t)get_u64(hdr + 40);
+  int64_t scan_pos = (int64_t)get_u64(hdr + 48);
+  if (num_frames <= 0 || num_frames > LONG_MAX / (long)sizeof(long) || scan_pos <= 0 ||
+      scan_pos > file_size) {
+    fclose(fp);
+    return -1;
+  }
+
+  // a stale index (the mp3 was rewritten) is treated as missing
+  if (mp3_filename) {
+    long size = 0;
+    long mtime = 0;
+    if (mp3_file_stat(mp3_filename, &size, &mtime) != 0 ||
+        size != file_size || mtime != file_mtime) {
+      fclose(fp);
+      return -1;
+    }
+  }
+
+  index->byte_offsets = (long*)nr_malloc(NULL, num_frames * sizeof(long));
+  index->sample_pos = (long*)nr_malloc(NULL, num_frames * sizeof(long));
+  if (!index->byte_offsets || !index->sample_pos) {
+    perror("unable to allocate mp3 frame index");
+    fclose(fp);
+    mp3_index_free(index);
+    return -1;
+  }
+  unsigned char entries[MP3_INDEX_CHUNK * MP3_INDEX_ENTRY_SIZE];
+  for (long f = 0; f < num_frames; f += MP3_INDEX_CHUNK) {
+    long n = num_frames - f < MP3_INDEX_CHUNK ? (long)(num_frames - f) : MP3_INDEX_CHUNK;
+    size_t bytes = (size_t)n * MP3_INDEX_ENTRY_SIZE;
+    if (fread(entries, 1, bytes, fp) != bytes) {
+      fclose(fp);
+      mp3_index_free(index);
+      return -1;
+    }
+    for (long i = 0; i < n; i++) {
+      index->byte_offsets[f + i] = (long)(int64_t)get_u64(entries + i * MP3_INDEX_ENTRY_SIZE);
+      index->sample_pos[f + i] = (long)(int64_t)get_u64(entries + i * MP3_INDEX_ENTRY_SIZE + 8);
+    }
+  }
+  fclose(fp);
+
+  index->num_frames = (long)num_frames;
+  index->capacity = (long)num_frames;
+  index->total_samples = (long)total_samples;
+  index->scan_pos = (long)scan_pos;
+  index->sample_rate = sample_rate;
+  index->channels = channels;
+  index->file_size = (long)file_size;
+  index->file_mtime = (long)file_mtime;
+  return 0;
+}
+
+int mp3_index_open(const char* mp3_filename, const char* sidecar,
+                   Mp3FrameIndex* index) {
+  if (sidecar && mp3_index_load(sidecar, mp3_filename, index) == 0) {
+    return 0;
+  }
+  // the first frames give the format, the rest is scanned as ranges need it
+  if (mp3_index_start(mp3_filename, index) != 0 ||
+      mp3_index_extend(mp3_filename, sidecar, index, 0) != 0) {
+    mp3_index_free(index);
+    return -1;
+  }
+  return 0;
+}
+
+long mp3_to_float_range(const char* filename, const Mp3FrameIndex* index,
+                        long start_sample, long num_samples, float** output) {
+  if (!filename || !index || index->num_frames <= 0 || !output ||
+      start_sample < 0 || num_samples <= 0) {
+    perror("invalid args to mp3_to_float_range");
+    return -1;
+  }
+  if (!mp3_index_covers(index, start_sample + num_samples)) {
+    fprintf(stderr, "mp3_to_float_range: the index doesn't reach the end of the range\n");
+    return -1;
+  }
+  if (start_sample >= index->total_samples) {
+    fprintf(stderr, "mp3_to_float_range: start is past the end of the file\n");
+    return -1;
+  }
+  if (start_sample + num_samples > index->total_samples) {
+    num_samples = index->total_samples - start_sample;
+  }
+  long end_sample = start_sample + num_samples;
+  uint64_t t0 = trace_begin();
+
+  // frames holding the first and last requested sample
+  long lo = 0;
+  long hi = index->num_frames - 1;
+  while (lo < hi) {
+    long mid = (lo + hi + 1) / 2;
+    if (index->sample_pos[mid] <= start_sample) lo = mid; else hi = mid - 1;
+  }
+  long first = lo;
+  long last = first;
+  while (last + 1 < index->num_frames &&
+         index->sample_pos[last + 1] < end_sample) {
+    last++;
+  }
+  last++;  // one past
+  long prime = priming_frame(index->byte_offsets, first);
+
+  // read just the bytes of [prime, last) plus one frame so libmad can sync
+  long read_end = last + 1 < index->num_frames ? index->byte_offsets[last + 1]
+                                               : index->file_size;
+  long base = index->byte_offsets[prime];
+  long range_size = read_end - base;
+
+  FILE* fp = fopen(filename, "rb");
+  if (!fp) {
+    perror("failed to open file");
+    return -1;
+  }
+  unsigned char* range_buffer =
+      (unsigned char*)nr_malloc(NULL, range_size + MAD_BUFFER_GUARD);
+  long* rel_offsets = (long*)nr_malloc(NULL, (last - prime) * sizeof(long));
+  long decoded_capacity = (index->sample_pos[last - 1] - index->sample_pos[first] +
+                           1152) * index->channels;
+  float* decoded_data = (float*)nr_malloc(NULL, decoded_capacity * sizeof(float));
+  if (!range_buffer || !rel_offsets || !decoded_data) {
+    perror("unable to allocate memory for mp3 range");
+    nr_free(NULL, range_buffer);
+    nr_free(NULL, rel_offsets);
+    nr_free(NULL, decoded_data);
+    fclose(fp);
+    return -1;
+  }
+  memset(range_buffer + range_size, 0, MAD_BUFFER_GUARD);
+  if (fseek(fp, base, SEEK_SET) != 0 ||
+      fread(range_buffer, 1, range_size, fp) != (size_t)range_size) {
+    perror("failed to read mp3 range");
+    nr_free(NULL, range_buffer);
+    nr_free(NULL, rel_offsets);
+    nr_free(NULL, decoded_data);
+    fclose(fp);
+    return -1;
+  }
+  fclose(fp);
+
+  for (long f = prime; f < last; f++) {
+    rel_offsets[f - prime] = index->byte_offsets[f] - base;
+  }
+
+  DecodeJob job;
+  memset(&job, 0, sizeof(job));
+  job.buffer = range_buffer;
+  job.buffer_size = range_size;
+  job.offsets = rel_offsets;
+  job.prime = 0;
+  job.first = first - prime;
+  job.last = last - prime;
+  job.end_offset = (last < index->num_frames ? index->byte_offsets[last]
+                                             : index->file_size) - base;
+  job.out = decoded_data;
+  job.out_capacity = decoded_capacity;
+  decode_range(&job);
+
+  nr_free(NULL, range_buffer);
+  nr_free(NULL, rel_offsets);
+
+  // trim to the requested samples
+  long skip = (start_sample - index->sample_pos[first]) * index->channels;
+  long want = num_samples * index->channels;
+  if (job.out_size < skip + want) {
+    if (job.out_size <= skip) {
+      nr_free(NULL, decoded_data);
+      fprintf(stderr, "mp3_to_float_range: decode failed\n");
+      return -1;
+    }
+    want = job.out_size - skip;
+  }
+  if (skip > 0) {
+    memmove(decoded_data, decoded_data + skip, want * sizeof(float));
+  }
+
+  *output = decoded_data;
+  trace_end("decode", "mp3_to_float_range", t0, want);
+  return want;
+}
+
+// encoder settings shared by the serial and chunked encoders
+static void configure_lame(lame_t lame, int sample_rate, int channels) {
+  lame_set_num_channels(lame, channels);
+  lame_set_in_samplerate(lame, sample_rate);
+
+  lame_set_brate(lame, 128);
+  lame_set_quality(lame, 5);  // 0 is best (slow), 9 is worst (very fast)
+}
+
+// lame's info (xing) frame leads the stream: a placeholder while encoding, then
+// filled in from lame_get_lametag_frame with the frame and byte counts, a seek
+// table, the encoder delay and padding gapless players need and two crcs.
+// offsets of its fields past the "Info" tag, in lame's layout (all four xing
+// fields, then the lame extension)
+#define XING_FRAMES 8
+#define XING_BYTES 12
+#define XING_TOC 16
+#define XING_TOC_ENTRIES 100
+#define LAME_DELAY_PADDING 141
+#define LAME_MUSIC_LENGTH 148
+#define LAME_MUSIC_CRC 152
+#define LAME_TAG_CRC 154
+
+static void put_be16(unsigned char* p, uint32_t v) {
+  p[0] = (unsigned char)(v >> 8);
+  p[1] = (unsigned char)v;
+}
+
+static void put_be32(unsigned char* p, uint32_t v) {
+  for (int i = 0; i < 4; i++) p[i] = (unsigned char)(v >> (24 - 8 * i));
+}
+
+static uint32_t get_be32(const unsigned char* p) {
+  return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+}
+
+// the crc-16 lame keeps for the music and the tag (poly 0x8005, reflected)
+static uint16_t lametag_crc(uint16_t crc, const unsigned char* p, long n) {
+  for (long i = 0; i < n; i++) {
+    crc ^= p[i];
+    for (int b = 0; b < 8; b++) crc = (crc & 1) ? (crc >> 1) ^ 0xa001 : crc >> 1;
+  }
+  return crc;
+}
+
+// offset of the "Info"/"Xing" tag in an info frame, after the header, its crc
+// and the side info. -1 if the frame doesn't carry lame's full tag
+static long lametag_offset(const unsigned char* frame, long frame_bytes) {
+  Mp3Header h;
+  if (frame_bytes < 4 || mp3_parse_header(frame, &h) != 0 || h.layer != 3) return -1;
+  int mpeg1 = ((frame[1] >> 3) & 3) == 3;
+  long off = 4 + ((frame[1] & 1) ? 0 : 2);
+  off += mpeg1 ? (h.channels == 1 ? 17 : 32) : (h.channels == 1 ? 9 : 17);
+  if (off + LAME_TAG_CRC + 2 > frame_bytes) return -1;
+  if (memcmp(frame + off, "Info", 4) != 0 && memcmp(frame + off, "Xing", 4) != 0) return -1;
+  if (get_be32(frame + off + 4) != 0x0f) return -1;  // frames, bytes, toc, scale
+  return off;
+}
+
 int float_to_mp3(const char* filename, const float* input, long num_samples,
                  int sample_rate, int channels) {
   if (!filename || !input || num_samples <= 0 || sample_rate <= 0 ||
@@ -140,6 +1013,7 @@ int float_to_mp3(const char* filename, const float* input, long num_samples,
     perror("invalid args to float_to_mp3");
     return -1;
   }
+  uint64_t t0 = trace_begin();
 
   // initialize lame stuff
   lame_t lame = lame_init();
@@ -148,12 +1022,7 @@ int float_to_mp3(const char* filename, const float* input, long num_samples,
     return -1;
   }
 
-  lame_set_num_channels(lame, channels);
-  lame_set_in_samplerate(lame, sample_rate);
-
-  lame_set_brate(lame, 128);
-  lame_set_quality(lame, 5);  // 0 is best (slow), 9 is worst (very fast)
-  
+  configure_lame(lame, sample_rate, channels);
 
   // open a new file to save the mp3
   FILE* fp = fopen(filename, "wb");
@@ -162,6 +1031,8 @@ int float_to_mp3(const char* filename, const float* input, long num_samples,
     lame_close(lame);
     return -1;
   }
+  // lame's info frame is a placeholder until the end, filled in by seeking back
+  int seekable = ftell(fp) >= 0;
 
   if (lame_init_params(lame) < 0) {
     fprintf(stderr, "Error: lame_init_params() failed.\n");
@@ -173,7 +1044,7 @@ int float_to_mp3(const char* filename, const float* input, long num_samples,
   // initialize output buffer. recommended size formula from LAME docs: 1.25 *
   // num_samples + 7200
   int mp3buf_size = (int)(1.25f * num_samples + 7200);
-  unsigned char* mp3buf = (unsigned char*)malloc(mp3buf_size);
+  unsigned char* mp3buf = (unsigned char*)nr_malloc(NULL, mp3buf_size);
   if (!mp3buf) {
     perror("error allocating mp3 output buffer\n");
     fclose(fp);
@@ -192,13 +1063,13 @@ int float_to_mp3(const char* filename, const float* input, long num_samples,
                                       num_samples, mp3buf, mp3buf_size);
   } else if (channels == 2) {
     // dealing with STEREO audio
-    float* left = (float*)malloc(num_samples * sizeof(float));
-    float* right = (float*)malloc(num_samples * sizeof(float));
+    float* left = (float*)nr_malloc(NULL, num_samples * sizeof(float));
+    float* right = (float*)nr_malloc(NULL, num_samples * sizeof(float));
     if (!left || !right) {
       fprintf(stderr, "float_to_mp3: channel split alloc failed.\n");
-      free(left);
-      free(right);
-      free(mp3buf);
+      nr_free(NULL, left);
+      nr_free(NULL, right);
+      nr_free(NULL, mp3buf);
       fclose(fp);
       lame_close(lame);
       return -1;
@@ -207,18 +1078,16 @@ int float_to_mp3(const char* filename, const float* input, long num_samples,
     // input is apparently interleaved via libmad so looks like [L, R, L, R...]
     // have to split intoseparate arrays for L and R
     int frame_count = num_samples / 2;
-    for (int i = 0; i < frame_count; i++) {
-      left[i] = input[2 * i];
-      right[i] = input[2 * i + 1];
-    }
+    float* planes[2] = {left, right};
+    pcm_deinterleave(input, planes, 2, frame_count);
     write_size = lame_encode_buffer_ieee_float(lame, left, right, frame_count, mp3buf, mp3buf_size);
 
-    free(left);
-    free(right);
+    nr_free(NULL, left);
+    nr_free(NULL, right);
   } else {
     // just return if not MONO or STEREO
     fprintf(stderr, "float_to_mp3: only supports mono or stereo.\n");
-    free(mp3buf);
+    nr_free(NULL, mp3buf);
     fclose(fp);
     lame_close(lame);
     return -1;
@@ -226,30 +1095,376 @@ int float_to_mp3(const char* filename, const float* input, long num_samples,
 
   if (write_size < 0) {
     fprintf(stderr, "float_to_mp3: error encoding (%d)\n", write_size);
-    free(mp3buf);
+    nr_free(NULL, mp3buf);
     fclose(fp);
     lame_close(lame);
     return -1;
   }
 
-  // write the encoded mp3 frames to mp3buf
+  // write the encoded mp3 frames to mp3buf. the info frame placeholder comes
+  // first, after an id3v2 tag if lame wrote one
+  long tag_pos = mp3_id3v2_size(mp3buf, write_size);
   fwrite(mp3buf, 1, write_size, fp);
 
   // flush the rest of the frames
   write_size = lame_encode_flush(lame, mp3buf, mp3buf_size);
   if (write_size < 0) {
     fprintf(stderr, "float_to_mp3: flush error\n");
-    free(mp3buf);
+    nr_free(NULL, mp3buf);
     fclose(fp);
     lame_close(lame);
     return -1;
   }
   fwrite(mp3buf, 1, write_size, fp);
 
+  // the encoder delay and padding gapless players trim by. a pipe keeps the
+  // blank placeholder, which plays as a frame of silence
+  size_t tag_bytes = seekable ? lame_get_lametag_frame(lame, mp3buf, mp3buf_size) : 0;
+  if (tag_bytes > 0 && tag_bytes <= (size_t)mp3buf_size &&
+      (fseek(fp, tag_pos, SEEK_SET) != 0 || fwrite(mp3buf, 1, tag_bytes, fp) != tag_bytes)) {
+    fprintf(stderr, "float_to_mp3: failed to write the info frame\n");
+    nr_free(NULL, mp3buf);
+    fclose(fp);
+    lame_close(lame);
+    return -1;
+  }
+
   // cleanup stuff
-  free(mp3buf);
+  nr_free(NULL, mp3buf);
   fclose(fp);
   lame_close(lame);
+  trace_end("encode", "float_to_mp3", t0, num_samples);
 
   return 0;  // success
-}
\ No newline at end of file
+}
+// frames each chunk encoder runs ahead of its chunk so the mdct overlap and
+// psychoacoustic state are warmed up with real audio by the first kept frame
+#define MP3_ENC_LEAD_FRAMES 3
+// frames fed past the end of a chunk so its last kept frame is not padded
+#define MP3_ENC_TAIL_FRAMES 3
+// below this many frames per chunk the serial encoder is used
+#define MP3_ENC_MIN_CHUNK_FRAMES 256
+
+typedef struct {
+  const float* input;   // interleaved, whole stream
+  long total_frames;    // input samples per channel
+  int sample_rate;
+  int channels;
+  int frame_size;       // samples per channel in one mp3 frame
+  long first_frame;     // first mp3 frame (global numbering) this chunk owns
+  long end_frame;       // one past the last owned frame, -1 = to the end
+  unsigned char* mp3;   // encoded bytes of the kept frames
+  long mp3_size;
+  int error;
+
+  // chunk 0 keeps lame's info frame ahead of its frames. lame fills it in for
+  // what this instance emitted, float_to_mp3_mt redoes it for the whole stream
+  unsigned char* lametag;  // the filled info frame, NULL if lame made none
+  long lametag_bytes;
+  long lame_frames;        // frames emitted after the info frame
+  long lame_bytes;         // bytes emitted, info frame included
+  int crc_from_tag;        // lame's music crc took in the placeholder too
+  int padding;             // lame_get_encoder_padding, the stream's for the last chunk
+} EncodeJob;
+
+// encodes one chunk on its own lame instance
+// every encoder starts on a frame boundary of the global stream, so its output
+// frame j lines up with global frame (start / frame_size + j) and the chunks
+// can be cut on frame boundaries and concatenated. the bit reservoir is off
+// so no kept frame borrows bits from a frame that gets dropped. only chunk 0
+// writes an info frame, ahead of its first frame like the serial encoder
+static void* encode_chunk(void* arg) {
+  EncodeJob* job = (EncodeJob*)arg;
+  uint64_t t0 = trace_begin();
+  const int ch = job->channels;
+  const long tag = job->first_frame == 0;  // local frames before the audio
+
+  long lead = job->first_frame < MP3_ENC_LEAD_FRAMES ? job->first_frame
+                                                     : MP3_ENC_LEAD_FRAMES;
+  long in_start = (job->first_frame - lead) * job->frame_size;
+  long in_end = job->total_frames;
+  if (job->end_frame >= 0) {
+    long want = (job->end_frame + MP3_ENC_TAIL_FRAMES) * (long)job->frame_size;
+    if (want < in_end) in_end = want;
+  }
+  long in_frames = in_end - in_start;
+
+  lame_t lame = lame_init();
+  if (!lame) {
+    job->error = 1;
+    return NULL;
+  }
+  configure_lame(lame, job->sample_rate, ch);
+  lame_set_disable_reservoir(lame, 1);
+  lame_set_bWriteVbrTag(lame, (int)tag);
+  if (lame_init_params(lame) < 0) {
+    job->error = 1;
+    lame_close(lame);
+    return NULL;
+  }
+
+  int mp3buf_size = (int)(1.25f * in_frames + 7200);
+  unsigned char* mp3buf = (unsigned char*)nr_malloc(NULL, mp3buf_size);
+  if (!mp3buf) {
+    job->error = 1;
+    lame_close(lame);
+    return NULL;
+  }
+
+  const float* src = job->input + in_start * ch;
+  int size = 0;
+  if (ch == 1) {
+    size = lame_encode_buffer_ieee_float(lame, src, NULL, (int)in_frames,
+                                         mp3buf, mp3buf_size);
+  } else {
+    size = lame_encode_buffer_interleaved_ieee_float(
+        lame, src, (int)in_frames, mp3buf, mp3buf_size);
+  }
+  int flushed = size >= 0 ? lame_encode_flush(lame, mp3buf + size,
+                                              mp3buf_size - size)
+                          : -1;
+  if (size >= 0 && flushed >= 0 && tag) {
+    size_t tag_bytes = lame_get_lametag_frame(lame, NULL, 0);
+    job->lametag = tag_bytes > 0 ? (unsigned char*)nr_malloc(NULL, tag_bytes) : NULL;
+    if (job->lametag &&
+        lame_get_lametag_frame(lame, job->lametag, tag_bytes) != tag_bytes) {
+      nr_free(NULL, job->lametag);
+      job->lametag = NULL;
+    }
+    job->lametag_bytes = job->lametag ? (long)tag_bytes : 0;
+  }
+  job->padding = lame_get_encoder_padding(lame);
+  lame_close(lame);
+  if (size < 0 || flushed < 0) {
+    fprintf(stderr, "float_to_mp3_mt: error encoding chunk (%d)\n",
+            size < 0 ? size : flushed);
+    nr_free(NULL, mp3buf);
+    job->error = 1;
+    return NULL;
+  }
+  long total = (long)size + flushed;
+
+  // keep local frames [0, tag) and [tag + lead, tag + lead + owned), dropping
+  // the warm-up/tail frames. every frame is counted for the info frame
+  long keep_begin = -1;
+  long keep_end = total;
+  long frame = 0;
+  long pos = 0;
+  while (pos + 4 <= total) {
+    Mp3Header h;
+    if (mp3_parse_header(mp3buf + pos, &h) != 0) {
+      fprintf(stderr, "float_to_mp3_mt: unexpected bytes in lame output\n");
+      nr_free(NULL, mp3buf);
+      job->error = 1;
+      return NULL;
+    }
+    if (frame == lead) keep_begin = pos;  // lead is 0 where there is a tag
+    if (job->end_frame >= 0 && keep_end == total &&
+        frame == tag + lead + (job->end_frame - job->first_frame)) {
+      keep_end = pos;
+    }
+    pos += h.frame_bytes;
+    frame++;
+  }
+  if (keep_begin < 0) keep_begin = keep_end;
+
+  if (job->lametag) {
+    long x = lametag_offset(job->lametag, job->lametag_bytes);
+    Mp3Header h;
+    if (x < 0 || mp3_parse_header(mp3buf, &h) != 0 || h.frame_bytes != job->lametag_bytes) {
+      // not the layout float_to_mp3_mt knows how to redo, keep the placeholder
+      nr_free(NULL, job->lametag);
+      job->lametag = NULL;
+    } else {
+      job->lame_frames = frame - tag;
+      job->lame_bytes = total;
+      // whether lame's music crc starts at the placeholder or after it has
+      // differed between versions, so check against what this one emitted
+      uint16_t crc = (uint16_t)((job->lametag[x + LAME_MUSIC_CRC] << 8) |
+                                job->lametag[x + LAME_MUSIC_CRC + 1]);
+      job->crc_from_tag = crc == lametag_crc(0, mp3buf, total);
+    }
+  }
+
+  memmove(mp3buf, mp3buf + keep_begin, keep_end - keep_begin);
+  job->mp3 = mp3buf;
+  job->mp3_size = keep_end - keep_begin;
+  trace_end("encode", "encode_chunk", t0, job->first_frame);
+  return NULL;
+}
+
+// turns chunk 0's info frame into the whole stream's and writes it over the
+// placeholder at the start of stream: the frame and byte counts move by what
+// the kept stream has against what chunk 0's lame emitted, the seek table and
+// the crcs are redone over the stream, and the padding is the last chunk's
+static void lametag_fill(unsigned char* stream, long size, const EncodeJob* first,
+                         int padding) {
+  unsigned char* tag = first->lametag;
+  long tag_bytes = first->lametag_bytes;
+  long x = lametag_offset(tag, tag_bytes);
+
+  long frames = 0;
+  for (long pos = tag_bytes; pos + 4 <= size; frames++) {
+    Mp3Header h;
+    if (mp3_parse_header(stream + pos, &h) != 0) return;
+    pos += h.frame_bytes;
+  }
+  if (frames == 0) return;
+
+  long extra_frames = frames - first->lame_frames;
+  long extra_bytes = size - first->lame_bytes;
+  put_be32(tag + x + XING_FRAMES, (uint32_t)(get_be32(tag + x + XING_FRAMES) + extra_frames));
+  put_be32(tag + x + XING_BYTES, (uint32_t)(get_be32(tag + x + XING_BYTES) + extra_bytes));
+  put_be32(tag + x + LAME_MUSIC_LENGTH,
+           (uint32_t)(get_be32(tag + x + LAME_MUSIC_LENGTH) + extra_bytes));
+
+  // toc entry i: where the frame i percent of the way in starts, in 256ths
+  // of the stream
+  unsigned char* toc = tag + x + XING_TOC;
+  long frame = 0;
+  long pos = tag_bytes;
+  for (int i = 0; i < XING_TOC_ENTRIES; i++) {
+    long want = frames * i / XING_TOC_ENTRIES;
+    while (frame < want) {
+      Mp3Header h;
+      mp3_parse_header(stream + pos, &h);
+      pos += h.frame_bytes;
+      frame++;
+    }
+    long entry = (long)((double)pos * 256.0 / size);
+    toc[i] = (unsigned char)(entry > 255 ? 255 : entry);
+  }
+
+  // 12 bits of encoder delay, then 12 of padding
+  unsigned char* dp = tag + x + LAME_DELAY_PADDING;
+  dp[1] = (unsigned char)((dp[1] & 0xf0) | ((padding >> 8) & 0x0f));
+  dp[2] = (unsigned char)padding;
+
+  long crc_from = first->crc_from_tag ? 0 : tag_bytes;
+  put_be16(tag + x + LAME_MUSIC_CRC, lametag_crc(0, stream + crc_from, size - crc_from));
+  put_be16(tag + x + LAME_TAG_CRC, lametag_crc(0, tag, x + LAME_TAG_CRC));
+  memcpy(stream, tag, tag_bytes);
+}
+
+int float_to_mp3_mt(const char* filename, const float* input, long num_samples,
+                    int sample_rate, int channels, int num_threads) {
+  if (!filename || !input || num_samples <= 0 || sample_rate <= 0 ||
+      channels <= 0) {
+    perror("invalid args to float_to_mp3_mt");
+    return -1;
+  }
+  if (channels > 2) {
+    fprintf(stderr, "float_to_mp3_mt: only supports mono or stereo.\n");
+    return -1;
+  }
+  if (num_threads <= 0) {
+    num_threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+  }
+  if (num_threads <= 1) {
+    return float_to_mp3(filename, input, num_samples, sample_rate, channels);
+  }
+
+  // the frame grid is only known once lame has picked its output format
+  lame_t probe = lame_init();
+  if (!probe) {
+    perror("failed to initialize lame");
+    return -1;
+  }
+  configure_lame(probe, sample_rate, channels);
+  if (lame_init_params(probe) < 0) {
+    fprintf(stderr, "Error: lame_init_params() failed.\n");
+    lame_close(probe);
+    return -1;
+  }
+  int frame_size = lame_get_framesize(probe);
+  int resampled = lame_get_out_samplerate(probe) != sample_rate;
+  lame_close(probe);
+
+  long total_frames = num_samples / channels;
+  long mp3_frames = total_frames / frame_size;
+  if (mp3_frames / MP3_ENC_MIN_CHUNK_FRAMES < num_threads) {
+    num_threads = (int)(mp3_frames / MP3_ENC_MIN_CHUNK_FRAMES);
+  }
+  if (num_threads <= 1 || resampled) {
+    // frames would not line up with the input when lame resamples
+    return float_to_mp3(filename, input, num_samples, sample_rate, channels);
+  }
+  uint64_t t0 = trace_begin();
+
+  EncodeJob* jobs = (EncodeJob*)nr_calloc(NULL, num_threads, sizeof(EncodeJob));
+  pthread_t* threads = (pthread_t*)nr_malloc(NULL, num_threads * sizeof(pthread_t));
+  if (!jobs || !threads) {
+    perror("unable to allocate parallel encoder");
+    nr_free(NULL, jobs);
+    nr_free(NULL, threads);
+    return -1;
+  }
+
+  int started = 0;
+  for (int t = 0; t < num_threads; t++) {
+    EncodeJob* job = &jobs[t];
+    job->input = input;
+    job->total_frames = total_frames;
+    job->sample_rate = sample_rate;
+    job->channels = channels;
+    job->frame_size = frame_size;
+    job->first_frame = mp3_frames * t / num_threads;
+    // the last chunk runs to the end and owns the flush frames
+    job->end_frame = t + 1 < num_threads ? mp3_frames * (t + 1) / num_threads : -1;
+    if (pthread_create(&threads[t], NULL, encode_chunk, job) != 0) {
+      job->error = 1;
+      break;
+    }
+    started++;
+  }
+  for (int t = 0; t < started; t++) {
+    pthread_join(threads[t], NULL);
+  }
+
+  int ret = started == num_threads ? 0 : -1;
+  for (int t = 0; t < started; t++) {
+    if (jobs[t].error) ret = -1;
+  }
+
+  // the chunks are joined in memory so the info frame can be filled in
+  unsigned char* stream = NULL;
+  long stream_size = 0;
+  if (ret == 0) {
+    for (int t = 0; t < num_threads; t++) stream_size += jobs[t].mp3_size;
+    stream = (unsigned char*)nr_malloc(NULL, stream_size > 0 ? stream_size : 1);
+    if (!stream) {
+      perror("unable to allocate parallel encoder output");
+      ret = -1;
+    }
+  }
+  if (ret == 0) {
+    long pos = 0;
+    for (int t = 0; t < num_threads; t++) {
+      memcpy(stream + pos, jobs[t].mp3, jobs[t].mp3_size);
+      pos += jobs[t].mp3_size;
+    }
+    if (jobs[0].lametag) {
+      lametag_fill(stream, stream_size, &jobs[0], jobs[num_threads - 1].padding);
+    }
+
+    FILE* fp = fopen(filename, "wb");
+    if (!fp) {
+      perror("error opening output file\n");
+      ret = -1;
+    } else {
+      if (fwrite(stream, 1, stream_size, fp) != (size_t)stream_size) ret = -1;
+      if (fclose(fp) != 0) ret = -1;
+      if (ret != 0) fprintf(stderr, "float_to_mp3_mt: write failed\n");
+    }
+  }
+  nr_free(NULL, stream);
+
+  for (int t = 0; t < started; t++) {
+    nr_free(NULL, jobs[t].mp3);
+    nr_free(NULL, jobs[t].lametag);
+  }
+  nr_free(NULL, jobs);
+  nr_free(NULL, threads);
+  if (ret == 0) trace_end("encode", "float_to_mp3_mt", t0, num_samples);
+  return ret;
+}
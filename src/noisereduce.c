@@ -1,121 +1,1016 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdint.h>
 #include <math.h>
 #include <string.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <unistd.h>
 
 #include "noisereduce.h"
+#include "half.h"
+#include "trace.h"
 
 // for FFTs
 #include "kiss_fft.h"
 #include "kiss_fftr.h"
 
+// noise profile file (little endian): "NRNP", u16 version, u16 reserved,
+// u32 frame_size, u32 sample_rate, u32 bin count, then one f32 estimate per bin
+#define PROFILE_MAGIC "NRNP"
+#define PROFILE_VERSION 1
+#define PROFILE_HEADER_SIZE 20
+
+// max deviation of the summed analysis*synthesis windows from a constant that
+// still counts as perfect reconstruction
+#define PR_TOLERANCE 1e-4f
+
+// VAD and smoothing parameters
+#define VAD_SMOOTHING 0.9f // energy smoothing factor
+
+#define DEFAULT_SAMPLE_RATE 44100
+
+// the low latency pair's cross-fade between frames, as a fraction of the hop
+#define LOW_LATENCY_FADE_DIV 4
+
+// noise_est of a fresh gate
+#define NOISE_BASELINE 1e-3f
+
+// spectral_gate_start_mt block sizing, see there
+#define TWO_PASS_MIN_BLOCK 8
+#define TWO_PASS_BLOCKS_PER_THREAD 4
+
+// spectral_gate_set_params mailbox: two parameter blocks, seq & 1 being the
+// published one. a writer fills the other half and then bumps seq, the audio
+// thread copies the published half and tries again if seq moved meanwhile
+// (a second update may have started rewriting the half it was reading).
+// the fields are relaxed atomics so that torn read is well defined
+struct SpectralGateParamBox {
+    _Atomic float slots[2][4]; // alpha, noise_floor, noise_decay, silence_threshold
+    atomic_uint seq;
+    atomic_flag writing; // one control thread at a time
+};
+
 static void make_hann_window(float* window, int length) {
     for (int i = 0; i < length; i++) {
         window[i] = 0.5f - 0.5f * cosf(2.0f * (float)PI * i / (length - 1)); // i just used formula from matlab
     }
 }
 
+// periodic hann of length `length`, evaluated at n
+static float periodic_hann(int n, int length) {
+    return 0.5f - 0.5f * cosf(2.0f * (float)PI * n / length);
+}
+
+// asymmetric analysis/synthesis pair for the low latency mode. the analysis window
+// keeps the full frame for frequency resolution, but its product with the
+// synthesis window only spans the newest hop + fade samples of the frame: a
+// cross-fade of `fade` samples, flat for the rest of the hop, and a fade back out
+// over the last `fade` samples, where both windows are the same root cosine. the
+// shifted products sum to one, and a frame's output is done one hop + fade after
+// its newest sample came in, where a hann product of 2*hop would take 2*hop
+static int make_low_latency_windows(float* analysis, float* synthesis, int length, int hop) {
+    int fade = hop / LOW_LATENCY_FADE_DIV > 0 ? hop / LOW_LATENCY_FADE_DIV : 1;
+    if (length <= hop + fade) {
+        return -1;
+    }
+    int short_start = length - hop - fade; // where the synthesis window starts
+    int peak = length - fade;              // the long analysis taper peaks here
+
+    for (int n = 0; n < length; n++) {
+        if (n < peak) {
+            analysis[n] = sqrtf(periodic_hann(n, 2 * peak));
+        } else {
+            analysis[n] = cosf((float)PI * (n - peak + 0.5f) / (2 * fade));
+        }
+    }
+    for (int n = 0; n < length; n++) {
+        int k = n - short_start;
+        if (k < 0) {
+            synthesis[n] = 0.0f;
+        } else if (n >= peak) {
+            synthesis[n] = analysis[n];
+        } else {
+            float rise = k < fade ? sinf((float)PI * (k + 0.5f) / (2 * fade)) : 1.0f;
+            synthesis[n] = analysis[n] > 0.0f ? rise * rise / analysis[n] : 0.0f;
+        }
+    }
+    return 0;
+}
+
+// sums analysis*synthesis over all hop shifts. returns the (mean) overlap-add gain
+// and sets *ripple to the largest relative deviation from it
+static float ola_gain(const float* analysis, const float* synthesis, int length, int hop, float* ripple) {
+    float sum_min = 0.0f, sum_max = 0.0f, sum_mean = 0.0f;
+    for (int i = 0; i < hop; i++) {
+        float sum = 0.0f;
+        for (int n = i; n < length; n += hop) {
+            sum += analysis[n] * synthesis[n];
+        }
+        if (i == 0 || sum < sum_min) sum_min = sum;
+        if (i == 0 || sum > sum_max) sum_max = sum;
+        sum_mean += sum;
+    }
+    sum_mean /= hop;
+    *ripple = sum_mean > 0.0f ? (sum_max - sum_min) / sum_mean : 1.0f;
+    return sum_mean;
+}
+
+// filterbank prototypes for SG_ENGINE_WOLA. the analysis window is a hann
+// tapered sinc over `taps` samples, with zeros every `subbands` samples out from
+// its centre c. the synthesis window is a triangle over the 2*hop - 1 samples
+// around c divided by the analysis window, so the pair overlap-adds to exactly
+// one. folding a frame into `subbands` samples aliases x[t + l*subbands] onto
+// x[t], and a triangle sitting on the sinc's (near linear) zero crossings
+// cancels those terms up to the curvature there. each cancellation sums two
+// analysis taps, a minimum norm nudge of the pair makes it exact
+static int make_wola_prototypes(float* analysis, float* synthesis, int taps, int subbands, int hop) {
+    if (taps % subbands != 0 || 2 * hop > subbands) {
+        return -1;
+    }
+    int c = taps / 2;
+    for (int t = 0; t < taps; t++) {
+        float x = (float)(t - c) / subbands;
+        float sinc = t == c ? 1.0f : sinf((float)PI * x) / ((float)PI * x);
+        analysis[t] = periodic_hann(t, taps) * sinc;
+        synthesis[t] = 0.0f;
+    }
+    for (int t = c - hop + 1; t < c + hop; t++) {
+        synthesis[t] = (1.0f - fabsf((float)(t - c)) / hop) / analysis[t];
+    }
+    int folds = taps / subbands;
+    for (int phase = 0; phase < hop; phase++) {
+        for (int l = -folds; l <= folds; l++) {
+            if (l == 0) continue;
+            // the (at most two) synthesis taps of this phase and the analysis taps they meet
+            int tap[2];
+            float weight[2];
+            int n = 0;
+            float alias = 0.0f;
+            for (int t = c - hop + 1; t < c + hop; t++) {
+                int u = t + l * subbands;
+                if ((t - phase) % hop != 0 || u < 0 || u >= taps) continue;
+                tap[n] = u;
+                weight[n] = synthesis[t];
+                alias += synthesis[t] * analysis[u];
+                n++;
+            }
+            float norm = 0.0f;
+            for (int i = 0; i < n; i++) norm += weight[i] * weight[i];
+            for (int i = 0; i < n && norm > 0.0f; i++) {
+                analysis[tap[i]] -= weight[i] * alias / norm;
+            }
+        }
+    }
+    return 0;
+}
+
+// largest folding alias term of a wola pair, relative to its overlap-add gain
+// of one. an stft pair (taps == subbands) has none
+static float wola_alias(const float* analysis, const float* synthesis, int taps, int subbands, int hop) {
+    float worst = 0.0f;
+    for (int phase = 0; phase < hop; phase++) {
+        for (int l = 1 - taps / subbands; l < taps / subbands; l++) {
+            float sum = 0.0f;
+            for (int t = phase; t < taps; t += hop) {
+                int u = t + l * subbands;
+                if (l != 0 && u >= 0 && u < taps) sum += synthesis[t] * analysis[u];
+            }
+            if (fabsf(sum) > worst) worst = fabsf(sum);
+        }
+    }
+    return worst;
+}
+
 static float db_to_gain(float db) {
     return powf(10.0f, db / 20.0f);
 }
 
-SpectralGateData* spectral_gate_init(const SpectralGateConfig* config) {
+// erb rate scale (glasberg & moore), number of erbs below f
+static double hz_to_erb(double f) {
+    return 21.4 * log10(1.0 + 0.00437 * f);
+}
+
+static double erb_to_hz(double e) {
+    return (pow(10.0, e / 21.4) - 1.0) / 0.00437;
+}
+
+// splits the bins into erb spaced bands of at least one bin each and builds the
+// tables that spread band gains back over the bins (linear between band centres)
+// returns the number of bands, or -1 on allocation failure
+static int make_bands(SpectralGateShared* spd, int num_bands, int sample_rate) {
+    int num_bins = spd->config.frame_size / 2 + 1;
+    if (num_bands > num_bins) num_bands = num_bins;
+
+    spd->band_edges = (int*)nr_malloc(&spd->allocator, (num_bands + 1) * sizeof(int));
+    spd->bin_band = (int*)nr_malloc(&spd->allocator, num_bins * sizeof(int));
+    spd->bin_weight = (float*)nr_malloc(&spd->allocator, num_bins * sizeof(float));
+    if (!spd->band_edges || !spd->bin_band || !spd->bin_weight) {
+        return -1;
+    }
+
+    // low bands would be narrower than a bin, so every band gets at least one and
+    // the rest of the spectrum is shared out again on the erb scale
+    double bin_hz = (double)sample_rate / spd->config.frame_size;
+    int* edges = spd->band_edges;
+    edges[0] = 0;
+    int b = 0;
+    while (b < num_bands && edges[b] < num_bins) {
+        double lo = hz_to_erb(edges[b] * bin_hz);
+        double hi = hz_to_erb((num_bins - 0.5) * bin_hz);
+        double step = (hi - lo) / (num_bands - b);
+        int edge = (int)floor(erb_to_hz(lo + step) / bin_hz + 0.5);
+        if (edge <= edges[b]) edge = edges[b] + 1;
+        if (edge > num_bins || b == num_bands - 1) edge = num_bins;
+        edges[++b] = edge;
+    }
+    num_bands = b;
+
+    float* centre = (float*)nr_malloc(&spd->allocator, num_bands * sizeof(float));
+    if (!centre) {
+        return -1;
+    }
+    for (b = 0; b < num_bands; b++) {
+        centre[b] = 0.5f * (edges[b] + edges[b + 1] - 1);
+    }
+    int last = num_bands - 1;
+    b = 0;
+    for (int k = 0; k < num_bins; k++) {
+        if (last == 0 || k <= centre[0]) {
+            spd->bin_band[k] = 0;
+            spd->bin_weight[k] = 0.0f;
+        } else if (k >= centre[last]) {
+            spd->bin_band[k] = last - 1;
+            spd->bin_weight[k] = 1.0f;
+        } else {
+            while (centre[b + 1] <= k) b++;
+            spd->bin_band[k] = b;
+            spd->bin_weight[k] = (k - centre[b]) / (centre[b + 1] - centre[b]);
+        }
+    }
+    nr_free(&spd->allocator, centre);
+    return num_bands;
+}
+
+// gain (or any per band value) at bin k
+static inline float band_to_bin(const SpectralGateData* spd, const float* band, int k) {
+    int b = spd->bin_band[k];
+    float w = spd->bin_weight[k];
+    return w == 0.0f ? band[b] : band[b] + w * (band[b + 1] - band[b]);
+}
+
+// kiss_fft's temporary buffers (generic radices, in place transforms) come from
+// the gate's allocator too
+static void* fft_tmp_alloc(void* ctx, size_t nbytes) {
+    return nr_malloc((const NrAllocator*)ctx, nbytes);
+}
+
+static void fft_tmp_free(void* ctx, void* ptr) {
+    nr_free((const NrAllocator*)ctx, ptr);
+}
+
+// the cfg goes into one aligned block from a, which has to outlive it
+static kiss_fftr_cfg alloc_fftr(const NrAllocator* a, int nfft, int inverse) {
+    size_t len = 0;
+    kiss_fftr_alloc(nfft, inverse, NULL, &len);
+    void* mem = len > 0 ? nr_aligned_alloc(a, 16, len) : NULL;
+    kiss_fftr_cfg cfg = mem ? kiss_fftr_alloc(nfft, inverse, mem, &len) : NULL;
+    if (!cfg) {
+        nr_free(a, mem);
+        return NULL;
+    }
+    kiss_fft_allocator tmp = {fft_tmp_alloc, fft_tmp_free, (void*)a};
+    kiss_fftr_set_allocator(cfg, &tmp);
+    return cfg;
+}
+
+SpectralGateShared* spectral_gate_shared_init_alloc(const SpectralGateConfig* config, const NrAllocator* allocator) {
     if (!config || config->frame_size <= 0 || config->hop_size <= 0 || config->hop_size > config->frame_size) {
         perror("invalid spectral gate config for init\n");
         return NULL;
     }
-    SpectralGateData* spd = (SpectralGateData*)calloc(1, sizeof(SpectralGateData));
-    if (!spd) {
-        perror("failed to allocate spectral gate data variable\n");
+    if (config->frame_size % 2 != 0) {
+        fprintf(stderr, "spectral gate frame_size must be even, got %d\n", config->frame_size);
         return NULL;
     }
-    spd->config = *config;
+    if (config->window_mode != SG_WINDOW_HANN && config->window_mode != SG_WINDOW_LOW_LATENCY) {
+        perror("invalid spectral gate window mode\n");
+        return NULL;
+    }
+    if (config->num_bands < 0 || config->sample_rate < 0) {
+        perror("invalid spectral gate band layout\n");
+        return NULL;
+    }
+    if (config->link_channels < 0) {
+        perror("invalid spectral gate link channel count\n");
+        return NULL;
+    }
+    if (config->smoothing_hop < 0) {
+        perror("invalid spectral gate smoothing hop\n");
+        return NULL;
+    }
+    int window_length = config->frame_size;
+    if (config->engine == SG_ENGINE_WOLA) {
+        window_length = config->wola_taps > 0 ? config->wola_taps : config->frame_size;
+        if (config->window_mode != SG_WINDOW_HANN || window_length % config->frame_size != 0 ||
+            2 * config->hop_size > config->frame_size) {
+            fprintf(stderr, "wola engine needs hann windows, taps a multiple of frame_size "
+                    "and hop_size <= frame_size / 2\n");
+            return NULL;
+        }
+    } else if (config->engine != SG_ENGINE_STFT) {
+        perror("invalid spectral gate engine\n");
+        return NULL;
+    }
+    SpectralGateShared* shared = (SpectralGateShared*)nr_calloc(allocator, 1, sizeof(SpectralGateShared));
+    if (!shared) {
+        perror("failed to allocate spectral gate shared data\n");
+        return NULL;
+    }
+    shared->allocator = allocator ? *allocator : *nr_get_allocator();
+    shared->config = *config;
+    shared->window_length = window_length;
+
+    int frame_size = config->frame_size;
+    int num_bins = frame_size / 2 + 1;
 
     // allocate kissfft shit here
-    spd->fwd_cfg = kiss_fftr_alloc(config->frame_size, 0, NULL, NULL);
-    spd->inv_cfg = kiss_fftr_alloc(config->frame_size, 1, NULL, NULL);
-    if (!spd->fwd_cfg || !spd->inv_cfg) {
+    shared->fwd_cfg = alloc_fftr(&shared->allocator, frame_size, 0);
+    shared->inv_cfg = alloc_fftr(&shared->allocator, frame_size, 1);
+    if (!shared->fwd_cfg || !shared->inv_cfg) {
         perror("failed to alloc fft configs in init\n");
-        kiss_fftr_free(spd->fwd_cfg);
-        kiss_fftr_free(spd->inv_cfg);
-        free(spd);
+        spectral_gate_shared_free(shared);
         return NULL;
     }
 
-    spd->window = (float*)malloc(config->frame_size * sizeof(float));
-    spd->noise_est = (float*)calloc((config->frame_size / 2) + 1, sizeof(float));
-    spd->overlap = (float*)calloc(config->frame_size, sizeof(float));
-    if (!spd->window || !spd->noise_est || !spd->overlap) {
-        perror("failed to alloc spd members in init\n");
-        free(spd->window);
-        free(spd->noise_est);
-        free(spd->overlap);
-        kiss_fftr_free(spd->fwd_cfg);
-        kiss_fftr_free(spd->inv_cfg);
-        free(spd);
+    // band tables first, they decide how long noise_est is
+    shared->num_noise = num_bins;
+    if (config->num_bands > 0) {
+        int sample_rate = config->sample_rate > 0 ? config->sample_rate : DEFAULT_SAMPLE_RATE;
+        shared->num_bands = make_bands(shared, config->num_bands, sample_rate);
+        if (shared->num_bands > 0) {
+            shared->band_gain = (float*)nr_malloc(&shared->allocator, shared->num_bands * sizeof(float));
+        }
+        if (shared->num_bands <= 0 || !shared->band_gain) {
+            perror("failed to alloc noise bands in init\n");
+            spectral_gate_shared_free(shared);
+            return NULL;
+        }
+        shared->num_noise = shared->num_bands;
+    }
+
+    shared->window = (float*)nr_aligned_alloc(&shared->allocator, 16, frame_size * sizeof(float));
+    shared->in_buf = (kiss_fft_scalar*)nr_aligned_alloc(&shared->allocator, 16, frame_size * sizeof(kiss_fft_scalar));
+    shared->freq_bins = (kiss_fft_cpx*)nr_aligned_alloc(&shared->allocator, 16, num_bins * sizeof(kiss_fft_cpx));
+    shared->out_freq_bins = (kiss_fft_cpx*)nr_aligned_alloc(&shared->allocator, 16, num_bins * sizeof(kiss_fft_cpx));
+    shared->time_buf = (float*)nr_aligned_alloc(&shared->allocator, 16, frame_size * sizeof(float));
+    shared->mag_buf = (float*)nr_aligned_alloc(&shared->allocator, 16, num_bins * sizeof(float));
+    if (!shared->window || !shared->in_buf || !shared->freq_bins ||
+        !shared->out_freq_bins || !shared->time_buf || !shared->mag_buf) {
+        perror("failed to alloc shared members in init\n");
+        spectral_gate_shared_free(shared);
+        return NULL;
+    }
+    if (config->link_channels > 0) {
+        size_t channels = (size_t)config->link_channels;
+        shared->link_frames = (const float**)nr_malloc(&shared->allocator, channels * sizeof(float*));
+        shared->link_in = (kiss_fft_scalar*)nr_aligned_alloc(&shared->allocator, 16, channels * frame_size * sizeof(kiss_fft_scalar));
+        shared->link_spectra = (kiss_fft_cpx*)nr_aligned_alloc(&shared->allocator, 16, channels * num_bins * sizeof(kiss_fft_cpx));
+        shared->link_gains = (float*)nr_aligned_alloc(&shared->allocator, 16, num_bins * sizeof(float));
+        if (!shared->link_frames || !shared->link_in || !shared->link_spectra || !shared->link_gains) {
+            perror("failed to alloc linked gate scratch in init\n");
+            spectral_gate_shared_free(shared);
+            return NULL;
+        }
+    }
+    if (config->compact_state) {
+        // float working copies of the half precision state of whichever instance runs
+        shared->work_noise = (float*)nr_malloc(&shared->allocator, shared->num_noise * sizeof(float));
+        shared->work_overlap = (float*)nr_malloc(&shared->allocator, window_length * sizeof(float));
+        shared->work_stream_in = (float*)nr_malloc(&shared->allocator, window_length * sizeof(float));
+        shared->work_stream_ola = (float*)nr_malloc(&shared->allocator, window_length * sizeof(float));
+        if (!shared->work_noise || !shared->work_overlap || !shared->work_stream_in || !shared->work_stream_ola) {
+            perror("failed to alloc compact state buffers in init\n");
+            spectral_gate_shared_free(shared);
+            return NULL;
+        }
+    }
+
+    if (config->engine == SG_ENGINE_WOLA) {
+        // the folded frame comes windowed, so the frame_size windows are all ones
+        // and the prototypes go around the fft
+        shared->wola_analysis = (float*)nr_malloc(&shared->allocator, window_length * sizeof(float));
+        shared->wola_synthesis = (float*)nr_malloc(&shared->allocator, window_length * sizeof(float));
+        if (!shared->wola_analysis || !shared->wola_synthesis ||
+            make_wola_prototypes(shared->wola_analysis, shared->wola_synthesis, window_length,
+                                 frame_size, config->hop_size) != 0) {
+            perror("failed to alloc wola prototypes in init\n");
+            spectral_gate_shared_free(shared);
+            return NULL;
+        }
+        for (int i = 0; i < frame_size; i++) {
+            shared->window[i] = 1.0f;
+        }
+        shared->synth_window = shared->window;
+
+        float ripple = 0.0f;
+        float gain = ola_gain(shared->wola_analysis, shared->wola_synthesis, window_length, config->hop_size, &ripple);
+        float alias = wola_alias(shared->wola_analysis, shared->wola_synthesis, window_length, frame_size,
+                                 config->hop_size);
+        if (ripple > PR_TOLERANCE || alias > PR_TOLERANCE) {
+            fprintf(stderr, "wola prototypes are not perfect reconstruction (ripple %g, alias %g)\n", ripple, alias);
+            spectral_gate_shared_free(shared);
+            return NULL;
+        }
+        shared->stream_norm = 1.0f / gain;
+        // hann frame energy of white noise is 3/8 of its power per sample
+        float power = 0.0f;
+        for (int t = 0; t < window_length; t++) {
+            power += shared->wola_analysis[t] * shared->wola_analysis[t];
+        }
+        shared->wola_energy_norm = 0.375f / power;
+        shared->stream_offset = window_length / 2 - config->hop_size + 1;
+        return shared;
+    }
+
+    // hann uses one window for both analysis and synthesis
+    if (config->window_mode == SG_WINDOW_LOW_LATENCY) {
+        shared->synth_window = (float*)nr_malloc(&shared->allocator, frame_size * sizeof(float));
+        if (!shared->synth_window ||
+            make_low_latency_windows(shared->window, shared->synth_window, frame_size, config->hop_size) != 0) {
+            perror("low latency windows need frame_size > hop_size + hop_size / 4\n");
+            spectral_gate_shared_free(shared);
+            return NULL;
+        }
+    } else {
+        make_hann_window(shared->window, frame_size);
+        shared->synth_window = shared->window;
+    }
+
+    // with gating off the stream path must give back the (delayed) input, so the
+    // window pair has to overlap-add to a constant. the asymmetric pair is built to
+    // sum to exactly one, reject it if the config breaks that
+    float ripple = 0.0f;
+    float gain = ola_gain(shared->window, shared->synth_window, frame_size, config->hop_size, &ripple);
+    if (config->window_mode == SG_WINDOW_LOW_LATENCY && ripple > PR_TOLERANCE) {
+        fprintf(stderr, "low latency window pair is not perfect reconstruction (ripple %g)\n", ripple);
+        spectral_gate_shared_free(shared);
+        return NULL;
+    }
+    shared->stream_norm = gain > 0.0f ? 1.0f / gain : 1.0f;
+
+    // the first synthesis sample that can be nonzero decides how much of a frame
+    // is still pending when it leaves the stream
+    int synth_start = 0;
+    while (synth_start < frame_size - config->hop_size && shared->synth_window[synth_start] == 0.0f) {
+        synth_start++;
+    }
+    shared->stream_offset = synth_start;
+    return shared;
+}
+
+void spectral_gate_shared_free(SpectralGateShared* shared) {
+    if (!shared) return;
+    if (shared->synth_window && shared->synth_window != shared->window) nr_free(&shared->allocator, shared->synth_window);
+    nr_free(&shared->allocator, shared->window);
+    nr_free(&shared->allocator, shared->wola_analysis);
+    nr_free(&shared->allocator, shared->wola_synthesis);
+    nr_free(&shared->allocator, shared->in_buf);
+    nr_free(&shared->allocator, shared->freq_bins);
+    nr_free(&shared->allocator, shared->out_freq_bins);
+    nr_free(&shared->allocator, shared->time_buf);
+    nr_free(&shared->allocator, shared->mag_buf);
+    nr_free(&shared->allocator, shared->band_edges);
+    nr_free(&shared->allocator, shared->bin_band);
+    nr_free(&shared->allocator, shared->bin_weight);
+    nr_free(&shared->allocator, shared->band_gain);
+    nr_free(&shared->allocator, (void*)shared->link_frames);
+    nr_free(&shared->allocator, shared->link_in);
+    nr_free(&shared->allocator, shared->link_spectra);
+    nr_free(&shared->allocator, shared->link_gains);
+    nr_free(&shared->allocator, shared->work_noise);
+    nr_free(&shared->allocator, shared->work_overlap);
+    nr_free(&shared->allocator, shared->work_stream_in);
+    nr_free(&shared->allocator, shared->work_stream_ola);
+
+    nr_free(&shared->allocator, shared->fwd_cfg);
+    nr_free(&shared->allocator, shared->inv_cfg);
+
+    NrAllocator a = shared->allocator;
+    nr_free(&a, shared);
+}
+
+SpectralGateShared* spectral_gate_shared_init(const SpectralGateConfig* config) {
+    return spectral_gate_shared_init_alloc(config, NULL);
+}
+
+SpectralGateData* spectral_gate_init_shared_alloc(SpectralGateShared* shared, const NrAllocator* allocator) {
+    if (!shared) {
+        perror("invalid shared data for spectral gate init\n");
+        return NULL;
+    }
+    if (!allocator) allocator = &shared->allocator;
+    SpectralGateData* spd = (SpectralGateData*)nr_calloc(allocator, 1, sizeof(SpectralGateData));
+    if (!spd) {
+        perror("failed to allocate spectral gate data variable\n");
         return NULL;
     }
+    spd->allocator = *allocator;
+    const SpectralGateConfig* config = &shared->config;
+    spd->config = *config;
+    spd->shared = shared;
+
+    // everything that only depends on the config is borrowed
+    spd->fwd_cfg = shared->fwd_cfg;
+    spd->inv_cfg = shared->inv_cfg;
+    spd->window = shared->window;
+    spd->synth_window = shared->synth_window;
+    spd->in_buf = shared->in_buf;
+    spd->freq_bins = shared->freq_bins;
+    spd->out_freq_bins = shared->out_freq_bins;
+    spd->time_buf = shared->time_buf;
+    spd->mag_buf = shared->mag_buf;
+    spd->num_bands = shared->num_bands;
+    spd->band_edges = shared->band_edges;
+    spd->bin_band = shared->bin_band;
+    spd->bin_weight = shared->bin_weight;
+    spd->band_gain = shared->band_gain;
+    spd->stream_offset = shared->stream_offset;
+    spd->stream_norm = shared->stream_norm;
+    spd->window_length = shared->window_length;
+    spd->wola_analysis = shared->wola_analysis;
+    spd->wola_synthesis = shared->wola_synthesis;
+    spd->wola_energy_norm = shared->wola_energy_norm;
 
-    memset(spd->overlap, 0, sizeof(float) * config->frame_size);
+    int window_length = shared->window_length;
+    int num_noise = shared->num_noise;
+    if (config->compact_state) {
+        spd->noise_half = (uint16_t*)nr_calloc(&spd->allocator, num_noise, sizeof(uint16_t));
+        spd->overlap_half = (uint16_t*)nr_calloc(&spd->allocator, window_length, sizeof(uint16_t));
+        spd->stream_in_half = (uint16_t*)nr_calloc(&spd->allocator, window_length, sizeof(uint16_t));
+        spd->stream_ola_half = (uint16_t*)nr_calloc(&spd->allocator, window_length, sizeof(uint16_t));
+        spd->noise_est = shared->work_noise;
+        spd->overlap = shared->work_overlap;
+        spd->stream_in = shared->work_stream_in;
+        spd->stream_ola = shared->work_stream_ola;
+    } else {
+        spd->noise_est = (float*)nr_calloc(&spd->allocator, num_noise, sizeof(float));
+        spd->overlap = (float*)nr_calloc(&spd->allocator, window_length, sizeof(float));
+        spd->stream_in = (float*)nr_calloc(&spd->allocator, window_length, sizeof(float));
+        spd->stream_ola = (float*)nr_calloc(&spd->allocator, window_length, sizeof(float));
+    }
+    spd->stream_out = (float*)nr_calloc(&spd->allocator, config->hop_size, sizeof(float));
+    if (config->link_channels > 0) {
+        size_t channels = (size_t)config->link_channels;
+        spd->link_overlap = (float*)nr_calloc(&spd->allocator, channels * config->frame_size, sizeof(float));
+        spd->link_stream_in = (float*)nr_calloc(&spd->allocator, channels * config->frame_size, sizeof(float));
+        spd->link_stream_ola = (float*)nr_calloc(&spd->allocator, channels * config->frame_size, sizeof(float));
+        spd->link_stream_out = (float*)nr_calloc(&spd->allocator, channels * config->hop_size, sizeof(float));
+        if (!spd->link_overlap || !spd->link_stream_in || !spd->link_stream_ola || !spd->link_stream_out) {
+            perror("failed to alloc linked overlap in init\n");
+            spectral_gate_free(spd);
+            return NULL;
+        }
+    }
+    spd->params = (struct SpectralGateParamBox*)nr_malloc(&spd->allocator, sizeof(struct SpectralGateParamBox));
+    if ((config->compact_state && (!spd->noise_half || !spd->overlap_half ||
+                                   !spd->stream_in_half || !spd->stream_ola_half)) ||
+        !spd->noise_est || !spd->overlap || !spd->stream_in || !spd->stream_ola || !spd->stream_out ||
+        !spd->params) {
+        perror("failed to alloc spd members in init\n");
+        spectral_gate_free(spd);
+        return NULL;
+    }
 
-    make_hann_window(spd->window, config->frame_size);
+    for (int slot = 0; slot < 2; slot++) {
+        atomic_init(&spd->params->slots[slot][0], config->alpha);
+        atomic_init(&spd->params->slots[slot][1], config->noise_floor);
+        atomic_init(&spd->params->slots[slot][2], config->noise_decay);
+        atomic_init(&spd->params->slots[slot][3], config->silence_threshold);
+    }
+    atomic_init(&spd->params->seq, 0);
+    atomic_flag_clear(&spd->params->writing);
+    spd->params_seen = 0;
 
-    for (int i = 0; i < (config->frame_size / 2) + 1; i++) {
-        spd->noise_est[i] = 1e-3f;  // use as baseline
+    for (int i = 0; i < num_noise; i++) {
+        spd->noise_est[i] = NOISE_BASELINE;
     };
+    if (config->compact_state) {
+        half_from_float(spd->noise_half, spd->noise_est, num_noise);
+    }
+    spd->vad_silence = 1;
 
     spd->initialized = 1;
     return spd;
 }
 
+SpectralGateData* spectral_gate_init_shared(SpectralGateShared* shared) {
+    return spectral_gate_init_shared_alloc(shared, NULL);
+}
+
+SpectralGateData* spectral_gate_init_alloc(const SpectralGateConfig* config, const NrAllocator* allocator) {
+    SpectralGateShared* shared = spectral_gate_shared_init_alloc(config, allocator);
+    if (!shared) {
+        return NULL;
+    }
+    SpectralGateData* spd = spectral_gate_init_shared_alloc(shared, NULL);
+    if (!spd) {
+        spectral_gate_shared_free(shared);
+        return NULL;
+    }
+    spd->owns_shared = 1;
+    return spd;
+}
+
+SpectralGateData* spectral_gate_init(const SpectralGateConfig* config) {
+    return spectral_gate_init_alloc(config, NULL);
+}
+
 void spectral_gate_free(SpectralGateData* spd) {
     if (!spd) return;
-    if (spd->window) free(spd->window);
-    if (spd->noise_est) free(spd->noise_est);
-    if (spd->overlap) free(spd->overlap);
+    if (spd->config.compact_state) {
+        nr_free(&spd->allocator, spd->noise_half);
+        nr_free(&spd->allocator, spd->overlap_half);
+        nr_free(&spd->allocator, spd->stream_in_half);
+        nr_free(&spd->allocator, spd->stream_ola_half);
+    } else {
+        nr_free(&spd->allocator, spd->noise_est);
+        nr_free(&spd->allocator, spd->overlap);
+        nr_free(&spd->allocator, spd->stream_in);
+        nr_free(&spd->allocator, spd->stream_ola);
+    }
+    nr_free(&spd->allocator, spd->stream_out);
+    nr_free(&spd->allocator, spd->link_overlap);
+    nr_free(&spd->allocator, spd->link_stream_in);
+    nr_free(&spd->allocator, spd->link_stream_ola);
+    nr_free(&spd->allocator, spd->link_stream_out);
+    nr_free(&spd->allocator, spd->params);
 
-    if (spd->fwd_cfg) kiss_fftr_free(spd->fwd_cfg);
-    if(spd->inv_cfg) kiss_fftr_free(spd->inv_cfg);
+    if (spd->owns_shared) spectral_gate_shared_free(spd->shared);
 
-    free(spd);
+    NrAllocator a = spd->allocator;
+    nr_free(&a, spd);
 }
 
-int spectral_gate_start(SpectralGateData* spd, const float* input, float* output, long num_samples) {
-    if (!spd || !spd->initialized || !input || !output) {
-        perror("spectral gate data invalid\n");
+size_t spectral_gate_state_bytes(const SpectralGateData* spd) {
+    if (!spd) return 0;
+    size_t window_length = (size_t)spd->window_length;
+    size_t num_noise = (size_t)spd->shared->num_noise;
+    size_t value = spd->config.compact_state ? sizeof(uint16_t) : sizeof(float);
+    return sizeof(SpectralGateData) + sizeof(struct SpectralGateParamBox) +
+           (num_noise + 3 * window_length) * value + (size_t)spd->config.hop_size * sizeof(float) +
+           (size_t)spd->config.link_channels * (3 * spd->config.frame_size + spd->config.hop_size) * sizeof(float);
+}
+
+// compact state lives as half floats between calls and is worked on in the
+// shared float buffers while one call runs
+static void state_load(const SpectralGateData* spd) {
+    if (!spd->config.compact_state) return;
+    int window_length = spd->window_length;
+    half_to_float(spd->noise_est, spd->noise_half, spd->shared->num_noise);
+    half_to_float(spd->overlap, spd->overlap_half, window_length);
+    half_to_float(spd->stream_in, spd->stream_in_half, window_length);
+    half_to_float(spd->stream_ola, spd->stream_ola_half, window_length);
+}
+
+static void state_store(SpectralGateData* spd) {
+    if (!spd->config.compact_state) return;
+    int window_length = spd->window_length;
+    half_from_float(spd->noise_half, spd->noise_est, spd->shared->num_noise);
+    half_from_float(spd->overlap_half, spd->overlap, window_length);
+    half_from_float(spd->stream_in_half, spd->stream_in, window_length);
+    half_from_float(spd->stream_ola_half, spd->stream_ola, window_length);
+}
+
+int spectral_gate_codec_config(SpectralGateConfig* config, int codec_frame) {
+    if (!config || codec_frame <= 0) {
+        return -1;
+    }
+    config->hop_size = codec_frame;
+    config->frame_size = 4 * codec_frame;
+    return 0;
+}
+
+int spectral_gate_latency(const SpectralGateData* spd) {
+    if (!spd || !spd->initialized) {
         return -1;
     }
+    return spd->window_length - spd->stream_offset;
+}
 
+// inverse fft, fft scaling and synthesis window of out_freq_bins into time_buf
+static void synthesize(SpectralGateData* spd) {
+    int frame_size = spd->config.frame_size;
+    float* time_buf = spd->time_buf;
+    kiss_fftri(spd->inv_cfg, spd->out_freq_bins, time_buf);
+
+    const float scale = 1.0f / frame_size;
+    for (int i = 0; i < frame_size; i++) {
+        time_buf[i] = time_buf[i] * scale * spd->synth_window[i];
+    }
+}
+
+// magnitude per bin, or mean magnitude per band, of freq_bins into mag_buf
+static void frame_magnitudes(SpectralGateData* spd) {
+    const kiss_fft_cpx* freq_bins = spd->freq_bins;
+    float* mag_buf = spd->mag_buf;
+    if (spd->num_bands > 0) {
+        for (int b = 0; b < spd->num_bands; b++) {
+            float sum = 0.0f;
+            for (int j = spd->band_edges[b]; j < spd->band_edges[b + 1]; j++) {
+                float re = freq_bins[j].r;
+                float im = freq_bins[j].i;
+                sum += sqrtf(re*re + im*im);
+            }
+            mag_buf[b] = sum / (spd->band_edges[b + 1] - spd->band_edges[b]);
+        }
+        return;
+    }
+    const int num_bins = spd->config.frame_size / 2 + 1;
+    for (int j = 0; j < num_bins; j++) {
+        float re = freq_bins[j].r;
+        float im = freq_bins[j].i;
+        mag_buf[j] = sqrtf(re*re + im*im);
+    }
+}
+
+// noise_decay or the VAD smoothing as applied once per frame. with smoothing_hop
+// set they are per smoothing_hop samples at 44.1 kHz, so they get raised to the
+// number of those a hop spans at this rate
+static float per_hop(const SpectralGateData* spd, float factor) {
+    if (spd->config.smoothing_hop <= 0) return factor;
+    int sample_rate = spd->config.sample_rate > 0 ? spd->config.sample_rate : DEFAULT_SAMPLE_RATE;
+    float hops = (float)spd->config.hop_size * DEFAULT_SAMPLE_RATE /
+                 ((float)sample_rate * spd->config.smoothing_hop);
+    return hops == 1.0f ? factor : powf(factor, hops);
+}
+
+// noise tracking, run for frames the VAD calls silent. every bin of a digitally
+// silent frame is zero, so its estimate just decays
+static void update_noise(SpectralGateData* spd, int digital_silence) {
+    float noise_decay = per_hop(spd, spd->config.noise_decay);
+    int num_noise = spd->num_bands > 0 ? spd->num_bands : spd->config.frame_size / 2 + 1;
+    if (digital_silence) {
+        for (int j = 0; j < num_noise; j++) {
+            spd->noise_est[j] = noise_decay * spd->noise_est[j];
+        }
+        return;
+    }
+    for (int j = 0; j < num_noise; j++) {
+        spd->noise_est[j] = noise_decay * spd->noise_est[j] + (1.0f - noise_decay) * spd->mag_buf[j];
+    }
+}
+
+// band grouped version of the gate for the band magnitudes in mag_buf: the gate
+// decision runs once per band and the band gains are spread over the bins. a
+// real gain keeps the phase, so no atan2 here
+static void gate_bands(SpectralGateData* spd, float noise_floor_gain) {
     int frame_size = spd->config.frame_size;
-    int hop_size = spd->config.hop_size;
     float alpha = spd->config.alpha;
-    float noise_floor_gain = db_to_gain(spd->config.noise_floor);
-    float noise_decay = spd->config.noise_decay;
+    const kiss_fft_cpx* freq_bins = spd->freq_bins;
+    kiss_fft_cpx* out_freq_bins = spd->out_freq_bins;
+    const int num_bins = frame_size / 2 + 1;
+
+    int open_bands = 0;
+    for (int b = 0; b < spd->num_bands; b++) {
+        spd->band_gain[b] = spd->mag_buf[b] < alpha * spd->noise_est[b] ? noise_floor_gain : 1.0f;
+        open_bands += spd->band_gain[b] == 1.0f;
+    }
+
+    if (open_bands == spd->num_bands) {
+        for (int i = 0; i < frame_size; i++) {
+            spd->time_buf[i] = spd->in_buf[i] * spd->synth_window[i];
+        }
+        spd->frames_passthrough++;
+        return;
+    }
+
+    for (int j = 0; j < num_bins; j++) {
+        float gain = band_to_bin(spd, spd->band_gain, j);
+        out_freq_bins[j].r = freq_bins[j].r * gain;
+        out_freq_bins[j].i = freq_bins[j].i * gain;
+    }
+    synthesize(spd);
+    spd->frames_gated++;
+}
+
+// the VAD: smooths the (normalized) frame energy and flips between speech and
+// silence with some hysteresis
+static void vad_update(const SpectralGateData* spd, float frame_energy,
+                       float* smoothed_energy, int* is_silence) {
     float silence_threshold = spd->config.silence_threshold;
 
-    // VAD and smoothing parameters
     const float vad_threshold_high = silence_threshold * 1.5f;  // Speech threshold
     const float vad_threshold_low = silence_threshold * 0.75f;  // Silence threshold
-    const float vad_smoothing = 0.9f;  // Energy smoothing factor
-    float smoothed_energy = 0.0f;
-    int is_silence = 1;
 
-    memset(output, 0, sizeof(float) * num_samples);
+    // update smoothed energy with exponential moving average
+    float smoothing = per_hop(spd, VAD_SMOOTHING);
+    *smoothed_energy = smoothing * *smoothed_energy + (1 - smoothing) * frame_energy;
+
+    if (*is_silence) {
+        if (*smoothed_energy > vad_threshold_high) {
+            *is_silence = 0;
+        }
+    } else {
+        if (*smoothed_energy < vad_threshold_low) {
+            *is_silence = 1;
+        }
+    }
+}
+
+// windows `count` (<= frame_size) samples into in_buf and runs the VAD on the
+// frame energy. returns 1 if the frame is digitally silent
+static int analyse_frame(SpectralGateData* spd, const float* input, int count,
+                         float* smoothed_energy, int* is_silence) {
+    int frame_size = spd->config.frame_size;
+
+    kiss_fft_scalar* in_buf = spd->in_buf;
+
+    // window the audio signal and calculate frame energy for VAD
+    float frame_energy = 0.0f;
+    int digital_silence = 1;
+    memset(in_buf, 0, frame_size * sizeof(kiss_fft_scalar));
+    for (int i = 0; i < count; i++) {
+        in_buf[i] = (kiss_fft_scalar)(input[i] * spd->window[i]);
+        frame_energy += in_buf[i] * in_buf[i];
+        digital_silence &= in_buf[i] == 0.0f;
+    }
+    frame_energy /= count;  // Normalize
+
+    vad_update(spd, frame_energy, smoothed_energy, is_silence);
+    return digital_silence;
+}
+
+// gates the frame analyse_frame left in in_buf: updates the noise estimate and
+// leaves the windowed synthesis frame (fft scaling included) in spd->time_buf
+// digitally silent frames and frames the gate leaves fully open skip the ffts
+// (silence skips both, open skips the inverse) and produce the same frame in the
+// time domain, so overlap-add is unaffected by which path a frame took
+static void gate_analysed(SpectralGateData* spd, int is_silence, int digital_silence) {
+    int frame_size = spd->config.frame_size;
+    float alpha = spd->config.alpha;
+    float noise_floor_gain = db_to_gain(spd->config.noise_floor);
+
+    kiss_fft_scalar* in_buf = spd->in_buf;
+    kiss_fft_cpx* freq_bins = spd->freq_bins;
+    kiss_fft_cpx* out_freq_bins = spd->out_freq_bins;
+    float* time_buf = spd->time_buf;
+    float* mag_buf = spd->mag_buf;
+    const int num_bins = frame_size / 2 + 1;
+
+    // digital silence: the gated output is zero, no fft needed either way
+    if (digital_silence) {
+        if (is_silence) {
+            update_noise(spd, 1);
+        }
+        memset(time_buf, 0, frame_size * sizeof(float));
+        spd->frames_silent++;
+        return;
+    }
+
+    // forward fft (real to complex), magnitudes and noise tracking
+    kiss_fftr(spd->fwd_cfg, in_buf, freq_bins);
+    frame_magnitudes(spd);
+    if (is_silence) {
+        update_noise(spd, 0);
+    }
+
+    if (spd->num_bands > 0) {
+        gate_bands(spd, noise_floor_gain);
+        return;
+    }
+
+    // the gate decision
+    int gated_bins = 0;
+    for (int j = 0; j < num_bins; j++) {
+        gated_bins += mag_buf[j] < alpha * spd->noise_est[j];
+    }
+
+    // gate fully open: the spectrum goes back unchanged, so the inverse fft would
+    // only reproduce the windowed input
+    if (gated_bins == 0) {
+        for (int i = 0; i < frame_size; i++) {
+            time_buf[i] = in_buf[i] * spd->synth_window[i];
+        }
+        spd->frames_passthrough++;
+        return;
+    }
+
+    // fill in frequency bins
+    for (int j = 0; j < num_bins; j++) {
+        float re = freq_bins[j].r;
+        float im = freq_bins[j].i;
+        float mag = mag_buf[j];
+
+        // noise gating
+        float threshold = alpha * spd->noise_est[j];
+        if (mag < threshold) {
+            mag *= noise_floor_gain;
+        }
+
+        // making sure phase is preserved - takes up cycles might have to change when using the MCU
+        float phase = atan2f(im, re);
+        out_freq_bins[j].r = mag * cosf(phase);
+        out_freq_bins[j].i = mag * sinf(phase);
+    }
+
+    // inverse fft (complex to real), scaling and synthesis window
+    synthesize(spd);
+    spd->frames_gated++;
+}
+
+// analyses, gates and resynthesises one frame of `count` (<= frame_size) samples
+static void gate_frame(SpectralGateData* spd, const float* input, int count,
+                       float* smoothed_energy, int* is_silence) {
+    int digital_silence = analyse_frame(spd, input, count, smoothed_energy, is_silence);
+    gate_analysed(spd, *is_silence, digital_silence);
+}
+
+// one wola filterbank frame of the window_length samples at input: windowed by the
+// analysis prototype and folded into the frame_size point fft frame, gated like an
+// stft frame, then unfolded under the synthesis prototype into stream_ola. only
+// the 2 * hop - 1 samples around the middle of the synthesis prototype are nonzero
+static void wola_frame(SpectralGateData* spd, const float* input, float* smoothed_energy, int* is_silence) {
+    int frame_size = spd->config.frame_size;
+    int hop_size = spd->config.hop_size;
+    int taps = spd->window_length;
+    const float* analysis = spd->wola_analysis;
+    kiss_fft_scalar* in_buf = spd->in_buf;
+
+    float frame_energy = 0.0f;
+    int digital_silence = 1;
+    memset(in_buf, 0, frame_size * sizeof(kiss_fft_scalar));
+    for (int base = 0; base < taps; base += frame_size) {
+        for (int i = 0; i < frame_size; i++) {
+            float v = input[base + i] * analysis[base + i];
+            frame_energy += v * v;
+            digital_silence &= v == 0.0f;
+            in_buf[i] += (kiss_fft_scalar)v;
+        }
+    }
+    vad_update(spd, frame_energy * spd->wola_energy_norm, smoothed_energy, is_silence);
+    gate_analysed(spd, *is_silence, digital_silence);
+
+    for (int t = spd->stream_offset; t < taps / 2 + hop_size; t++) {
+        spd->stream_ola[t] += spd->time_buf[t % frame_size] * spd->wola_synthesis[t];
+    }
+}
+
+static int spectral_gate_start_streamed(SpectralGateData* spd, const float* input, float* output, long num_samples);
+static void apply_params(SpectralGateData* spd);
+
+// offline overlap-add (spectral_gate_start and its linked and two pass versions):
+// frames are scaled by stream_norm like the stream path's, so an open gate keeps
+// the input level in every mode. what lands past the end of a call is summed in
+// carry and added to the start of the next one
+
+// adds the carry of the previous call to output[lo, hi) and, when the call is
+// serial (lo == 0, hi == num_samples), shifts what is left of it to the front
+static void carry_in(float* carry, int frame_size, float* output, long lo, long hi, long num_samples) {
+    for (long t = lo; t < hi && t < frame_size; t++) {
+        output[t] += carry[t];
+    }
+    if (lo != 0 || hi != num_samples) return;
+    int used = num_samples < frame_size ? (int)num_samples : frame_size;
+    memmove(carry, carry + used, (frame_size - used) * sizeof(float));
+    memset(carry + frame_size - used, 0, used * sizeof(float));
+}
 
-    // allocating FFT buffers
-    kiss_fft_scalar* in_buf = (kiss_fft_scalar*)malloc(frame_size * sizeof(kiss_fft_scalar));
-    kiss_fft_cpx* freq_bins = (kiss_fft_cpx*)malloc((frame_size / 2 + 1) * sizeof(kiss_fft_cpx));
-    kiss_fft_cpx* out_freq_bins = (kiss_fft_cpx*)malloc((frame_size / 2 + 1) * sizeof(kiss_fft_cpx));
-    float* time_buf = (float*)malloc(frame_size * sizeof(float));
+// overlap-adds the frame at pos into output[lo, hi), and into carry (if not NULL)
+// where it runs past num_samples
+static void overlap_add(const SpectralGateData* spd, const float* frame, long pos, float* output,
+                        long lo, long hi, long num_samples, float* carry) {
+    int frame_size = spd->config.frame_size;
+    float norm = spd->stream_norm;
+    for (int i = 0; i < frame_size; i++) {
+        long t = pos + i;
+        if (t >= num_samples) {
+            if (carry) carry[t - num_samples] += frame[i] * norm;
+        } else if (t >= lo && t < hi) {
+            output[t] += frame[i] * norm;
+        }
+    }
+}
 
-    if (!in_buf || !freq_bins || !out_freq_bins || !time_buf) {
-        fprintf(stderr, "spectral_gate_process: out of memory for temp buffers\n");
-        free(in_buf);
-        free(freq_bins);
-        free(out_freq_bins);
-        free(time_buf);
+int spectral_gate_start(SpectralGateData* spd, const float* input, float* output, long num_samples) {
+    if (!spd || !spd->initialized || !input || !output) {
+        perror("spectral gate data invalid\n");
         return -1;
     }
+    if (spd->config.window_mode == SG_WINDOW_LOW_LATENCY || spd->config.engine == SG_ENGINE_WOLA) {
+        return spectral_gate_start_streamed(spd, input, output, num_samples);
+    }
+    uint64_t t0 = trace_begin();
+    state_load(spd);
+
+    int frame_size = spd->config.frame_size;
+    int hop_size = spd->config.hop_size;
+
+    float smoothed_energy = 0.0f;
+    int is_silence = 1;
+
+    memset(output, 0, sizeof(float) * num_samples);
+    carry_in(spd->overlap, frame_size, output, 0, num_samples, num_samples);
 
     long pos = 0;
     while (pos < num_samples) {  // Handle partial frames
@@ -124,83 +1019,879 @@ int spectral_gate_start(SpectralGateData* spd, const float* input, float* output
             current_frame_size = num_samples - pos;
         }
 
-        // window the audio signal and calculate frame energy for VAD
-        float frame_energy = 0.0f;
+        long frame = pos / hop_size;
+        uint64_t tf = trace_frame_sampled(frame) ? trace_begin() : 0;
+        apply_params(spd);
+        gate_frame(spd, input + pos, current_frame_size, &smoothed_energy, &is_silence);
+        trace_end("gate", "frame", tf, frame);
+
+        overlap_add(spd, spd->time_buf, pos, output, 0, num_samples, num_samples, spd->overlap);
+        pos += hop_size;
+    }
+
+    state_store(spd);
+    trace_end("gate", "spectral_gate_start", t0, num_samples);
+    return 0;
+}
+
+// linked gating (spectral_gate_start_linked, spectral_gate_stream_linked): every
+// channel is windowed and transformed, but the VAD, the noise tracking and the
+// gate decision run once on a detection spectrum, and the one mask goes to all
+// channels. mid uses the mean of the channel spectra, which is the spectrum of
+// the mid signal without an fft of its own, max the loudest channel per bin
+
+// windows `count` (<= frame_size) samples of every channel's frame into link_in,
+// runs the VAD on the detection signal and, unless the frame is digitally silent,
+// the noise tracking and the gate decision. leaves the mask in link_gains and sets
+// *open when it passes everything. returns 1 if the frame is digitally silent
+static int linked_frame(SpectralGateData* spd, const float* const* frames, int count, int channels,
+                        int link, float* smoothed_energy, int* is_silence, int* open) {
+    int frame_size = spd->config.frame_size;
+    const int num_bins = frame_size / 2 + 1;
+    kiss_fft_scalar* in_bufs = spd->shared->link_in;
+    kiss_fft_cpx* spectra = spd->shared->link_spectra;
+    float* gains = spd->shared->link_gains;
+    float* mag_buf = spd->mag_buf;
+    float alpha = spd->config.alpha;
+    float noise_floor_gain = db_to_gain(spd->config.noise_floor);
+
+    // window every channel, the detection signal's energy drives the VAD
+    float frame_energy = 0.0f;
+    int digital_silence = 1;
+    for (int c = 0; c < channels; c++) {
+        kiss_fft_scalar* in_buf = in_bufs + (size_t)c * frame_size;
+        float energy = 0.0f;
         memset(in_buf, 0, frame_size * sizeof(kiss_fft_scalar));
-        for (int i = 0; i < current_frame_size; i++) {
-            in_buf[i] = (kiss_fft_scalar)(input[pos + i] * spd->window[i]);
-            frame_energy += in_buf[i] * in_buf[i];
+        for (int i = 0; i < count; i++) {
+            in_buf[i] = (kiss_fft_scalar)(frames[c][i] * spd->window[i]);
+            energy += in_buf[i] * in_buf[i];
+            digital_silence &= in_buf[i] == 0.0f;
         }
-        frame_energy /= current_frame_size;  // Normalize
-
-        // update smoothed energy with exponential moving average
-        smoothed_energy = vad_smoothing * smoothed_energy + (1 - vad_smoothing) * frame_energy;
+        if (link == SG_LINK_MAX && energy > frame_energy) frame_energy = energy;
+    }
+    if (link == SG_LINK_MID) {
+        for (int i = 0; i < count; i++) {
+            float mid = 0.0f;
+            for (int c = 0; c < channels; c++) mid += in_bufs[(size_t)c * frame_size + i];
+            mid /= channels;
+            frame_energy += mid * mid;
+        }
+    }
+    vad_update(spd, frame_energy / count, smoothed_energy, is_silence);
 
-        if (is_silence) {
-            if (smoothed_energy > vad_threshold_high) {
-                is_silence = 0;
+    *open = 0;
+    if (digital_silence) {
+        if (*is_silence) update_noise(spd, 1);
+        spd->frames_silent++;
+        return 1;
+    }
+    for (int c = 0; c < channels; c++) {
+        kiss_fftr(spd->fwd_cfg, in_bufs + (size_t)c * frame_size, spectra + (size_t)c * num_bins);
+    }
+    if (link == SG_LINK_MID) {
+        for (int j = 0; j < num_bins; j++) {
+            float re = 0.0f;
+            float im = 0.0f;
+            for (int c = 0; c < channels; c++) {
+                re += spectra[(size_t)c * num_bins + j].r;
+                im += spectra[(size_t)c * num_bins + j].i;
+            }
+            spd->freq_bins[j].r = re / channels;
+            spd->freq_bins[j].i = im / channels;
+        }
+        frame_magnitudes(spd);
+    } else {
+        // gains doubles as the per bin maximum until the decision
+        for (int j = 0; j < num_bins; j++) {
+            float peak = 0.0f;
+            for (int c = 0; c < channels; c++) {
+                float re = spectra[(size_t)c * num_bins + j].r;
+                float im = spectra[(size_t)c * num_bins + j].i;
+                float mag = sqrtf(re*re + im*im);
+                if (mag > peak) peak = mag;
+            }
+            gains[j] = peak;
+        }
+        if (spd->num_bands > 0) {
+            for (int b = 0; b < spd->num_bands; b++) {
+                float sum = 0.0f;
+                for (int j = spd->band_edges[b]; j < spd->band_edges[b + 1]; j++) sum += gains[j];
+                mag_buf[b] = sum / (spd->band_edges[b + 1] - spd->band_edges[b]);
             }
         } else {
-            if (smoothed_energy < vad_threshold_low) {
-                is_silence = 1;
+            memcpy(mag_buf, gains, num_bins * sizeof(float));
+        }
+    }
+    if (*is_silence) update_noise(spd, 0);
+
+    // the gate decision, once for all channels
+    *open = 1;
+    if (spd->num_bands > 0) {
+        for (int b = 0; b < spd->num_bands; b++) {
+            spd->band_gain[b] = mag_buf[b] < alpha * spd->noise_est[b] ? noise_floor_gain : 1.0f;
+            *open &= spd->band_gain[b] == 1.0f;
+        }
+        for (int j = 0; !*open && j < num_bins; j++) {
+            gains[j] = band_to_bin(spd, spd->band_gain, j);
+        }
+    } else {
+        for (int j = 0; j < num_bins; j++) {
+            gains[j] = mag_buf[j] < alpha * spd->noise_est[j] ? noise_floor_gain : 1.0f;
+            *open &= gains[j] == 1.0f;
+        }
+    }
+    if (*open) {
+        spd->frames_passthrough++;
+    } else {
+        spd->frames_gated++;
+    }
+    return 0;
+}
+
+// channel c of the frame linked_frame decided on, resynthesised into time_buf
+static void linked_synth(SpectralGateData* spd, int c, int digital_silence, int open) {
+    int frame_size = spd->config.frame_size;
+    const int num_bins = frame_size / 2 + 1;
+    const kiss_fft_scalar* in_buf = spd->shared->link_in + (size_t)c * frame_size;
+    const kiss_fft_cpx* spectrum = spd->shared->link_spectra + (size_t)c * num_bins;
+    const float* gains = spd->shared->link_gains;
+    float* time_buf = spd->time_buf;
+    if (digital_silence) {
+        memset(time_buf, 0, frame_size * sizeof(float));
+    } else if (open) {
+        for (int i = 0; i < frame_size; i++) {
+            time_buf[i] = in_buf[i] * spd->synth_window[i];
+        }
+    } else {
+        for (int j = 0; j < num_bins; j++) {
+            spd->out_freq_bins[j].r = spectrum[j].r * gains[j];
+            spd->out_freq_bins[j].i = spectrum[j].i * gains[j];
+        }
+        synthesize(spd);
+    }
+}
+
+int spectral_gate_start_linked(SpectralGateData* spd, const float* const* inputs, float* const* outputs,
+                               int channels, long num_samples, int link) {
+    if (!spd || !spd->initialized || !inputs || !outputs || channels <= 0 ||
+        (link != SG_LINK_MID && link != SG_LINK_MAX)) {
+        perror("spectral gate data invalid\n");
+        return -1;
+    }
+    // the low latency windows and the wola engine go through the stream path, which isn't linked
+    if (channels == 1 || spd->config.window_mode != SG_WINDOW_HANN || spd->config.engine != SG_ENGINE_STFT) {
+        for (int c = 0; c < channels; c++) {
+            if (spectral_gate_start(spd, inputs[c], outputs[c], num_samples) != 0) return -1;
+        }
+        return 0;
+    }
+    if (channels > spd->config.link_channels) {
+        fprintf(stderr, "linked gate was set up for %d channels, got %d\n", spd->config.link_channels, channels);
+        return -1;
+    }
+    int frame_size = spd->config.frame_size;
+    int hop_size = spd->config.hop_size;
+    uint64_t t0 = trace_begin();
+    state_load(spd);
+
+    float smoothed_energy = 0.0f;
+    int is_silence = 1;
+    const float** frames = (const float**)spd->shared->link_frames;
+
+    for (int c = 0; c < channels; c++) {
+        memset(outputs[c], 0, sizeof(float) * num_samples);
+        carry_in(spd->link_overlap + (size_t)c * frame_size, frame_size, outputs[c], 0, num_samples, num_samples);
+    }
+
+    long pos = 0;
+    while (pos < num_samples) {
+        int count = pos + frame_size > num_samples ? (int)(num_samples - pos) : frame_size;
+        long frame = pos / hop_size;
+        uint64_t tf = trace_frame_sampled(frame) ? trace_begin() : 0;
+        apply_params(spd);
+        for (int c = 0; c < channels; c++) frames[c] = inputs[c] + pos;
+        int open;
+        int digital_silence = linked_frame(spd, frames, count, channels, link, &smoothed_energy, &is_silence, &open);
+
+        // resynthesis and overlap-add, channel by channel through time_buf. the
+        // carries are the instance's, like spectral_gate_start's overlap
+        for (int c = 0; c < channels; c++) {
+            linked_synth(spd, c, digital_silence, open);
+            overlap_add(spd, spd->time_buf, pos, outputs[c], 0, num_samples, num_samples,
+                        spd->link_overlap + (size_t)c * frame_size);
+        }
+        trace_end("gate", "linked frame", tf, frame);
+        pos += hop_size;
+    }
+
+    state_store(spd);
+    trace_end("gate", "spectral_gate_start_linked", t0, num_samples);
+    return 0;
+}
+
+// the streaming version keeps a stream_in / stream_ola / stream_out per channel
+// (link_stream_*) and hands out a hop of every channel once all of them have it
+int spectral_gate_stream_linked(SpectralGateData* spd, const float* const* inputs, float* const* outputs,
+                                int channels, long num_samples, int link) {
+    if (!spd || !spd->initialized || !inputs || !outputs || channels <= 0 ||
+        (link != SG_LINK_MID && link != SG_LINK_MAX)) {
+        perror("spectral gate data invalid\n");
+        return -1;
+    }
+    if (channels == 1) {
+        return spectral_gate_stream(spd, inputs[0], outputs[0], num_samples);
+    }
+    if (spd->config.engine != SG_ENGINE_STFT) {
+        fprintf(stderr, "the wola engine can't gate linked channels\n");
+        return -1;
+    }
+    if (channels > spd->config.link_channels) {
+        fprintf(stderr, "linked gate was set up for %d channels, got %d\n", spd->config.link_channels, channels);
+        return -1;
+    }
+    state_load(spd);
+
+    int frame_size = spd->config.frame_size;
+    int hop_size = spd->config.hop_size;
+    int tail = frame_size - hop_size;
+    const float** frames = (const float**)spd->shared->link_frames;
+    for (int c = 0; c < channels; c++) frames[c] = spd->link_stream_in + (size_t)c * frame_size;
+
+    long pos = 0;
+    while (pos < num_samples) {
+        // hand out the finished hop while taking in the next one, per channel
+        int n = hop_size - spd->link_fill;
+        if (n > num_samples - pos) {
+            n = (int)(num_samples - pos);
+        }
+        for (int c = 0; c < channels; c++) {
+            float* stream_in = spd->link_stream_in + (size_t)c * frame_size;
+            const float* stream_out = spd->link_stream_out + (size_t)c * hop_size;
+            memcpy(stream_in + tail + spd->link_fill, inputs[c] + pos, n * sizeof(float));
+            memcpy(outputs[c] + pos, stream_out + spd->link_fill, n * sizeof(float));
+        }
+        spd->link_fill += n;
+        pos += n;
+
+        if (spd->link_fill < hop_size) {
+            break;
+        }
+        spd->link_fill = 0;
+
+        apply_params(spd);
+        int open;
+        int digital_silence = linked_frame(spd, frames, frame_size, channels, link,
+                                           &spd->vad_energy, &spd->vad_silence, &open);
+        for (int c = 0; c < channels; c++) {
+            float* stream_in = spd->link_stream_in + (size_t)c * frame_size;
+            float* stream_ola = spd->link_stream_ola + (size_t)c * frame_size;
+            float* stream_out = spd->link_stream_out + (size_t)c * hop_size;
+            linked_synth(spd, c, digital_silence, open);
+            for (int i = 0; i < frame_size; i++) {
+                stream_ola[i] += spd->time_buf[i];
+            }
+            for (int i = 0; i < hop_size; i++) {
+                stream_out[i] = stream_ola[spd->stream_offset + i] * spd->stream_norm;
             }
+            memmove(stream_ola, stream_ola + hop_size, tail * sizeof(float));
+            memset(stream_ola + tail, 0, hop_size * sizeof(float));
+            memmove(stream_in, stream_in + hop_size, tail * sizeof(float));
         }
+    }
+    state_store(spd);
+    return 0;
+}
+
+// two pass offline gating (spectral_gate_start_mt). the only thing that keeps
+// spectral_gate_start serial is the VAD and noise_est recurrence, so pass one
+// runs just that: windowed frame energy for every frame and an fft for the
+// frames that feed the estimate. it records the VAD decision per frame and a
+// noise_est snapshot per block of frames. pass two gates the blocks on worker
+// gates of their own, in any order. a sample of a block is overlap-added from
+// the frames covering it in the same order as the serial loop, so each block
+// also recomputes the last few frames of the block before (lead-in) and only
+// keeps what lands in its own range, which makes the output bit-identical
 
-        // forward fft (real to complex)
-        kiss_fftr(spd->fwd_cfg, in_buf, freq_bins);
+typedef struct {
+    SpectralGateData* spd; // the caller's instance, read only while pass two runs
+    const float* input;
+    float* output;
+    long num_samples;
+    long num_frames;
+    long block_frames;
+    long num_blocks;
+    int lead_in;
+    const unsigned char* silence; // per frame VAD decision
+    const float* snapshots; // noise_est ahead of the first frame each block computes
+    float* last_overlap; // carry past the final sample, for the caller's state
+    atomic_long next_block;
+    atomic_int failed;
+} TwoPass;
 
-        // fill in frequency bins
-        for (int j = 0; j < (frame_size / 2 + 1); j++) {
-            float re = freq_bins[j].r;
-            float im = freq_bins[j].i;
-            float mag = sqrtf(re*re + im*im);
-            
-            // if frame is silent, update noise estimates
-            if (is_silence) {
-                spd->noise_est[j] = noise_decay * spd->noise_est[j] + (1.0f - noise_decay) * mag;
+typedef struct {
+    TwoPass* tp;
+    pthread_t thread;
+    long frames_gated;
+    long frames_silent;
+    long frames_passthrough;
+} TwoPassWorker;
+
+static long block_first_frame(const TwoPass* tp, long block) {
+    long first = block * tp->block_frames - tp->lead_in;
+    return first > 0 ? first : 0;
+}
+
+static void* two_pass_worker(void* arg) {
+    TwoPassWorker* w = (TwoPassWorker*)arg;
+    TwoPass* tp = w->tp;
+    const SpectralGateData* spd = tp->spd;
+    int frame_size = spd->config.frame_size;
+    int hop_size = spd->config.hop_size;
+    int num_noise = spd->shared->num_noise;
+
+    // plans and scratch of its own, state in float whatever the caller keeps
+    SpectralGateConfig config = spd->config;
+    config.compact_state = 0;
+    SpectralGateShared* shared = spectral_gate_shared_init_alloc(&config, &spd->shared->allocator);
+    SpectralGateData* gate = shared ? spectral_gate_init_shared_alloc(shared, &spd->allocator) : NULL;
+    if (!gate) {
+        atomic_store(&tp->failed, 1);
+        spectral_gate_shared_free(shared);
+        return NULL;
+    }
+
+    for (;;) {
+        long block = atomic_fetch_add(&tp->next_block, 1);
+        if (block >= tp->num_blocks || atomic_load(&tp->failed)) break;
+        long first = block * tp->block_frames;
+        long last = first + tp->block_frames < tp->num_frames ? first + tp->block_frames : tp->num_frames;
+        long start = block_first_frame(tp, block);
+        long lo = first * hop_size;
+        long hi = last == tp->num_frames ? tp->num_samples : last * hop_size;
+        uint64_t tb = trace_begin();
+
+        memcpy(gate->noise_est, tp->snapshots + block * num_noise, num_noise * sizeof(float));
+        // the caller's carry goes in ahead of the frames, like in the serial loop.
+        // the last block's frames make the new one, lead-in frames included
+        carry_in(spd->overlap, frame_size, tp->output, lo, hi, tp->num_samples);
+        float* carry = last == tp->num_frames ? tp->last_overlap : NULL;
+
+        for (long k = start; k < last; k++) {
+            long pos = k * hop_size;
+            int count = pos + frame_size > tp->num_samples ? (int)(tp->num_samples - pos) : frame_size;
+            if (k == first) {
+                gate->frames_gated = gate->frames_silent = gate->frames_passthrough = 0;
             }
+            uint64_t tf = k >= first && trace_frame_sampled(k) ? trace_begin() : 0;
+            float energy = 0.0f;
+            int is_silence = 1;
+            int digital_silence = analyse_frame(gate, tp->input + pos, count, &energy, &is_silence);
+            gate_analysed(gate, tp->silence[k], digital_silence);
+            trace_end("gate", "frame", tf, k);
+
+            overlap_add(gate, gate->time_buf, pos, tp->output, lo, hi, tp->num_samples, carry);
+        }
+        w->frames_gated += gate->frames_gated;
+        w->frames_silent += gate->frames_silent;
+        w->frames_passthrough += gate->frames_passthrough;
+        trace_end("gate", "two_pass_block", tb, block);
+    }
+
+    spectral_gate_free(gate);
+    spectral_gate_shared_free(shared);
+    return NULL;
+}
+
+static void* two_pass_thread(void* arg) {
+    trace_thread_name("gate worker");
+    return two_pass_worker(arg);
+}
+
+int spectral_gate_start_mt(SpectralGateData* spd, const float* input, float* output, long num_samples, int num_threads) {
+    if (!spd || !spd->initialized || !input || !output) {
+        perror("spectral gate data invalid\n");
+        return -1;
+    }
+    if (num_threads <= 0) {
+        num_threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    }
+    int frame_size = spd->config.frame_size;
+    int hop_size = spd->config.hop_size;
+    int lead_in = (frame_size + hop_size - 1) / hop_size;
+    long num_frames = (num_samples + hop_size - 1) / hop_size;
+
+    // blocks of at least TWO_PASS_MIN_BLOCK lead-ins keep the recomputed frames
+    // cheap, and a few blocks per thread even out the load
+    long block_frames = (num_frames + TWO_PASS_BLOCKS_PER_THREAD * num_threads - 1) /
+                        (TWO_PASS_BLOCKS_PER_THREAD * (long)num_threads);
+    if (block_frames < TWO_PASS_MIN_BLOCK * lead_in) block_frames = TWO_PASS_MIN_BLOCK * lead_in;
+    long num_blocks = (num_frames + block_frames - 1) / block_frames;
+    if (num_threads > num_blocks) num_threads = (int)num_blocks;
+    // the low latency windows and the wola engine go through the stream path, which stays serial
+    if (num_threads <= 1 || spd->config.window_mode != SG_WINDOW_HANN || spd->config.engine != SG_ENGINE_STFT) {
+        return spectral_gate_start(spd, input, output, num_samples);
+    }
+    // frames are gated out of order, so updates only land between calls
+    apply_params(spd);
+
+    const NrAllocator* a = &spd->allocator;
+    int num_noise = spd->shared->num_noise;
+    TwoPass tp;
+    memset(&tp, 0, sizeof(tp));
+    tp.spd = spd;
+    tp.input = input;
+    tp.output = output;
+    tp.num_samples = num_samples;
+    tp.num_frames = num_frames;
+    tp.block_frames = block_frames;
+    tp.num_blocks = num_blocks;
+    tp.lead_in = lead_in;
+    unsigned char* silence = (unsigned char*)nr_malloc(a, num_frames);
+    float* snapshots = (float*)nr_malloc(a, num_blocks * num_noise * sizeof(float));
+    tp.last_overlap = (float*)nr_calloc(a, frame_size, sizeof(float));
+    TwoPassWorker* workers = (TwoPassWorker*)nr_calloc(a, num_threads, sizeof(TwoPassWorker));
+    if (!silence || !snapshots || !tp.last_overlap || !workers) {
+        perror("failed to alloc two pass gate\n");
+        nr_free(a, silence);
+        nr_free(a, snapshots);
+        nr_free(a, tp.last_overlap);
+        nr_free(a, workers);
+        return -1;
+    }
+    tp.silence = silence;
+    tp.snapshots = snapshots;
+    atomic_init(&tp.next_block, 0);
+    atomic_init(&tp.failed, 0);
 
-            // noise gating
-            float threshold = alpha * spd->noise_est[j];
-            if (mag < threshold) {
-                mag *= noise_floor_gain;
+    // pass one: VAD and noise tracking, in order
+    uint64_t t0 = trace_begin();
+    state_load(spd);
+    float smoothed_energy = 0.0f;
+    int is_silence = 1;
+    long block = 0;
+    for (long k = 0; k < num_frames; k++) {
+        while (block < num_blocks && block_first_frame(&tp, block) == k) {
+            memcpy(snapshots + block * num_noise, spd->noise_est, num_noise * sizeof(float));
+            block++;
+        }
+        long pos = k * hop_size;
+        int count = pos + frame_size > num_samples ? (int)(num_samples - pos) : frame_size;
+        int digital_silence = analyse_frame(spd, input + pos, count, &smoothed_energy, &is_silence);
+        silence[k] = (unsigned char)is_silence;
+        if (is_silence) {
+            if (!digital_silence) {
+                kiss_fftr(spd->fwd_cfg, spd->in_buf, spd->freq_bins);
+                frame_magnitudes(spd);
             }
+            update_noise(spd, digital_silence);
+        }
+    }
+
+    trace_end("gate", "two_pass_vad", t0, num_frames);
+
+    // pass two: every block on its own, the calling thread being one worker
+    t0 = trace_begin();
+    memset(output, 0, sizeof(float) * num_samples);
+    for (int t = 0; t < num_threads; t++) {
+        workers[t].tp = &tp;
+    }
+    int started = 0;
+    for (int t = 1; t < num_threads; t++) {
+        if (pthread_create(&workers[t].thread, NULL, two_pass_thread, &workers[t]) != 0) {
+            break;
+        }
+        started = t;
+    }
+    two_pass_worker(&workers[0]);
+    for (int t = 1; t <= started; t++) {
+        pthread_join(workers[t].thread, NULL);
+    }
 
-            // making sure phase is preserved - takes up cycles might have to change when using the MCU
-            float phase = atan2f(im, re);
-            out_freq_bins[j].r = mag * cosf(phase);
-            out_freq_bins[j].i = mag * sinf(phase);
+    int status = atomic_load(&tp.failed) ? -1 : 0;
+    if (status == 0) {
+        memcpy(spd->overlap, tp.last_overlap, frame_size * sizeof(float));
+        for (int t = 0; t < num_threads; t++) {
+            spd->frames_gated += workers[t].frames_gated;
+            spd->frames_silent += workers[t].frames_silent;
+            spd->frames_passthrough += workers[t].frames_passthrough;
         }
+    } else {
+        fprintf(stderr, "spectral_gate_start_mt: failed to set up the worker gates\n");
+    }
+    state_store(spd);
+    trace_end("gate", "two_pass_gate", t0, num_frames);
 
-        // inverse fft (complex to real)
-        kiss_fftri(spd->inv_cfg, out_freq_bins, time_buf);
+    nr_free(a, silence);
+    nr_free(a, snapshots);
+    nr_free(a, tp.last_overlap);
+    nr_free(a, workers);
+    return status;
+}
 
-        // overlap add for smoother transition between frames
-        const float scale = 1.0f / frame_size;  // FFT scaling
-        for (int i = 0; i < frame_size; i++) {
-            float val = time_buf[i] * scale * spd->window[i];
-            if (pos + i < num_samples) {
-                output[pos + i] += val + spd->overlap[i];
+int spectral_gate_stream(SpectralGateData* spd, const float* input, float* output, long num_samples) {
+    if (!spd || !spd->initialized || !input || !output) {
+        perror("spectral gate data invalid\n");
+        return -1;
+    }
+    state_load(spd);
+
+    int frame_size = spd->config.frame_size;
+    int hop_size = spd->config.hop_size;
+    int window_length = spd->window_length;
+    int tail = window_length - hop_size;
+
+    long pos = 0;
+    while (pos < num_samples) {
+        // hand out the finished block while taking in the next hop of input
+        int n = hop_size - spd->stream_fill;
+        if (n > num_samples - pos) {
+            n = (int)(num_samples - pos);
+        }
+        memcpy(spd->stream_in + tail + spd->stream_fill, input + pos, n * sizeof(float));
+        memcpy(output + pos, spd->stream_out + spd->stream_fill, n * sizeof(float));
+        spd->stream_fill += n;
+        pos += n;
+
+        if (spd->stream_fill < hop_size) {
+            break;
+        }
+        spd->stream_fill = 0;
+
+        apply_params(spd);
+        // overlap-add, then the hop starting at stream_offset has seen every frame
+        // that covers it
+        if (spd->config.engine == SG_ENGINE_WOLA) {
+            wola_frame(spd, spd->stream_in, &spd->vad_energy, &spd->vad_silence);
+        } else {
+            gate_frame(spd, spd->stream_in, frame_size, &spd->vad_energy, &spd->vad_silence);
+            for (int i = 0; i < frame_size; i++) {
+                spd->stream_ola[i] += spd->time_buf[i];
             }
         }
+        for (int i = 0; i < hop_size; i++) {
+            spd->stream_out[i] = spd->stream_ola[spd->stream_offset + i] * spd->stream_norm;
+        }
+
+        memmove(spd->stream_ola, spd->stream_ola + hop_size, tail * sizeof(float));
+        memset(spd->stream_ola + tail, 0, hop_size * sizeof(float));
+        memmove(spd->stream_in, spd->stream_in + hop_size, tail * sizeof(float));
+    }
+    state_store(spd);
+    return 0;
+}
+
+void spectral_gate_stream_reset(SpectralGateData* spd) {
+    if (!spd || !spd->initialized) return;
+    // the float copies belong to whichever instance ran last in compact mode
+    if (spd->config.compact_state) {
+        memset(spd->stream_in_half, 0, spd->window_length * sizeof(uint16_t));
+        memset(spd->stream_ola_half, 0, spd->window_length * sizeof(uint16_t));
+    } else {
+        memset(spd->stream_in, 0, spd->window_length * sizeof(float));
+        memset(spd->stream_ola, 0, spd->window_length * sizeof(float));
+    }
+    memset(spd->stream_out, 0, spd->config.hop_size * sizeof(float));
+    spd->stream_fill = 0;
+    if (spd->link_stream_in) {
+        size_t channels = (size_t)spd->config.link_channels;
+        memset(spd->link_stream_in, 0, channels * spd->config.frame_size * sizeof(float));
+        memset(spd->link_stream_ola, 0, channels * spd->config.frame_size * sizeof(float));
+        memset(spd->link_stream_out, 0, channels * spd->config.hop_size * sizeof(float));
+    }
+    spd->link_fill = 0;
+    spd->vad_energy = 0.0f;
+    spd->vad_silence = 1;
+}
 
-        // update overlap buffer
-        int overlap_size = frame_size - hop_size;
-        for (int i = 0; i < overlap_size; i++) {
-            spd->overlap[i] = time_buf[i + hop_size] * scale * spd->window[i + hop_size];
+void spectral_gate_reset(SpectralGateData* spd) {
+    if (!spd || !spd->initialized) return;
+    spectral_gate_stream_reset(spd);
+    int num_noise = spd->shared->num_noise;
+    if (spd->config.compact_state) {
+        float baseline = NOISE_BASELINE;
+        uint16_t half;
+        half_from_float(&half, &baseline, 1);
+        for (int i = 0; i < num_noise; i++) {
+            spd->noise_half[i] = half;
         }
-        // clear remaining overlap in buffer
-        for (int i = overlap_size; i < frame_size; i++) {
-            spd->overlap[i] = 0.0f;
+        memset(spd->overlap_half, 0, spd->window_length * sizeof(uint16_t));
+    } else {
+        for (int i = 0; i < num_noise; i++) {
+            spd->noise_est[i] = NOISE_BASELINE;
         }
+        memset(spd->overlap, 0, spd->window_length * sizeof(float));
+    }
+    if (spd->link_overlap) {
+        memset(spd->link_overlap, 0, (size_t)spd->config.link_channels * spd->config.frame_size * sizeof(float));
+    }
+    spd->frames_gated = 0;
+    spd->frames_silent = 0;
+    spd->frames_passthrough = 0;
+}
 
-        pos += hop_size;
+static int params_valid(const SpectralGateParams* params) {
+    // the negated compares also catch nans
+    return !(params->alpha < 0.0f) && params->alpha == params->alpha &&
+           !(params->noise_decay < 0.0f || params->noise_decay > 1.0f) && params->noise_decay == params->noise_decay &&
+           params->noise_floor == params->noise_floor && params->silence_threshold == params->silence_threshold;
+}
+
+int spectral_gate_set_params(SpectralGateData* spd, const SpectralGateParams* params) {
+    if (!spd || !spd->initialized || !params || !params_valid(params)) {
+        return -1;
     }
+    struct SpectralGateParamBox* box = spd->params;
+    while (atomic_flag_test_and_set_explicit(&box->writing, memory_order_acquire)) {
+        // another control thread is mid update, it only takes a few stores
+    }
+    unsigned seq = atomic_load_explicit(&box->seq, memory_order_relaxed);
+    _Atomic float* slot = box->slots[(seq + 1) & 1];
+    // a reader still copying this half must see seq move if it sees our stores
+    atomic_thread_fence(memory_order_release);
+    atomic_store_explicit(&slot[0], params->alpha, memory_order_relaxed);
+    atomic_store_explicit(&slot[1], params->noise_floor, memory_order_relaxed);
+    atomic_store_explicit(&slot[2], params->noise_decay, memory_order_relaxed);
+    atomic_store_explicit(&slot[3], params->silence_threshold, memory_order_relaxed);
+    atomic_store_explicit(&box->seq, seq + 1, memory_order_release);
+    atomic_flag_clear_explicit(&box->writing, memory_order_release);
+    return 0;
+}
 
-    free(in_buf);
-    free(freq_bins);
-    free(out_freq_bins);
-    free(time_buf);
+// copies the published half, returns its sequence number
+static unsigned read_params(const struct SpectralGateParamBox* box, unsigned seq, SpectralGateParams* out) {
+    for (;;) {
+        const _Atomic float* slot = box->slots[seq & 1];
+        out->alpha = atomic_load_explicit(&slot[0], memory_order_relaxed);
+        out->noise_floor = atomic_load_explicit(&slot[1], memory_order_relaxed);
+        out->noise_decay = atomic_load_explicit(&slot[2], memory_order_relaxed);
+        out->silence_threshold = atomic_load_explicit(&slot[3], memory_order_relaxed);
+        atomic_thread_fence(memory_order_acquire);
+        unsigned again = atomic_load_explicit(&box->seq, memory_order_relaxed);
+        if (again == seq) return seq;
+        seq = again;
+    }
+}
 
+int spectral_gate_get_params(const SpectralGateData* spd, SpectralGateParams* params) {
+    if (!spd || !spd->initialized || !params) {
+        return -1;
+    }
+    const struct SpectralGateParamBox* box = spd->params;
+    unsigned seq = atomic_load_explicit(&box->seq, memory_order_acquire);
+    read_params(box, seq, params);
     return 0;
-}
\ No newline at end of file
+}
+
+// frame boundary: takes over values published since the last frame, if any
+static void apply_params(SpectralGateData* spd) {
+    unsigned seq = atomic_load_explicit(&spd->params->seq, memory_order_acquire);
+    if (seq == spd->params_seen) return;
+    SpectralGateParams params;
+    spd->params_seen = read_params(spd->params, seq, &params);
+    spd->config.alpha = params.alpha;
+    spd->config.noise_floor = params.noise_floor;
+    spd->config.noise_decay = params.noise_decay;
+    spd->config.silence_threshold = params.silence_threshold;
+}
+
+// offline run of the low latency windows and the wola engine: the stream path with
+// its delay taken out, so the output lines up with the input like the hann path
+static int spectral_gate_start_streamed(SpectralGateData* spd, const float* input, float* output, long num_samples) {
+    int hop_size = spd->config.hop_size;
+    long discard = spectral_gate_latency(spd);  // outputs that precede input[0]
+    spectral_gate_stream_reset(spd);
+
+    float* zeros = (float*)nr_calloc(&spd->allocator, hop_size, sizeof(float));
+    float* scratch = (float*)nr_malloc(&spd->allocator, hop_size * sizeof(float));
+    if (!zeros || !scratch) {
+        fprintf(stderr, "spectral_gate_start: out of memory for delay compensation\n");
+        nr_free(&spd->allocator, zeros);
+        nr_free(&spd->allocator, scratch);
+        return -1;
+    }
+
+    // feed the input followed by zeros until every input sample has come out
+    long fed = 0;
+    long written = 0;
+    while (written < num_samples) {
+        const float* src = zeros;
+        long n = hop_size;
+        if (fed < num_samples) {
+            src = input + fed;
+            if (n > num_samples - fed) n = num_samples - fed;
+        }
+        if (discard > 0) {
+            if (n > discard) n = discard;
+            spectral_gate_stream(spd, src, scratch, n);
+            discard -= n;
+        } else {
+            if (n > num_samples - written) n = num_samples - written;
+            spectral_gate_stream(spd, src, output + written, n);
+            written += n;
+        }
+        fed += n;
+    }
+
+    nr_free(&spd->allocator, zeros);
+    nr_free(&spd->allocator, scratch);
+    return 0;
+}
+
+static void put_u32(unsigned char* p, uint32_t v) {
+    p[0] = (unsigned char)(v & 0xff);
+    p[1] = (unsigned char)((v >> 8) & 0xff);
+    p[2] = (unsigned char)((v >> 16) & 0xff);
+    p[3] = (unsigned char)(v >> 24);
+}
+
+static uint32_t get_u32(const unsigned char* p) {
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+int spectral_gate_save_profile(const SpectralGateData* spd, int sample_rate, const char* filename) {
+    if (!spd || !spd->initialized || sample_rate <= 0 || !filename) {
+        perror("invalid args to spectral_gate_save_profile\n");
+        return -1;
+    }
+
+    state_load(spd);
+    uint32_t num_bins = (uint32_t)(spd->config.frame_size / 2 + 1);
+    unsigned char header[PROFILE_HEADER_SIZE];
+    memcpy(header, PROFILE_MAGIC, 4);
+    header[4] = PROFILE_VERSION;
+    header[5] = 0;
+    header[6] = 0; // reserved
+    header[7] = 0;
+    put_u32(header + 8, (uint32_t)spd->config.frame_size);
+    put_u32(header + 12, (uint32_t)sample_rate);
+    put_u32(header + 16, num_bins);
+
+    FILE* fp = fopen(filename, "wb");
+    if (!fp) {
+        perror("failed to open noise profile for writing\n");
+        return -1;
+    }
+    // profiles are always per bin, band estimates are spread over the bins like gains
+    int ok = fwrite(header, 1, PROFILE_HEADER_SIZE, fp) == PROFILE_HEADER_SIZE;
+    for (uint32_t i = 0; ok && i < num_bins; i++) {
+        uint32_t bits;
+        unsigned char le[4];
+        float est = spd->num_bands > 0 ? band_to_bin(spd, spd->noise_est, (int)i) : spd->noise_est[i];
+        memcpy(&bits, &est, sizeof(bits));
+        put_u32(le, bits);
+        ok = fwrite(le, 1, 4, fp) == 4;
+    }
+    if (fclose(fp) != 0) ok = 0;
+    if (!ok) {
+        fprintf(stderr, "spectral_gate_save_profile: failed to write %s\n", filename);
+        return -1;
+    }
+    return 0;
+}
+
+// per bin estimates to band estimates, the band mean like the gate uses
+static void bins_to_bands(SpectralGateData* spd, const float* bins) {
+    for (int b = 0; b < spd->num_bands; b++) {
+        float sum = 0.0f;
+        for (int j = spd->band_edges[b]; j < spd->band_edges[b + 1]; j++) {
+            sum += bins[j];
+        }
+        spd->noise_est[b] = sum / (spd->band_edges[b + 1] - spd->band_edges[b]);
+    }
+}
+
+int spectral_gate_load_profile(SpectralGateData* spd, int sample_rate, const char* filename) {
+    if (!spd || !spd->initialized || sample_rate <= 0 || !filename) {
+        perror("invalid args to spectral_gate_load_profile\n");
+        return -1;
+    }
+
+    FILE* fp = fopen(filename, "rb");
+    if (!fp) {
+        perror("failed to open noise profile\n");
+        return -1;
+    }
+    unsigned char header[PROFILE_HEADER_SIZE];
+    if (fread(header, 1, PROFILE_HEADER_SIZE, fp) != PROFILE_HEADER_SIZE ||
+        memcmp(header, PROFILE_MAGIC, 4) != 0 || header[4] != PROFILE_VERSION) {
+        fprintf(stderr, "spectral_gate_load_profile: %s is not a noise profile\n", filename);
+        fclose(fp);
+        return -1;
+    }
+    uint32_t src_frame_size = get_u32(header + 8);
+    uint32_t src_rate = get_u32(header + 12);
+    uint32_t src_bins = get_u32(header + 16);
+    if (src_frame_size < 2 || src_rate == 0 || src_bins != src_frame_size / 2 + 1) {
+        fprintf(stderr, "spectral_gate_load_profile: corrupt header in %s\n", filename);
+        fclose(fp);
+        return -1;
+    }
+
+    float* src = (float*)nr_malloc(&spd->allocator, src_bins * sizeof(float));
+    if (!src) {
+        perror("failed to alloc noise profile\n");
+        fclose(fp);
+        return -1;
+    }
+    for (uint32_t i = 0; i < src_bins; i++) {
+        unsigned char le[4];
+        if (fread(le, 1, 4, fp) != 4) {
+            fprintf(stderr, "spectral_gate_load_profile: truncated %s\n", filename);
+            nr_free(&spd->allocator, src);
+            fclose(fp);
+            return -1;
+        }
+        uint32_t bits = get_u32(le);
+        memcpy(&src[i], &bits, sizeof(bits));
+    }
+    fclose(fp);
+
+    int frame_size = spd->config.frame_size;
+    int num_bins = frame_size / 2 + 1;
+    state_load(spd);
+    if ((int)src_frame_size == frame_size && (int)src_rate == sample_rate) {
+        if (spd->num_bands > 0) {
+            bins_to_bands(spd, src);
+        } else {
+            memcpy(spd->noise_est, src, num_bins * sizeof(float));
+        }
+        state_store(spd);
+        nr_free(&spd->allocator, src);
+        return 0;
+    }
+
+    // band mode interpolates into scratch first and then averages per band
+    float* dst = spd->noise_est;
+    if (spd->num_bands > 0) {
+        dst = (float*)nr_malloc(&spd->allocator, num_bins * sizeof(float));
+        if (!dst) {
+            perror("failed to alloc noise profile\n");
+            nr_free(&spd->allocator, src);
+            return -1;
+        }
+    }
+
+    // resample the profile along frequency. bin magnitudes of noise grow with the
+    // window energy, ie. with sqrt(frame_size) for the same window shape
+    float level = sqrtf((float)frame_size / (float)src_frame_size);
+    for (int k = 0; k < num_bins; k++) {
+        double freq = (double)k * sample_rate / frame_size;
+        double x = freq * src_frame_size / src_rate;
+        int i = (int)x;
+        float est;
+        if (i >= (int)src_bins - 1) {
+            est = src[src_bins - 1]; // past the profile's nyquist, hold the top bin
+        } else {
+            float t = (float)(x - i);
+            est = src[i] + t * (src[i + 1] - src[i]);
+        }
+        dst[k] = est * level;
+    }
+    if (dst != spd->noise_est) {
+        bins_to_bands(spd, dst);
+        nr_free(&spd->allocator, dst);
+    }
+    state_store(spd);
+    nr_free(&spd->allocator, src);
+    return 0;
+}
@@ -0,0 +1,78 @@
+#include "nr_alloc.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+static void* default_alloc(void* ctx, size_t size) {
+  (void)ctx;
+  return malloc(size);
+}
+
+static void default_free(void* ctx, void* ptr) {
+  (void)ctx;
+  free(ptr);
+}
+
+static void* default_aligned_alloc(void* ctx, size_t alignment, size_t size) {
+  (void)ctx;
+#ifdef _WIN32
+  // no posix_memalign, and _aligned_malloc blocks can't go to free()
+  (void)alignment;
+  return malloc(size);
+#else
+  void* ptr = NULL;
+  if (alignment < sizeof(void*)) alignment = sizeof(void*);
+  return posix_memalign(&ptr, alignment, size) == 0 ? ptr : NULL;
+#endif
+}
+
+static const NrAllocator default_allocator = {default_alloc, default_free,
+                                              default_aligned_alloc, NULL};
+static NrAllocator process_allocator = {default_alloc, default_free,
+                                        default_aligned_alloc, NULL};
+
+void nr_set_allocator(const NrAllocator* allocator) {
+  process_allocator =
+      allocator && allocator->alloc && allocator->free ? *allocator : default_allocator;
+}
+
+const NrAllocator* nr_get_allocator(void) {
+  return &process_allocator;
+}
+
+void* nr_malloc(const NrAllocator* a, size_t size) {
+  if (!a) a = &process_allocator;
+  return a->alloc(a->ctx, size ? size : 1);
+}
+
+void* nr_calloc(const NrAllocator* a, size_t count, size_t size) {
+  if (size && count > SIZE_MAX / size) return NULL;
+  void* ptr = nr_malloc(a, count * size);
+  if (ptr) memset(ptr, 0, count * size);
+  return ptr;
+}
+
+void* nr_aligned_alloc(const NrAllocator* a, size_t alignment, size_t size) {
+  if (!a) a = &process_allocator;
+  if (!a->aligned_alloc) return a->alloc(a->ctx, size ? size : 1);
+  return a->aligned_alloc(a->ctx, alignment, size ? size : 1);
+}
+
+void* nr_realloc(const NrAllocator* a, void* ptr, size_t old_size, size_t new_size) {
+  if (!a) a = &process_allocator;
+  if (a->alloc == default_alloc) return realloc(ptr, new_size ? new_size : 1);
+  void* grown = a->alloc(a->ctx, new_size ? new_size : 1);
+  if (!grown) return NULL;  // like realloc, ptr is left alone
+  if (ptr) {
+    memcpy(grown, ptr, old_size < new_size ? old_size : new_size);
+    a->free(a->ctx, ptr);
+  }
+  return grown;
+}
+
+void nr_free(const NrAllocator* a, void* ptr) {
+  if (!ptr) return;
+  if (!a) a = &process_allocator;
+  a->free(a->ctx, ptr);
+}
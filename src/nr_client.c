@@ -0,0 +1,218 @@
+#define _GNU_SOURCE
+#include "nr_client.h"
+
+// memfd and SCM_RIGHTS, the daemon is linux only
+#ifdef __linux__
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "nr_alloc.h"
+#include "nr_ipc.h"
+
+struct NrClient {
+  int sock;
+  int memfd;
+  float* ring;
+  size_t ring_bytes;
+  int slots;
+  int slot_frames;
+  int latency;
+
+  long next_seq;  // sequence number of the next submit
+  long done_seq;  // every block before this one has come back
+  long* frames;   // frames of the block in each slot
+};
+
+static int send_msg(int sock, const void* msg, size_t size, int fd) {
+  struct iovec iov = {(void*)msg, size};
+  struct msghdr mh;
+  memset(&mh, 0, sizeof(mh));
+  mh.msg_iov = &iov;
+  mh.msg_iovlen = 1;
+
+  // the ring's memfd rides along with the open message
+  char control[CMSG_SPACE(sizeof(int))];
+  if (fd >= 0) {
+    memset(control, 0, sizeof(control));
+    mh.msg_control = control;
+    mh.msg_controllen = sizeof(control);
+    struct cmsghdr* cm = CMSG_FIRSTHDR(&mh);
+    cm->cmsg_level = SOL_SOCKET;
+    cm->cmsg_type = SCM_RIGHTS;
+    cm->cmsg_len = CMSG_LEN(sizeof(int));
+    memcpy(CMSG_DATA(cm), &fd, sizeof(int));
+  }
+
+  ssize_t n;
+  do {
+    n = sendmsg(sock, &mh, MSG_NOSIGNAL);
+  } while (n < 0 && errno == EINTR);
+  return n == (ssize_t)size ? 0 : -1;
+}
+
+static int recv_msg(int sock, NrMsg* msg) {
+  ssize_t n;
+  do {
+    n = recv(sock, msg, sizeof(*msg), 0);
+  } while (n < 0 && errno == EINTR);
+  return n == (ssize_t)sizeof(*msg) ? 0 : -1;
+}
+
+NrClient* nr_client_open(const char* socket_path,
+                         const SpectralGateConfig* config, int slots,
+                         int slot_frames) {
+  if (!config || slots <= 0 || slot_frames <= 0 ||
+      nr_ring_bytes((uint32_t)slots, (uint32_t)slot_frames) == 0) {
+    fprintf(stderr, "nr_client_open: invalid arguments\n");
+    return NULL;
+  }
+  if (!socket_path) socket_path = NR_IPC_DEFAULT_SOCKET;
+
+  NrClient* client = (NrClient*)nr_calloc(NULL, 1, sizeof(NrClient));
+  if (!client) {
+    perror("failed to allocate client");
+    return NULL;
+  }
+  client->sock = -1;
+  client->memfd = -1;
+  client->slots = slots;
+  client->slot_frames = slot_frames;
+  client->frames = (long*)nr_calloc(NULL, slots, sizeof(long));
+  if (!client->frames) {
+    perror("failed to allocate client");
+    nr_client_close(client);
+    return NULL;
+  }
+
+  // the ring lives in an anonymous memfd that both processes map. its size is
+  // sealed, the daemon refuses a ring that could shrink under its mapping
+  client->ring_bytes = (size_t)nr_ring_bytes(slots, slot_frames);
+  client->memfd = memfd_create("nr_ring", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+  if (client->memfd < 0 ||
+      ftruncate(client->memfd, (off_t)client->ring_bytes) != 0 ||
+      fcntl(client->memfd, F_ADD_SEALS,
+            F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL) != 0) {
+    perror("failed to create shared ring");
+    nr_client_close(client);
+    return NULL;
+  }
+  void* ring = mmap(NULL, client->ring_bytes, PROT_READ | PROT_WRITE,
+                    MAP_SHARED, client->memfd, 0);
+  if (ring == MAP_FAILED) {
+    perror("failed to map shared ring");
+    nr_client_close(client);
+    return NULL;
+  }
+  client->ring = (float*)ring;
+
+  struct sockaddr_un addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  if (strlen(socket_path) >= sizeof(addr.sun_path)) {
+    fprintf(stderr, "nr_client_open: socket path too long\n");
+    nr_client_close(client);
+    return NULL;
+  }
+  strcpy(addr.sun_path, socket_path);
+  client->sock = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+  if (client->sock < 0 ||
+      connect(client->sock, (struct sockaddr*)&addr, sizeof(addr)) != 0) {
+    fprintf(stderr, "nr_client_open: can't connect to %s: %s\n", socket_path,
+            strerror(errno));
+    nr_client_close(client);
+    return NULL;
+  }
+
+  NrOpenMsg open_msg;
+  memset(&open_msg, 0, sizeof(open_msg));
+  open_msg.type = NR_MSG_OPEN;
+  open_msg.magic = NR_IPC_MAGIC;
+  open_msg.version = NR_IPC_VERSION;
+  open_msg.slots = (uint32_t)slots;
+  open_msg.slot_frames = (uint32_t)slot_frames;
+  open_msg.config = *config;
+  NrMsg reply;
+  if (send_msg(client->sock, &open_msg, sizeof(open_msg), client->memfd) != 0 ||
+      recv_msg(client->sock, &reply) != 0 || reply.type != NR_MSG_OPENED ||
+      reply.status != 0) {
+    fprintf(stderr, "nr_client_open: daemon refused the gate\n");
+    nr_client_close(client);
+    return NULL;
+  }
+  client->latency = (int)reply.seq;
+  return client;
+}
+
+float* nr_client_buffer(NrClient* client) {
+  if (!client || client->next_seq - client->done_seq >= client->slots) {
+    return NULL;
+  }
+  return client->ring + (client->next_seq % client->slots) * client->slot_frames;
+}
+
+long nr_client_submit(NrClient* client, long frames) {
+  if (!nr_client_buffer(client) || frames <= 0 ||
+      frames > client->slot_frames) {
+    fprintf(stderr, "nr_client_submit: no free slot or bad frame count\n");
+    return -1;
+  }
+  NrMsg msg = {NR_MSG_SUBMIT, 0, client->next_seq, frames};
+  if (send_msg(client->sock, &msg, sizeof(msg), -1) != 0) {
+    perror("nr_client_submit");
+    return -1;
+  }
+  client->frames[client->next_seq % client->slots] = frames;
+  return client->next_seq++;
+}
+
+long nr_client_wait(NrClient* client, long seq, float** output) {
+  if (!client || seq < 0 || seq >= client->next_seq) {
+    fprintf(stderr, "nr_client_wait: block was never submitted\n");
+    return -1;
+  }
+  if (seq + client->slots < client->next_seq) {
+    fprintf(stderr, "nr_client_wait: slot of block %ld was reused\n", seq);
+    return -1;
+  }
+  // blocks come back in order, so read replies up to seq
+  while (client->done_seq <= seq) {
+    NrMsg reply;
+    if (recv_msg(client->sock, &reply) != 0 || reply.type != NR_MSG_DONE ||
+        reply.seq != client->done_seq) {
+      fprintf(stderr, "nr_client_wait: lost the daemon\n");
+      return -1;
+    }
+    if (reply.status != 0) {
+      fprintf(stderr, "nr_client_wait: daemon failed block %ld\n",
+              (long)reply.seq);
+      return -1;
+    }
+    client->done_seq++;
+  }
+  int slot = (int)(seq % client->slots);
+  if (output) *output = client->ring + (long)slot * client->slot_frames;
+  return client->frames[slot];
+}
+
+int nr_client_latency(const NrClient* client) {
+  return client ? client->latency : -1;
+}
+
+void nr_client_close(NrClient* client) {
+  if (!client) return;
+  if (client->sock >= 0) close(client->sock);
+  if (client->ring) munmap(client->ring, client->ring_bytes);
+  if (client->memfd >= 0) close(client->memfd);
+  nr_free(NULL, client->frames);
+  nr_free(NULL, client);
+}
+
+#endif  // __linux__
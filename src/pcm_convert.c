@@ -0,0 +1,359 @@
+#include "pcm_convert.h"
+
+#include <math.h>
+#include <string.h>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define PCM_CONVERT_SSE2 1
+#endif
+#if defined(PCM_CONVERT_SSE2) && defined(__SSSE3__)
+#include <tmmintrin.h>
+#define PCM_CONVERT_SSSE3 1
+#endif
+
+#define S16_SCALE (1.0f / 32768.0f)
+#define S24_SCALE (1.0f / 8388608.0f)
+#define S16_MAX 32767.0f
+#define S24_MAX 8388607.0f
+
+static inline float raise_peak(float peak, float v) {
+  v = fabsf(v);
+  return v > peak ? v : peak;
+}
+
+// nan goes out as 0, like the truncating casts of lrintf's nan result did
+static inline float clip_unit(float v) {
+  if (v != v) return 0.0f;
+  if (v > 1.0f) return 1.0f;
+  if (v < -1.0f) return -1.0f;
+  return v;
+}
+
+#ifdef PCM_CONVERT_SSE2
+static inline __m128 abs_ps(__m128 v) {
+  return _mm_andnot_ps(_mm_set1_ps(-0.0f), v);
+}
+
+// nan lanes leave the running peak alone, same as the scalar compare
+static inline __m128 raise_peak_ps(__m128 peak, __m128 v) {
+  return _mm_max_ps(abs_ps(v), peak);
+}
+
+static inline float peak_lanes(__m128 v) {
+  float lanes[4];
+  _mm_storeu_ps(lanes, v);
+  float peak = lanes[0] > lanes[1] ? lanes[0] : lanes[1];
+  if (lanes[2] > peak) peak = lanes[2];
+  return lanes[3] > peak ? lanes[3] : peak;
+}
+
+// clipped to [-1, 1] and scaled, nan as 0, rounded to nearest even (lrintf in
+// the default rounding mode)
+static inline __m128i scale_clip_ps(__m128 v, float max) {
+  v = _mm_and_ps(v, _mm_cmpord_ps(v, v));
+  v = _mm_min_ps(_mm_max_ps(v, _mm_set1_ps(-1.0f)), _mm_set1_ps(1.0f));
+  return _mm_cvtps_epi32(_mm_mul_ps(v, _mm_set1_ps(max)));
+}
+#endif
+
+void pcm_peak(const float* in, long count, float* peak) {
+  if (!peak) return;
+  float p = *peak;
+  long i = 0;
+#ifdef PCM_CONVERT_SSE2
+  __m128 acc = _mm_set1_ps(p);
+  for (; i + 4 <= count; i += 4) {
+    acc = raise_peak_ps(acc, _mm_loadu_ps(in + i));
+  }
+  p = peak_lanes(acc);
+#endif
+  for (; i < count; i++) p = raise_peak(p, in[i]);
+  *peak = p;
+}
+
+// the strided fallback, frames [start, frames)
+static inline void interleave_scalar(const float* const* in, float* out, int channels,
+                                     long start, long frames) {
+  for (long i = start; i < frames; i++) {
+    for (int c = 0; c < channels; c++) out[i * channels + c] = in[c][i];
+  }
+}
+
+static inline void deinterleave_scalar(const float* in, float* const* out, int channels,
+                                       long start, long frames) {
+  for (long i = start; i < frames; i++) {
+    for (int c = 0; c < channels; c++) out[c][i] = in[i * channels + c];
+  }
+}
+
+void pcm_interleave(const float* const* in, float* out, int channels, long frames) {
+  long i = 0;
+  switch (channels) {
+    case 1:
+      memcpy(out, in[0], frames * sizeof(float));
+      return;
+#ifdef PCM_CONVERT_SSE2
+    case 2:
+      for (; i + 4 <= frames; i += 4) {
+        __m128 l = _mm_loadu_ps(in[0] + i);
+        __m128 r = _mm_loadu_ps(in[1] + i);
+        _mm_storeu_ps(out + 2 * i, _mm_unpacklo_ps(l, r));
+        _mm_storeu_ps(out + 2 * i + 4, _mm_unpackhi_ps(l, r));
+      }
+      break;
+    case 4:
+    case 8:
+      // 4x4 transposes, the second half of each 8 channel frame from in[4..7]
+      for (; i + 4 <= frames; i += 4) {
+        for (int half = 0; half < channels; half += 4) {
+          __m128 r0 = _mm_loadu_ps(in[half] + i);
+          __m128 r1 = _mm_loadu_ps(in[half + 1] + i);
+          __m128 r2 = _mm_loadu_ps(in[half + 2] + i);
+          __m128 r3 = _mm_loadu_ps(in[half + 3] + i);
+          _MM_TRANSPOSE4_PS(r0, r1, r2, r3);
+          float* dst = out + i * channels + half;
+          _mm_storeu_ps(dst, r0);
+          _mm_storeu_ps(dst + channels, r1);
+          _mm_storeu_ps(dst + 2 * channels, r2);
+          _mm_storeu_ps(dst + 3 * channels, r3);
+        }
+      }
+      break;
+#endif
+    case 3:
+      // constant strides so the compiler unrolls the inner loop
+      interleave_scalar(in, out, 3, 0, frames);
+      return;
+    case 6:
+      interleave_scalar(in, out, 6, 0, frames);
+      return;
+    default:
+      break;
+  }
+  interleave_scalar(in, out, channels, i, frames);
+}
+
+void pcm_deinterleave(const float* in, float* const* out, int channels, long frames) {
+  long i = 0;
+  switch (channels) {
+    case 1:
+      memcpy(out[0], in, frames * sizeof(float));
+      return;
+#ifdef PCM_CONVERT_SSE2
+    case 2:
+      for (; i + 4 <= frames; i += 4) {
+        __m128 a = _mm_loadu_ps(in + 2 * i);
+        __m128 b = _mm_loadu_ps(in + 2 * i + 4);
+        _mm_storeu_ps(out[0] + i, _mm_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0)));
+        _mm_storeu_ps(out[1] + i, _mm_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1)));
+      }
+      break;
+    case 4:
+    case 8:
+      for (; i + 4 <= frames; i += 4) {
+        for (int half = 0; half < channels; half += 4) {
+          const float* src = in + i * channels + half;
+          __m128 r0 = _mm_loadu_ps(src);
+          __m128 r1 = _mm_loadu_ps(src + channels);
+          __m128 r2 = _mm_loadu_ps(src + 2 * channels);
+          __m128 r3 = _mm_loadu_ps(src + 3 * channels);
+          _MM_TRANSPOSE4_PS(r0, r1, r2, r3);
+          _mm_storeu_ps(out[half] + i, r0);
+          _mm_storeu_ps(out[half + 1] + i, r1);
+          _mm_storeu_ps(out[half + 2] + i, r2);
+          _mm_storeu_ps(out[half + 3] + i, r3);
+        }
+      }
+      break;
+#endif
+    case 3:
+      deinterleave_scalar(in, out, 3, 0, frames);
+      return;
+    case 6:
+      deinterleave_scalar(in, out, 6, 0, frames);
+      return;
+    default:
+      break;
+  }
+  deinterleave_scalar(in, out, channels, i, frames);
+}
+
+void pcm_extract_channel(const float* in, float* out, int channels, int ch, long frames) {
+  long i = 0;
+  if (channels == 1) {
+    memcpy(out, in, frames * sizeof(float));
+    return;
+  }
+#ifdef PCM_CONVERT_SSE2
+  if (channels == 2) {
+    for (; i + 4 <= frames; i += 4) {
+      __m128 a = _mm_loadu_ps(in + 2 * i);
+      __m128 b = _mm_loadu_ps(in + 2 * i + 4);
+      _mm_storeu_ps(out + i, ch == 0 ? _mm_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0))
+                                     : _mm_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1)));
+    }
+  }
+#endif
+  for (; i < frames; i++) out[i] = in[i * channels + ch];
+}
+
+void pcm_insert_channel(const float* in, float* out, int channels, int ch, long frames) {
+  long i = 0;
+  if (channels == 1) {
+    memcpy(out, in, frames * sizeof(float));
+    return;
+  }
+#ifdef PCM_CONVERT_SSE2
+  if (channels == 2) {
+    // the other channel is read back and the pairs rebuilt around it
+    for (; i + 4 <= frames; i += 4) {
+      __m128 x = _mm_loadu_ps(in + i);
+      __m128 a = _mm_loadu_ps(out + 2 * i);
+      __m128 b = _mm_loadu_ps(out + 2 * i + 4);
+      __m128 l, r;
+      if (ch == 0) {
+        l = x;
+        r = _mm_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1));
+      } else {
+        l = _mm_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0));
+        r = x;
+      }
+      _mm_storeu_ps(out + 2 * i, _mm_unpacklo_ps(l, r));
+      _mm_storeu_ps(out + 2 * i + 4, _mm_unpackhi_ps(l, r));
+    }
+  }
+#endif
+  for (; i < frames; i++) out[i * channels + ch] = in[i];
+}
+
+void pcm_fixed_to_float(const int32_t* const* in, float* out, int channels, long frames,
+                        int frac_bits, float* peak) {
+  // a power of 2, so scaling after the int to float rounding is exact
+  const float scale = 1.0f / (float)(1L << frac_bits);
+  float p = peak ? *peak : 0.0f;
+  long i = 0;
+#ifdef PCM_CONVERT_SSE2
+  const __m128 vscale = _mm_set1_ps(scale);
+  __m128 acc = _mm_set1_ps(p);
+  if (channels == 1) {
+    for (; i + 4 <= frames; i += 4) {
+      __m128 v = _mm_mul_ps(_mm_cvtepi32_ps(_mm_loadu_si128((const __m128i*)(in[0] + i))),
+                            vscale);
+      acc = raise_peak_ps(acc, v);
+      _mm_storeu_ps(out + i, v);
+    }
+  } else if (channels == 2) {
+    for (; i + 4 <= frames; i += 4) {
+      __m128 l = _mm_mul_ps(_mm_cvtepi32_ps(_mm_loadu_si128((const __m128i*)(in[0] + i))),
+                            vscale);
+      __m128 r = _mm_mul_ps(_mm_cvtepi32_ps(_mm_loadu_si128((const __m128i*)(in[1] + i))),
+                            vscale);
+      acc = raise_peak_ps(raise_peak_ps(acc, l), r);
+      _mm_storeu_ps(out + 2 * i, _mm_unpacklo_ps(l, r));
+      _mm_storeu_ps(out + 2 * i + 4, _mm_unpackhi_ps(l, r));
+    }
+  }
+  p = peak_lanes(acc);
+#endif
+  for (; i < frames; i++) {
+    for (int c = 0; c < channels; c++) {
+      float v = (float)in[c][i] * scale;
+      p = raise_peak(p, v);
+      out[i * channels + c] = v;
+    }
+  }
+  if (peak) *peak = p;
+}
+
+void pcm_s16_to_float(const unsigned char* in, float* out, long count, float* peak) {
+  float p = peak ? *peak : 0.0f;
+  long i = 0;
+#ifdef PCM_CONVERT_SSE2
+  const __m128 scale = _mm_set1_ps(S16_SCALE);
+  __m128 acc = _mm_set1_ps(p);
+  for (; i + 8 <= count; i += 8) {
+    __m128i v = _mm_loadu_si128((const __m128i*)(in + 2 * i));
+    // each sample into the top half of a lane, then shifted down with its sign
+    __m128 lo = _mm_mul_ps(_mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpacklo_epi16(v, v), 16)), scale);
+    __m128 hi = _mm_mul_ps(_mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpackhi_epi16(v, v), 16)), scale);
+    acc = raise_peak_ps(raise_peak_ps(acc, lo), hi);
+    _mm_storeu_ps(out + i, lo);
+    _mm_storeu_ps(out + i + 4, hi);
+  }
+  p = peak_lanes(acc);
+#endif
+  for (; i < count; i++) {
+    int16_t v = (int16_t)(uint16_t)(in[2 * i] | (in[2 * i + 1] << 8));
+    out[i] = (float)v * S16_SCALE;
+    p = raise_peak(p, out[i]);
+  }
+  if (peak) *peak = p;
+}
+
+void pcm_s24_to_float(const unsigned char* in, float* out, long count, float* peak) {
+  float p = peak ? *peak : 0.0f;
+  long i = 0;
+#ifdef PCM_CONVERT_SSSE3
+  // the 3 bytes of sample k into the top of lane k, the shift sign extends
+  const __m128i spread = _mm_setr_epi8(-1, 0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11);
+  const __m128 scale = _mm_set1_ps(S24_SCALE);
+  __m128 acc = _mm_set1_ps(p);
+  for (; i + 4 <= count; i += 4) {
+    const unsigned char* src = in + 3 * i;
+    int32_t tail;
+    memcpy(&tail, src + 8, 4);  // 12 bytes, no read past the samples
+    __m128i v = _mm_unpacklo_epi64(_mm_loadl_epi64((const __m128i*)src), _mm_cvtsi32_si128(tail));
+    v = _mm_srai_epi32(_mm_shuffle_epi8(v, spread), 8);
+    __m128 f = _mm_mul_ps(_mm_cvtepi32_ps(v), scale);
+    acc = raise_peak_ps(acc, f);
+    _mm_storeu_ps(out + i, f);
+  }
+  p = peak_lanes(acc);
+#endif
+  for (; i < count; i++) {
+    const unsigned char* s = in + 3 * i;
+    int32_t v = (int32_t)((uint32_t)s[0] << 8 | (uint32_t)s[1] << 16 | (uint32_t)s[2] << 24) >>
+                8;  // sign extend
+    out[i] = (float)v * S24_SCALE;
+    p = raise_peak(p, out[i]);
+  }
+  if (peak) *peak = p;
+}
+
+void pcm_float_to_s16(const float* in, unsigned char* out, long count) {
+  long i = 0;
+#ifdef PCM_CONVERT_SSE2
+  for (; i + 8 <= count; i += 8) {
+    __m128i lo = scale_clip_ps(_mm_loadu_ps(in + i), S16_MAX);
+    __m128i hi = scale_clip_ps(_mm_loadu_ps(in + i + 4), S16_MAX);
+    _mm_storeu_si128((__m128i*)(out + 2 * i), _mm_packs_epi32(lo, hi));
+  }
+#endif
+  for (; i < count; i++) {
+    uint16_t v = (uint16_t)(int16_t)lrintf(clip_unit(in[i]) * S16_MAX);
+    out[2 * i] = (unsigned char)(v & 0xff);
+    out[2 * i + 1] = (unsigned char)(v >> 8);
+  }
+}
+
+void pcm_float_to_s24(const float* in, unsigned char* out, long count) {
+  long i = 0;
+#ifdef PCM_CONVERT_SSSE3
+  // the low 3 bytes of each lane, packed into the first 12
+  const __m128i pack = _mm_setr_epi8(0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1);
+  for (; i + 4 <= count; i += 4) {
+    __m128i v = _mm_shuffle_epi8(scale_clip_ps(_mm_loadu_ps(in + i), S24_MAX), pack);
+    unsigned char* dst = out + 3 * i;
+    _mm_storel_epi64((__m128i*)dst, v);
+    int32_t tail = _mm_cvtsi128_si32(_mm_srli_si128(v, 8));
+    memcpy(dst + 8, &tail, 4);
+  }
+#endif
+  for (; i < count; i++) {
+    uint32_t v = (uint32_t)(int32_t)lrintf(clip_unit(in[i]) * S24_MAX);
+    out[3 * i] = (unsigned char)(v & 0xff);
+    out[3 * i + 1] = (unsigned char)((v >> 8) & 0xff);
+    out[3 * i + 2] = (unsigned char)((v >> 16) & 0xff);
+  }
+}
@@ -0,0 +1,707 @@
+#include "pcm_io.h"
+
+#include <limits.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "nr_alloc.h"
+#include "pcm_convert.h"
+#include "trace.h"
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define PCM_HAVE_MMAP 1
+#endif
+
+#define WAV_FORMAT_PCM 0x0001
+#define WAV_FORMAT_IEEE_FLOAT 0x0003
+#define WAV_FORMAT_EXTENSIBLE 0xFFFE
+
+// largest riff size a finished file may carry, 0xffffffff is what streaming
+// writers leave for "unknown"
+#define WAV_MAX_RIFF_SIZE 0xfffffffeu
+
+// frames converted per staging pass when streaming
+#define PCM_STAGING_FRAMES 4096
+
+struct PcmReader {
+  PcmSpec spec;
+  FILE* fp;
+  int owns_fp;
+
+  // mmap mode: the whole file is mapped and data points at the samples
+  const unsigned char* map;
+  size_t map_size;
+  const unsigned char* data;
+
+  long data_bytes;  // -1 when the length is unknown (streams)
+  long consumed;    // bytes of sample data handed out so far
+
+  unsigned char* staging;
+};
+
+struct PcmWriter {
+  PcmSpec spec;
+  PcmContainer container;
+  FILE* fp;
+  int owns_fp;
+  long data_bytes;
+  long max_data_bytes;  // wav only, -1 when the stream can't seek back to fix the header
+  unsigned char* staging;
+};
+
+static uint16_t read_le16(const unsigned char* p) {
+  return (uint16_t)(p[0] | (p[1] << 8));
+}
+
+static uint32_t read_le32(const unsigned char* p) {
+  return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) |
+         ((uint32_t)p[3] << 24);
+}
+
+static void write_le16(unsigned char* p, uint16_t v) {
+  p[0] = (unsigned char)(v & 0xff);
+  p[1] = (unsigned char)(v >> 8);
+}
+
+static void write_le32(unsigned char* p, uint32_t v) {
+  p[0] = (unsigned char)(v & 0xff);
+  p[1] = (unsigned char)((v >> 8) & 0xff);
+  p[2] = (unsigned char)((v >> 16) & 0xff);
+  p[3] = (unsigned char)(v >> 24);
+}
+
+int pcm_container_from_filename(const char* filename) {
+  if (!filename) return -1;
+  const char* dot = strrchr(filename, '.');
+  if (!dot) return -1;
+  char ext[8];
+  int i = 0;
+  for (dot++; *dot && i < (int)sizeof(ext) - 1; dot++) {
+    char c = *dot;
+    ext[i++] = (c >= 'A' && c <= 'Z') ? (char)(c - 'A' + 'a') : c;
+  }
+  ext[i] = '\0';
+
+  if (strcmp(ext, "wav") == 0) return PCM_CONTAINER_WAV;
+  if (strcmp(ext, "raw") == 0 || strcmp(ext, "pcm") == 0) {
+    return PCM_CONTAINER_RAW;
+  }
+  return -1;
+}
+
+int pcm_format_bytes(PcmFormat format) {
+  switch (format) {
+    case PCM_FORMAT_S16:
+      return 2;
+    case PCM_FORMAT_S24:
+      return 3;
+    case PCM_FORMAT_F32:
+      return 4;
+  }
+  return 0;
+}
+
+int pcm_format_from_string(const char* str) {
+  if (!str) return -1;
+  if (strcmp(str, "s16") == 0) return PCM_FORMAT_S16;
+  if (strcmp(str, "s24") == 0) return PCM_FORMAT_S24;
+  if (strcmp(str, "f32") == 0) return PCM_FORMAT_F32;
+  return -1;
+}
+
+static int spec_valid(const PcmSpec* spec) {
+  return spec && spec->sample_rate > 0 && spec->channels > 0 &&
+         pcm_format_bytes(spec->format) > 0;
+}
+
+// converts count samples from the on-disk format to float
+static void decode_samples(const unsigned char* src, float* dst, long count,
+                           PcmFormat format) {
+  switch (format) {
+    case PCM_FORMAT_S16:
+      pcm_s16_to_float(src, dst, count, NULL);
+      break;
+    case PCM_FORMAT_S24:
+      pcm_s24_to_float(src, dst, count, NULL);
+      break;
+    case PCM_FORMAT_F32:
+      // wav floats are little endian, same as every host we build for
+      memcpy(dst, src, (size_t)count * sizeof(float));
+      break;
+  }
+}
+
+// converts count floats to the on-disk format
+static void encode_samples(const float* src, unsigned char* dst, long count,
+                           PcmFormat format) {
+  switch (format) {
+    case PCM_FORMAT_S16:
+      pcm_float_to_s16(src, dst, count);
+      break;
+    case PCM_FORMAT_S24:
+      pcm_float_to_s24(src, dst, count);
+      break;
+    case PCM_FORMAT_F32:
+      memcpy(dst, src, (size_t)count * sizeof(float));
+      break;
+  }
+}
+
+// fills spec from a "fmt " chunk body, returns 0 on success
+static int parse_fmt_chunk(const unsigned char* fmt, uint32_t size,
+                           PcmSpec* spec) {
+  if (size < 16) return -1;
+  uint16_t tag = read_le16(fmt);
+  uint16_t channels = read_le16(fmt + 2);
+  uint32_t rate = read_le32(fmt + 4);
+  uint16_t bits = read_le16(fmt + 14);
+
+  // extensible puts the real format tag at the start of the subformat guid
+  if (tag == WAV_FORMAT_EXTENSIBLE) {
+    if (size < 26) return -1;
+    tag = read_le16(fmt + 24);
+  }
+
+  if (tag == WAV_FORMAT_PCM && bits == 16) {
+    spec->format = PCM_FORMAT_S16;
+  } else if (tag == WAV_FORMAT_PCM && bits == 24) {
+    spec->format = PCM_FORMAT_S24;
+  } else if (tag == WAV_FORMAT_IEEE_FLOAT && bits == 32) {
+    spec->format = PCM_FORMAT_F32;
+  } else {
+    fprintf(stderr, "pcm_io: unsupported wav format (tag %u, %u bits)\n",
+            (unsigned)tag, (unsigned)bits);
+    return -1;
+  }
+  spec->channels = channels;
+  spec->sample_rate = (int)rate;
+  return spec_valid(spec) ? 0 : -1;
+}
+
+// walks the RIFF chunks of a stream until the data chunk
+// leaves the file positioned at the first sample
+static int read_wav_header(FILE* fp, PcmSpec* spec, long* data_bytes) {
+  unsigned char hdr[12];
+  if (fread(hdr, 1, 12, fp) != 12 || memcmp(hdr, "RIFF", 4) != 0 ||
+      memcmp(hdr + 8, "WAVE", 4) != 0) {
+    fprintf(stderr, "pcm_io: not a RIFF/WAVE file\n");
+    return -1;
+  }
+
+  int have_fmt = 0;
+  unsigned char chunk[8];
+  while (fread(chunk, 1, 8, fp) == 8) {
+    uint32_t size = read_le32(chunk + 4);
+    if (memcmp(chunk, "fmt ", 4) == 0) {
+      unsigned char fmt[40];
+      uint32_t keep = size < sizeof(fmt) ? size : (uint32_t)sizeof(fmt);
+      if (fread(fmt, 1, keep, fp) != keep) return -1;
+      if (parse_fmt_chunk(fmt, keep, spec) != 0) return -1;
+      // skip whatever did not fit plus the pad byte
+      for (uint32_t i = keep; i < size + (size & 1); i++) fgetc(fp);
+      have_fmt = 1;
+    } else if (memcmp(chunk, "data", 4) == 0) {
+      if (!have_fmt) {
+        fprintf(stderr, "pcm_io: data chunk before fmt chunk\n");
+        return -1;
+      }
+      // streaming writers leave 0 or 0xffffffff, read to eof in that case
+      *data_bytes = (size == 0 || size == 0xffffffffu) ? -1 : (long)size;
+      return 0;
+    } else {
+      for (uint32_t i = 0; i < size + (size & 1); i++) {
+        if (fgetc(fp) == EOF) return -1;
+      }
+    }
+  }
+  fprintf(stderr, "pcm_io: no data chunk in wav file\n");
+  return -1;
+}
+
+// same as read_wav_header but over a mapped buffer
+static int parse_wav_buffer(const unsigned char* buf, size_t size,
+                            PcmSpec* spec, size_t* data_offset,
+                            long* data_bytes) {
+  if (size < 12 || memcmp(buf, "RIFF", 4) != 0 ||
+      memcmp(buf + 8, "WAVE", 4) != 0) {
+    fprintf(stderr, "pcm_io: not a RIFF/WAVE file\n");
+    return -1;
+  }
+
+  int have_fmt = 0;
+  size_t pos = 12;
+  while (pos + 8 <= size) {
+    uint32_t chunk_size = read_le32(buf + pos + 4);
+    const unsigned char* body = buf + pos + 8;
+    size_t avail = size - pos - 8;
+    if (memcmp(buf + pos, "fmt ", 4) == 0) {
+      if (chunk_size > avail ||
+          parse_fmt_chunk(body, chunk_size, spec) != 0) {
+        return -1;
+      }
+      have_fmt = 1;
+    } else if (memcmp(buf + pos, "data", 4) == 0) {
+      if (!have_fmt) {
+        fprintf(stderr, "pcm_io: data chunk before fmt chunk\n");
+        return -1;
+      }
+      *data_offset = pos + 8;
+      if (chunk_size == 0 || chunk_size == 0xffffffffu || chunk_size > avail) {
+        *data_bytes = (long)avail;
+      } else {
+        *data_bytes = (long)chunk_size;
+      }
+      return 0;
+    }
+    pos += 8 + (size_t)chunk_size + (chunk_size & 1);
+  }
+  fprintf(stderr, "pcm_io: no data chunk in wav file\n");
+  return -1;
+}
+
+static PcmReader* reader_alloc(void) {
+  PcmReader* reader = (PcmReader*)nr_calloc(NULL, 1, sizeof(PcmReader));
+  if (!reader) {
+    perror("failed to allocate pcm reader");
+    return NULL;
+  }
+  reader->data_bytes = -1;
+  return reader;
+}
+
+#ifdef PCM_HAVE_MMAP
+static int reader_map(PcmReader* reader, const char* filename,
+                      PcmContainer container, const PcmSpec* raw_spec) {
+  int fd = open(filename, O_RDONLY);
+  if (fd < 0) return -1;
+
+  struct stat st;
+  if (fstat(fd, &st) != 0 || st.st_size <= 0) {
+    close(fd);
+    return -1;
+  }
+  size_t size = (size_t)st.st_size;
+  void* map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED) return -1;
+  madvise(map, size, MADV_SEQUENTIAL);
+
+  reader->map = (const unsigned char*)map;
+  reader->map_size = size;
+
+  if (container == PCM_CONTAINER_WAV) {
+    size_t offset = 0;
+    if (parse_wav_buffer(reader->map, size, &reader->spec, &offset,
+                         &reader->data_bytes) != 0) {
+      return -1;
+    }
+    reader->data = reader->map + offset;
+  } else {
+    reader->spec = *raw_spec;
+    reader->data = reader->map;
+    reader->data_bytes = (long)size;
+  }
+  return 0;
+}
+#endif
+
+PcmReader* pcm_reader_open(const char* filename, PcmContainer container,
+                           const PcmSpec* raw_spec, int use_mmap) {
+  if (!filename || (container == PCM_CONTAINER_RAW && !spec_valid(raw_spec))) {
+    fprintf(stderr, "invalid args to pcm_reader_open\n");
+    return NULL;
+  }
+
+#ifdef PCM_HAVE_MMAP
+  if (use_mmap) {
+    PcmReader* reader = reader_alloc();
+    if (!reader) return NULL;
+    if (reader_map(reader, filename, container, raw_spec) == 0) {
+      return reader;
+    }
+    // not mappable (or bad header), the stream path reports the error
+    pcm_reader_close(reader);
+  }
+#else
+  (void)use_mmap;
+#endif
+
+  FILE* fp = fopen(filename, "rb");
+  if (!fp) {
+    perror("failed to open file");
+    return NULL;
+  }
+  PcmReader* reader = pcm_reader_open_file(fp, container, raw_spec);
+  if (!reader) {
+    fclose(fp);
+    return NULL;
+  }
+  reader->owns_fp = 1;
+  return reader;
+}
+
+PcmReader* pcm_reader_open_file(FILE* fp, PcmContainer container,
+                                const PcmSpec* raw_spec) {
+  if (!fp || (container == PCM_CONTAINER_RAW && !spec_valid(raw_spec))) {
+    fprintf(stderr, "invalid args to pcm_reader_open_file\n");
+    return NULL;
+  }
+  PcmReader* reader = reader_alloc();
+  if (!reader) return NULL;
+  reader->fp = fp;
+
+  if (container == PCM_CONTAINER_WAV) {
+    if (read_wav_header(fp, &reader->spec, &reader->data_bytes) != 0) {
+      nr_free(NULL, reader);
+      return NULL;
+    }
+  } else {
+    reader->spec = *raw_spec;
+  }
+
+  size_t frame_bytes = (size_t)pcm_format_bytes(reader->spec.format) *
+                       (size_t)reader->spec.channels;
+  reader->staging = (unsigned char*)nr_malloc(NULL, PCM_STAGING_FRAMES * frame_bytes);
+  if (!reader->staging) {
+    perror("failed to allocate pcm staging buffer");
+    nr_free(NULL, reader);
+    return NULL;
+  }
+  return reader;
+}
+
+const PcmSpec* pcm_reader_spec(const PcmReader* reader) {
+  return reader ? &reader->spec : NULL;
+}
+
+long pcm_reader_frames(const PcmReader* reader) {
+  if (!reader || reader->data_bytes < 0) return -1;
+  return reader->data_bytes /
+         (pcm_format_bytes(reader->spec.format) * reader->spec.channels);
+}
+
+long pcm_reader_read(PcmReader* reader, float* output, long max_frames) {
+  if (!reader || !output || max_frames < 0) return -1;
+
+  const long frame_bytes =
+      (long)pcm_format_bytes(reader->spec.format) * reader->spec.channels;
+  const int ch = reader->spec.channels;
+
+  if (reader->data_bytes >= 0) {
+    long left = (reader->data_bytes - reader->consumed) / frame_bytes;
+    if (max_frames > left) max_frames = left;
+  }
+
+  if (reader->map) {
+    decode_samples(reader->data + reader->consumed, output, max_frames * ch,
+                   reader->spec.format);
+    reader->consumed += max_frames * frame_bytes;
+    return max_frames;
+  }
+
+  long done = 0;
+  while (done < max_frames) {
+    long want = max_frames - done;
+    if (want > PCM_STAGING_FRAMES) want = PCM_STAGING_FRAMES;
+    size_t got = fread(reader->staging, (size_t)frame_bytes, (size_t)want,
+                       reader->fp);
+    if (got == 0) {
+      if (ferror(reader->fp)) {
+        perror("pcm_reader_read");
+        return -1;
+      }
+      break;
+    }
+    decode_samples(reader->staging, output + done * ch, (long)got * ch,
+                   reader->spec.format);
+    reader->consumed += (long)got * frame_bytes;
+    done += (long)got;
+  }
+  return done;
+}
+
+long pcm_reader_skip(PcmReader* reader, long frames) {
+  if (!reader || frames < 0) return -1;
+
+  const long frame_bytes =
+      (long)pcm_format_bytes(reader->spec.format) * reader->spec.channels;
+  if (reader->data_bytes >= 0) {
+    long left = (reader->data_bytes - reader->consumed) / frame_bytes;
+    if (frames > left) frames = left;
+  }
+  if (reader->map || (reader->data_bytes >= 0 &&
+                      fseek(reader->fp, frames * frame_bytes, SEEK_CUR) == 0)) {
+    reader->consumed += frames * frame_bytes;
+    return frames;
+  }
+
+  // unknown length or not seekable, read through the staging buffer
+  long done = 0;
+  while (done < frames) {
+    long want = frames - done;
+    if (want > PCM_STAGING_FRAMES) want = PCM_STAGING_FRAMES;
+    size_t got = fread(reader->staging, (size_t)frame_bytes, (size_t)want,
+                       reader->fp);
+    if (got == 0) {
+      if (ferror(reader->fp)) {
+        perror("pcm_reader_skip");
+        return -1;
+      }
+      break;
+    }
+    reader->consumed += (long)got * frame_bytes;
+    done += (long)got;
+  }
+  return done;
+}
+
+void pcm_reader_close(PcmReader* reader) {
+  if (!reader) return;
+#ifdef PCM_HAVE_MMAP
+  if (reader->map) munmap((void*)reader->map, reader->map_size);
+#endif
+  if (reader->owns_fp && reader->fp) fclose(reader->fp);
+  nr_free(NULL, reader->staging);
+  nr_free(NULL, reader);
+}
+
+static uint32_t wav_header_size(const PcmSpec* spec) {
+  return spec->format == PCM_FORMAT_F32 ? 46 : 44;
+}
+
+// the most sample data whose riff size, pad byte included, still fits 32 bits
+static long wav_max_data_bytes(const PcmSpec* spec) {
+  int64_t frame_bytes = (int64_t)pcm_format_bytes(spec->format) * spec->channels;
+  int64_t room = (int64_t)WAV_MAX_RIFF_SIZE - (wav_header_size(spec) - 8) - 1;
+  if (room > LONG_MAX) room = LONG_MAX;
+  return (long)(room / frame_bytes * frame_bytes);
+}
+
+// 44 byte canonical header, or 46 for float (fmt carries cbSize). the riff size
+// counts the pad byte pcm_writer_close adds after odd sized data
+static int write_wav_header(FILE* fp, const PcmSpec* spec, long data_bytes) {
+  unsigned char hdr[46];
+  int is_float = spec->format == PCM_FORMAT_F32;
+  uint32_t fmt_size = is_float ? 18 : 16;
+  uint32_t header_size = wav_header_size(spec);
+  int bytes = pcm_format_bytes(spec->format);
+  if (data_bytes > wav_max_data_bytes(spec)) return -1;
+  uint32_t data_size =
+      data_bytes < 0 ? 0xffffffffu : (uint32_t)data_bytes;
+  uint32_t riff_size =
+      data_bytes < 0 ? 0xffffffffu
+                     : (uint32_t)(header_size - 8 + data_bytes + (data_bytes & 1));
+
+  memcpy(hdr, "RIFF", 4);
+  write_le32(hdr + 4, riff_size);
+  memcpy(hdr + 8, "WAVEfmt ", 8);
+  write_le32(hdr + 16, fmt_size);
+  write_le16(hdr + 20, is_float ? WAV_FORMAT_IEEE_FLOAT : WAV_FORMAT_PCM);
+  write_le16(hdr + 22, (uint16_t)spec->channels);
+  write_le32(hdr + 24, (uint32_t)spec->sample_rate);
+  write_le32(hdr + 28, (uint32_t)(spec->sample_rate * spec->channels * bytes));
+  write_le16(hdr + 32, (uint16_t)(spec->channels * bytes));
+  write_le16(hdr + 34, (uint16_t)(bytes * 8));
+  unsigned char* p = hdr + 36;
+  if (is_float) {
+    write_le16(p, 0);  // cbSize
+    p += 2;
+  }
+  memcpy(p, "data", 4);
+  write_le32(p + 4, data_size);
+
+  return fwrite(hdr, 1, header_size, fp) == header_size ? 0 : -1;
+}
+
+PcmWriter* pcm_writer_open(const char* filename, PcmContainer container,
+                           const PcmSpec* spec) {
+  if (!filename) {
+    fprintf(stderr, "invalid args to pcm_writer_open\n");
+    return NULL;
+  }
+  FILE* fp = fopen(filename, "wb");
+  if (!fp) {
+    perror("error opening output file");
+    return NULL;
+  }
+  PcmWriter* writer = pcm_writer_open_file(fp, container, spec);
+  if (!writer) {
+    fclose(fp);
+    return NULL;
+  }
+  writer->owns_fp = 1;
+  return writer;
+}
+
+PcmWriter* pcm_writer_open_file(FILE* fp, PcmContainer container,
+                                const PcmSpec* spec) {
+  if (!fp || !spec_valid(spec)) {
+    fprintf(stderr, "invalid args to pcm_writer_open_file\n");
+    return NULL;
+  }
+  PcmWriter* writer = (PcmWriter*)nr_calloc(NULL, 1, sizeof(PcmWriter));
+  if (!writer) {
+    perror("failed to allocate pcm writer");
+    return NULL;
+  }
+  writer->spec = *spec;
+  writer->container = container;
+  writer->fp = fp;
+
+  size_t frame_bytes =
+      (size_t)pcm_format_bytes(spec->format) * (size_t)spec->channels;
+  writer->staging = (unsigned char*)nr_malloc(NULL, PCM_STAGING_FRAMES * frame_bytes);
+  if (!writer->staging) {
+    perror("failed to allocate pcm staging buffer");
+    nr_free(NULL, writer);
+    return NULL;
+  }
+
+  // sizes are unknown until close, patched there when the stream can seek
+  if (container == PCM_CONTAINER_WAV && write_wav_header(fp, spec, -1) != 0) {
+    fprintf(stderr, "pcm_io: failed to write wav header\n");
+    nr_free(NULL, writer->staging);
+    nr_free(NULL, writer);
+    return NULL;
+  }
+  // a pipe keeps the "unknown" sizes and has no limit, a file gets its real
+  // sizes at close and so can't grow past what they can hold
+  writer->max_data_bytes =
+      container == PCM_CONTAINER_WAV && ftell(fp) >= 0 ? wav_max_data_bytes(spec) : -1;
+  return writer;
+}
+
+int pcm_writer_write(PcmWriter* writer, const float* input, long frames) {
+  if (!writer || !input || frames < 0) return -1;
+
+  const int ch = writer->spec.channels;
+  const size_t frame_bytes =
+      (size_t)pcm_format_bytes(writer->spec.format) * (size_t)ch;
+
+  if (writer->max_data_bytes >= 0 &&
+      frames > (writer->max_data_bytes - writer->data_bytes) / (long)frame_bytes) {
+    fprintf(stderr, "pcm_writer_write: wav output would pass the 4 GiB limit of the "
+            "format, write a .raw file instead\n");
+    return -1;
+  }
+
+  long done = 0;
+  while (done < frames) {
+    long n = frames - done;
+    if (n > PCM_STAGING_FRAMES) n = PCM_STAGING_FRAMES;
+    encode_samples(input + done * ch, writer->staging, n * ch,
+                   writer->spec.format);
+    if (fwrite(writer->staging, frame_bytes, (size_t)n, writer->fp) !=
+        (size_t)n) {
+      perror("pcm_writer_write");
+      return -1;
+    }
+    writer->data_bytes += n * (long)frame_bytes;
+    done += n;
+  }
+  return 0;
+}
+
+int pcm_writer_flush(PcmWriter* writer) {
+  if (!writer) return -1;
+  if (fflush(writer->fp) != 0) {
+    perror("pcm_writer_flush");
+    return -1;
+  }
+  return 0;
+}
+
+int pcm_writer_close(PcmWriter* writer) {
+  if (!writer) return -1;
+  int ret = 0;
+
+  if (writer->container == PCM_CONTAINER_WAV && fseek(writer->fp, 0, SEEK_SET) == 0) {
+    if (write_wav_header(writer->fp, &writer->spec, writer->data_bytes) != 0) {
+      ret = -1;
+    }
+  }
+  // pad byte for odd sized data chunks
+  if (writer->container == PCM_CONTAINER_WAV && (writer->data_bytes & 1)) {
+    fseek(writer->fp, 0, SEEK_END);
+    fputc(0, writer->fp);
+  }
+
+  if (fflush(writer->fp) != 0) ret = -1;
+  if (writer->owns_fp && fclose(writer->fp) != 0) ret = -1;
+  nr_free(NULL, writer->staging);
+  nr_free(NULL, writer);
+  return ret;
+}
+
+long pcm_to_float(const char* filename, PcmSpec* spec, float** output) {
+  if (!filename || !spec || !output) {
+    fprintf(stderr, "invalid args to pcm_to_float\n");
+    return -1;
+  }
+  int container = pcm_container_from_filename(filename);
+  if (container < 0) {
+    fprintf(stderr, "pcm_to_float: %s is not a wav/raw file\n", filename);
+    return -1;
+  }
+  uint64_t t0 = trace_begin();
+
+  PcmReader* reader =
+      pcm_reader_open(filename, (PcmContainer)container, spec, 1);
+  if (!reader) return -1;
+  *spec = reader->spec;
+
+  long frames = pcm_reader_frames(reader);
+  if (frames <= 0) {
+    fprintf(stderr, "pcm_to_float: no samples in %s\n", filename);
+    pcm_reader_close(reader);
+    return -1;
+  }
+
+  float* data = (float*)nr_malloc(NULL, (size_t)frames * spec->channels * sizeof(float));
+  if (!data) {
+    perror("unable to allocate memory for pcm buffer");
+    pcm_reader_close(reader);
+    return -1;
+  }
+  long got = pcm_reader_read(reader, data, frames);
+  pcm_reader_close(reader);
+  if (got <= 0) {
+    nr_free(NULL, data);
+    return -1;
+  }
+
+  *output = data;
+  trace_end("io", "pcm_to_float", t0, got * spec->channels);
+  return got * spec->channels;
+}
+
+int float_to_pcm(const char* filename, const float* input, long num_samples,
+                 const PcmSpec* spec) {
+  if (!filename || !input || num_samples <= 0 || !spec_valid(spec)) {
+    fprintf(stderr, "invalid args to float_to_pcm\n");
+    return -1;
+  }
+  int container = pcm_container_from_filename(filename);
+  if (container < 0) {
+    fprintf(stderr, "float_to_pcm: %s is not a wav/raw file\n", filename);
+    return -1;
+  }
+
+  uint64_t t0 = trace_begin();
+  PcmWriter* writer = pcm_writer_open(filename, (PcmContainer)container, spec);
+  if (!writer) return -1;
+  if (pcm_writer_write(writer, input, num_samples / spec->channels) != 0) {
+    pcm_writer_close(writer);
+    return -1;
+  }
+  int status = pcm_writer_close(writer);
+  if (status == 0) trace_end("io", "float_to_pcm", t0, num_samples);
+  return status;
+}
@@ -0,0 +1,315 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <string.h>
+
+#include "resample.h"
+#include "nr_alloc.h"
+
+#if defined(__SSE__) || defined(_M_X64)
+#include <xmmintrin.h>
+#define RESAMPLE_SSE 1
+#endif
+
+#define RESAMPLE_PI 3.14159265358979323846
+// kaiser window design: stopband attenuation in dB, and where the transition
+// band is centred as a fraction of the lower nyquist
+#define RESAMPLE_STOPBAND_DB 80.0
+#define RESAMPLE_CUTOFF 0.97
+
+static int gcd(int a, int b) {
+    while (b) {
+        int t = a % b;
+        a = b;
+        b = t;
+    }
+    return a;
+}
+
+// zeroth order modified bessel function of the first kind, for the kaiser window
+static double bessel_i0(double x) {
+    double sum = 1.0;
+    double term = 1.0;
+    for (int k = 1; k < 64 && term > 1e-12 * sum; k++) {
+        term *= (x / (2.0 * k)) * (x / (2.0 * k));
+        sum += term;
+    }
+    return sum;
+}
+
+// taps is a multiple of 4
+static float dot(const float* a, const float* b, int taps) {
+#ifdef RESAMPLE_SSE
+    // two accumulators, so consecutive adds don't wait on each other
+    __m128 acc0 = _mm_setzero_ps();
+    __m128 acc1 = _mm_setzero_ps();
+    int i = 0;
+    for (; i + 8 <= taps; i += 8) {
+        acc0 = _mm_add_ps(acc0, _mm_mul_ps(_mm_loadu_ps(a + i), _mm_loadu_ps(b + i)));
+        acc1 = _mm_add_ps(acc1, _mm_mul_ps(_mm_loadu_ps(a + i + 4), _mm_loadu_ps(b + i + 4)));
+    }
+    if (i < taps) {
+        acc0 = _mm_add_ps(acc0, _mm_mul_ps(_mm_loadu_ps(a + i), _mm_loadu_ps(b + i)));
+    }
+    float lanes[4];
+    _mm_storeu_ps(lanes, _mm_add_ps(acc0, acc1));
+    return (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+#else
+    float acc0 = 0.0f, acc1 = 0.0f, acc2 = 0.0f, acc3 = 0.0f;
+    for (int i = 0; i < taps; i += 4) {
+        acc0 += a[i] * b[i];
+        acc1 += a[i + 1] * b[i + 1];
+        acc2 += a[i + 2] * b[i + 2];
+        acc3 += a[i + 3] * b[i + 3];
+    }
+    return (acc0 + acc1) + (acc2 + acc3);
+#endif
+}
+
+// 2:1 half band for the step between rate and rate / 2: flat up to
+// nyquist_low and down by the stopband from rate / 2 - nyquist_low, which is
+// all that folds back below nyquist_low. the ideal response is sin(pi n / 2) /
+// (pi n), 0.5 at the centre and zero at every other even offset, so only the
+// odd offsets are kept, laid out in order so one dot product covers them
+static int half_band_init(Resampler* rs, int rate, double nyquist_low) {
+    double width = 2.0 * RESAMPLE_PI * (rate / 2.0 - 2.0 * nyquist_low) / rate;
+    int length = (int)ceil((RESAMPLE_STOPBAND_DB - 7.95) / (2.285 * width)) + 1;
+    // odd offsets each side, rounded up to even so 2 * half_taps suits dot
+    int half_taps = ((length + 3) / 4 + 1) & ~1;
+    rs->half_coefs = (float*)nr_malloc(NULL, 2 * half_taps * sizeof(float));
+    if (!rs->half_coefs) return -1;
+    rs->half_taps = half_taps;
+
+    double beta = 0.1102 * (RESAMPLE_STOPBAND_DB - 8.7);
+    for (int m = 0; m < half_taps; m++) {
+        int n = 2 * m + 1;
+        double r = n / (2.0 * half_taps);
+        double w = bessel_i0(beta * sqrt(1.0 - r * r)) / bessel_i0(beta);
+        float h = (float)(sin(RESAMPLE_PI * n / 2.0) / (RESAMPLE_PI * n) * w);
+        rs->half_coefs[half_taps - 1 - m] = h;
+        rs->half_coefs[half_taps + m] = h;
+    }
+    return 0;
+}
+
+Resampler* resampler_init(int in_rate, int out_rate, int taps_per_phase) {
+    if (in_rate <= 0 || out_rate <= 0 || taps_per_phase <= 0) {
+        perror("invalid resampler config for init\n");
+        return NULL;
+    }
+    Resampler* rs = (Resampler*)nr_calloc(NULL, 1, sizeof(Resampler));
+    if (!rs) {
+        perror("failed to allocate resampler\n");
+        return NULL;
+    }
+    rs->in_rate = in_rate;
+    rs->out_rate = out_rate;
+
+    // the polyphase stage's rates, the half band taking the higher one's factor 2
+    int poly_in = in_rate;
+    int poly_out = out_rate;
+    if (in_rate % 2 == 0 && in_rate >= RESAMPLE_HALF_BAND_RATIO * out_rate) {
+        rs->half_band = -1;
+        poly_in = in_rate / 2;
+        taps_per_phase = (taps_per_phase + 1) / 2; // same width at half the rate
+        if (half_band_init(rs, in_rate, out_rate / 2.0) != 0) goto fail;
+    } else if (out_rate % 2 == 0 && out_rate >= RESAMPLE_HALF_BAND_RATIO * in_rate) {
+        rs->half_band = 1;
+        poly_out = out_rate / 2;
+        if (half_band_init(rs, out_rate, in_rate / 2.0) != 0) goto fail;
+    }
+    int g = gcd(poly_in, poly_out);
+    rs->up = poly_out / g;
+    rs->down = poly_in / g;
+    rs->taps = (taps_per_phase + 3) & ~3;
+
+    long length = (long)rs->up * rs->taps;
+    rs->phases = (float*)nr_malloc(NULL, length * sizeof(float));
+    if (!rs->phases) goto fail;
+
+    // lowpass at the lower of the two nyquists, designed at the upsampled rate.
+    // the kaiser beta sets the stopband, the length then sets the transition
+    // width around the cutoff. an odd length keeps the delay a whole sample, an
+    // even one leaves its last tap at zero
+    long design = length % 2 ? length : length - 1;
+    double cutoff = 0.5 * RESAMPLE_CUTOFF / (rs->up > rs->down ? rs->up : rs->down);
+    double beta = 0.1102 * (RESAMPLE_STOPBAND_DB - 8.7);
+    double center = (design - 1) / 2.0;
+    for (long i = 0; i < length; i++) {
+        double x = i - center;
+        double sinc = x == 0.0 ? 2.0 * cutoff : sin(2.0 * RESAMPLE_PI * cutoff * x) / (RESAMPLE_PI * x);
+        double r = (i + 0.5 - design / 2.0) / (design / 2.0);
+        double w = i < design ? bessel_i0(beta * sqrt(1.0 - r * r)) / bessel_i0(beta) : 0.0;
+        // gain of `up` makes up for the zeros stuffed in by interpolation
+        float h = (float)(sinc * w * rs->up);
+
+        // tap t of phase p is h[p + t * up], stored reversed so a phase lines up
+        // with consecutive input samples
+        int p = (int)(i % rs->up);
+        int t = (int)(i / rs->up);
+        rs->phases[(long)p * rs->taps + (rs->taps - 1 - t)] = h;
+    }
+    rs->delay = (design - 1) / 2;
+    return rs;
+
+fail:
+    perror("failed to allocate resampler filter\n");
+    resampler_free(rs);
+    return NULL;
+}
+
+void resampler_free(Resampler* rs) {
+    if (!rs) return;
+    nr_free(NULL, rs->phases);
+    nr_free(NULL, rs->half_coefs);
+    nr_free(NULL, rs);
+}
+
+// response of the polyphase filter alone, freq at its input rate
+static double polyphase_gain_db(const Resampler* rs, double freq) {
+    // the filter is symmetric, so its response is real about the centre tap
+    int poly_in = rs->half_band < 0 ? rs->in_rate / 2 : rs->in_rate;
+    long length = (long)rs->up * rs->taps;
+    double center = (double)rs->delay;
+    double omega = 2.0 * RESAMPLE_PI * freq / ((double)poly_in * rs->up);
+    double sum = 0.0;
+    for (long i = 0; i < length; i++) {
+        int p = (int)(i % rs->up);
+        int t = (int)(i / rs->up);
+        sum += rs->phases[(long)p * rs->taps + (rs->taps - 1 - t)] * cos(omega * (i - center));
+    }
+    return 20.0 * log10(fabs(sum) / rs->up + 1e-12);
+}
+
+static double half_band_gain_db(const Resampler* rs, double freq, int rate) {
+    const float* c = rs->half_coefs + rs->half_taps; // offsets 1, 3, 5, ...
+    double sum = 0.5;
+    for (int m = 0; m < rs->half_taps; m++) {
+        sum += 2.0 * c[m] * cos(2.0 * RESAMPLE_PI * freq * (2 * m + 1) / rate);
+    }
+    return 20.0 * log10(fabs(sum) + 1e-12);
+}
+
+double resampler_gain_db(const Resampler* rs, double freq) {
+    if (!rs) return 0.0;
+    if (rs->half_band == 0) return polyphase_gain_db(rs, freq);
+    // above a quarter of the higher rate a tone reaches the polyphase stage as
+    // its mirror about that point: folded back by the 2:1 decimation, or as the
+    // image the 2:1 interpolation makes of it
+    int rate = rs->half_band < 0 ? rs->in_rate : rs->out_rate;
+    double mirrored = freq <= rate / 4.0 ? freq : rate / 2.0 - freq;
+    return half_band_gain_db(rs, freq, rate) + polyphase_gain_db(rs, mirrored);
+}
+
+long resampler_output_length(const Resampler* rs, long num_in) {
+    if (!rs || num_in <= 0) return 0;
+    return (num_in * rs->out_rate + rs->in_rate - 1) / rs->in_rate;
+}
+
+static void polyphase_process(const Resampler* rs, const float* input, long num_in,
+                              float* output, long num_out) {
+    const int taps = rs->taps;
+    for (long k = 0; k < num_out; k++) {
+        // position in the upsampled signal, shifted by the filter delay
+        long u = k * rs->down + rs->delay;
+        long newest = u / rs->up; // input sample under the last tap
+        const float* coef = rs->phases + (u % rs->up) * taps;
+        long oldest = newest - taps + 1;
+
+        if (oldest >= 0 && newest < num_in) {
+            output[k] = dot(coef, input + oldest, taps);
+        } else {
+            // edges, samples outside the buffer are zero
+            float acc = 0.0f;
+            for (int j = 0; j < taps; j++) {
+                long n = oldest + j;
+                if (n >= 0 && n < num_in) {
+                    acc += coef[j] * input[n];
+                }
+            }
+            output[k] = acc;
+        }
+    }
+}
+
+// odd holds the odd input samples, odd[i] = input[2 * i + 1], so the taps of
+// output[j] (centred on input[2 * j]) are odd[j - half_taps, j + half_taps)
+static void half_band_decimate(const Resampler* rs, const float* input, long num_in,
+                               const float* odd, long num_odd, float* output, long num_out) {
+    const int ht = rs->half_taps;
+    const float* c = rs->half_coefs;
+    for (long j = 0; j < num_out; j++) {
+        float acc;
+        if (j - ht >= 0 && j + ht <= num_odd) {
+            acc = dot(c, odd + j - ht, 2 * ht);
+        } else {
+            acc = 0.0f;
+            for (int q = 0; q < 2 * ht; q++) {
+                long i = j - ht + q;
+                if (i >= 0 && i < num_odd) acc += c[q] * odd[i];
+            }
+        }
+        output[j] = acc + (2 * j < num_in ? 0.5f * input[2 * j] : 0.0f);
+    }
+}
+
+// even outputs are the input samples, odd ones the half band between them, its
+// taps on input[i - half_taps + 1, i + half_taps] and a gain of 2 for the zeros
+// stuffed in between
+static void half_band_interpolate(const Resampler* rs, const float* input, long num_in,
+                                  float* output, long num_out) {
+    const int ht = rs->half_taps;
+    const float* c = rs->half_coefs;
+    for (long k = 0; k < num_out; k++) {
+        long i = k / 2;
+        if (k % 2 == 0) {
+            output[k] = i < num_in ? input[i] : 0.0f;
+            continue;
+        }
+        float acc;
+        if (i - ht + 1 >= 0 && i + ht < num_in) {
+            acc = dot(c, input + i - ht + 1, 2 * ht);
+        } else {
+            acc = 0.0f;
+            for (int q = 0; q < 2 * ht; q++) {
+                long n = i - ht + 1 + q;
+                if (n >= 0 && n < num_in) acc += c[q] * input[n];
+            }
+        }
+        output[k] = 2.0f * acc;
+    }
+}
+
+long resampler_process(const Resampler* rs, const float* input, long num_in, float* output) {
+    if (!rs || !input || !output || num_in <= 0) {
+        perror("invalid args to resampler_process\n");
+        return -1;
+    }
+    long num_out = resampler_output_length(rs, num_in);
+    if (rs->half_band == 0) {
+        polyphase_process(rs, input, num_in, output, num_out);
+        return num_out;
+    }
+
+    // the half rate signal between the two stages, and the odd input samples
+    // the half band decimator reads
+    long num_mid = rs->half_band < 0 ? (num_in + 1) / 2
+                                     : (num_in * rs->up + rs->down - 1) / rs->down;
+    long num_odd = rs->half_band < 0 ? num_in / 2 : 0;
+    float* mid = (float*)nr_malloc(NULL, (num_mid + num_odd) * sizeof(float));
+    if (!mid) {
+        fprintf(stderr, "resampler_process: out of memory\n");
+        return -1;
+    }
+    if (rs->half_band < 0) {
+        float* odd = mid + num_mid;
+        for (long i = 0; i < num_odd; i++) odd[i] = input[2 * i + 1];
+        half_band_decimate(rs, input, num_in, odd, num_odd, mid, num_mid);
+        polyphase_process(rs, mid, num_mid, output, num_out);
+    } else {
+        polyphase_process(rs, input, num_in, mid, num_mid);
+        half_band_interpolate(rs, mid, num_mid, output, num_out);
+    }
+    nr_free(NULL, mid);
+    return num_out;
+}
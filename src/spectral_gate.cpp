@@ -0,0 +1,13 @@
+// explicit instantiations of the compile time gate for the frame/hop pairs in use:
+// 1024/256 is the cli default, 256/64 and 512/128 the voice band sizes at 16 kHz,
+// 2048/512 for 88.2/96 kHz material
+#include "spectral_gate.hpp"
+
+namespace noisereduce {
+
+template class SpectralGate<256, 64>;
+template class SpectralGate<512, 128>;
+template class SpectralGate<1024, 256>;
+template class SpectralGate<2048, 512>;
+
+}  // namespace noisereduce
@@ -0,0 +1,254 @@
+#include "task_pool.h"
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "nr_alloc.h"
+#include "trace.h"
+
+typedef struct {
+  TaskFn fn;
+  void* arg;
+} Task;
+
+// ring buffer deque, owner works at the head, thieves take from the tail
+typedef struct {
+  pthread_mutex_t lock;
+  Task* tasks;
+  int cap;
+  int head;  // next task the owner pops is tasks[(head - 1) & (cap - 1)]
+  int count;
+} Deque;
+
+typedef struct {
+  TaskPool* pool;
+  int index;
+  pthread_t thread;
+  Deque deque;
+} Worker;
+
+struct TaskPool {
+  Worker* workers;
+  int num_threads;
+
+  // sleeping and waiting
+  pthread_mutex_t lock;
+  pthread_cond_t work_cv;  // tasks were queued
+  pthread_cond_t idle_cv;  // pending dropped to zero
+  atomic_long queued;      // tasks sitting in deques
+  atomic_long pending;     // queued or running
+  atomic_long steals;
+  atomic_uint next_queue;  // round robin for outside submits
+  int stop;
+};
+
+// the worker the calling thread is, if it belongs to a pool
+static __thread Worker* tls_worker = NULL;
+
+static int deque_push_head(Deque* d, Task t) {
+  pthread_mutex_lock(&d->lock);
+  if (d->count == d->cap) {
+    int cap = d->cap ? 2 * d->cap : 64;
+    Task* tasks = (Task*)nr_malloc(NULL, cap * sizeof(Task));
+    if (!tasks) {
+      pthread_mutex_unlock(&d->lock);
+      return -1;
+    }
+    // unroll so the tail sits at index 0
+    int tail = (d->head - d->count) & (d->cap - 1);
+    for (int i = 0; i < d->count; i++) {
+      tasks[i] = d->tasks[(tail + i) & (d->cap - 1)];
+    }
+    nr_free(NULL, d->tasks);
+    d->tasks = tasks;
+    d->cap = cap;
+    d->head = d->count;
+  }
+  d->tasks[d->head] = t;
+  d->head = (d->head + 1) & (d->cap - 1);
+  d->count++;
+  pthread_mutex_unlock(&d->lock);
+  return 0;
+}
+
+static int deque_pop_head(Deque* d, Task* t) {
+  int ok = 0;
+  pthread_mutex_lock(&d->lock);
+  if (d->count > 0) {
+    d->head = (d->head - 1) & (d->cap - 1);
+    *t = d->tasks[d->head];
+    d->count--;
+    ok = 1;
+  }
+  pthread_mutex_unlock(&d->lock);
+  return ok;
+}
+
+static int deque_pop_tail(Deque* d, Task* t) {
+  int ok = 0;
+  pthread_mutex_lock(&d->lock);
+  if (d->count > 0) {
+    *t = d->tasks[(d->head - d->count) & (d->cap - 1)];
+    d->count--;
+    ok = 1;
+  }
+  pthread_mutex_unlock(&d->lock);
+  return ok;
+}
+
+// own deque first, then the others starting next door
+static int find_task(Worker* w, Task* t) {
+  TaskPool* pool = w->pool;
+  if (deque_pop_head(&w->deque, t)) return 1;
+  for (int i = 1; i < pool->num_threads; i++) {
+    Worker* victim = &pool->workers[(w->index + i) % pool->num_threads];
+    if (deque_pop_tail(&victim->deque, t)) {
+      atomic_fetch_add(&pool->steals, 1);
+      return 1;
+    }
+  }
+  return 0;
+}
+
+static void* worker_main(void* arg) {
+  Worker* w = (Worker*)arg;
+  TaskPool* pool = w->pool;
+  tls_worker = w;
+  trace_thread_name("pool worker");
+  for (;;) {
+    Task t;
+    if (find_task(w, &t)) {
+      atomic_fetch_sub(&pool->queued, 1);
+      t.fn(pool, t.arg);
+      if (atomic_fetch_sub(&pool->pending, 1) == 1) {
+        pthread_mutex_lock(&pool->lock);
+        pthread_cond_broadcast(&pool->idle_cv);
+        pthread_mutex_unlock(&pool->lock);
+      }
+      continue;
+    }
+    pthread_mutex_lock(&pool->lock);
+    while (!pool->stop && atomic_load(&pool->queued) == 0) {
+      pthread_cond_wait(&pool->work_cv, &pool->lock);
+    }
+    int stop = pool->stop && atomic_load(&pool->queued) == 0;
+    pthread_mutex_unlock(&pool->lock);
+    if (stop) break;
+  }
+  return NULL;
+}
+
+static void task_pool_free(TaskPool* pool, int num_workers) {
+  for (int i = 0; i < num_workers; i++) {
+    pthread_mutex_destroy(&pool->workers[i].deque.lock);
+    nr_free(NULL, pool->workers[i].deque.tasks);
+  }
+  pthread_cond_destroy(&pool->work_cv);
+  pthread_cond_destroy(&pool->idle_cv);
+  pthread_mutex_destroy(&pool->lock);
+  nr_free(NULL, pool->workers);
+  nr_free(NULL, pool);
+}
+
+TaskPool* task_pool_create(int num_threads) {
+  if (num_threads <= 0) {
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    num_threads = cores > 0 ? (int)cores : 1;
+  }
+  TaskPool* pool = (TaskPool*)nr_calloc(NULL, 1, sizeof(TaskPool));
+  if (!pool) {
+    perror("failed to allocate task pool");
+    return NULL;
+  }
+  pool->workers = (Worker*)nr_calloc(NULL, num_threads, sizeof(Worker));
+  if (!pool->workers) {
+    perror("failed to allocate task pool");
+    nr_free(NULL, pool);
+    return NULL;
+  }
+  pthread_mutex_init(&pool->lock, NULL);
+  pthread_cond_init(&pool->work_cv, NULL);
+  pthread_cond_init(&pool->idle_cv, NULL);
+  atomic_init(&pool->queued, 0);
+  atomic_init(&pool->pending, 0);
+  atomic_init(&pool->steals, 0);
+  atomic_init(&pool->next_queue, 0);
+  for (int i = 0; i < num_threads; i++) {
+    pool->workers[i].pool = pool;
+    pool->workers[i].index = i;
+    pthread_mutex_init(&pool->workers[i].deque.lock, NULL);
+  }
+  pool->num_threads = num_threads;
+  for (int i = 0; i < num_threads; i++) {
+    if (pthread_create(&pool->workers[i].thread, NULL, worker_main,
+                       &pool->workers[i]) != 0) {
+      perror("failed to start task pool worker");
+      // stop and join the ones that did start
+      pthread_mutex_lock(&pool->lock);
+      pool->stop = 1;
+      pthread_cond_broadcast(&pool->work_cv);
+      pthread_mutex_unlock(&pool->lock);
+      for (int j = 0; j < i; j++) pthread_join(pool->workers[j].thread, NULL);
+      pool->num_threads = 0;
+      task_pool_free(pool, num_threads);
+      return NULL;
+    }
+  }
+  return pool;
+}
+
+int task_pool_submit(TaskPool* pool, TaskFn fn, void* arg) {
+  if (!pool || !fn) return -1;
+  Worker* w = tls_worker;
+  if (!w || w->pool != pool) {
+    unsigned q = atomic_fetch_add(&pool->next_queue, 1);
+    w = &pool->workers[q % (unsigned)pool->num_threads];
+  }
+  atomic_fetch_add(&pool->pending, 1);
+  Task t = {fn, arg};
+  if (deque_push_head(&w->deque, t) != 0) {
+    atomic_fetch_sub(&pool->pending, 1);
+    fprintf(stderr, "task_pool_submit: out of memory\n");
+    return -1;
+  }
+  // queued goes up under the lock so a worker can't miss it between its
+  // check and its wait
+  pthread_mutex_lock(&pool->lock);
+  atomic_fetch_add(&pool->queued, 1);
+  pthread_cond_signal(&pool->work_cv);
+  pthread_mutex_unlock(&pool->lock);
+  return 0;
+}
+
+void task_pool_wait(TaskPool* pool) {
+  if (!pool) return;
+  pthread_mutex_lock(&pool->lock);
+  while (atomic_load(&pool->pending) > 0) {
+    pthread_cond_wait(&pool->idle_cv, &pool->lock);
+  }
+  pthread_mutex_unlock(&pool->lock);
+}
+
+void task_pool_destroy(TaskPool* pool) {
+  if (!pool) return;
+  task_pool_wait(pool);
+  pthread_mutex_lock(&pool->lock);
+  pool->stop = 1;
+  pthread_cond_broadcast(&pool->work_cv);
+  pthread_mutex_unlock(&pool->lock);
+  for (int i = 0; i < pool->num_threads; i++) {
+    pthread_join(pool->workers[i].thread, NULL);
+  }
+  task_pool_free(pool, pool->num_threads);
+}
+
+int task_pool_threads(const TaskPool* pool) {
+  return pool ? pool->num_threads : 0;
+}
+
+long task_pool_steals(const TaskPool* pool) {
+  return pool ? atomic_load(&((TaskPool*)pool)->steals) : 0;
+}
@@ -0,0 +1,187 @@
+#include "trace.h"
+
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "nr_alloc.h"
+
+#define TRACE_CHUNK_EVENTS 4096
+#define TRACE_NAME_LEN 32
+
+typedef struct {
+  const char* cat;
+  const char* name;
+  uint64_t begin;  // ns, monotonic
+  uint64_t end;
+  long arg;
+} TraceEvent;
+
+// events only ever go to the owning thread's newest chunk, a full one gets a
+// successor instead of a wrap, so the writer at exit never races a rewrite
+typedef struct TraceChunk {
+  _Atomic(struct TraceChunk*) next;
+  atomic_int count;  // events published, stored after the event is written
+  TraceEvent events[TRACE_CHUNK_EVENTS];
+} TraceChunk;
+
+typedef struct TraceThread {
+  struct TraceThread* next;  // registry, push only
+  int tid;
+  char name[TRACE_NAME_LEN];
+  TraceChunk* first;
+  TraceChunk* current;  // owner only
+} TraceThread;
+
+static atomic_int trace_on;
+static atomic_int trace_started;
+static _Atomic(TraceThread*) trace_threads;
+static atomic_int trace_next_tid;
+static char* trace_path;
+static int trace_sample = 1;
+static uint64_t trace_epoch;
+static __thread TraceThread* trace_self;
+
+static uint64_t now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+static TraceChunk* chunk_new(void) {
+  TraceChunk* chunk = (TraceChunk*)nr_malloc(NULL, sizeof(TraceChunk));
+  if (!chunk) return NULL;
+  atomic_init(&chunk->next, NULL);
+  atomic_init(&chunk->count, 0);
+  return chunk;
+}
+
+// the calling thread's buffer, registered on its first event
+static TraceThread* thread_self(void) {
+  if (trace_self) return trace_self;
+  TraceThread* t = (TraceThread*)nr_calloc(NULL, 1, sizeof(TraceThread));
+  if (!t) return NULL;
+  t->first = t->current = chunk_new();
+  if (!t->first) {
+    nr_free(NULL, t);
+    return NULL;
+  }
+  t->tid = atomic_fetch_add(&trace_next_tid, 1) + 1;
+  snprintf(t->name, sizeof(t->name), t->tid == 1 ? "main" : "thread %d", t->tid);
+  TraceThread* head = atomic_load(&trace_threads);
+  do {
+    t->next = head;
+  } while (!atomic_compare_exchange_weak(&trace_threads, &head, t));
+  trace_self = t;
+  return t;
+}
+
+static void trace_at_exit(void) {
+  trace_stop();
+}
+
+int trace_start(const char* path, int frame_sample) {
+  if (!path) return -1;
+  if (atomic_exchange(&trace_started, 1)) {
+    fprintf(stderr, "trace_start: tracing can only be started once\n");
+    return -1;
+  }
+  size_t len = strlen(path) + 1;
+  trace_path = (char*)nr_malloc(NULL, len);
+  if (!trace_path) return -1;
+  memcpy(trace_path, path, len);
+  trace_sample = frame_sample > 1 ? frame_sample : 1;
+  trace_epoch = now_ns();
+  atexit(trace_at_exit);
+  atomic_store(&trace_on, 1);
+  thread_self();  // the starting thread gets the first row
+  return 0;
+}
+
+int trace_active(void) {
+  return atomic_load_explicit(&trace_on, memory_order_relaxed);
+}
+
+int trace_frame_sampled(long frame) {
+  return trace_active() && frame % trace_sample == 0;
+}
+
+uint64_t trace_begin(void) {
+  return trace_active() ? now_ns() : 0;
+}
+
+void trace_end(const char* cat, const char* name, uint64_t begin, long arg) {
+  if (!begin || !trace_active()) return;
+  uint64_t end = now_ns();
+  TraceThread* t = thread_self();
+  if (!t) return;
+  TraceChunk* chunk = t->current;
+  int n = atomic_load_explicit(&chunk->count, memory_order_relaxed);
+  if (n == TRACE_CHUNK_EVENTS) {
+    TraceChunk* next = chunk_new();
+    if (!next) return;  // dropped
+    atomic_store_explicit(&chunk->next, next, memory_order_release);
+    t->current = chunk = next;
+    n = 0;
+  }
+  TraceEvent* e = &chunk->events[n];
+  e->cat = cat;
+  e->name = name;
+  e->begin = begin;
+  e->end = end;
+  e->arg = arg;
+  atomic_store_explicit(&chunk->count, n + 1, memory_order_release);
+}
+
+void trace_thread_name(const char* name) {
+  if (!trace_active() || !name) return;
+  TraceThread* t = thread_self();
+  if (!t) return;
+  snprintf(t->name, sizeof(t->name), "%s", name);
+}
+
+static void write_string(FILE* fp, const char* s) {
+  fputc('"', fp);
+  for (; *s; s++) {
+    if (*s == '"' || *s == '\\') fputc('\\', fp);
+    if ((unsigned char)*s >= 0x20) fputc(*s, fp);
+  }
+  fputc('"', fp);
+}
+
+int trace_stop(void) {
+  if (!atomic_exchange(&trace_on, 0)) return 0;
+  FILE* fp = fopen(trace_path, "w");
+  if (!fp) {
+    perror(trace_path);
+    return -1;
+  }
+  int pid = (int)getpid();
+  long events = 0;
+  fprintf(fp, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+  for (TraceThread* t = atomic_load(&trace_threads); t; t = t->next) {
+    fprintf(fp, "%s{\"ph\":\"M\",\"name\":\"thread_name\",\"pid\":%d,\"tid\":%d,\"args\":{\"name\":",
+            events++ ? ",\n" : "", pid, t->tid);
+    write_string(fp, t->name);
+    fprintf(fp, "}}");
+    for (TraceChunk* c = t->first; c; c = atomic_load_explicit(&c->next, memory_order_acquire)) {
+      int count = atomic_load_explicit(&c->count, memory_order_acquire);
+      for (int i = 0; i < count; i++) {
+        const TraceEvent* e = &c->events[i];
+        // microseconds since trace_start
+        fprintf(fp, ",\n{\"ph\":\"X\",\"cat\":\"%s\",\"name\":\"%s\",\"pid\":%d,\"tid\":%d,"
+                "\"ts\":%.3f,\"dur\":%.3f,\"args\":{\"n\":%ld}}",
+                e->cat, e->name, pid, t->tid, (double)(e->begin - trace_epoch) / 1000.0,
+                (double)(e->end - e->begin) / 1000.0, e->arg);
+        events++;
+      }
+    }
+  }
+  fprintf(fp, "\n]}\n");
+  int status = fclose(fp) == 0 ? 0 : -1;
+  if (status != 0) perror(trace_path);
+  return status;
+}
@@ -0,0 +1,155 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <string.h>
+
+#include "voiceband.h"
+#include "nr_alloc.h"
+
+int voiceband_config(const SpectralGateConfig* full, int sample_rate, int band_rate,
+                     SpectralGateConfig* band) {
+    if (!full || !band || sample_rate <= 0 || band_rate <= 0 || band_rate > sample_rate) {
+        perror("invalid args to voiceband_config\n");
+        return -1;
+    }
+    *band = *full;
+
+    // the same frame length in time, rounded up to a size whose half factors into
+    // 2, 3 and 5, and the hop keeps its ratio. eg. 1024 / 256 at 44.1 kHz becomes
+    // 384 / 96 at 16 kHz, both 23-24 ms frames every 6 ms
+    int scaled = (int)lround((double)full->frame_size * band_rate / sample_rate);
+    int frame_size = kiss_fftr_next_fast_size_real(scaled < 16 ? 16 : scaled);
+    int hop_size = (int)lround((double)full->hop_size * frame_size / full->frame_size);
+    if (hop_size < 1) hop_size = 1;
+
+    band->frame_size = frame_size;
+    band->hop_size = hop_size;
+    band->sample_rate = band_rate;
+    // noise_decay and the VAD smoothing stay timed like the full rate gate's
+    if (full->smoothing_hop <= 0) {
+        band->smoothing_hop = (int)lround((double)full->hop_size * 44100 / sample_rate);
+    }
+    return 0;
+}
+
+VoiceBand* voiceband_init(const SpectralGateConfig* full, int sample_rate, int band_rate,
+                          VoiceBandHighMode high_mode) {
+    if (!full || sample_rate <= 0 || band_rate <= 0 || band_rate > sample_rate) {
+        perror("invalid voice band config for init\n");
+        return NULL;
+    }
+    VoiceBand* vb = (VoiceBand*)nr_calloc(NULL, 1, sizeof(VoiceBand));
+    if (!vb) {
+        perror("failed to allocate voice band\n");
+        return NULL;
+    }
+    vb->sample_rate = sample_rate;
+    vb->band_rate = band_rate;
+    vb->high_mode = high_mode;
+    vb->high_gain = high_mode == VB_HIGH_PASS ? 1.0f : powf(10.0f, full->noise_floor / 20.0f);
+    // the decimator's taps are at the full rate, scaled by the rate ratio to
+    // give it the interpolator's transition width
+    int down_taps = (int)(((long)VOICEBAND_TAPS * sample_rate + band_rate - 1) / band_rate);
+    vb->down = resampler_init(sample_rate, band_rate, down_taps);
+    vb->up = resampler_init(band_rate, sample_rate, VOICEBAND_TAPS);
+    if (!vb->down || !vb->up) {
+        voiceband_free(vb);
+        return NULL;
+    }
+    return vb;
+}
+
+void voiceband_free(VoiceBand* vb) {
+    if (!vb) return;
+    resampler_free(vb->down);
+    resampler_free(vb->up);
+    nr_free(NULL, vb);
+}
+
+// the high band's gain per band sample for VB_HIGH_ATTENUATE: how far the gate
+// left the top of the voice band open, measured per block as the energy of the
+// first difference (which weighs 4-8 kHz most) of gated against low. it opens
+// at once and closes over a few blocks, and never goes below high_gain
+static void follow_gate(const VoiceBand* vb, const float* low, const float* gated, float* gain,
+                        long band_len) {
+    int block = vb->band_rate * VOICEBAND_FOLLOW_MS / 1000;
+    float g = vb->high_gain;
+    float prev = 0.0f;
+    for (long start = 0; start < band_len; start += block) {
+        long end = start + block < band_len ? start + block : band_len;
+        double in = 0.0, out = 0.0;
+        for (long i = start; i < end; i++) {
+            double dl = low[i] - (i > 0 ? low[i - 1] : 0.0f);
+            double dg = gated[i] - (i > 0 ? gated[i - 1] : 0.0f);
+            in += dl * dl;
+            out += dg * dg;
+        }
+        if (in > 0.0) {
+            float target = (float)sqrt(out / in);
+            if (target > 1.0f) target = 1.0f;
+            if (target < vb->high_gain) target = vb->high_gain;
+            g = target > g ? target : VOICEBAND_FOLLOW_RELEASE * g + (1.0f - VOICEBAND_FOLLOW_RELEASE) * target;
+        }
+        // ramps from the last block's gain to this one's
+        for (long i = start; i < end; i++) {
+            float t = (float)(i - start + 1) / (end - start);
+            gain[i] = start == 0 ? g : prev + t * (g - prev);
+        }
+        prev = g;
+    }
+}
+
+int voiceband_process(VoiceBand* vb, SpectralGateData* band_spd, const float* input,
+                      float* output, long num_samples) {
+    if (!vb || !band_spd || !input || !output || num_samples <= 0) {
+        perror("invalid args to voiceband_process\n");
+        return -1;
+    }
+
+    long band_len = resampler_output_length(vb->down, num_samples);
+    long up_len = resampler_output_length(vb->up, band_len);
+    float* low = (float*)nr_malloc(NULL, band_len * sizeof(float));
+    float* gated = (float*)nr_malloc(NULL, band_len * sizeof(float));
+    float* up = (float*)nr_malloc(NULL, up_len * sizeof(float));
+    float* gain = (float*)nr_malloc(NULL, band_len * sizeof(float));
+    if (!low || !gated || !up || !gain) {
+        fprintf(stderr, "voiceband_process: out of memory\n");
+        nr_free(NULL, low);
+        nr_free(NULL, gated);
+        nr_free(NULL, up);
+        nr_free(NULL, gain);
+        return -1;
+    }
+
+    int ret = -1;
+    if (resampler_process(vb->down, input, num_samples, low) == band_len &&
+        spectral_gate_start(band_spd, low, gated, band_len) == 0) {
+        // out = g * x + up(gated - g * low)
+        // the high band is x - up(low), so this is up(gated) plus the high band
+        // scaled by g, for the cost of a single interpolation. g follows the gate
+        // slowly enough to pass through the interpolator as a constant
+        if (vb->high_mode == VB_HIGH_ATTENUATE) {
+            follow_gate(vb, low, gated, gain, band_len);
+        } else {
+            for (long i = 0; i < band_len; i++) gain[i] = vb->high_gain;
+        }
+        for (long i = 0; i < band_len; i++) {
+            gated[i] -= gain[i] * low[i];
+        }
+        if (resampler_process(vb->up, gated, band_len, up) == up_len) {
+            long n = up_len < num_samples ? up_len : num_samples;
+            for (long i = 0; i < num_samples; i++) {
+                long b = (long)((double)i * vb->band_rate / vb->sample_rate);
+                float g = gain[b < band_len ? b : band_len - 1];
+                output[i] = g * input[i] + (i < n ? up[i] : 0.0f);
+            }
+            ret = 0;
+        }
+    }
+
+    nr_free(NULL, low);
+    nr_free(NULL, gated);
+    nr_free(NULL, up);
+    nr_free(NULL, gain);
+    return ret;
+}
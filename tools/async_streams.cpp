@@ -0,0 +1,116 @@
+// serves many concurrent streams from one thread with the coroutine api
+//
+//   gcc -O2 -c -Ilib src/noisereduce.c src/half.c src/kiss_fft.c src/kiss_fftr.c src/nr_alloc.c
+//       src/trace.c src/pcm_io.c src/pcm_convert.c src/mp3_utils.c
+//   g++ -std=c++20 -O2 -Ilib tools/async_streams.cpp src/async_gate.cpp *.o -lmad -lmp3lame -lpthread -o async_streams
+//   ./async_streams input.wav [streams] [block]
+//
+// every stream opens its own reader on the file, downmixes each block to mono and
+// gates it. all coroutines run on the main thread, reads go through one io
+// worker and gating through one dsp worker that takes every pending block in a
+// single pass. since one worker runs all gates they share one plan/window block
+// and keep their state in half precision
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+#include "async_gate.hpp"
+
+using namespace noisereduce::async;
+
+namespace {
+
+struct StreamStats {
+    long frames = 0;
+    double energy = 0.0;
+};
+
+Task<void> serve(BatchExecutor& io, BatchExecutor& dsp, SpectralGateShared* shared,
+                 const char* path, int block, StreamStats& stats) {
+    AsyncPcmReader reader(io, path);
+    AsyncGate gate(dsp, shared);
+    const int channels = reader.spec().channels;
+    std::vector<float> pcm(static_cast<size_t>(block) * channels);
+    std::vector<float> mono(block);
+
+    for (;;) {
+        long frames = co_await reader.read(pcm);
+        if (frames == 0) break;
+        for (long i = 0; i < frames; i++) {
+            float sum = 0.0f;
+            for (int ch = 0; ch < channels; ch++) sum += pcm[i * channels + ch];
+            mono[i] = sum / channels;
+        }
+        std::span<float> out(mono.data(), static_cast<size_t>(frames));
+        co_await gate.process(out);
+        for (float v : out) stats.energy += static_cast<double>(v) * v;
+        stats.frames += frames;
+    }
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+    if (argc < 2) {
+        std::fprintf(stderr, "usage: %s input.wav [streams] [block]\n", argv[0]);
+        return 1;
+    }
+    const char* path = argv[1];
+    int streams = argc > 2 ? std::atoi(argv[2]) : 256;
+    int block = argc > 3 ? std::atoi(argv[3]) : 480;
+    if (streams <= 0 || block <= 0) {
+        std::fprintf(stderr, "streams and block must be positive\n");
+        return 1;
+    }
+
+    int sample_rate = 0;
+    try {
+        EventLoop probe_loop;
+        BatchExecutor probe_io(probe_loop);
+        sample_rate = AsyncPcmReader(probe_io, path).spec().sample_rate;
+    } catch (const std::exception& e) {
+        std::fprintf(stderr, "%s\n", e.what());
+        return 1;
+    }
+
+    SpectralGateConfig config{};
+    config.frame_size = 1024;
+    config.hop_size = 256;
+    config.alpha = 1.5f;
+    config.noise_floor = -30.0f;
+    config.noise_decay = 0.98f;
+    config.silence_threshold = 0.01f;
+    config.window_mode = SG_WINDOW_HANN;
+    config.sample_rate = sample_rate;
+    config.compact_state = 1;
+    SpectralGateShared* shared = spectral_gate_shared_init(&config);
+    if (!shared) return 1;
+
+    std::vector<StreamStats> stats(streams);
+    long dsp_jobs = 0, dsp_batches = 0;
+    auto t0 = std::chrono::steady_clock::now();
+    {
+        EventLoop loop;
+        BatchExecutor io(loop);
+        BatchExecutor dsp(loop);
+        for (int s = 0; s < streams; s++) {
+            spawn(loop, serve(io, dsp, shared, path, block, stats[s]));
+        }
+        loop.run();
+        dsp_jobs = dsp.jobs();
+        dsp_batches = dsp.batches();
+    }
+    double wall = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+    spectral_gate_shared_free(shared);
+
+    long frames = 0;
+    for (const StreamStats& s : stats) frames += s.frames;
+    double audio = static_cast<double>(frames) / sample_rate;
+    std::printf("%d streams, %.1f s of audio in %.3f s (%.1fx realtime on one loop thread)\n",
+                streams, audio, wall, wall > 0.0 ? audio / wall : 0.0);
+    std::printf("dsp worker: %ld blocks in %ld passes (%.1f blocks per pass)\n",
+                dsp_jobs, dsp_batches, dsp_batches ? static_cast<double>(dsp_jobs) / dsp_batches : 0.0);
+    return 0;
+}
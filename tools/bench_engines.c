@@ -0,0 +1,140 @@
+// latency and cost per channel of the stft engine against the wola filterbank
+//
+//   gcc -O2 -std=gnu11 -Ilib tools/bench_engines.c src/noisereduce.c src/half.c
+//       src/kiss_fft.c src/kiss_fftr.c src/nr_alloc.c src/trace.c -lm -lpthread
+//       -o bench_engines
+//   ./bench_engines [seconds] [block]
+//
+// every config streams the same synthetic input (noise with bursts of tones) in
+// blocks of `block` samples through spectral_gate_stream, like one channel of a
+// live stream. the report is the delay, the cpu time per second of audio, how far
+// the noise only stretches come down and the snr of the bursts against the clean
+// tones once the delay is taken out
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "noisereduce.h"
+
+#define RATE 44100
+
+typedef struct {
+  const char* name;
+  int engine;
+  int window_mode;
+  int frame_size;
+  int hop_size;
+  int wola_taps;
+} EngineCase;
+
+static const EngineCase cases[] = {
+    {"stft hann", SG_ENGINE_STFT, SG_WINDOW_HANN, 1024, 256, 0},
+    {"stft hann", SG_ENGINE_STFT, SG_WINDOW_HANN, 512, 128, 0},
+    {"stft hann", SG_ENGINE_STFT, SG_WINDOW_HANN, 256, 64, 0},
+    {"stft low latency", SG_ENGINE_STFT, SG_WINDOW_LOW_LATENCY, 1024, 128, 0},
+    {"wola", SG_ENGINE_WOLA, SG_WINDOW_HANN, 256, 32, 256},
+    {"wola", SG_ENGINE_WOLA, SG_WINDOW_HANN, 256, 32, 512},
+    {"wola", SG_ENGINE_WOLA, SG_WINDOW_HANN, 256, 32, 1024},
+    {"wola", SG_ENGINE_WOLA, SG_WINDOW_HANN, 128, 16, 256},
+    {"wola", SG_ENGINE_WOLA, SG_WINDOW_HANN, 512, 64, 1024},
+};
+
+static double now_seconds(void) {
+  struct timespec ts;
+  timespec_get(&ts, TIME_UTC);
+  return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+// noise everywhere, tones every other half second; clean gets the tones alone
+static void make_input(float* input, float* clean, long n) {
+  unsigned seed = 1;
+  for (long i = 0; i < n; i++) {
+    seed = seed * 1103515245u + 12345u;
+    float noise = ((seed >> 8) / 8388608.0f - 1.0f) * 0.02f;
+    int burst = (i / (RATE / 2)) % 2;
+    clean[i] = burst ? 0.3f * sinf(0.05f * i) + 0.1f * sinf(0.31f * i) : 0.0f;
+    input[i] = noise + clean[i];
+  }
+}
+
+static void bench(const EngineCase* c, const float* input, const float* clean, long n,
+                  int block, float* output) {
+  SpectralGateConfig config;
+  memset(&config, 0, sizeof(config));
+  config.frame_size = c->frame_size;
+  config.hop_size = c->hop_size;
+  config.alpha = 1.5f;
+  config.noise_floor = -30.0f;
+  config.noise_decay = 0.98f;
+  config.silence_threshold = 0.001f;
+  config.window_mode = c->window_mode;
+  config.sample_rate = RATE;
+  config.engine = c->engine;
+  config.wola_taps = c->wola_taps;
+  config.smoothing_hop = 256;  // every case tracks noise as fast as the 1024 / 256 stft
+
+  SpectralGateData* spd = spectral_gate_init(&config);
+  if (!spd) {
+    fprintf(stderr, "failed to init %s %d/%d\n", c->name, c->frame_size, c->hop_size);
+    return;
+  }
+  double t0 = now_seconds();
+  for (long i = 0; i < n; i += block) {
+    long m = n - i < block ? n - i : block;
+    spectral_gate_stream(spd, input + i, output + i, m);
+  }
+  double elapsed = now_seconds() - t0;
+  int latency = spectral_gate_latency(spd);
+
+  double noise_in = 0.0, noise_out = 0.0, ref = 0.0, err = 0.0;
+  for (long i = 0; i + latency < n; i++) {
+    double out = output[i + latency];
+    if (clean[i] == 0.0f) {
+      noise_in += (double)input[i] * input[i];
+      noise_out += out * out;
+    } else {
+      ref += (double)clean[i] * clean[i];
+      err += (out - clean[i]) * (out - clean[i]);
+    }
+  }
+  double audio = (double)n / RATE;
+  char taps[16] = "";
+  if (c->engine == SG_ENGINE_WOLA) snprintf(taps, sizeof(taps), "%d", spd->window_length);
+  printf("%-17s %5d %4d %5s  %5d (%5.1f ms)  %7.1f us/s  %6.1fx  %5.1f dB  %5.1f dB\n", c->name,
+         c->frame_size, c->hop_size, taps, latency, 1000.0 * latency / RATE,
+         1e6 * elapsed / audio, audio / elapsed, 10.0 * log10(noise_in / noise_out),
+         10.0 * log10(ref / err));
+  spectral_gate_free(spd);
+}
+
+int main(int argc, char** argv) {
+  double seconds = argc > 1 ? atof(argv[1]) : 30.0;
+  int block = argc > 2 ? atoi(argv[2]) : 32;
+  if (seconds <= 0.0 || block <= 0) {
+    fprintf(stderr, "usage: %s [seconds] [block]\n", argv[0]);
+    return 1;
+  }
+  long n = (long)(seconds * RATE);
+  float* input = (float*)malloc(n * sizeof(float));
+  float* clean = (float*)malloc(n * sizeof(float));
+  float* output = (float*)malloc(n * sizeof(float));
+  if (!input || !clean || !output) {
+    perror("failed to allocate buffers");
+    return 1;
+  }
+  make_input(input, clean, n);
+
+  printf("%.0f s at %d Hz in blocks of %d, one channel\n", seconds, RATE, block);
+  printf("%-17s %5s %4s %5s  %16s  %10s  %7s  %8s  %8s\n", "engine", "frame", "hop", "taps",
+         "latency", "cpu", "speed", "noise", "tone snr");
+  for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+    bench(&cases[i], input, clean, n, block, output);
+  }
+  free(input);
+  free(clean);
+  free(output);
+  return 0;
+}
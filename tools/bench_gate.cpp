@@ -0,0 +1,125 @@
+// benchmark of the compile time c++ gate against the c streaming gate
+//
+//   gcc -O2 -c -Ilib src/noisereduce.c src/half.c src/kiss_fft.c src/kiss_fftr.c src/nr_alloc.c
+//       src/trace.c
+//   g++ -std=c++20 -O2 -Ilib tools/bench_gate.cpp src/spectral_gate.cpp *.o -lpthread -o bench_gate
+//   ./bench_gate [seconds] [block]
+//
+// both gates get the same synthetic input (noise with bursts of tones) in blocks
+// of `block` samples, once with the smoothing per hop and once with smoothing_hop
+// 256. the report is speed relative to realtime at 44.1 kHz and how far the
+// outputs are apart. exits 1 when they are further apart than rounding explains
+
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <vector>
+
+#include "noisereduce.h"
+#include "spectral_gate.hpp"
+
+namespace {
+
+constexpr int kRate = 44100;
+
+// the two gates only differ in the order of float operations. the gain mask is
+// hard though, so a bin right at alpha * noise_est can land on either side and
+// a minute of audio agrees to about 92 dB. gates that track noise differently
+// are 30-45 dB apart
+constexpr double kMinSnr = 80.0;
+
+double now() {
+    using clock = std::chrono::steady_clock;
+    return std::chrono::duration<double>(clock::now().time_since_epoch()).count();
+}
+
+std::vector<float> make_input(long n) {
+    std::vector<float> x(n);
+    std::mt19937 rng(1);
+    std::uniform_real_distribution<float> noise(-0.01f, 0.01f);
+    for (long i = 0; i < n; i++) {
+        bool burst = (i / (kRate / 2)) % 2;
+        x[i] = noise(rng) + (burst ? 0.3f * std::sin(0.05f * i) + 0.1f * std::sin(0.31f * i) : 0.0f);
+    }
+    return x;
+}
+
+// returns false when the outputs disagree
+template <int Frame, int Hop>
+bool bench(const std::vector<float>& input, int block, int smoothing_hop) {
+    SpectralGateConfig config{};
+    config.frame_size = Frame;
+    config.hop_size = Hop;
+    config.alpha = 1.5f;
+    config.noise_floor = -30.0f;
+    config.noise_decay = 0.98f;
+    config.silence_threshold = 0.01f;
+    config.window_mode = SG_WINDOW_HANN;
+    config.sample_rate = kRate;
+    config.smoothing_hop = smoothing_hop;
+
+    const long n = static_cast<long>(input.size());
+    std::vector<float> out_c(n), out_cpp(n);
+
+    SpectralGateData* spd = spectral_gate_init(&config);
+    if (!spd) {
+        std::fprintf(stderr, "failed to init the c gate\n");
+        std::exit(1);
+    }
+    double t0 = now();
+    for (long i = 0; i < n; i += block) {
+        long m = n - i < block ? n - i : block;
+        spectral_gate_stream(spd, input.data() + i, out_c.data() + i, m);
+    }
+    double t_c = now() - t0;
+    spectral_gate_free(spd);
+
+    noisereduce::SpectralGate<Frame, Hop> gate(config);
+    t0 = now();
+    for (long i = 0; i < n; i += block) {
+        std::size_t m = static_cast<std::size_t>(n - i < block ? n - i : block);
+        gate.process(std::span<const float>(input.data() + i, m), std::span<float>(out_cpp.data() + i, m));
+    }
+    double t_cpp = now() - t0;
+
+    double ref = 0.0, err = 0.0, max_err = 0.0;
+    for (long i = 0; i < n; i++) {
+        double d = static_cast<double>(out_cpp[i]) - out_c[i];
+        ref += static_cast<double>(out_c[i]) * out_c[i];
+        err += d * d;
+        max_err = std::fmax(max_err, std::fabs(d));
+    }
+    double audio = static_cast<double>(n) / kRate;
+    double snr = err > 0.0 ? 10.0 * std::log10(ref / err) : 999.0;
+    std::printf("%5d/%-4d smooth %3d  c %7.1fx  c++ %7.1fx  speedup %.2f  snr %.1f dB  max diff %.2e%s\n",
+                Frame, Hop, smoothing_hop, audio / t_c, audio / t_cpp, t_c / t_cpp, snr, max_err,
+                snr < kMinSnr ? "  MISMATCH" : "");
+    return snr >= kMinSnr;
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+    double seconds = argc > 1 ? std::atof(argv[1]) : 60.0;
+    int block = argc > 2 ? std::atoi(argv[2]) : 480;
+    if (seconds <= 0.0 || block <= 0) {
+        std::fprintf(stderr, "usage: %s [seconds] [block]\n", argv[0]);
+        return 1;
+    }
+    std::vector<float> input = make_input(static_cast<long>(seconds * kRate));
+    std::printf("%.0f s of audio in blocks of %d, speed as multiple of realtime\n", seconds, block);
+    bool ok = true;
+    for (int smoothing_hop : {0, 256}) {
+        ok &= bench<256, 64>(input, block, smoothing_hop);
+        ok &= bench<512, 128>(input, block, smoothing_hop);
+        ok &= bench<1024, 256>(input, block, smoothing_hop);
+        ok &= bench<2048, 512>(input, block, smoothing_hop);
+    }
+    if (!ok) {
+        std::printf("c and c++ gates disagree by more than %.0f dB\n", kMinSnr);
+        return 1;
+    }
+    return 0;
+}
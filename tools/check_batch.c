@@ -0,0 +1,251 @@
+// checks that the work-stealing batch runner writes the same samples as gating
+// the files one after another
+//
+//   gcc -O2 -std=gnu11 -Ilib tools/check_batch.c src/batch.c src/task_pool.c
+//       src/mp3_utils.c src/pcm_io.c src/pcm_convert.c src/noisereduce.c src/half.c
+//       src/kiss_fft.c src/kiss_fftr.c src/nr_alloc.c src/trace.c -lmad -lmp3lame
+//       -lm -lpthread -o check_batch
+//   ./check_batch [--files n] [--threads n] [--seed n] [--dir path] [--bands n]
+//
+// writes --files (default 24) f32 wavs of make_tonal's notes over white noise
+// to dir/in (dir defaults to /tmp/check_batch), 1-3 channels at 16, 44.1 or
+// 48 kHz and 0.2-4 s long, so the pool gets uneven work to steal. batch_run gates them into dir/one on a
+// single worker and into dir/pool on --threads (default 8), both as f32, and
+// each output is compared sample for sample with a plain loop over the files
+// and channels with the same config. the longest file is also run on its own
+// into dir/big, where it gets the whole pool and its channels are gated on
+// spectral_gate_start_mt. a run with dir/in as its own output
+// directory and one with two inputs of the same name must both be refused.
+// exits 1 on any difference
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "batch.h"
+#include "nr_alloc.h"
+#include "pcm_convert.h"
+#include "pcm_io.h"
+#include "test_signal.h"
+
+#define MAX_FILES 256
+
+static const int rates[] = {16000, 44100, 48000};
+
+static int make_file(const char* path, int rate, int channels, long frames) {
+  float* pcm = (float*)malloc(frames * channels * sizeof(float));
+  float* tonal = (float*)malloc(frames * sizeof(float));
+  float* noise = (float*)malloc(frames * sizeof(float));
+  int status = -1;
+  if (pcm && tonal && noise) {
+    for (int c = 0; c < channels; c++) {
+      make_tonal(tonal, frames, rate);
+      make_noise(noise, frames, NOISE_WHITE);
+      for (long i = 0; i < frames; i++) {
+        pcm[i * channels + c] = 0.2f * tonal[i] + 0.03f * noise[i];
+      }
+    }
+    PcmSpec spec = {rate, channels, PCM_FORMAT_F32};
+    status = float_to_pcm(path, pcm, frames * channels, &spec);
+  }
+  free(pcm);
+  free(tonal);
+  free(noise);
+  return status;
+}
+
+// gates one file the way a batch channel task does, on this thread
+static float* gate_serial(const char* path, const SpectralGateConfig* base, long* samples) {
+  PcmSpec spec = {0, 0, PCM_FORMAT_F32};
+  float* pcm = NULL;
+  long total = pcm_to_float(path, &spec, &pcm);
+  if (total <= 0) return NULL;
+  int channels = spec.channels;
+  long frames = total / channels;
+  float* out = (float*)nr_calloc(NULL, frames * channels, sizeof(float));
+  float* in_ch = (float*)nr_malloc(NULL, frames * sizeof(float));
+  float* out_ch = (float*)nr_malloc(NULL, frames * sizeof(float));
+  SpectralGateConfig config = *base;
+  config.sample_rate = spec.sample_rate;
+  int status = out && in_ch && out_ch ? 0 : -1;
+  for (int c = 0; c < channels && status == 0; c++) {
+    SpectralGateData* spd = spectral_gate_init(&config);
+    pcm_extract_channel(pcm, in_ch, channels, c, frames);
+    status = spd ? spectral_gate_start(spd, in_ch, out_ch, frames) : -1;
+    pcm_insert_channel(out_ch, out, channels, c, frames);
+    spectral_gate_free(spd);
+  }
+  nr_free(NULL, pcm);
+  nr_free(NULL, in_ch);
+  nr_free(NULL, out_ch);
+  if (status != 0) {
+    nr_free(NULL, out);
+    return NULL;
+  }
+  *samples = frames * channels;
+  return out;
+}
+
+// compares one batch output with the serial result, returns the differing
+// samples or -1 when the file is missing or the wrong length
+static long compare_output(const char* path, const float* expect, long samples) {
+  PcmSpec spec = {0, 0, PCM_FORMAT_F32};
+  float* got = NULL;
+  long total = pcm_to_float(path, &spec, &got);
+  long diffs = -1;
+  if (total == samples) {
+    diffs = 0;
+    for (long i = 0; i < samples; i++) diffs += memcmp(&got[i], &expect[i], sizeof(float)) != 0;
+  }
+  nr_free(NULL, got);
+  return diffs;
+}
+
+int main(int argc, char** argv) {
+  int num_files = 24;
+  int threads = 8;
+  unsigned seed = 1;
+  int bands = 0;
+  const char* dir = "/tmp/check_batch";
+
+  for (int i = 1; i < argc; i++) {
+    const char* arg = argv[i];
+    int has_value = i + 1 < argc;
+    if (strcmp(arg, "--files") == 0 && has_value) {
+      num_files = atoi(argv[++i]);
+    } else if (strcmp(arg, "--threads") == 0 && has_value) {
+      threads = atoi(argv[++i]);
+    } else if (strcmp(arg, "--seed") == 0 && has_value) {
+      seed = (unsigned)strtoul(argv[++i], NULL, 10);
+    } else if (strcmp(arg, "--dir") == 0 && has_value) {
+      dir = argv[++i];
+    } else if (strcmp(arg, "--bands") == 0 && has_value) {
+      bands = atoi(argv[++i]);
+    } else {
+      num_files = 0;
+      break;
+    }
+  }
+  if (num_files < 1 || num_files > MAX_FILES || threads < 2 || seed == 0 || bands < 0) {
+    fprintf(stderr, "usage: %s [--files n] [--threads n] [--seed n] [--dir path] [--bands n]\n",
+            argv[0]);
+    return 1;
+  }
+
+  char in_dir[1024], one_dir[1024], pool_dir[1024], big_dir[1024], path[1200];
+  snprintf(in_dir, sizeof(in_dir), "%s/in", dir);
+  snprintf(one_dir, sizeof(one_dir), "%s/one", dir);
+  snprintf(pool_dir, sizeof(pool_dir), "%s/pool", dir);
+  snprintf(big_dir, sizeof(big_dir), "%s/big", dir);
+  mkdir(dir, 0755);
+  if ((mkdir(in_dir, 0755) != 0 && access(in_dir, W_OK) != 0) ||
+      (mkdir(one_dir, 0755) != 0 && access(one_dir, W_OK) != 0) ||
+      (mkdir(pool_dir, 0755) != 0 && access(pool_dir, W_OK) != 0) ||
+      (mkdir(big_dir, 0755) != 0 && access(big_dir, W_OK) != 0)) {
+    perror(dir);
+    return 1;
+  }
+
+  char names[MAX_FILES][64];
+  int longest = 0;
+  long longest_frames = 0;
+  rng_state = seed;
+  for (int f = 0; f < num_files; f++) {
+    int rate = rates[(int)(uniform() * 3)];
+    int channels = 1 + (int)(uniform() * 3);
+    long frames = (long)((0.2f + 3.8f * uniform()) * rate);
+    snprintf(names[f], sizeof(names[f]), "%03d_%dch_%d.wav", f, channels, rate);
+    if (frames * channels > longest_frames) {
+      longest = f;
+      longest_frames = frames * channels;
+    }
+    snprintf(path, sizeof(path), "%s/%.63s", in_dir, names[f]);
+    if (make_file(path, rate, channels, frames) != 0) {
+      fprintf(stderr, "failed to write %s\n", path);
+      return 1;
+    }
+  }
+
+  BatchOptions opts;
+  memset(&opts, 0, sizeof(opts));
+  opts.input = in_dir;
+  opts.out_format = PCM_FORMAT_F32;
+  opts.config.frame_size = 1024;
+  opts.config.hop_size = 256;
+  opts.config.alpha = 1.5f;
+  opts.config.noise_floor = -30.0f;
+  opts.config.noise_decay = 0.98f;
+  opts.config.silence_threshold = 0.01f;
+  opts.config.num_bands = bands;
+  opts.out_dir = one_dir;
+  opts.threads = 1;
+  int failed = batch_run(&opts) != 0;
+  opts.out_dir = pool_dir;
+  opts.threads = threads;
+  failed |= batch_run(&opts) != 0;
+
+  char list[1100];
+  snprintf(list, sizeof(list), "%s/big.txt", dir);
+  FILE* fp = fopen(list, "w");
+  if (fp) {
+    fprintf(fp, "%s/%s\n", in_dir, names[longest]);
+    fclose(fp);
+  }
+  opts.input = list;
+  opts.out_dir = big_dir;
+  failed |= !fp || batch_run(&opts) != 0;
+  opts.input = in_dir;
+
+  // outputs that would land on an input, or two inputs sharing an output,
+  // must fail the run before anything is written
+  opts.out_dir = in_dir;
+  int in_place = batch_run(&opts) != 0;
+  snprintf(list, sizeof(list), "%s/list.txt", dir);
+  fp = fopen(list, "w");
+  if (fp) {
+    fprintf(fp, "%s/%s\n%s/%s\n", in_dir, names[0], one_dir, names[0]);
+    fclose(fp);
+  }
+  opts.input = list;
+  opts.out_dir = pool_dir;
+  int same_name = fp && batch_run(&opts) != 0;
+  printf("rejects in place outputs: %s, shared output names: %s\n",
+         in_place ? "yes" : "NO", same_name ? "yes" : "NO");
+  failed |= !in_place || !same_name;
+
+  printf("%-20s %10s  %8s %8s %8s\n", "file", "samples", "one", "pool", "big");
+  for (int f = 0; f < num_files; f++) {
+    long samples = 0;
+    snprintf(path, sizeof(path), "%s/%.63s", in_dir, names[f]);
+    float* expect = gate_serial(path, &opts.config, &samples);
+    if (!expect) {
+      fprintf(stderr, "%s: serial gate failed\n", names[f]);
+      failed = 1;
+      continue;
+    }
+    snprintf(path, sizeof(path), "%s/%.63s", one_dir, names[f]);
+    long one = compare_output(path, expect, samples);
+    snprintf(path, sizeof(path), "%s/%.63s", pool_dir, names[f]);
+    long pool = compare_output(path, expect, samples);
+    long big = 0;
+    if (f == longest) {
+      snprintf(path, sizeof(path), "%s/%.63s", big_dir, names[f]);
+      big = compare_output(path, expect, samples);
+    }
+    nr_free(NULL, expect);
+    int same = one == 0 && pool == 0 && big == 0;
+    if (f == longest) {
+      printf("%-20s %10ld  %8ld %8ld %8ld%s\n", names[f], samples, one, pool, big,
+             same ? "" : "  MISMATCH");
+    } else {
+      printf("%-20s %10ld  %8ld %8ld %8s%s\n", names[f], samples, one, pool, "-",
+             same ? "" : "  MISMATCH");
+    }
+    failed |= !same;
+  }
+  printf("%s\n", failed ? "batch output differs from the serial gate" : "all outputs match");
+  return failed;
+}
@@ -0,0 +1,139 @@
+// decodes mp3s with mp3_to_float and mp3_to_float_mt and checks they agree
+// sample for sample
+//
+//   gcc -O2 -std=gnu11 -Ilib tools/check_decode_mt.c src/mp3_utils.c src/pcm_convert.c
+//       src/nr_alloc.c src/trace.c -lmad -lmp3lame -lm -lpthread -o check_decode_mt
+//   ./check_decode_mt [--threads 2,3,4,8] [--seconds s] [file.mp3 ...]
+//
+// without files a stereo signal of --seconds (default 30) is made, encoded with
+// float_to_mp3 to /tmp/check_decode_mt.mp3 and used. every file is decoded once
+// serially and then in parallel on each --threads count; per run: the length,
+// rate and channels against the serial decode, the number of samples that
+// differ (by any bit) and the first of them. exits 1 on any difference.
+// the synthetic file is 128 kbit/s, where two frames hold a whole reservoir;
+// low bitrate and vbr files are the ones that test how far back ranges prime
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "mp3_utils.h"
+#include "nr_alloc.h"
+
+#define MAX_THREAD_COUNTS 16
+#define SYNTH_PATH "/tmp/check_decode_mt.mp3"
+
+static int parse_counts(const char* str, int* counts) {
+  int count = 0;
+  char* end;
+  while (*str && count < MAX_THREAD_COUNTS) {
+    counts[count] = (int)strtol(str, &end, 10);
+    if (end == str || counts[count] < 1) return -1;
+    count++;
+    str = *end == ',' ? end + 1 : end;
+    if (*end && *end != ',') return -1;
+  }
+  return count;
+}
+
+// notes of two harmonics, a different pitch on each channel
+static int make_mp3(const char* path, double seconds) {
+  int rate = 44100;
+  long frames = (long)(seconds * rate);
+  float* pcm = (float*)malloc(frames * 2 * sizeof(float));
+  if (!pcm) return -1;
+  for (int c = 0; c < 2; c++) {
+    double phase = 0.0;
+    for (long i = 0; i < frames; i++) {
+      float freq = (220.0f + 110.0f * c) * powf(2.0f, (float)((i / (rate / 4)) % 12) / 12.0f);
+      phase += (double)freq / rate;
+      float p = 2.0f * (float)M_PI * (float)(phase - floor(phase));
+      pcm[i * 2 + c] = 0.3f * (sinf(p) + 0.5f * sinf(2.0f * p));
+    }
+  }
+  int status = float_to_mp3(path, pcm, frames * 2, rate, 2);
+  free(pcm);
+  return status;
+}
+
+// compares one file, returns 1 when a parallel decode differs, -1 on error
+static int check_file(const char* path, const int* counts, int num_counts) {
+  float* serial = NULL;
+  int rate, channels;
+  long length = mp3_to_float(path, &serial, &rate, &channels);
+  if (length <= 0) {
+    fprintf(stderr, "%s: serial decode failed\n", path);
+    return -1;
+  }
+  printf("%s: %ld samples, %d Hz, %d channels\n", path, length, rate, channels);
+
+  int failed = 0;
+  for (int k = 0; k < num_counts; k++) {
+    float* mt = NULL;
+    int mt_rate, mt_channels;
+    long mt_length = mp3_to_float_mt(path, &mt, &mt_rate, &mt_channels, counts[k]);
+    if (mt_length <= 0) {
+      fprintf(stderr, "%s: decode on %d threads failed\n", path, counts[k]);
+      failed = -1;
+      continue;
+    }
+    long common = mt_length < length ? mt_length : length;
+    long diffs = 0, first = -1;
+    for (long i = 0; i < common; i++) {
+      if (memcmp(&serial[i], &mt[i], sizeof(float)) != 0) {
+        if (first < 0) first = i;
+        diffs++;
+      }
+    }
+    int same = diffs == 0 && mt_length == length && mt_rate == rate && mt_channels == channels;
+    printf("  %2d threads: %ld samples, %d Hz, %d channels, %ld differ", counts[k], mt_length,
+           mt_rate, mt_channels, diffs);
+    if (first >= 0) printf(", first at %ld (%g against %g)", first, mt[first], serial[first]);
+    printf("%s\n", same ? "" : "  MISMATCH");
+    if (!same && failed == 0) failed = 1;
+    nr_free(NULL, mt);
+  }
+  nr_free(NULL, serial);
+  return failed;
+}
+
+int main(int argc, char** argv) {
+  int counts[MAX_THREAD_COUNTS] = {2, 3, 4, 8};
+  int num_counts = 4;
+  double seconds = 30.0;
+  const char* files[64];
+  int num_files = 0;
+
+  for (int i = 1; i < argc; i++) {
+    const char* arg = argv[i];
+    int has_value = i + 1 < argc;
+    if (strcmp(arg, "--threads") == 0 && has_value) {
+      num_counts = parse_counts(argv[++i], counts);
+    } else if (strcmp(arg, "--seconds") == 0 && has_value) {
+      seconds = atof(argv[++i]);
+    } else if (arg[0] != '-' && num_files < 64) {
+      files[num_files++] = arg;
+    } else {
+      num_counts = -1;
+      break;
+    }
+  }
+  if (num_counts <= 0 || seconds <= 0.0) {
+    fprintf(stderr, "usage: %s [--threads 2,3,4,8] [--seconds s] [file.mp3 ...]\n", argv[0]);
+    return 1;
+  }
+  if (num_files == 0) {
+    if (make_mp3(SYNTH_PATH, seconds) != 0) {
+      fprintf(stderr, "failed to encode %s\n", SYNTH_PATH);
+      return 1;
+    }
+    files[num_files++] = SYNTH_PATH;
+  }
+
+  int failed = 0;
+  for (int f = 0; f < num_files; f++) {
+    if (check_file(files[f], counts, num_counts) != 0) failed = 1;
+  }
+  return failed;
+}
@@ -0,0 +1,350 @@
+// encodes the same signal with float_to_mp3 and float_to_mp3_mt, decodes both and
+// checks the parallel stream against the serial one
+//
+//   gcc -O2 -std=gnu11 -Ilib tools/check_encode_mt.c src/mp3_utils.c src/pcm_convert.c
+//       src/nr_alloc.c src/trace.c -lmad -lmp3lame -lm -lpthread -o check_encode_mt
+//   ./check_encode_mt [--seconds s] [--rate hz] [--channels 1|2] [--threads n]
+//                     [--seed n] [--margin db] [--prefix path]
+//
+// the input is make_tonal's notes over light white noise, different notes on
+// each channel. both mp3s are written to prefix_serial.mp3 / prefix_mt.mp3
+// (prefix defaults to /tmp/check_encode_mt) and decoded with mp3_to_float. the
+// decoded lengths have to match, then each decode is lined up with the input
+// (encoder plus decoder delay, found by cross correlation) and the coding error
+// is measured over one mp3 frame either side of every chunk boundary of the
+// parallel encoder, as dB against the input there. both streams lead with
+// lame's info frame, filled in for the whole stream: its frame count has to be
+// the frames in the file after it, frames * frame size - delay - padding the
+// input length (what a gapless player keeps) and its crcs have to match, and
+// the two have to agree. exits 1 when the lengths differ, an info frame is
+// wrong or a boundary's parallel error is more than --margin dB (default 3)
+// above the serial error at the same place
+
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "mp3_utils.h"
+#include "nr_alloc.h"
+#include "test_signal.h"
+
+// mirrors MP3_ENC_MIN_CHUNK_FRAMES in src/mp3_utils.c, to find the boundaries
+#define MIN_CHUNK_FRAMES 256
+// lags searched for the delay, in mp3 frames
+#define MAX_DELAY_FRAMES 3
+// the info frame sits in the first frame, well within this
+#define INFO_SEARCH_BYTES 4096
+
+// interleaved, frames samples per channel, each channel its own notes
+static int make_input(float* out, long frames, int channels, int rate) {
+  float* tonal = (float*)calloc(frames, sizeof(float));
+  float* noise = (float*)malloc(frames * sizeof(float));
+  if (!tonal || !noise) {
+    free(tonal);
+    free(noise);
+    return -1;
+  }
+  for (int c = 0; c < channels; c++) {
+    make_tonal(tonal, frames, rate);
+    make_noise(noise, frames, NOISE_WHITE);
+    for (long i = 0; i < frames; i++) {
+      out[i * channels + c] = 0.25f * tonal[i] + 0.01f * noise[i];
+    }
+  }
+  free(tonal);
+  free(noise);
+  return 0;
+}
+
+// what the info frame at the start of an mp3 says about it
+typedef struct {
+  long frames;
+  long stream_frames;  // layer III frames in the file after the info frame
+  int delay;
+  int padding;
+  int tag_crc_ok;
+  int music_crc_ok;  // over the stream from the info frame or from the frame after
+} InfoFrame;
+
+static uint16_t crc16(uint16_t crc, const unsigned char* p, long n) {
+  for (long i = 0; i < n; i++) {
+    crc ^= p[i];
+    for (int b = 0; b < 8; b++) crc = (crc & 1) ? (crc >> 1) ^ 0xa001 : crc >> 1;
+  }
+  return crc;
+}
+
+// length in bytes of the layer III frame whose header is at p, 0 if it isn't one
+static long frame_bytes(const unsigned char* p) {
+  static const int kbps[2][15] = {{0, 32, 40, 48, 56, 64, 80, 96, 112, 128, 160, 192, 224, 256, 320},
+                                  {0, 8, 16, 24, 32, 40, 48, 56, 64, 80, 96, 112, 128, 144, 160}};
+  static const int rates[3] = {44100, 48000, 32000};
+  if (p[0] != 0xff || (p[1] & 0xe0) != 0xe0 || ((p[1] >> 1) & 3) != 1) return 0;
+  int lsf = !(p[1] & 0x08);
+  int shift = !(p[1] & 0x10) ? 2 : lsf;
+  int bitrate = (p[2] >> 4) < 15 ? kbps[lsf][p[2] >> 4] : 0;
+  int rate_index = (p[2] >> 2) & 3;
+  if (bitrate == 0 || rate_index == 3) return 0;
+  return (lsf ? 72L : 144L) * bitrate * 1000 / (rates[rate_index] >> shift) + ((p[2] >> 1) & 1);
+}
+
+// reads lame's info frame, returns -1 if the file doesn't start with one
+static int read_info(const char* path, InfoFrame* info) {
+  FILE* fp = fopen(path, "rb");
+  if (!fp) return -1;
+  fseek(fp, 0, SEEK_END);
+  long size = ftell(fp);
+  fseek(fp, 0, SEEK_SET);
+  unsigned char* buf = size > 0 ? (unsigned char*)malloc(size) : NULL;
+  int ok = buf && fread(buf, 1, size, fp) == (size_t)size;
+  fclose(fp);
+
+  long x = -1;
+  for (long i = 0; ok && i + 4 <= size && i < INFO_SEARCH_BYTES; i++) {
+    if (memcmp(buf + i, "Info", 4) == 0 || memcmp(buf + i, "Xing", 4) == 0) {
+      x = i;
+      break;
+    }
+  }
+  if (x < 0 || x + 156 > size) {
+    free(buf);
+    return -1;
+  }
+  const unsigned char* t = buf + x;
+  info->frames = ((long)t[8] << 24) | ((long)t[9] << 16) | ((long)t[10] << 8) | t[11];
+  info->delay = (t[141] << 4) | (t[142] >> 4);
+  info->padding = ((t[142] & 0x0f) << 8) | t[143];
+  info->tag_crc_ok = crc16(0, buf, x + 154) == ((t[154] << 8) | t[155]);
+
+  // the info frame's header is the sync word before the tag, the rest of the
+  // frame after the tag is zeros and the next sync word starts the audio
+  long frame_start = x - 1;
+  while (frame_start > 0 && !(buf[frame_start] == 0xff && (buf[frame_start + 1] & 0xe0) == 0xe0)) {
+    frame_start--;
+  }
+  long frame_end = x + 156;
+  while (frame_end + 1 < size && !(buf[frame_end] == 0xff && (buf[frame_end + 1] & 0xe0) == 0xe0)) {
+    frame_end++;
+  }
+  // lame's music crc may also cover the info frame as it was emitted: the
+  // header and zeros
+  uint16_t music_crc = (uint16_t)((t[152] << 8) | t[153]);
+  uint16_t audio_crc = crc16(0, buf + frame_end, size - frame_end);
+  static const unsigned char zeros[INFO_SEARCH_BYTES] = {0};
+  uint16_t placeholder_crc = crc16(0, buf, frame_start + 4);
+  placeholder_crc = crc16(placeholder_crc, zeros, frame_end - frame_start - 4);
+  placeholder_crc = crc16(placeholder_crc, buf + frame_end, size - frame_end);
+  info->music_crc_ok = audio_crc == music_crc || placeholder_crc == music_crc;
+  info->stream_frames = 0;
+  for (long pos = frame_end; pos + 4 <= size && frame_bytes(buf + pos) > 0;
+       pos += frame_bytes(buf + pos)) {
+    info->stream_frames++;
+  }
+  free(buf);
+  return 0;
+}
+
+// checks an info frame against its stream: the frames that follow it and,
+// unless lame resampled, the gapless length. returns 1 when something is off
+static int check_info(const char* name, const InfoFrame* info, long frame_size,
+                      long input_frames, int resampled) {
+  long gapless = info->frames * frame_size - info->delay - info->padding;
+  int bad = info->frames != info->stream_frames || !info->tag_crc_ok || !info->music_crc_ok ||
+            (!resampled && gapless != input_frames);
+  printf("info frame: %-8s %ld of %ld frames, delay %d, padding %d, gapless %ld of %ld, "
+         "crcs %s%s\n",
+         name, info->frames, info->stream_frames, info->delay, info->padding, gapless,
+         input_frames, info->tag_crc_ok && info->music_crc_ok ? "ok" : "wrong",
+         bad ? "  WRONG" : "");
+  return bad;
+}
+
+// lag of decoded against input (channel 0) in [0, max_lag] with the largest
+// correlation over span frames from start
+static long find_delay(const float* input, const float* decoded, long decoded_frames,
+                       int channels, long start, long span, long max_lag) {
+  long best = -1;
+  double best_corr = -INFINITY;
+  for (long lag = 0; lag <= max_lag; lag++) {
+    if (start + span + lag > decoded_frames) break;
+    double corr = 0.0;
+    for (long i = start; i < start + span; i++) {
+      corr += (double)input[i * channels] * decoded[(i + lag) * channels];
+    }
+    if (corr > best_corr) {
+      best_corr = corr;
+      best = lag;
+    }
+  }
+  return best;
+}
+
+// coding error of decoded (delay taken out) over input frames [from, to), in dB
+// against the input there
+static double error_db(const float* input, const float* decoded, long decoded_frames,
+                       int channels, long delay, long from, long to) {
+  double ref = 0.0, err = 0.0;
+  for (long i = from; i < to; i++) {
+    for (int c = 0; c < channels; c++) {
+      double x = input[i * channels + c];
+      double y = i + delay < decoded_frames ? decoded[(i + delay) * channels + c] : 0.0;
+      ref += x * x;
+      err += (y - x) * (y - x);
+    }
+  }
+  return ref > 0.0 && err > 0.0 ? 10.0 * log10(err / ref) : -INFINITY;
+}
+
+static void usage(const char* prog) {
+  fprintf(stderr,
+          "usage: %s [--seconds s] [--rate hz] [--channels 1|2] [--threads n] [--seed n] "
+          "[--margin db] [--prefix path]\n",
+          prog);
+}
+
+int main(int argc, char** argv) {
+  double seconds = 30.0;
+  int rate = 44100;
+  int channels = 2;
+  int threads = 4;
+  unsigned seed = 1;
+  double margin = 3.0;
+  const char* prefix = "/tmp/check_encode_mt";
+
+  for (int i = 1; i < argc; i++) {
+    const char* arg = argv[i];
+    int has_value = i + 1 < argc;
+    if (strcmp(arg, "--seconds") == 0 && has_value) {
+      seconds = atof(argv[++i]);
+    } else if (strcmp(arg, "--rate") == 0 && has_value) {
+      rate = atoi(argv[++i]);
+    } else if (strcmp(arg, "--channels") == 0 && has_value) {
+      channels = atoi(argv[++i]);
+    } else if (strcmp(arg, "--threads") == 0 && has_value) {
+      threads = atoi(argv[++i]);
+    } else if (strcmp(arg, "--seed") == 0 && has_value) {
+      seed = (unsigned)strtoul(argv[++i], NULL, 10);
+    } else if (strcmp(arg, "--margin") == 0 && has_value) {
+      margin = atof(argv[++i]);
+    } else if (strcmp(arg, "--prefix") == 0 && has_value) {
+      prefix = argv[++i];
+    } else {
+      usage(argv[0]);
+      return 1;
+    }
+  }
+  if (seconds <= 1.0 || rate < 8000 || channels < 1 || channels > 2 || threads < 2 || seed == 0) {
+    usage(argv[0]);
+    return 1;
+  }
+
+  // the frame grid the encoder works on, as float_to_mp3_mt probes it
+  lame_t probe = lame_init();
+  if (!probe) {
+    perror("failed to initialize lame");
+    return 1;
+  }
+  lame_set_num_channels(probe, channels);
+  lame_set_in_samplerate(probe, rate);
+  lame_set_brate(probe, 128);
+  if (lame_init_params(probe) < 0) {
+    fprintf(stderr, "lame_init_params() failed\n");
+    lame_close(probe);
+    return 1;
+  }
+  long frame_size = lame_get_framesize(probe);
+  int resampled = lame_get_out_samplerate(probe) != rate;
+  lame_close(probe);
+
+  long frames = (long)(seconds * rate);
+  float* input = (float*)malloc(frames * channels * sizeof(float));
+  rng_state = seed;
+  if (!input || make_input(input, frames, channels, rate) != 0) {
+    perror("failed to allocate input");
+    free(input);
+    return 1;
+  }
+
+  char serial_path[1024], mt_path[1024];
+  snprintf(serial_path, sizeof(serial_path), "%s_serial.mp3", prefix);
+  snprintf(mt_path, sizeof(mt_path), "%s_mt.mp3", prefix);
+  if (float_to_mp3(serial_path, input, frames * channels, rate, channels) != 0 ||
+      float_to_mp3_mt(mt_path, input, frames * channels, rate, channels, threads) != 0) {
+    fprintf(stderr, "encoding failed\n");
+    free(input);
+    return 1;
+  }
+  float* serial = NULL;
+  float* mt = NULL;
+  int serial_rate, serial_channels, mt_rate, mt_channels;
+  long serial_len = mp3_to_float(serial_path, &serial, &serial_rate, &serial_channels);
+  long mt_len = mp3_to_float(mt_path, &mt, &mt_rate, &mt_channels);
+  if (serial_len <= 0 || mt_len <= 0 || serial_channels != channels || mt_channels != channels) {
+    fprintf(stderr, "decoding failed\n");
+    nr_free(NULL, serial);
+    nr_free(NULL, mt);
+    free(input);
+    return 1;
+  }
+
+  printf("%.1f s at %d Hz, %d channels, %d threads, frames of %ld, seed %u\n", seconds, rate,
+         channels, threads, frame_size, seed);
+  printf("decoded: serial %ld, parallel %ld samples\n", serial_len, mt_len);
+  int failed = serial_len != mt_len;
+  if (failed) printf("lengths differ\n");
+
+  // the same split float_to_mp3_mt makes
+  long mp3_frames = frames / frame_size;
+  int chunks = threads;
+  if (mp3_frames / MIN_CHUNK_FRAMES < chunks) chunks = (int)(mp3_frames / MIN_CHUNK_FRAMES);
+
+  InfoFrame serial_info, mt_info;
+  if (read_info(serial_path, &serial_info) != 0 || read_info(mt_path, &mt_info) != 0) {
+    printf("missing info frame\n");
+    failed = 1;
+  } else {
+    failed |= check_info("serial", &serial_info, frame_size, frames, resampled);
+    failed |= check_info("parallel", &mt_info, frame_size, frames, resampled);
+    if (serial_info.frames != mt_info.frames || serial_info.delay != mt_info.delay ||
+        serial_info.padding != mt_info.padding) {
+      printf("info frames differ\n");
+      failed = 1;
+    }
+  }
+
+  if (chunks <= 1 || resampled) {
+    printf("float_to_mp3_mt fell back to the serial encoder, no chunk boundaries\n");
+  } else {
+    long serial_frames = serial_len / channels, mt_frames = mt_len / channels;
+    long max_lag = MAX_DELAY_FRAMES * frame_size;
+    long span = frames / 4 < rate ? frames / 4 : rate;
+    long serial_delay = find_delay(input, serial, serial_frames, channels, frames / 4, span, max_lag);
+    long mt_delay = find_delay(input, mt, mt_frames, channels, frames / 4, span, max_lag);
+    printf("delay: serial %ld, parallel %ld\n", serial_delay, mt_delay);
+    if (serial_delay < 0 || mt_delay < 0) {
+      printf("could not line the decodes up with the input\n");
+      failed = 1;
+    } else {
+      printf("%8s %10s  %9s %9s\n", "boundary", "sample", "serial", "parallel");
+      for (int t = 1; t < chunks; t++) {
+        long at = mp3_frames * t / chunks * frame_size;
+        long from = at - frame_size, to = at + frame_size;
+        double s = error_db(input, serial, serial_frames, channels, serial_delay, from, to);
+        double m = error_db(input, mt, mt_frames, channels, mt_delay, from, to);
+        int over = m > s + margin;
+        printf("%8d %10ld  %+9.1f %+9.1f%s\n", t, at, s, m, over ? "  over the margin" : "");
+        failed |= over;
+      }
+      printf("%8s %10s  %+9.1f %+9.1f\n", "all", "",
+             error_db(input, serial, serial_frames, channels, serial_delay, 0, frames),
+             error_db(input, mt, mt_frames, channels, mt_delay, 0, frames));
+    }
+  }
+
+  nr_free(NULL, serial);
+  nr_free(NULL, mt);
+  free(input);
+  return failed;
+}
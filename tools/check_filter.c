@@ -0,0 +1,177 @@
+// checks that the stdin filter mode (filter_run, spectral_gate_stream) gives
+// the file path's output (spectral_gate_start per channel) on the cli defaults
+//
+//   gcc -O2 -std=gnu11 -Ilib tools/check_filter.c src/filter.c src/pcm_io.c
+//       src/pcm_convert.c src/noisereduce.c src/half.c src/kiss_fft.c
+//       src/kiss_fftr.c src/nr_alloc.c src/trace.c -lm -lpthread -o check_filter
+//   ./check_filter [--seconds s] [--rate hz] [--seed n] [--dir path]
+//
+// the input is make_speech over pink noise at 10 dB snr per channel, after half
+// a second of noise alone, written as a stereo f32 wav to dir (default /tmp).
+// filter_run reads it as a stream, the way `cat in.wav | nr - out.wav` does,
+// and the file path gates the same samples. per channel: the level of the
+// filter output against the file output, their correlation and the largest
+// difference, leaving out the first frame, which the file path fades in.
+// exits 1 when the level is off by more than LEVEL_LIMIT_DB or the correlation
+// is below CORR_LIMIT
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "filter.h"
+#include "noisereduce.h"
+#include "nr_alloc.h"
+#include "pcm_io.h"
+#include "test_signal.h"
+
+#define CHANNELS 2
+#define LEVEL_LIMIT_DB 0.1
+#define CORR_LIMIT 0.999
+
+// the cli's defaults (make_config in src/main.c)
+static void default_config(SpectralGateConfig* config, int rate) {
+  memset(config, 0, sizeof(*config));
+  config->frame_size = 1024;
+  config->hop_size = 256;
+  config->alpha = 1.5f;
+  config->noise_floor = -30.0f;
+  config->noise_decay = 0.98f;
+  config->silence_threshold = 0.01f;
+  config->sample_rate = rate;
+}
+
+// one channel, scratch gets the noise
+static void make_channel(float* out, float* scratch, long n, int rate) {
+  long lead = rate / 2;
+  memset(out, 0, n * sizeof(float));
+  make_speech(out + lead, n - lead, rate);
+  make_noise(scratch, n, NOISE_PINK);
+  double peak = 0.0, speech = 0.0, noise = 0.0;
+  for (long i = 0; i < n; i++) {
+    peak = fabs(out[i]) > peak ? fabs(out[i]) : peak;
+    speech += (double)out[i] * out[i];
+    noise += (double)scratch[i] * scratch[i];
+  }
+  // speech peaks at -6 dBFS, noise 10 dB below it over the whole signal
+  float scale = peak > 0.0 ? (float)(0.5 / peak) : 0.0f;
+  float k = noise > 0.0 ? (float)sqrt(speech * scale * scale / (noise * 10.0)) : 0.0f;
+  for (long i = 0; i < n; i++) out[i] = scale * out[i] + k * scratch[i];
+}
+
+// filter_run from in_path read as a stream into an f32 wav at out_path
+static int run_filter(const char* in_path, const char* out_path, const SpectralGateConfig* config) {
+  FILE* fp = fopen(in_path, "rb");
+  PcmReader* reader = fp ? pcm_reader_open_file(fp, PCM_CONTAINER_WAV, NULL) : NULL;
+  PcmWriter* writer = NULL;
+  int status = -1;
+  if (reader) {
+    PcmSpec spec = *pcm_reader_spec(reader);
+    spec.format = PCM_FORMAT_F32;
+    writer = pcm_writer_open(out_path, PCM_CONTAINER_WAV, &spec);
+  }
+  if (writer) {
+    status = filter_run(reader, writer, config, 0, -1, NULL, NULL);
+    if (pcm_writer_close(writer) != 0) status = -1;
+  }
+  if (reader) pcm_reader_close(reader);
+  if (fp) fclose(fp);
+  return status;
+}
+
+int main(int argc, char** argv) {
+  double seconds = 10.0;
+  int rate = 44100;
+  unsigned seed = 1;
+  const char* dir = "/tmp";
+
+  for (int i = 1; i < argc; i++) {
+    const char* arg = argv[i];
+    int has_value = i + 1 < argc;
+    if (strcmp(arg, "--seconds") == 0 && has_value) {
+      seconds = atof(argv[++i]);
+    } else if (strcmp(arg, "--rate") == 0 && has_value) {
+      rate = atoi(argv[++i]);
+    } else if (strcmp(arg, "--seed") == 0 && has_value) {
+      seed = (unsigned)strtoul(argv[++i], NULL, 10);
+    } else if (strcmp(arg, "--dir") == 0 && has_value) {
+      dir = argv[++i];
+    } else {
+      seconds = 0.0;
+      break;
+    }
+  }
+  if (seconds <= 1.0 || rate < 8000 || seed == 0) {
+    fprintf(stderr, "usage: %s [--seconds s] [--rate hz] [--seed n] [--dir path]\n", argv[0]);
+    return 1;
+  }
+
+  SpectralGateConfig config;
+  default_config(&config, rate);
+  long n = (long)(seconds * rate);
+  float* input = (float*)malloc(n * CHANNELS * sizeof(float));
+  float* channel = (float*)malloc(n * sizeof(float));
+  float* scratch = (float*)malloc(n * sizeof(float));
+  float* gated = (float*)malloc(n * sizeof(float));
+  if (!input || !channel || !scratch || !gated) {
+    perror("failed to allocate buffers");
+    return 1;
+  }
+  rng_state = seed;
+  for (int c = 0; c < CHANNELS; c++) {
+    make_channel(channel, scratch, n, rate);
+    for (long i = 0; i < n; i++) input[i * CHANNELS + c] = channel[i];
+  }
+
+  char in_path[1024];
+  char out_path[1024];
+  snprintf(in_path, sizeof(in_path), "%s/check_filter_in.wav", dir);
+  snprintf(out_path, sizeof(out_path), "%s/check_filter_out.wav", dir);
+  PcmSpec spec = {rate, CHANNELS, PCM_FORMAT_F32};
+  float* filtered = NULL;
+  PcmSpec out_spec = {0, 0, PCM_FORMAT_F32};
+  if (float_to_pcm(in_path, input, n * CHANNELS, &spec) != 0 ||
+      run_filter(in_path, out_path, &config) != 0 ||
+      pcm_to_float(out_path, &out_spec, &filtered) != n * CHANNELS) {
+    fprintf(stderr, "filter run failed\n");
+    return 1;
+  }
+
+  printf("%.1f s at %d Hz, seed %u, frame %d / hop %d\n", seconds, rate, seed, config.frame_size,
+         config.hop_size);
+  printf("%-8s %9s %9s %10s\n", "channel", "level dB", "corr", "max diff");
+  int failed = 0;
+  for (int c = 0; c < CHANNELS; c++) {
+    for (long i = 0; i < n; i++) channel[i] = input[i * CHANNELS + c];
+    SpectralGateData* spd = spectral_gate_init(&config);
+    if (!spd || spectral_gate_start(spd, channel, gated, n) != 0) {
+      fprintf(stderr, "file path gate failed\n");
+      return 1;
+    }
+    spectral_gate_free(spd);
+
+    double ff = 0.0, gg = 0.0, fg = 0.0, peak = 0.0;
+    for (long i = config.frame_size; i < n; i++) {
+      double f = gated[i];
+      double g = filtered[i * CHANNELS + c];
+      ff += f * f;
+      gg += g * g;
+      fg += f * g;
+      peak = fabs(f - g) > peak ? fabs(f - g) : peak;
+    }
+    double level = ff > 0.0 && gg > 0.0 ? 10.0 * log10(gg / ff) : 0.0;
+    double corr = ff > 0.0 && gg > 0.0 ? fg / sqrt(ff * gg) : 0.0;
+    int bad = fabs(level) > LEVEL_LIMIT_DB || !(corr >= CORR_LIMIT);
+    printf("%-8d %+9.3f %9.6f %10.2e%s\n", c, level, corr, peak, bad ? "  MISMATCH" : "");
+    failed |= bad;
+  }
+  printf("%s\n", failed ? "the filter path differs from the file path" : "both paths agree");
+
+  nr_free(NULL, filtered);
+  free(input);
+  free(channel);
+  free(scratch);
+  free(gated);
+  return failed;
+}
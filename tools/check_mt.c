@@ -0,0 +1,160 @@
+// checks that spectral_gate_start_mt gives the same bits as spectral_gate_start
+//
+//   gcc -O2 -std=gnu11 -Ilib tools/check_mt.c src/noisereduce.c src/half.c
+//       src/kiss_fft.c src/kiss_fftr.c src/nr_alloc.c src/trace.c -lm -lpthread
+//       -o check_mt
+//   ./check_mt [--seconds s] [--seed n] [--threads n]
+//
+// the input is make_speech over pink noise at 10 dB snr, after half a second
+// of noise alone. every variant gates it with spectral_gate_start on one
+// instance and with spectral_gate_start_mt on another, on 2 to --threads
+// (default 8) threads, each split the same way over CALLS consecutive calls of
+// different lengths so the state carried between calls is covered too. per
+// variant and thread count: the samples that differ and the first of them.
+// exits 1 when any sample differs
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "noisereduce.h"
+#include "test_signal.h"
+
+// consecutive calls per run, as fractions of the input
+#define CALLS 3
+static const double call_split[CALLS] = {0.45, 0.2, 0.35};
+
+typedef struct {
+  const char* name;
+  int rate;
+  int frame_size;
+  int hop_size;
+  int num_bands;
+  int compact;
+} Variant;
+
+static const Variant variants[] = {
+    {.name = "stft", .rate = 44100, .frame_size = 1024, .hop_size = 256},
+    {.name = "bands32", .rate = 44100, .frame_size = 1024, .hop_size = 256, .num_bands = 32},
+    {.name = "compact", .rate = 44100, .frame_size = 1024, .hop_size = 256, .compact = 1},
+    {.name = "48k-960", .rate = 48000, .frame_size = 960, .hop_size = 240},
+    {.name = "48k-960-c32", .rate = 48000, .frame_size = 960, .hop_size = 240, .num_bands = 32,
+     .compact = 1},
+};
+#define NUM_VARIANTS (int)(sizeof(variants) / sizeof(variants[0]))
+
+// threads 0 runs spectral_gate_start, otherwise spectral_gate_start_mt
+static int run_variant(const Variant* v, int threads, const float* input, float* output, long n) {
+  SpectralGateConfig config;
+  memset(&config, 0, sizeof(config));
+  config.frame_size = v->frame_size;
+  config.hop_size = v->hop_size;
+  config.alpha = 1.5f;
+  config.noise_floor = -30.0f;
+  config.noise_decay = 0.98f;
+  config.silence_threshold = 0.01f;
+  config.num_bands = v->num_bands;
+  config.sample_rate = v->rate;
+  config.compact_state = v->compact;
+  SpectralGateData* spd = spectral_gate_init(&config);
+  if (!spd) return -1;
+
+  int status = 0;
+  long pos = 0;
+  for (int c = 0; c < CALLS && status == 0; c++) {
+    long m = c == CALLS - 1 ? n - pos : (long)(call_split[c] * n);
+    status = threads > 0
+                 ? spectral_gate_start_mt(spd, input + pos, output + pos, m, threads)
+                 : spectral_gate_start(spd, input + pos, output + pos, m);
+    pos += m;
+  }
+  spectral_gate_free(spd);
+  return status;
+}
+
+// scratch gets the noise
+static void make_input(float* out, float* scratch, long n, int rate) {
+  long lead = rate / 2;  // noise alone first, for the estimate to settle
+  memset(out, 0, n * sizeof(float));
+  make_speech(out + lead, n - lead, rate);
+  make_noise(scratch, n, NOISE_PINK);
+  double peak = 0.0, speech = 0.0, noise = 0.0;
+  for (long i = 0; i < n; i++) {
+    peak = fabs(out[i]) > peak ? fabs(out[i]) : peak;
+    speech += (double)out[i] * out[i];
+    noise += (double)scratch[i] * scratch[i];
+  }
+  // speech peaks at -6 dBFS, noise 10 dB below it over the whole signal
+  float scale = peak > 0.0 ? (float)(0.5 / peak) : 0.0f;
+  float k = noise > 0.0 ? (float)sqrt(speech * scale * scale / (noise * 10.0)) : 0.0f;
+  for (long i = 0; i < n; i++) out[i] = scale * out[i] + k * scratch[i];
+}
+
+int main(int argc, char** argv) {
+  double seconds = 20.0;
+  unsigned seed = 1;
+  int max_threads = 8;
+
+  for (int i = 1; i < argc; i++) {
+    const char* arg = argv[i];
+    int has_value = i + 1 < argc;
+    if (strcmp(arg, "--seconds") == 0 && has_value) {
+      seconds = atof(argv[++i]);
+    } else if (strcmp(arg, "--seed") == 0 && has_value) {
+      seed = (unsigned)strtoul(argv[++i], NULL, 10);
+    } else if (strcmp(arg, "--threads") == 0 && has_value) {
+      max_threads = atoi(argv[++i]);
+    } else {
+      seconds = 0.0;
+      break;
+    }
+  }
+  if (seconds <= 1.0 || seed == 0 || max_threads < 2) {
+    fprintf(stderr, "usage: %s [--seconds s] [--seed n] [--threads n]\n", argv[0]);
+    return 1;
+  }
+
+  printf("%.1f s, seed %u, %d calls\n", seconds, seed, CALLS);
+  printf("%-12s %7s  %10s %10s\n", "variant", "threads", "differ", "first");
+  int failed = 0;
+  for (int vi = 0; vi < NUM_VARIANTS; vi++) {
+    const Variant* v = &variants[vi];
+    long n = (long)(seconds * v->rate);
+    float* input = (float*)malloc(n * sizeof(float));
+    float* serial = (float*)malloc(n * sizeof(float));
+    float* mt = (float*)malloc(n * sizeof(float));
+    if (!input || !serial || !mt) {
+      perror("failed to allocate buffers");
+      return 1;
+    }
+    rng_state = seed;
+    make_input(input, serial, n, v->rate);
+    int ok = run_variant(v, 0, input, serial, n) == 0;
+    if (!ok) fprintf(stderr, "%s: serial gate failed\n", v->name);
+    for (int threads = 2; threads <= max_threads && ok; threads++) {
+      memset(mt, 0, n * sizeof(float));
+      if (run_variant(v, threads, input, mt, n) != 0) {
+        fprintf(stderr, "%s: gate on %d threads failed\n", v->name, threads);
+        ok = 0;
+        break;
+      }
+      long differ = 0, first = -1;
+      for (long i = 0; i < n; i++) {
+        if (memcmp(&serial[i], &mt[i], sizeof(float)) != 0) {
+          if (first < 0) first = i;
+          differ++;
+        }
+      }
+      printf("%-12s %7d  %10ld %10ld%s\n", v->name, threads, differ, first,
+             differ ? "  MISMATCH" : "");
+      failed |= differ != 0;
+    }
+    failed |= !ok;
+    free(input);
+    free(serial);
+    free(mt);
+  }
+  printf("%s\n", failed ? "the threaded gate differs from the serial one" : "all outputs match");
+  return failed;
+}
@@ -0,0 +1,197 @@
+// stress test of spectral_gate_set_params against readers: no reader may ever
+// see a parameter set that mixes two updates
+//
+//   gcc -O2 -std=gnu11 -Ilib tools/check_params.c src/noisereduce.c src/half.c
+//       src/kiss_fft.c src/kiss_fftr.c src/nr_alloc.c src/trace.c -lm -lpthread
+//       -o check_params
+//   ./check_params [--seconds s] [--writers n] [--readers n]
+//
+// every update carries a 40 bit tag spread over the four fields so that each
+// field can be checked against the others: alpha holds the low 20 bits,
+// noise_floor minus the high 20, silence_threshold their xor and noise_decay
+// their sum mod 1024 over 1024 (all exact in a float). writers publish their
+// own increasing tags as fast as they can, readers spin on
+// spectral_gate_get_params, and one more thread streams short blocks through
+// the gate and checks the values its frames took over (spd->config after each
+// call). a set is torn when its fields disagree, out of order when a reader
+// sees a writer's tag go backwards. exits 1 on either
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "noisereduce.h"
+
+#define MAX_THREADS 64
+#define STREAM_FRAME 256
+#define STREAM_HOP 64
+
+typedef struct {
+  SpectralGateData* spd;
+  int id;
+  int writers;
+  long count;     // sets published, or reads made
+  long torn;
+  long reordered;
+} Worker;
+
+static atomic_int stop;
+
+static void encode(uint64_t tag, SpectralGateParams* params) {
+  unsigned lo = tag & 0xfffff, hi = (tag >> 20) & 0xfffff;
+  params->alpha = (float)lo;
+  params->noise_floor = -(float)hi;
+  params->silence_threshold = (float)(lo ^ hi);
+  params->noise_decay = ((lo + hi) & 1023) / 1024.0f;
+}
+
+// the tag of a consistent set, or -1 when the fields disagree
+static int64_t decode(float alpha, float noise_floor, float noise_decay, float silence_threshold) {
+  unsigned lo = (unsigned)alpha, hi = (unsigned)-noise_floor;
+  SpectralGateParams expect;
+  encode(((uint64_t)hi << 20) | lo, &expect);
+  if (expect.alpha != alpha || expect.noise_floor != noise_floor ||
+      expect.noise_decay != noise_decay || expect.silence_threshold != silence_threshold) {
+    return -1;
+  }
+  return ((int64_t)hi << 20) | lo;
+}
+
+// last tag seen from each writer, a tag goes to writer tag % writers
+static void check(Worker* w, int64_t tag, int64_t* last) {
+  if (tag < 0) {
+    w->torn++;
+    return;
+  }
+  int from = (int)(tag % w->writers);
+  if (tag < last[from]) w->reordered++;
+  last[from] = tag;
+}
+
+static void* writer_main(void* arg) {
+  Worker* w = (Worker*)arg;
+  SpectralGateParams params;
+  for (uint64_t j = 1; !atomic_load_explicit(&stop, memory_order_relaxed); j++) {
+    encode(j * w->writers + w->id, &params);
+    if (spectral_gate_set_params(w->spd, &params) != 0) break;
+    w->count++;
+  }
+  return NULL;
+}
+
+static void* reader_main(void* arg) {
+  Worker* w = (Worker*)arg;
+  int64_t last[MAX_THREADS] = {0};
+  SpectralGateParams params;
+  while (!atomic_load_explicit(&stop, memory_order_relaxed)) {
+    if (spectral_gate_get_params(w->spd, &params) != 0) break;
+    check(w, decode(params.alpha, params.noise_floor, params.noise_decay, params.silence_threshold),
+          last);
+    w->count++;
+  }
+  return NULL;
+}
+
+// the audio side: whatever the frames of a call took over is left in spd->config
+static void* stream_main(void* arg) {
+  Worker* w = (Worker*)arg;
+  int64_t last[MAX_THREADS] = {0};
+  float in[STREAM_HOP], out[STREAM_HOP];
+  unsigned rng = 1;
+  while (!atomic_load_explicit(&stop, memory_order_relaxed)) {
+    for (int i = 0; i < STREAM_HOP; i++) {
+      rng = rng * 1664525u + 1013904223u;
+      in[i] = (float)(rng >> 8) / 16777216.0f - 0.5f;
+    }
+    if (spectral_gate_stream(w->spd, in, out, STREAM_HOP) != 0) break;
+    const SpectralGateConfig* c = &w->spd->config;
+    check(w, decode(c->alpha, c->noise_floor, c->noise_decay, c->silence_threshold), last);
+    w->count++;
+  }
+  return NULL;
+}
+
+int main(int argc, char** argv) {
+  double seconds = 2.0;
+  int writers = 2;
+  int readers = 2;
+
+  for (int i = 1; i < argc; i++) {
+    const char* arg = argv[i];
+    int has_value = i + 1 < argc;
+    if (strcmp(arg, "--seconds") == 0 && has_value) {
+      seconds = atof(argv[++i]);
+    } else if (strcmp(arg, "--writers") == 0 && has_value) {
+      writers = atoi(argv[++i]);
+    } else if (strcmp(arg, "--readers") == 0 && has_value) {
+      readers = atoi(argv[++i]);
+    } else {
+      writers = 0;
+      break;
+    }
+  }
+  if (seconds <= 0.0 || writers < 1 || readers < 0 || writers + readers + 1 > MAX_THREADS) {
+    fprintf(stderr, "usage: %s [--seconds s] [--writers n] [--readers n]\n", argv[0]);
+    return 1;
+  }
+
+  // starts out as tag 0, so the stream side's first calls check out too
+  SpectralGateParams params;
+  encode(0, &params);
+  SpectralGateConfig config;
+  memset(&config, 0, sizeof(config));
+  config.frame_size = STREAM_FRAME;
+  config.hop_size = STREAM_HOP;
+  config.alpha = params.alpha;
+  config.noise_floor = params.noise_floor;
+  config.noise_decay = params.noise_decay;
+  config.silence_threshold = params.silence_threshold;
+  SpectralGateData* spd = spectral_gate_init(&config);
+  if (!spd) {
+    fprintf(stderr, "failed to initialize the gate\n");
+    return 1;
+  }
+
+  int total = writers + readers + 1;
+  Worker workers[MAX_THREADS];
+  pthread_t threads[MAX_THREADS];
+  int started = 0;
+  for (int t = 0; t < total; t++) {
+    Worker* w = &workers[t];
+    memset(w, 0, sizeof(*w));
+    w->spd = spd;
+    w->id = t;
+    w->writers = writers;
+    void* (*run)(void*) = t < writers ? writer_main : t < total - 1 ? reader_main : stream_main;
+    if (pthread_create(&threads[t], NULL, run, w) != 0) {
+      perror("failed to start thread");
+      break;
+    }
+    started++;
+  }
+
+  struct timespec pause = {(time_t)seconds, (long)((seconds - (time_t)seconds) * 1e9)};
+  nanosleep(&pause, NULL);
+  atomic_store(&stop, 1);
+  for (int t = 0; t < started; t++) pthread_join(threads[t], NULL);
+
+  long sets = 0, torn = 0, reordered = 0;
+  for (int t = 0; t < started; t++) {
+    Worker* w = &workers[t];
+    if (t < writers) {
+      sets += w->count;
+      continue;
+    }
+    printf("%-7s %d: %10ld reads, %ld torn, %ld out of order\n", t < total - 1 ? "reader" : "stream",
+           t - writers, w->count, w->torn, w->reordered);
+    torn += w->torn;
+    reordered += w->reordered;
+  }
+  printf("%ld sets from %d writers in %.1f s\n", sets, writers, seconds);
+  spectral_gate_free(spd);
+  return started != total || torn > 0 || reordered > 0;
+}
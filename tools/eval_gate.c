@@ -0,0 +1,426 @@
+// quality against speed of the gate variants on synthetic noisy signals
+//
+//   gcc -O2 -std=gnu11 -Ilib tools/eval_gate.c src/noisereduce.c src/half.c
+//       src/kiss_fft.c src/kiss_fftr.c src/nr_alloc.c src/trace.c src/voiceband.c
+//       src/resample.c src/pcm_io.c src/pcm_convert.c -lm -lpthread -o eval_gate
+//   ./eval_gate [--seconds s] [--rate hz] [--snr 0,5,10,20] [--seed n] [--wav dir]
+//               [variant ...]
+//
+// clean signals are made here, no decoder involved: "speech" is a pulse train
+// with a wandering pitch through three vowel formants, in syllables and words
+// with pauses and the odd fricative, "tonal" is notes of a few harmonics with
+// vibrato. each is mixed with white and pink noise at every --snr (over the
+// whole signal, after half a second of noise alone for the estimate to settle)
+// and run through every variant (all of them by default):
+//
+//   stft         the cli default, 1024 / 256 hann
+//   compact      half precision state
+//   bands32      noise tracked on 32 erb bands
+//   low-latency  the asymmetric window pair, smoothing timed like a 256 hop
+//   wola         the filterbank engine, 256 / 32, frame long prototype, same
+//   stream       stft through spectral_gate_stream in 480 sample blocks
+//   codec10      streamed, frames lined up with 10 ms codec frames
+//   threads4     stft two pass on 4 threads
+//   voice-band   gated at 16 kHz, the band above attenuated
+//   vb-pass      gated at 16 kHz, the band above passed through
+//
+// per run: segmental snr (20 ms segments clamped to [-10, 35] dB, over the
+// segments with signal) before and after, the improvement, the residual noise
+// (output over input level in the stretches without signal) and the realtime
+// factor of the gate call. the output is first scaled by its least squares gain
+// on the clean signal, which is reported too, so a variant with a level offset
+// isn't taken for one that distorts. the last table averages each variant over
+// all conditions. --wav writes clean, noisy and gated files for listening
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "noisereduce.h"
+#include "nr_alloc.h"
+#include "pcm_io.h"
+#include "test_signal.h"
+#include "voiceband.h"
+
+#define MAX_SNRS 16
+#define LEAD_IN_SECONDS 0.5
+#define SEGMENT_SECONDS 0.02
+#define SEG_SNR_MIN -10.0
+#define SEG_SNR_MAX 35.0
+#define STREAM_BLOCK 480
+
+typedef enum { SIGNAL_SPEECH, SIGNAL_TONAL, SIGNAL_COUNT } SignalKind;
+
+static const char* signal_names[SIGNAL_COUNT] = {"speech", "tonal"};
+static const char* noise_names[NOISE_COUNT] = {"white", "pink"};
+
+typedef struct {
+  const char* name;
+  int engine;
+  int window_mode;
+  int frame_size;  // 0 = the default 1024 / 256
+  int hop_size;
+  int num_bands;
+  int compact;
+  int threads;     // > 1 runs spectral_gate_start_mt
+  int stream;      // spectral_gate_stream in blocks, the delay taken out
+  int codec_ms;    // > 0 lines the frames up with spectral_gate_codec_config
+  int voice_band;  // 1 + VoiceBandHighMode
+  int smoothing_hop;
+} Variant;
+
+static const Variant variants[] = {
+    {.name = "stft"},
+    {.name = "compact", .compact = 1},
+    {.name = "bands32", .num_bands = 32},
+    {.name = "low-latency", .window_mode = SG_WINDOW_LOW_LATENCY, .frame_size = 1024, .hop_size = 128,
+     .smoothing_hop = 256},
+    {.name = "wola", .engine = SG_ENGINE_WOLA, .frame_size = 256, .hop_size = 32, .smoothing_hop = 256},
+    {.name = "stream", .stream = 1},
+    {.name = "codec10", .stream = 1, .codec_ms = 10},
+    {.name = "threads4", .threads = 4},
+    {.name = "voice-band", .voice_band = 1 + VB_HIGH_ATTENUATE},
+    {.name = "vb-pass", .voice_band = 1 + VB_HIGH_PASS},
+};
+#define NUM_VARIANTS (int)(sizeof(variants) / sizeof(variants[0]))
+
+typedef struct {
+  double seg_in;
+  double seg_out;
+  double residual;  // dB
+  double gain;      // dB
+  double realtime;
+} Result;
+
+static double now_seconds(void) {
+  struct timespec ts;
+  timespec_get(&ts, TIME_UTC);
+  return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+static double energy(const float* x, long n) {
+  double sum = 0.0;
+  for (long i = 0; i < n; i++) sum += (double)x[i] * x[i];
+  return sum;
+}
+
+
+// feeds input and then latency samples of silence through spectral_gate_stream
+// in blocks, output gets the result with the delay taken out
+static int stream_variant(SpectralGateData* spd, const float* input, float* output, long n,
+                          int block) {
+  long latency = spectral_gate_latency(spd);
+  long total = n + latency;
+  float* in = (float*)calloc(total, sizeof(float));
+  float* out = (float*)malloc(total * sizeof(float));
+  if (!in || !out) {
+    free(in);
+    free(out);
+    return -1;
+  }
+  memcpy(in, input, n * sizeof(float));
+  int status = 0;
+  for (long i = 0; i < total && status == 0; i += block) {
+    long m = total - i < block ? total - i : block;
+    status = spectral_gate_stream(spd, in + i, out + i, m);
+  }
+  memcpy(output, out + latency, n * sizeof(float));
+  free(in);
+  free(out);
+  return status;
+}
+
+// runs one variant from input into output, returns the seconds spent in the gate
+// or -1 on error
+static double run_variant(const Variant* v, int rate, const float* input, float* output,
+                          long n) {
+  SpectralGateConfig config;
+  memset(&config, 0, sizeof(config));
+  config.frame_size = v->frame_size > 0 ? v->frame_size : 1024;
+  config.hop_size = v->hop_size > 0 ? v->hop_size : 256;
+  config.alpha = 1.5f;
+  config.noise_floor = -30.0f;
+  config.noise_decay = 0.98f;
+  config.silence_threshold = 0.01f;
+  config.window_mode = v->window_mode;
+  config.num_bands = v->num_bands;
+  config.sample_rate = rate;
+  config.compact_state = v->compact;
+  config.engine = v->engine;
+  config.smoothing_hop = v->smoothing_hop;
+  if (v->codec_ms > 0 && spectral_gate_codec_config(&config, rate * v->codec_ms / 1000) != 0) {
+    return -1.0;
+  }
+
+  VoiceBand* vb = NULL;
+  if (v->voice_band) {
+    SpectralGateConfig band;
+    if (voiceband_config(&config, rate, VOICEBAND_RATE, &band) != 0) return -1.0;
+    vb = voiceband_init(&config, rate, VOICEBAND_RATE, (VoiceBandHighMode)(v->voice_band - 1));
+    if (!vb) return -1.0;
+    config = band;
+  }
+  SpectralGateData* spd = spectral_gate_init(&config);
+  if (!spd) {
+    voiceband_free(vb);
+    return -1.0;
+  }
+
+  int status;
+  double t0 = now_seconds();
+  if (vb) {
+    status = voiceband_process(vb, spd, input, output, n);
+  } else if (v->stream) {
+    status = stream_variant(spd, input, output, n, v->codec_ms > 0 ? config.hop_size : STREAM_BLOCK);
+  } else if (v->threads > 1) {
+    status = spectral_gate_start_mt(spd, input, output, n, v->threads);
+  } else {
+    status = spectral_gate_start(spd, input, output, n);
+  }
+  double elapsed = now_seconds() - t0;
+
+  spectral_gate_free(spd);
+  voiceband_free(vb);
+  return status == 0 ? elapsed : -1.0;
+}
+
+// mean segmental snr of x against clean over the segments where clean is active
+static double segmental_snr(const float* clean, const float* x, float scale, long n,
+                            const unsigned char* active, int seg) {
+  double sum = 0.0;
+  long count = 0;
+  for (long s = 0; s * seg + seg <= n; s++) {
+    if (!active[s]) continue;
+    const float* c = clean + s * seg;
+    const float* y = x + s * seg;
+    double ref = 0.0, err = 0.0;
+    for (int i = 0; i < seg; i++) {
+      double d = (double)y[i] * scale - c[i];
+      ref += (double)c[i] * c[i];
+      err += d * d;
+    }
+    double snr = err > 0.0 ? 10.0 * log10(ref / err) : SEG_SNR_MAX;
+    if (snr < SEG_SNR_MIN) snr = SEG_SNR_MIN;
+    if (snr > SEG_SNR_MAX) snr = SEG_SNR_MAX;
+    sum += snr;
+    count++;
+  }
+  return count > 0 ? sum / count : 0.0;
+}
+
+// level of x against noisy over the segments where clean is silent, in dB
+static double residual_noise(const float* noisy, const float* x, float scale, long n,
+                             const unsigned char* active, int seg) {
+  double in = 0.0, out = 0.0;
+  for (long s = 0; s * seg + seg <= n; s++) {
+    if (active[s]) continue;
+    for (int i = 0; i < seg; i++) {
+      double y = (double)x[s * seg + i] * scale;
+      in += (double)noisy[s * seg + i] * noisy[s * seg + i];
+      out += y * y;
+    }
+  }
+  return in > 0.0 && out > 0.0 ? 10.0 * log10(out / in) : -INFINITY;
+}
+
+static void evaluate(const float* clean, const float* noisy, const float* output, long n,
+                     int rate, double elapsed, Result* r) {
+  int seg = (int)(SEGMENT_SECONDS * rate);
+  long segments = n / seg;
+  unsigned char* active = (unsigned char*)calloc(segments > 0 ? segments : 1, 1);
+  if (!active) {
+    memset(r, 0, sizeof(*r));
+    return;
+  }
+  // a segment has signal when it is within 40 dB of the loudest one
+  double peak = 0.0;
+  for (long s = 0; s < segments; s++) {
+    double e = energy(clean + s * seg, seg);
+    if (e > peak) peak = e;
+  }
+  for (long s = 0; s < segments; s++) {
+    active[s] = energy(clean + s * seg, seg) > peak * 1e-4;
+  }
+
+  double cross = 0.0;
+  for (long i = 0; i < n; i++) cross += (double)output[i] * clean[i];
+  double ref = energy(clean, n);
+  double gain = ref > 0.0 ? cross / ref : 0.0;
+  float scale = gain > 1e-6 ? (float)(1.0 / gain) : 1.0f;
+
+  r->gain = gain > 0.0 ? 20.0 * log10(gain) : -INFINITY;
+  r->seg_in = segmental_snr(clean, noisy, 1.0f, n, active, seg);
+  r->seg_out = segmental_snr(clean, output, scale, n, active, seg);
+  r->residual = residual_noise(noisy, output, scale, n, active, seg);
+  r->realtime = elapsed > 0.0 ? (double)n / rate / elapsed : INFINITY;
+  free(active);
+}
+
+static int find_variant(const char* name) {
+  for (int i = 0; i < NUM_VARIANTS; i++) {
+    if (strcmp(variants[i].name, name) == 0) return i;
+  }
+  return -1;
+}
+
+static int parse_snrs(const char* str, double* snrs) {
+  int count = 0;
+  char* end;
+  while (*str && count < MAX_SNRS) {
+    snrs[count++] = strtod(str, &end);
+    if (end == str) return -1;
+    str = *end == ',' ? end + 1 : end;
+    if (*end && *end != ',') return -1;
+  }
+  return count;
+}
+
+static void write_wav(const char* dir, const char* name, const float* x, long n, int rate) {
+  char path[1024];
+  PcmSpec spec = {rate, 1, PCM_FORMAT_F32};
+  snprintf(path, sizeof(path), "%s/%s.wav", dir, name);
+  if (float_to_pcm(path, x, n, &spec) != 0) fprintf(stderr, "failed to write %s\n", path);
+}
+
+static void usage(const char* prog) {
+  fprintf(stderr,
+          "usage: %s [--seconds s] [--rate hz] [--snr 0,5,10,20] [--seed n] [--wav dir] "
+          "[variant ...]\nvariants:",
+          prog);
+  for (int i = 0; i < NUM_VARIANTS; i++) fprintf(stderr, " %s", variants[i].name);
+  fprintf(stderr, "\n");
+}
+
+int main(int argc, char** argv) {
+  double seconds = 10.0;
+  int rate = 44100;
+  double snrs[MAX_SNRS] = {0.0, 5.0, 10.0, 20.0};
+  int num_snrs = 4;
+  unsigned seed = 1;
+  const char* wav_dir = NULL;
+  int selected[NUM_VARIANTS];
+  int num_selected = 0;
+
+  for (int i = 1; i < argc; i++) {
+    const char* arg = argv[i];
+    int has_value = i + 1 < argc;
+    if (strcmp(arg, "--seconds") == 0 && has_value) {
+      seconds = atof(argv[++i]);
+    } else if (strcmp(arg, "--rate") == 0 && has_value) {
+      rate = atoi(argv[++i]);
+    } else if (strcmp(arg, "--snr") == 0 && has_value) {
+      num_snrs = parse_snrs(argv[++i], snrs);
+    } else if (strcmp(arg, "--seed") == 0 && has_value) {
+      seed = (unsigned)strtoul(argv[++i], NULL, 10);
+    } else if (strcmp(arg, "--wav") == 0 && has_value) {
+      wav_dir = argv[++i];
+    } else {
+      int v = find_variant(arg);
+      if (v < 0 || num_selected == NUM_VARIANTS) {
+        usage(argv[0]);
+        return 1;
+      }
+      selected[num_selected++] = v;
+    }
+  }
+  if (seconds <= LEAD_IN_SECONDS || rate < 8000 || num_snrs <= 0 || seed == 0) {
+    usage(argv[0]);
+    return 1;
+  }
+  if (num_selected == 0) {
+    for (int i = 0; i < NUM_VARIANTS; i++) selected[num_selected++] = i;
+  }
+
+  long n = (long)(seconds * rate);
+  long lead = (long)(LEAD_IN_SECONDS * rate);
+  float* clean = (float*)calloc(n, sizeof(float));
+  float* noise = (float*)malloc(n * sizeof(float));
+  float* noisy = (float*)malloc(n * sizeof(float));
+  float* output = (float*)malloc(n * sizeof(float));
+  Result* results =
+      (Result*)calloc((size_t)NUM_VARIANTS * SIGNAL_COUNT * NOISE_COUNT * num_snrs, sizeof(Result));
+  if (!clean || !noise || !noisy || !output || !results) {
+    perror("failed to allocate buffers");
+    return 1;
+  }
+
+  printf("%.1f s at %d Hz, %.1f s of noise first, seed %u\n", seconds, rate, LEAD_IN_SECONDS, seed);
+  printf("%-11s %-6s %-5s %4s  %7s %7s %7s  %8s  %7s  %8s\n", "variant", "signal", "noise", "snr",
+         "seg in", "seg out", "improve", "residual", "gain", "realtime");
+  int failed = 0;
+  for (int sig = 0; sig < SIGNAL_COUNT; sig++) {
+    rng_state = seed + 977u * sig;
+    memset(clean, 0, n * sizeof(float));
+    if (sig == SIGNAL_SPEECH) {
+      make_speech(clean + lead, n - lead, rate);
+    } else {
+      make_tonal(clean + lead, n - lead, rate);
+    }
+    // peak at -6 dBFS, so the gate's absolute silence threshold sees a sane level
+    float peak = 0.0f;
+    for (long i = 0; i < n; i++) peak = fabsf(clean[i]) > peak ? fabsf(clean[i]) : peak;
+    for (long i = 0; i < n && peak > 0.0f; i++) clean[i] *= 0.5f / peak;
+    double clean_energy = energy(clean, n);
+
+    for (int nk = 0; nk < NOISE_COUNT; nk++) {
+      make_noise(noise, n, (NoiseKind)nk);
+      double noise_energy = energy(noise, n);
+      for (int si = 0; si < num_snrs; si++) {
+        float k = (float)sqrt(clean_energy / (noise_energy * pow(10.0, snrs[si] / 10.0)));
+        for (long i = 0; i < n; i++) noisy[i] = clean[i] + k * noise[i];
+        char name[128];
+        if (wav_dir) {
+          snprintf(name, sizeof(name), "%s_clean", signal_names[sig]);
+          write_wav(wav_dir, name, clean, n, rate);
+          snprintf(name, sizeof(name), "%s_%s_%g", signal_names[sig], noise_names[nk], snrs[si]);
+          write_wav(wav_dir, name, noisy, n, rate);
+        }
+
+        for (int vi = 0; vi < num_selected; vi++) {
+          const Variant* v = &variants[selected[vi]];
+          Result* r = &results[((selected[vi] * SIGNAL_COUNT + sig) * NOISE_COUNT + nk) * num_snrs + si];
+          double elapsed = run_variant(v, rate, noisy, output, n);
+          if (elapsed < 0.0) {
+            fprintf(stderr, "%s failed\n", v->name);
+            failed = 1;
+            continue;
+          }
+          evaluate(clean, noisy, output, n, rate, elapsed, r);
+          printf("%-11s %-6s %-5s %4g  %7.2f %7.2f %+7.2f  %+8.2f  %+7.2f  %7.1fx\n", v->name,
+                 signal_names[sig], noise_names[nk], snrs[si], r->seg_in, r->seg_out,
+                 r->seg_out - r->seg_in, r->residual, r->gain, r->realtime);
+          if (wav_dir) {
+            snprintf(name, sizeof(name), "%s_%s_%g_%s", signal_names[sig], noise_names[nk],
+                     snrs[si], v->name);
+            write_wav(wav_dir, name, output, n, rate);
+          }
+        }
+      }
+    }
+  }
+
+  // every condition weighs the same in the averages
+  printf("\n%-11s %7s  %8s  %7s  %8s\n", "variant", "improve", "residual", "gain", "realtime");
+  int runs = SIGNAL_COUNT * NOISE_COUNT * num_snrs;
+  for (int vi = 0; vi < num_selected && !failed; vi++) {
+    const Result* r = &results[selected[vi] * runs];
+    double improve = 0.0, residual = 0.0, gain = 0.0, realtime = 0.0;
+    for (int j = 0; j < runs; j++) {
+      improve += r[j].seg_out - r[j].seg_in;
+      residual += r[j].residual;
+      gain += r[j].gain;
+      realtime += r[j].realtime;
+    }
+    printf("%-11s %+7.2f  %+8.2f  %+7.2f  %7.1fx\n", variants[selected[vi]].name, improve / runs,
+           residual / runs, gain / runs, realtime / runs);
+  }
+
+  free(clean);
+  free(noise);
+  free(noisy);
+  free(output);
+  free(results);
+  return failed;
+}
@@ -0,0 +1,158 @@
+// streams a wav/raw file through nr_daemon and checks the result against the
+// same gate run in process
+//
+//   gcc -O2 -std=gnu11 -Ilib tools/nr_client_demo.c src/nr_client.c src/pcm_io.c src/pcm_convert.c
+//       src/noisereduce.c src/half.c src/kiss_fft.c src/kiss_fftr.c src/nr_alloc.c src/trace.c
+//       -lm -lpthread -o nr_client_demo
+//   ./nr_daemon &
+//   ./nr_client_demo input.wav output.wav [--socket path] [--slots n] [--block frames]
+//
+// the input is downmixed to mono, sent in blocks with up to `slots` of them in
+// flight, and the output is written with the gate's latency taken out
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "noisereduce.h"
+#include "nr_alloc.h"
+#include "nr_client.h"
+#include "pcm_io.h"
+
+static double now_seconds(void) {
+  struct timespec ts;
+  timespec_get(&ts, TIME_UTC);
+  return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+int main(int argc, char** argv) {
+  if (argc < 3) {
+    fprintf(stderr,
+            "usage: %s input.wav output.wav [--socket path] [--slots n] "
+            "[--block frames]\n",
+            argv[0]);
+    return 1;
+  }
+  const char* socket_path = NULL;
+  int slots = 8;
+  int block = 480;
+  for (int i = 3; i + 1 < argc; i += 2) {
+    if (strcmp(argv[i], "--socket") == 0) {
+      socket_path = argv[i + 1];
+    } else if (strcmp(argv[i], "--slots") == 0) {
+      slots = atoi(argv[i + 1]);
+    } else if (strcmp(argv[i], "--block") == 0) {
+      block = atoi(argv[i + 1]);
+    }
+  }
+
+  PcmSpec spec;
+  float* pcm = NULL;
+  long total = pcm_to_float(argv[1], &spec, &pcm);
+  if (total < 0) return 1;
+  long frames = total / spec.channels;
+  float* mono = (float*)malloc(frames * sizeof(float));
+  if (!mono) {
+    perror("failed to allocate buffers");
+    nr_free(NULL, pcm);
+    return 1;
+  }
+  for (long i = 0; i < frames; i++) {
+    float sum = 0.0f;
+    for (int ch = 0; ch < spec.channels; ch++) sum += pcm[i * spec.channels + ch];
+    mono[i] = sum / spec.channels;
+  }
+  nr_free(NULL, pcm);
+
+  SpectralGateConfig config;
+  memset(&config, 0, sizeof(config));
+  config.frame_size = 1024;
+  config.hop_size = 256;
+  config.alpha = 1.5f;
+  config.noise_floor = -30.0f;
+  config.noise_decay = 0.98f;
+  config.silence_threshold = 0.01f;
+  config.window_mode = SG_WINDOW_HANN;
+  config.sample_rate = spec.sample_rate;
+
+  NrClient* client = nr_client_open(socket_path, &config, slots, block);
+  if (!client) {
+    free(mono);
+    return 1;
+  }
+  long latency = nr_client_latency(client);
+  long padded = frames + latency;  // zeros flush the last samples out
+  float* out = (float*)malloc(padded * sizeof(float));
+  if (!out) {
+    perror("failed to allocate buffers");
+    nr_client_close(client);
+    free(mono);
+    return 1;
+  }
+
+  // keep the ring full: submit while a slot is free, otherwise collect the oldest
+  double t0 = now_seconds();
+  long sent = 0;
+  long received = 0;
+  long next_wait = 0;
+  while (received < padded) {
+    float* buf = sent < padded ? nr_client_buffer(client) : NULL;
+    if (buf) {
+      long n = padded - sent < block ? padded - sent : block;
+      for (long i = 0; i < n; i++) {
+        buf[i] = sent + i < frames ? mono[sent + i] : 0.0f;
+      }
+      if (nr_client_submit(client, n) < 0) break;
+      sent += n;
+      continue;
+    }
+    float* gated;
+    long n = nr_client_wait(client, next_wait++, &gated);
+    if (n < 0) break;
+    memcpy(out + received, gated, n * sizeof(float));
+    received += n;
+  }
+  double elapsed = now_seconds() - t0;
+  nr_client_close(client);
+  if (received < padded) {
+    fprintf(stderr, "daemon connection failed after %ld frames\n", received);
+    free(out);
+    free(mono);
+    return 1;
+  }
+  printf("%ld frames through the daemon in %.3f s (%.1fx realtime), latency %ld\n",
+         frames, elapsed, elapsed > 0.0 ? frames / (double)spec.sample_rate / elapsed : 0.0,
+         latency);
+
+  // the same gate in process, fed the same blocks
+  SpectralGateData* spd = spectral_gate_init(&config);
+  float* local = (float*)malloc(padded * sizeof(float));
+  float* zeros = (float*)calloc(block, sizeof(float));
+  if (spd && local && zeros) {
+    for (long pos = 0; pos < padded; pos += block) {
+      long n = padded - pos < block ? padded - pos : block;
+      const float* src = pos < frames ? mono + pos : zeros;
+      if (pos < frames && pos + n > frames) {
+        // the block straddles the end of the input, pad it like the ring did
+        memcpy(local + pos, mono + pos, (frames - pos) * sizeof(float));
+        memset(local + frames, 0, (pos + n - frames) * sizeof(float));
+        src = local + pos;
+      }
+      spectral_gate_stream(spd, src, local + pos, n);
+    }
+    long mismatches = 0;
+    for (long i = 0; i < padded; i++) mismatches += local[i] != out[i];
+    printf("in process check: %ld of %ld samples differ\n", mismatches, padded);
+  }
+  spectral_gate_free(spd);
+  free(local);
+  free(zeros);
+
+  PcmSpec out_spec = spec;
+  out_spec.channels = 1;
+  int status = float_to_pcm(argv[2], out + latency, frames, &out_spec);
+  free(out);
+  free(mono);
+  return status == 0 ? 0 : 1;
+}
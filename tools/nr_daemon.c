@@ -0,0 +1,508 @@
+// local denoise daemon: hosts gate instances for other processes
+//
+//   gcc -O2 -std=gnu11 -Ilib tools/nr_daemon.c src/noisereduce.c src/half.c
+//       src/kiss_fft.c src/kiss_fftr.c src/nr_alloc.c src/trace.c -lm -lpthread -o nr_daemon
+//   ./nr_daemon [--socket path] [--threads n]
+//
+// clients connect with nr_client_open() (src/nr_client.c). each client is pinned
+// to one worker thread, which gates its blocks in place in the client's memfd
+// ring, so audio never crosses the socket (see lib/nr_ipc.h). workers keep one
+// set of fft plans and windows per distinct frame layout and share it between
+// all their clients' gates, until the last of them disconnects
+//
+// the accept loop only hands connections out; the open message is read by the
+// worker from its poll loop, so a client that connects and says nothing only
+// holds its own socket until OPEN_TIMEOUT_SECONDS. rings have to be sealed
+// against shrinking and growing, a client that truncates a ring we have
+// mapped would otherwise kill the daemon with SIGBUS
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "noisereduce.h"
+#include "nr_ipc.h"
+
+// how long a connecting client gets to send its open message
+#define OPEN_TIMEOUT_SECONDS 2
+
+// seals a ring needs before it is mapped
+#define RING_SEALS (F_SEAL_SHRINK | F_SEAL_GROW)
+
+// what a client's gate config may ask for
+#define MIN_FRAME_SIZE 16
+#define MAX_FRAME_SIZE 16384
+#define MAX_WOLA_TAPS (4 * MAX_FRAME_SIZE)
+#define MAX_BANDS 256
+#define MAX_LINK_CHANNELS 8
+#define MAX_SAMPLE_RATE 384000
+#define MAX_SMOOTHING_HOP 65536
+
+typedef struct DaemonClient {
+  int fd;
+  int64_t open_deadline;  // ms on the monotonic clock, until the open message
+  float* ring;
+  size_t ring_bytes;
+  uint32_t slots;
+  uint32_t slot_frames;
+  SpectralGateConfig config;
+  SpectralGateShared* shared;  // the worker's plan the gate runs on
+  SpectralGateData* spd;
+  int64_t next_seq;
+  struct DaemonClient* next;  // pending list
+} DaemonClient;
+
+typedef struct {
+  SpectralGateConfig config;
+  SpectralGateShared* shared;
+  int users;  // clients gating on it, freed with the last one
+} SharedPlan;
+
+typedef struct {
+  pthread_t thread;
+  int wake[2];  // pipe, a byte means new clients or stop
+
+  pthread_mutex_t lock;
+  DaemonClient* pending;  // handed over by the accept loop
+  int stop;
+
+  // owned by the worker thread
+  DaemonClient** clients;
+  int num_clients;
+  int cap_clients;
+  SharedPlan* plans;
+  int num_plans;
+  long blocks;
+  long clients_served;
+} Worker;
+
+static volatile sig_atomic_t g_quit = 0;
+
+static int64_t now_ms(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static void on_signal(int sig) {
+  (void)sig;
+  g_quit = 1;
+}
+
+static void send_reply(int fd, uint32_t type, int32_t status, int64_t seq) {
+  NrMsg msg = {type, status, seq, 0};
+  if (send(fd, &msg, sizeof(msg), MSG_NOSIGNAL) != (ssize_t)sizeof(msg)) {
+    // the client went away, poll reports the hangup
+  }
+}
+
+// the library checks the layout of a config but not its size, and the sizes
+// here come from another process
+static int config_valid(const SpectralGateConfig* config) {
+  int frame_size = config->frame_size;
+  int wola_taps = config->wola_taps;
+  return frame_size >= MIN_FRAME_SIZE && frame_size <= MAX_FRAME_SIZE &&
+         (frame_size & (frame_size - 1)) == 0 && config->hop_size > 0 &&
+         config->hop_size <= frame_size && wola_taps >= 0 && wola_taps <= MAX_WOLA_TAPS &&
+         config->num_bands >= 0 && config->num_bands <= MAX_BANDS &&
+         config->link_channels >= 0 && config->link_channels <= MAX_LINK_CHANNELS &&
+         config->sample_rate >= 0 && config->sample_rate <= MAX_SAMPLE_RATE &&
+         config->smoothing_hop >= 0 && config->smoothing_hop <= MAX_SMOOTHING_HOP;
+}
+
+// whether a plan built for a also fits b: only the fields the shared block is
+// made from count, the gate's tuning is per instance
+static int plan_fits(const SpectralGateConfig* a, const SpectralGateConfig* b) {
+  int taps_a = a->wola_taps > 0 ? a->wola_taps : a->frame_size;
+  int taps_b = b->wola_taps > 0 ? b->wola_taps : b->frame_size;
+  return a->frame_size == b->frame_size && a->hop_size == b->hop_size &&
+         a->window_mode == b->window_mode && a->engine == b->engine &&
+         (a->engine != SG_ENGINE_WOLA || taps_a == taps_b) && a->num_bands == b->num_bands &&
+         (a->num_bands == 0 || a->sample_rate == b->sample_rate) &&
+         a->compact_state == b->compact_state && a->link_channels == b->link_channels;
+}
+
+// plans are per worker, so the gates sharing them are only ever driven from
+// that worker's thread
+static SpectralGateShared* worker_plan(Worker* w, const SpectralGateConfig* config) {
+  for (int i = 0; i < w->num_plans; i++) {
+    if (plan_fits(&w->plans[i].config, config)) {
+      w->plans[i].users++;
+      return w->plans[i].shared;
+    }
+  }
+  SpectralGateShared* shared = spectral_gate_shared_init(config);
+  if (!shared) return NULL;
+  SharedPlan* plans = (SharedPlan*)realloc(w->plans, (w->num_plans + 1) * sizeof(SharedPlan));
+  if (!plans) {
+    spectral_gate_shared_free(shared);
+    return NULL;
+  }
+  w->plans = plans;
+  w->plans[w->num_plans].config = *config;
+  w->plans[w->num_plans].shared = shared;
+  w->plans[w->num_plans].users = 1;
+  w->num_plans++;
+  return shared;
+}
+
+static void worker_release_plan(Worker* w, SpectralGateShared* shared) {
+  for (int i = 0; i < w->num_plans; i++) {
+    if (w->plans[i].shared == shared) {
+      if (--w->plans[i].users == 0) {
+        spectral_gate_shared_free(shared);
+        w->plans[i] = w->plans[--w->num_plans];
+      }
+      return;
+    }
+  }
+}
+
+// the gate goes before the plan it runs on
+static void client_free(Worker* w, DaemonClient* c) {
+  if (!c) return;
+  if (c->fd >= 0) close(c->fd);
+  if (c->ring) munmap(c->ring, c->ring_bytes);
+  spectral_gate_free(c->spd);
+  if (c->shared) worker_release_plan(w, c->shared);
+  free(c);
+}
+
+// reads the open message and its memfd, maps the ring and creates the gate
+// returns -1 (after a refusal where it can) if the client should be dropped
+static int worker_open(Worker* w, DaemonClient* c) {
+  NrOpenMsg msg;
+  char control[CMSG_SPACE(sizeof(int))];
+  struct iovec iov = {&msg, sizeof(msg)};
+  struct msghdr mh;
+  memset(&mh, 0, sizeof(mh));
+  mh.msg_iov = &iov;
+  mh.msg_iovlen = 1;
+  mh.msg_control = control;
+  mh.msg_controllen = sizeof(control);
+  ssize_t n;
+  do {
+    n = recvmsg(c->fd, &mh, MSG_DONTWAIT | MSG_CMSG_CLOEXEC);
+  } while (n < 0 && errno == EINTR);
+  if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) return 0;
+
+  int memfd = -1;
+  struct cmsghdr* cm = n > 0 ? CMSG_FIRSTHDR(&mh) : NULL;
+  if (cm && cm->cmsg_level == SOL_SOCKET && cm->cmsg_type == SCM_RIGHTS) {
+    memcpy(&memfd, CMSG_DATA(cm), sizeof(int));
+  }
+  if (n != (ssize_t)sizeof(msg) || memfd < 0 || msg.type != NR_MSG_OPEN ||
+      msg.magic != NR_IPC_MAGIC || msg.version != NR_IPC_VERSION ||
+      nr_ring_bytes(msg.slots, msg.slot_frames) == 0 || !config_valid(&msg.config)) {
+    fprintf(stderr, "nr_daemon: rejected a client that sent no valid open message\n");
+    send_reply(c->fd, NR_MSG_OPENED, -1, 0);
+    if (memfd >= 0) close(memfd);
+    return -1;
+  }
+
+  // the seals keep the ring from changing size under the mapping, so it only
+  // has to be large enough once
+  size_t ring_bytes = (size_t)nr_ring_bytes(msg.slots, msg.slot_frames);
+  int seals = fcntl(memfd, F_GET_SEALS);
+  struct stat st;
+  void* ring = MAP_FAILED;
+  if (seals < 0 || (seals & RING_SEALS) != RING_SEALS) {
+    fprintf(stderr, "nr_daemon: rejected a client ring that isn't sealed\n");
+  } else if (fstat(memfd, &st) == 0 && (uint64_t)st.st_size >= ring_bytes) {
+    ring = mmap(NULL, ring_bytes, PROT_READ | PROT_WRITE, MAP_SHARED, memfd, 0);
+    if (ring == MAP_FAILED) fprintf(stderr, "nr_daemon: failed to map a client ring\n");
+  } else {
+    fprintf(stderr, "nr_daemon: rejected a client ring that is too small\n");
+  }
+  close(memfd);
+  if (ring == MAP_FAILED) {
+    send_reply(c->fd, NR_MSG_OPENED, -1, 0);
+    return -1;
+  }
+  c->ring = (float*)ring;
+  c->ring_bytes = ring_bytes;
+  c->slots = msg.slots;
+  c->slot_frames = msg.slot_frames;
+  c->config = msg.config;
+
+  c->shared = worker_plan(w, &c->config);
+  c->spd = c->shared ? spectral_gate_init_shared(c->shared) : NULL;
+  // the instance starts out with the config the plan was built for
+  SpectralGateParams params = {c->config.alpha, c->config.noise_floor, c->config.noise_decay,
+                               c->config.silence_threshold};
+  if (!c->spd || spectral_gate_set_params(c->spd, &params) != 0) {
+    send_reply(c->fd, NR_MSG_OPENED, -1, 0);
+    return -1;
+  }
+  c->spd->config.sample_rate = c->config.sample_rate;
+  c->spd->config.smoothing_hop = c->config.smoothing_hop;
+  w->clients_served++;
+  send_reply(c->fd, NR_MSG_OPENED, 0, spectral_gate_latency(c->spd));
+  return 0;
+}
+
+// takes a connection from the accept loop, it is opened once it has sent
+// its open message
+static void worker_adopt(Worker* w, DaemonClient* c) {
+  if (w->num_clients == w->cap_clients) {
+    int cap = w->cap_clients ? 2 * w->cap_clients : 16;
+    DaemonClient** clients = (DaemonClient**)realloc(w->clients, cap * sizeof(DaemonClient*));
+    if (!clients) {
+      send_reply(c->fd, NR_MSG_OPENED, -1, 0);
+      client_free(w, c);
+      return;
+    }
+    w->clients = clients;
+    w->cap_clients = cap;
+  }
+  w->clients[w->num_clients++] = c;
+}
+
+// gates every submit the client has queued, returns -1 once it should be dropped
+static int worker_serve(Worker* w, DaemonClient* c) {
+  if (!c->spd) return worker_open(w, c);
+  for (;;) {
+    NrMsg msg;
+    ssize_t n = recv(c->fd, &msg, sizeof(msg), MSG_DONTWAIT);
+    if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) return 0;
+    if (n < 0 && errno == EINTR) continue;
+    if (n != (ssize_t)sizeof(msg) || msg.type != NR_MSG_SUBMIT) return -1;
+
+    int status = 0;
+    uint64_t slot = (uint64_t)msg.seq % c->slots;
+    if (msg.seq != c->next_seq || msg.frames <= 0 || msg.frames > c->slot_frames ||
+        (slot + 1) * c->slot_frames * sizeof(float) > c->ring_bytes) {
+      status = -1;
+    } else {
+      float* block = c->ring + slot * c->slot_frames;
+      status = spectral_gate_stream(c->spd, block, block, (long)msg.frames);
+      w->blocks++;
+    }
+    c->next_seq = msg.seq + 1;
+    send_reply(c->fd, NR_MSG_DONE, status, msg.seq);
+  }
+}
+
+static void* worker_main(void* arg) {
+  Worker* w = (Worker*)arg;
+  struct pollfd* fds = NULL;
+  int cap_fds = 0;
+
+  for (;;) {
+    if (cap_fds < w->num_clients + 1) {
+      cap_fds = 2 * (w->num_clients + 1);
+      struct pollfd* grown = (struct pollfd*)realloc(fds, cap_fds * sizeof(struct pollfd));
+      if (!grown) {
+        perror("worker: out of memory");
+        break;
+      }
+      fds = grown;
+    }
+    fds[0].fd = w->wake[0];
+    fds[0].events = POLLIN;
+    // wake up for the first client that runs out of time to open
+    int64_t deadline = -1;
+    for (int i = 0; i < w->num_clients; i++) {
+      DaemonClient* c = w->clients[i];
+      fds[i + 1].fd = c->fd;
+      fds[i + 1].events = POLLIN;
+      if (!c->spd && (deadline < 0 || c->open_deadline < deadline)) {
+        deadline = c->open_deadline;
+      }
+    }
+    int timeout = -1;
+    if (deadline >= 0) {
+      int64_t left = deadline - now_ms();
+      timeout = left > 0 ? (int)left : 0;
+    }
+    int num_fds = w->num_clients + 1;
+    if (poll(fds, num_fds, timeout) < 0) {
+      if (errno == EINTR) continue;
+      perror("worker: poll");
+      break;
+    }
+
+    // clients first, the list below may grow
+    int64_t now = now_ms();
+    int kept = 0;
+    for (int i = 0; i < num_fds - 1; i++) {
+      DaemonClient* c = w->clients[i];
+      short ev = fds[i + 1].revents;
+      int drop = 0;
+      if (ev & POLLIN) drop = worker_serve(w, c) != 0;
+      if (!(ev & POLLIN) && (ev & (POLLHUP | POLLERR))) drop = 1;
+      if (!drop && !c->spd && now >= c->open_deadline) {
+        fprintf(stderr, "nr_daemon: dropped a client that sent no open message\n");
+        drop = 1;
+      }
+      if (drop) {
+        client_free(w, c);
+      } else {
+        w->clients[kept++] = c;
+      }
+    }
+    w->num_clients = kept;
+
+    if (fds[0].revents & POLLIN) {
+      char buf[64];
+      while (read(w->wake[0], buf, sizeof(buf)) == (ssize_t)sizeof(buf)) {
+      }
+      pthread_mutex_lock(&w->lock);
+      DaemonClient* pending = w->pending;
+      w->pending = NULL;
+      int stop = w->stop;
+      pthread_mutex_unlock(&w->lock);
+      while (pending) {
+        DaemonClient* next = pending->next;
+        worker_adopt(w, pending);
+        pending = next;
+      }
+      if (stop) break;
+    }
+  }
+
+  for (int i = 0; i < w->num_clients; i++) client_free(w, w->clients[i]);
+  free(w->clients);
+  w->clients = NULL;
+  w->num_clients = 0;
+  for (int i = 0; i < w->num_plans; i++) spectral_gate_shared_free(w->plans[i].shared);
+  free(w->plans);
+  w->plans = NULL;
+  free(fds);
+  return NULL;
+}
+
+static void worker_post(Worker* w, DaemonClient* c, int stop) {
+  pthread_mutex_lock(&w->lock);
+  if (c) {
+    c->next = w->pending;
+    w->pending = c;
+  }
+  if (stop) w->stop = 1;
+  pthread_mutex_unlock(&w->lock);
+  char byte = 1;
+  if (write(w->wake[1], &byte, 1) != 1) {
+    perror("failed to wake worker");
+  }
+}
+
+static void usage(const char* prog) {
+  fprintf(stderr,
+          "usage: %s [--socket path] [--threads n]\n"
+          "  --socket path   unix socket to listen on (default %s)\n"
+          "  --threads n     worker threads (default: one per core)\n",
+          prog, NR_IPC_DEFAULT_SOCKET);
+}
+
+int main(int argc, char** argv) {
+  const char* socket_path = NR_IPC_DEFAULT_SOCKET;
+  int threads = 0;
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--socket") == 0 && i + 1 < argc) {
+      socket_path = argv[++i];
+    } else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+      threads = atoi(argv[++i]);
+    } else {
+      usage(argv[0]);
+      return 1;
+    }
+  }
+  if (threads <= 0) {
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    threads = cores > 0 ? (int)cores : 1;
+  }
+
+  struct sockaddr_un addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  if (strlen(socket_path) >= sizeof(addr.sun_path)) {
+    fprintf(stderr, "socket path too long\n");
+    return 1;
+  }
+  strcpy(addr.sun_path, socket_path);
+  int listener = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+  unlink(socket_path);  // a stale socket from a previous run
+  if (listener < 0 || bind(listener, (struct sockaddr*)&addr, sizeof(addr)) != 0 ||
+      listen(listener, 64) != 0) {
+    fprintf(stderr, "can't listen on %s: %s\n", socket_path, strerror(errno));
+    return 1;
+  }
+
+  // no SA_RESTART, so a signal breaks accept() out
+  struct sigaction sa;
+  memset(&sa, 0, sizeof(sa));
+  sa.sa_handler = on_signal;
+  sigaction(SIGINT, &sa, NULL);
+  sigaction(SIGTERM, &sa, NULL);
+  signal(SIGPIPE, SIG_IGN);
+
+  Worker* workers = (Worker*)calloc(threads, sizeof(Worker));
+  if (!workers) {
+    perror("failed to allocate workers");
+    return 1;
+  }
+  int started = 0;
+  for (; started < threads; started++) {
+    Worker* w = &workers[started];
+    pthread_mutex_init(&w->lock, NULL);
+    if (pipe2(w->wake, O_CLOEXEC | O_NONBLOCK) != 0 ||
+        pthread_create(&w->thread, NULL, worker_main, w) != 0) {
+      perror("failed to start worker");
+      break;
+    }
+  }
+  printf("nr_daemon: listening on %s with %d workers\n", socket_path, started);
+  fflush(stdout);
+
+  long accepted = 0;
+  while (!g_quit && started > 0) {
+    int fd = accept4(listener, NULL, NULL, SOCK_CLOEXEC);
+    if (fd < 0) {
+      if (errno == EINTR || errno == ECONNABORTED) continue;
+      perror("accept");
+      break;
+    }
+    DaemonClient* c = (DaemonClient*)calloc(1, sizeof(DaemonClient));
+    if (!c) {
+      perror("failed to allocate client");
+      close(fd);
+      continue;
+    }
+    c->fd = fd;
+    c->open_deadline = now_ms() + OPEN_TIMEOUT_SECONDS * 1000;
+    worker_post(&workers[accepted++ % started], c, 0);
+  }
+
+  long blocks = 0;
+  long served = 0;
+  for (int i = 0; i < started; i++) {
+    worker_post(&workers[i], NULL, 1);
+    pthread_join(workers[i].thread, NULL);
+    blocks += workers[i].blocks;
+    served += workers[i].clients_served;
+  }
+  for (int i = 0; i < threads; i++) {
+    if (i < started) {
+      close(workers[i].wake[0]);
+      close(workers[i].wake[1]);
+    }
+    pthread_mutex_destroy(&workers[i].lock);
+  }
+  free(workers);
+  close(listener);
+  unlink(socket_path);
+  printf("nr_daemon: served %ld clients, %ld blocks\n", served, blocks);
+  return 0;
+}
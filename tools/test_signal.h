@@ -0,0 +1,145 @@
+#ifndef TEST_SIGNAL_H
+#define TEST_SIGNAL_H
+
+#include <math.h>
+#include <string.h>
+
+// synthetic test signals for the tools, no decoder involved. everything draws
+// from one xorshift generator, so setting rng_state to a seed gives the same
+// signal on every run
+
+typedef enum { NOISE_WHITE, NOISE_PINK, NOISE_COUNT } NoiseKind;
+
+static unsigned rng_state = 1;
+
+static inline float uniform(void) {
+  rng_state ^= rng_state << 13;
+  rng_state ^= rng_state >> 17;
+  rng_state ^= rng_state << 5;
+  return (rng_state >> 8) / 16777216.0f;  // [0, 1)
+}
+
+static inline float uniform_range(float lo, float hi) {
+  return lo + (hi - lo) * uniform();
+}
+
+// two pole resonator at freq with bandwidth bw, unity gain at the peak
+typedef struct {
+  float a1, a2, b0;
+  float y1, y2;
+} Resonator;
+
+static inline void resonator_set(Resonator* r, float freq, float bw, int rate) {
+  float radius = expf(-(float)M_PI * bw / rate);
+  float theta = 2.0f * (float)M_PI * freq / rate;
+  r->a1 = 2.0f * radius * cosf(theta);
+  r->a2 = -radius * radius;
+  r->b0 = (1.0f - radius) * sqrtf(1.0f - 2.0f * radius * cosf(2.0f * theta) + radius * radius);
+}
+
+static inline float resonator_run(Resonator* r, float x) {
+  float y = r->b0 * x + r->a1 * r->y1 + r->a2 * r->y2;
+  r->y2 = r->y1;
+  r->y1 = y;
+  return y;
+}
+
+// 20 ms raised cosine at both ends of a segment
+static inline float segment_envelope(long i, long length, int rate) {
+  long ramp = rate / 50;
+  if (ramp * 2 > length) ramp = length / 2;
+  if (ramp <= 0) return 1.0f;
+  if (i < ramp) return 0.5f - 0.5f * cosf((float)M_PI * i / ramp);
+  if (i >= length - ramp) return 0.5f - 0.5f * cosf((float)M_PI * (length - i) / ramp);
+  return 1.0f;
+}
+
+// words of 1-4 syllables with pauses between them. a syllable is a vowel (glottal
+// pulses with a falling pitch through three formants), sometimes after a fricative
+static inline void make_speech(float* out, long n, int rate) {
+  static const float vowels[5][3] = {
+      {730, 1090, 2440}, {530, 1840, 2480}, {270, 2290, 3010}, {570, 840, 2410}, {300, 870, 2240},
+  };
+  float pitch_base = uniform_range(100.0f, 200.0f);
+  float phase = 0.0f;
+  float tilt = 0.0f;
+  Resonator formants[3];
+  Resonator hiss;
+  memset(formants, 0, sizeof(formants));
+  memset(&hiss, 0, sizeof(hiss));
+  long pos = 0;
+  while (pos < n) {
+    int syllables = 1 + (int)(uniform() * 4);
+    for (int s = 0; s < syllables && pos < n; s++) {
+      if (uniform() < 0.3f) {
+        long length = (long)(uniform_range(0.04f, 0.12f) * rate);
+        resonator_set(&hiss, uniform_range(3500.0f, 6000.0f), 1500.0f, rate);
+        for (long i = 0; i < length && pos < n; i++, pos++) {
+          out[pos] = 0.3f * segment_envelope(i, length, rate) *
+                     resonator_run(&hiss, uniform_range(-1.0f, 1.0f));
+        }
+      }
+      const float* f = vowels[(int)(uniform() * 5)];
+      for (int k = 0; k < 3; k++) resonator_set(&formants[k], f[k], 60.0f + 40.0f * k, rate);
+      long length = (long)(uniform_range(0.08f, 0.25f) * rate);
+      float pitch = pitch_base * uniform_range(0.9f, 1.2f);
+      for (long i = 0; i < length && pos < n; i++, pos++) {
+        float f0 = pitch * (1.0f - 0.15f * i / length);
+        phase += f0 / rate;
+        float pulse = 0.0f;
+        if (phase >= 1.0f) {
+          phase -= 1.0f;
+          pulse = 1.0f;
+        }
+        tilt = 0.9f * tilt + pulse;  // glottal roll off
+        float v = tilt;
+        for (int k = 0; k < 3; k++) v = resonator_run(&formants[k], v);
+        out[pos] = segment_envelope(i, length, rate) * v;
+      }
+    }
+    long pause = (long)(uniform_range(0.1f, 0.4f) * rate);
+    for (long i = 0; i < pause && pos < n; i++, pos++) out[pos] = 0.0f;
+  }
+}
+
+// notes of three harmonics with a 5 Hz vibrato, short gaps between them
+static inline void make_tonal(float* out, long n, int rate) {
+  long pos = 0;
+  double phase = 0.0;
+  while (pos < n) {
+    float freq = 220.0f * powf(2.0f, (int)(uniform() * 24) / 12.0f);
+    long length = (long)(uniform_range(0.3f, 0.6f) * rate);
+    for (long i = 0; i < length && pos < n; i++, pos++) {
+      float vibrato = 1.0f + 0.005f * sinf(2.0f * (float)M_PI * 5.0f * i / rate);
+      phase += (double)freq * vibrato / rate;
+      float p = 2.0f * (float)M_PI * (float)(phase - floor(phase));
+      out[pos] = segment_envelope(i, length, rate) *
+                 (sinf(p) + 0.5f * sinf(2.0f * p) + 0.25f * sinf(3.0f * p));
+    }
+    long gap = (long)(uniform_range(0.05f, 0.2f) * rate);
+    for (long i = 0; i < gap && pos < n; i++, pos++) out[pos] = 0.0f;
+  }
+}
+
+// n samples of white or pink noise
+static inline void make_noise(float* out, long n, NoiseKind kind) {
+  // pink by paul kellet's filter
+  float b0 = 0, b1 = 0, b2 = 0, b3 = 0, b4 = 0, b5 = 0, b6 = 0;
+  for (long i = 0; i < n; i++) {
+    float white = uniform_range(-1.0f, 1.0f);
+    if (kind == NOISE_WHITE) {
+      out[i] = white;
+      continue;
+    }
+    b0 = 0.99886f * b0 + white * 0.0555179f;
+    b1 = 0.99332f * b1 + white * 0.0750759f;
+    b2 = 0.96900f * b2 + white * 0.1538520f;
+    b3 = 0.86650f * b3 + white * 0.3104856f;
+    b4 = 0.55000f * b4 + white * 0.5329522f;
+    b5 = -0.7616f * b5 - white * 0.0168980f;
+    out[i] = b0 + b1 + b2 + b3 + b4 + b5 + b6 + white * 0.5362f;
+    b6 = white * 0.115926f;
+  }
+}
+
+#endif